@@ -31,89 +31,134 @@
 #include <algorithms/optimizer/PTOptimizer.h>
 #include "algorithms/basic/CalculateCPStatistics.h"
 #include "hugin_base/panotools/PanoToolsUtils.h"
+#include <map>
 
 namespace HuginBase {
 
+namespace
+{
+
+/** the normal control points of an image pair */
+struct ImagePairCPs
+{
+    unsigned int image1;
+    unsigned int image2;
+    /** indices of the control points in the panorama */
+    std::vector<unsigned int> cps;
+};
+
+/** optimises the position of the second image of the pair and returns the control
+ *  points with an error > mean + n*sigma, the panorama is only read */
+std::vector<unsigned int> getCPoutsideLimit_singlePair(const Panorama& pano, const ImagePairCPs& pair, double n)
+{
+    const CPVector& allCP = pano.getCtrlPoints();
+    // build a panorama with only both images and their control points,
+    // this avoids to scan all images and control points like in Panorama::getSubset
+    Panorama clean;
+    PanoramaOptions opts = pano.getOptions();
+    opts.optimizeReferenceImage = 0;
+    opts.colorReferenceImage = 0;
+    clean.setOptions(opts);
+    clean.addImage(pano.getImage(pair.image1));
+    clean.addImage(pano.getImage(pair.image2));
+    CPVector cpl;
+    cpl.reserve(pair.cps.size());
+    for (size_t i = 0; i < pair.cps.size(); ++i)
+    {
+        ControlPoint cp = allCP[pair.cps[i]];
+        cp.image1Nr = (cp.image1Nr == pair.image1) ? 0 : 1;
+        cp.image2Nr = (cp.image2Nr == pair.image1) ? 0 : 1;
+        cpl.push_back(cp);
+    };
+    clean.setCtrlPoints(cpl);
+    //optimize position
+    OptimizeVector optvec;
+    std::set<std::string> imgopt;
+    optvec.push_back(imgopt);
+    imgopt.insert("r");
+    imgopt.insert("p");
+    imgopt.insert("y");
+    optvec.push_back(imgopt);
+    clean.setOptimizeVector(optvec);
+    // the native optimizer has no global state and can run in parallel
+    PTOptimizer::optimize(clean, PTOptimizer::NATIVE);
+    cpl = clean.getCtrlPoints();
+    //calculate statistic and determine limit
+    double min,max,mean,var;
+    CalculateCPStatisticsError::calcCtrlPntsErrorStats(clean,min,max,mean,var);
+    // if the standard deviation is bigger than the value, assume we have a lot of
+    // false cp, in this case take the mean value directly as limit
+    double limit = (sqrt(var) > mean) ? mean : (mean + n*sqrt(var));
+
+    //identify cp with big error
+    std::vector<unsigned int> CPtoRemove;
+    for (size_t i = 0; i < cpl.size(); ++i)
+    {
+        if (cpl[i].error > limit)
+        {
+            CPtoRemove.push_back(pair.cps[i]);
+        };
+    };
+    return CPtoRemove;
+};
+
+} // namespace
+
 UIntSet getCPoutsideLimit_pair(Panorama pano, AppBase::ProgressDisplay& progress, double n)
 {
-    CPVector allCP=pano.getCtrlPoints();
-    unsigned int nrImg=pano.getNrOfImages();
+    const CPVector& allCP = pano.getCtrlPoints();
     PanoramaOptions opts=pano.getOptions();
     //set projection to equrectangular for optimisation
     opts.setProjection(PanoramaOptions::EQUIRECTANGULAR);
     pano.setOptions(opts);
     UIntSet CPtoRemove;
 
+    // collect the normal control points of each image pair,
+    // horizontal and vertical control points are not used
+    std::map<std::pair<unsigned int, unsigned int>, std::vector<unsigned int> > cpsOfPair;
+    for (unsigned int i = 0; i < allCP.size(); ++i)
+    {
+        const ControlPoint& cp = allCP[i];
+        if (cp.mode == ControlPoint::X_Y && cp.image1Nr != cp.image2Nr)
+        {
+            cpsOfPair[std::make_pair(std::min(cp.image1Nr, cp.image2Nr), std::max(cp.image1Nr, cp.image2Nr))].push_back(i);
+        };
+    };
+    std::vector<ImagePairCPs> pairs;
+    for (std::map<std::pair<unsigned int, unsigned int>, std::vector<unsigned int> >::const_iterator it = cpsOfPair.begin(); it != cpsOfPair.end(); ++it)
+    {
+        // we need at least 3 cp to optimize 3 variables: yaw, pitch and roll
+        // do not check linked image pairs
+        if (it->second.size() > 3 && !pano.getImage(it->first.first).YawisLinkedWith(pano.getImage(it->first.second)))
+        {
+            ImagePairCPs pair;
+            pair.image1 = it->first.first;
+            pair.image2 = it->first.second;
+            pair.cps = it->second;
+            pairs.push_back(pair);
+        };
+    };
+
     // do optimisation of all images pair
     // after it remove cp with errors > median/mean + n*sigma
-    for (unsigned int image1=0; image1<nrImg-1; image1++)
+    // the pairs are processed in parallel, the progress is updated after each chunk
+    const int chunkSize = 64;
+    std::vector<std::vector<unsigned int> > pairResults(pairs.size());
+    for (int chunkStart = 0; chunkStart < static_cast<int>(pairs.size()); chunkStart += chunkSize)
     {
-        const SrcPanoImage& img=pano.getImage(image1);
-        for (unsigned int image2=image1+1; image2<nrImg; image2++)
+        const int chunkEnd = std::min<int>(chunkStart + chunkSize, pairs.size());
+#pragma omp parallel for schedule(dynamic)
+        for (int i = chunkStart; i < chunkEnd; ++i)
         {
-            //do not check linked image pairs
-            if(img.YawisLinkedWith(pano.getImage(image2)))
-                continue;
-            UIntSet Images;
-            Images.clear();
-            Images.insert(image1);
-            Images.insert(image2);
-            Panorama clean=pano.getSubset(Images);
-            // pictures should contain at least 2 control points
-            if(clean.getNrOfCtrlPoints()>1)
-            {
-                // remove all horizontal and vertical control points
-                CPVector cpl = clean.getCtrlPoints();
-                CPVector newCP;
-                for (CPVector::const_iterator it = cpl.begin(); it != cpl.end(); ++it) 
-                    if (it->mode == ControlPoint::X_Y)
-                        newCP.push_back(*it);
-                clean.setCtrlPoints(newCP);
-
-                // we need at least 3 cp to optimize 3 variables: yaw, pitch and roll
-                if(clean.getNrOfCtrlPoints()>3)
-                {
-                    //optimize position and hfov
-                    OptimizeVector optvec;
-                    std::set<std::string> imgopt;
-                    //imgopt.insert("v");
-                    optvec.push_back(imgopt);
-                    imgopt.insert("r");
-                    imgopt.insert("p");
-                    imgopt.insert("y");
-                    optvec.push_back(imgopt);
-                    clean.setOptimizeVector(optvec);
-                    PTools::optimize(clean);
-                    cpl.clear();
-                    cpl=clean.getCtrlPoints();
-                    //calculate statistic and determine limit
-                    double min,max,mean,var;
-                    CalculateCPStatisticsError::calcCtrlPntsErrorStats(clean,min,max,mean,var);
-                    // if the standard deviation is bigger than the value, assume we have a lot of
-                    // false cp, in this case take the mean value directly as limit
-                    double limit = (sqrt(var) > mean) ? mean : (mean + n*sqrt(var));
-
-                    //identify cp with big error
-                    unsigned int index=0;
-                    unsigned int cpcounter=0;
-                    for (CPVector::const_iterator it = allCP.begin(); it != allCP.end(); ++it)
-                    {
-                        if(it->mode == ControlPoint::X_Y)
-                            if((it->image1Nr==image1 && it->image2Nr==image2) ||
-                                (it->image1Nr==image2 && it->image2Nr==image1))
-                            {
-                                if (cpl[index].error>limit)
-                                    CPtoRemove.insert(cpcounter);
-                                index++;
-                            };
-                        cpcounter++;
-                    };
-                };
-            };
-            if (!progress.updateDisplayValue())
-            {
-                return CPtoRemove;
-            };
+            pairResults[i] = getCPoutsideLimit_singlePair(pano, pairs[i], n);
+        };
+        for (int i = chunkStart; i < chunkEnd; ++i)
+        {
+            CPtoRemove.insert(pairResults[i].begin(), pairResults[i].end());
+        };
+        if (!progress.updateDisplayValue())
+        {
+            return CPtoRemove;
         };
     };
 
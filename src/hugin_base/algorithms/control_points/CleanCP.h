@@ -37,6 +37,7 @@
 namespace HuginBase {
 
 /** optimises images pairwise and removes for every image pair control points with error > mean+n*sigma 
+  the image pairs are optimised in parallel with the native optimizer
   @param pano panorama which should be used
   @param n determines, how big the deviation from mean should be to determine wrong control points, default 2.0
   @return set which contains control points with error > mean+n*sigma */
@@ -26,6 +26,7 @@
 #include "ComputeImageROI.h"
 
 #include <algorithm>
+#include <vector>
 #include <nona/RemappedPanoImage.h>
 #include <nona/RemappedPanoImage.h>
 
@@ -106,12 +107,24 @@ void estimateImageAlpha(const SrcPanoImage & src,
 
     // remap image
     vigra::BImage img(destSz.x, destSz.y, (unsigned char)0);
+    // buffers for transforming a whole row at once
+    const int rowLength = std::max(destRect.width(), 0);
+    std::vector<double> panoX(rowLength);
+    std::vector<double> panoY(rowLength);
+    std::vector<double> imgX(rowLength);
+    std::vector<double> imgY(rowLength);
+    std::vector<char> validCoord(rowLength);
+    for (int x = destRect.left(); x < destRect.right(); x++) {
+        panoX[x - destRect.left()] = x / scale;
+    }
     for (int y=destRect.top(); y < destRect.bottom(); y++) {
+        std::fill(panoY.begin(), panoY.end(), y / scale);
+        vigra_ext::transformImgCoordBatch(transf, panoX.data(), panoY.data(), rowLength, imgX.data(), imgY.data(), validCoord.data());
         for (int x=destRect.left(); x < destRect.right(); x++) {
             // sample image
             // coordinates in real image pixels
-            double sx,sy;
-            transf.transformImgCoord(sx,sy, x/scale, y/scale);
+            const double sx = imgX[x - destRect.left()];
+            const double sy = imgY[x - destRect.left()];
             bool valid=true;
             if (src.getCropMode() == SrcPanoImage::CROP_CIRCLE) {
                 double dx = sx - cropCenter.x;
@@ -202,4 +202,36 @@ void ImageGraph::VisitAllImages(const size_t startImg, bool forceAllComponents,
     };
 };
 
+HuginBase::UIntSet ImageGraph::GetNeighborhood(const HuginBase::UIntSet& images, const size_t hops) const
+{
+    HuginBase::UIntSet neighborhood;
+    std::vector<size_t> currentLevel;
+    for (HuginBase::UIntSet::const_iterator it = images.begin(); it != images.end(); ++it)
+    {
+        if (*it < m_graph.size())
+        {
+            neighborhood.insert(*it);
+            currentLevel.push_back(*it);
+        };
+    };
+    // breadth first search, stop after the given number of levels
+    for (size_t level = 0; level < hops && !currentLevel.empty(); ++level)
+    {
+        std::vector<size_t> nextLevel;
+        for (size_t i = 0; i < currentLevel.size(); ++i)
+        {
+            const HuginBase::UIntSet& neighbors = m_graph[currentLevel[i]];
+            for (HuginBase::UIntSet::const_iterator it = neighbors.begin(); it != neighbors.end(); ++it)
+            {
+                if (neighborhood.insert(*it).second)
+                {
+                    nextLevel.push_back(*it);
+                };
+            };
+        };
+        currentLevel.swap(nextLevel);
+    };
+    return neighborhood;
+};
+
 }  // namespace HuginGraph
@@ -69,6 +69,9 @@ public:
     *  @param forceAllComponents if true all images are visited, if false only the images
     *  connected with startImg are visited */
     void VisitAllImages(const size_t startImg, bool forceAllComponents, BreadthFirstSearchVisitor* visitor);
+    /** returns all images, which can be reached from the given images with at most
+    *  the given number of edges, the start images are included */
+    HuginBase::UIntSet GetNeighborhood(const HuginBase::UIntSet& images, const size_t hops) const;
 private:
     GraphList m_graph;
 }; // class ImageGraph
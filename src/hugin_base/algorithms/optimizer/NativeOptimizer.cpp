@@ -0,0 +1,1616 @@
+// -*- c-basic-offset: 4 -*-
+/** @file NativeOptimizer.cpp
+ *
+ *  @brief in-process optimizer for the geometric image variables
+ *
+ */
+/*  This is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public
+ *  License along with this software. If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "NativeOptimizer.h"
+
+#include <cmath>
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <set>
+#include <vector>
+#include <hugin_utils/utils.h>
+#include <hugin_utils/stl_utils.h>
+#include <hugin_math/hugin_math.h>
+#include <panotools/PanoToolsInterface.h>
+
+namespace HuginBase {
+
+namespace
+{
+
+/** the geometric variables of an image, which are handled by the optimizer */
+enum GeometricVariable
+{
+    VAR_YAW = 0,
+    VAR_PITCH,
+    VAR_ROLL,
+    VAR_HFOV,
+    VAR_A,
+    VAR_B,
+    VAR_C,
+    VAR_D,
+    VAR_E,
+    VAR_TRX,
+    VAR_TRY,
+    VAR_TRZ,
+    VAR_TPY,
+    VAR_TPP,
+    VAR_COUNT
+};
+
+/** names of the variables as used in the optimize vector */
+const char* const variableNames[VAR_COUNT] = { "y", "p", "r", "v", "a", "b", "c", "d", "e", "TrX", "TrY", "TrZ", "Tpy", "Tpp" };
+
+/** a control point depends on the variables of both images */
+const int nrOfSlots = 2 * VAR_COUNT;
+
+/** number with its first derivatives for forward mode automatic differentiation
+ *  @tparam N number of derivatives */
+template <int N>
+class Dual
+{
+public:
+    Dual() : v(0)
+    {
+        std::fill(d, d + N, 0.0);
+    };
+    // implicit conversion from constants
+    Dual(const double value) : v(value)
+    {
+        std::fill(d, d + N, 0.0);
+    };
+    /** returns a variable, which has the derivative 1 in the given slot */
+    static Dual variable(const double value, const int slot)
+    {
+        Dual x(value);
+        x.d[slot] = 1.0;
+        return x;
+    };
+    /** returns a number with the given value and the derivatives of x scaled by factor */
+    static Dual chain(const double value, const double factor, const Dual& x)
+    {
+        Dual result;
+        result.v = value;
+        for (int i = 0; i < N; ++i)
+        {
+            result.d[i] = factor * x.d[i];
+        };
+        return result;
+    };
+
+    friend Dual operator+(const Dual& a, const Dual& b)
+    {
+        Dual result;
+        result.v = a.v + b.v;
+        for (int i = 0; i < N; ++i)
+        {
+            result.d[i] = a.d[i] + b.d[i];
+        };
+        return result;
+    };
+    friend Dual operator+(const Dual& a, const double b)
+    {
+        Dual result(a);
+        result.v += b;
+        return result;
+    };
+    friend Dual operator+(const double a, const Dual& b)
+    {
+        return b + a;
+    };
+    friend Dual operator-(const Dual& a, const Dual& b)
+    {
+        Dual result;
+        result.v = a.v - b.v;
+        for (int i = 0; i < N; ++i)
+        {
+            result.d[i] = a.d[i] - b.d[i];
+        };
+        return result;
+    };
+    friend Dual operator-(const Dual& a, const double b)
+    {
+        Dual result(a);
+        result.v -= b;
+        return result;
+    };
+    friend Dual operator-(const double a, const Dual& b)
+    {
+        return chain(a - b.v, -1.0, b);
+    };
+    friend Dual operator-(const Dual& a)
+    {
+        return chain(-a.v, -1.0, a);
+    };
+    friend Dual operator*(const Dual& a, const Dual& b)
+    {
+        Dual result;
+        result.v = a.v * b.v;
+        for (int i = 0; i < N; ++i)
+        {
+            result.d[i] = a.d[i] * b.v + a.v * b.d[i];
+        };
+        return result;
+    };
+    friend Dual operator*(const Dual& a, const double b)
+    {
+        return chain(a.v * b, b, a);
+    };
+    friend Dual operator*(const double a, const Dual& b)
+    {
+        return chain(a * b.v, a, b);
+    };
+    friend Dual operator/(const Dual& a, const Dual& b)
+    {
+        Dual result;
+        result.v = a.v / b.v;
+        const double inv = 1.0 / b.v;
+        for (int i = 0; i < N; ++i)
+        {
+            result.d[i] = (a.d[i] - result.v * b.d[i]) * inv;
+        };
+        return result;
+    };
+    friend Dual operator/(const Dual& a, const double b)
+    {
+        return chain(a.v / b, 1.0 / b, a);
+    };
+    friend Dual operator/(const double a, const Dual& b)
+    {
+        const double value = a / b.v;
+        return chain(value, -value / b.v, b);
+    };
+
+    friend Dual sin(const Dual& x) { return chain(std::sin(x.v), std::cos(x.v), x); };
+    friend Dual cos(const Dual& x) { return chain(std::cos(x.v), -std::sin(x.v), x); };
+    friend Dual tan(const Dual& x)
+    {
+        const double t = std::tan(x.v);
+        return chain(t, 1.0 + t * t, x);
+    };
+    friend Dual asin(const Dual& x) { return chain(std::asin(x.v), 1.0 / std::sqrt(1.0 - x.v * x.v), x); };
+    friend Dual atan(const Dual& x) { return chain(std::atan(x.v), 1.0 / (1.0 + x.v * x.v), x); };
+    friend Dual sqrt(const Dual& x)
+    {
+        const double s = std::sqrt(x.v);
+        return chain(s, 0.5 / s, x);
+    };
+    friend Dual atan2(const Dual& y, const Dual& x)
+    {
+        Dual result;
+        result.v = std::atan2(y.v, x.v);
+        const double inv = 1.0 / (x.v * x.v + y.v * y.v);
+        for (int i = 0; i < N; ++i)
+        {
+            result.d[i] = (x.v * y.d[i] - y.v * x.d[i]) * inv;
+        };
+        return result;
+    };
+
+    /** the value */
+    double v;
+    /** the derivatives */
+    double d[N];
+};
+
+typedef Dual<nrOfSlots> CPDual;
+
+inline double value(const double x)
+{
+    return x;
+}
+
+template <int N>
+inline double value(const Dual<N>& x)
+{
+    return x.v;
+}
+
+/** the constant properties and the variables of an image */
+struct ImageModel
+{
+    SrcPanoImage::Projection projection;
+    double width;
+    /** the center of the image in pixel coordinates */
+    double centerX;
+    double centerY;
+    /** normalisation radius of the radial distortion */
+    double radius;
+    /** true, if the radial distortion is evaluated */
+    bool radial;
+    /** true, if the translation is evaluated */
+    bool translation;
+    /** values of the variables */
+    double values[VAR_COUNT];
+    /** index of the variables in the parameter vector, -1 for constant variables */
+    int params[VAR_COUNT];
+};
+
+/** a control point */
+struct CPModel
+{
+    unsigned int image1;
+    unsigned int image2;
+    double x1, y1, x2, y2;
+    int mode;
+    /** false, if the control point could not be evaluated with the initial values */
+    bool used;
+};
+
+/** returns true, if the variable var is linked between both images */
+bool isLinked(const SrcPanoImage& img1, const SrcPanoImage& img2, const int var)
+{
+    switch (var)
+    {
+        case VAR_YAW:
+            return img1.YawisLinkedWith(img2);
+        case VAR_PITCH:
+            return img1.PitchisLinkedWith(img2);
+        case VAR_ROLL:
+            return img1.RollisLinkedWith(img2);
+        case VAR_HFOV:
+            return img1.HFOVisLinkedWith(img2);
+        case VAR_A:
+        case VAR_B:
+        case VAR_C:
+            return img1.RadialDistortionisLinkedWith(img2);
+        case VAR_D:
+        case VAR_E:
+            return img1.RadialDistortionCenterShiftisLinkedWith(img2);
+        case VAR_TRX:
+            return img1.XisLinkedWith(img2);
+        case VAR_TRY:
+            return img1.YisLinkedWith(img2);
+        case VAR_TRZ:
+            return img1.ZisLinkedWith(img2);
+        case VAR_TPY:
+            return img1.TranslationPlaneYawisLinkedWith(img2);
+        case VAR_TPP:
+            return img1.TranslationPlanePitchisLinkedWith(img2);
+    };
+    return false;
+}
+
+/** returns true, if the projection of the image is implemented */
+bool isSupportedProjection(const SrcPanoImage::Projection projection)
+{
+    switch (projection)
+    {
+        case SrcPanoImage::RECTILINEAR:
+        case SrcPanoImage::PANORAMIC:
+        case SrcPanoImage::CIRCULAR_FISHEYE:
+        case SrcPanoImage::FULL_FRAME_FISHEYE:
+        case SrcPanoImage::EQUIRECTANGULAR:
+        case SrcPanoImage::FISHEYE_ORTHOGRAPHIC:
+        case SrcPanoImage::FISHEYE_STEREOGRAPHIC:
+        case SrcPanoImage::FISHEYE_EQUISOLID:
+        case SrcPanoImage::FISHEYE_THOBY:
+            return true;
+    };
+    return false;
+}
+
+/** fills the constant part of the model and the values of the variables, all variables are constant */
+void initImageModel(const SrcPanoImage& img, ImageModel& model)
+{
+    model.projection = img.getProjection();
+    const vigra::Size2D size = img.getSize();
+    model.width = size.width();
+    model.centerX = size.width() / 2.0 - 0.5;
+    model.centerY = size.height() / 2.0 - 0.5;
+    model.radius = std::min(size.width(), size.height()) / 2.0;
+    for (int i = 0; i < VAR_COUNT; ++i)
+    {
+        model.values[i] = img.getVar(variableNames[i]);
+        model.params[i] = -1;
+    };
+    model.radial = false;
+    model.translation = false;
+}
+
+/** sets the flags for the optional steps of the transformation */
+void updateImageModelFlags(ImageModel& model)
+{
+    model.radial = false;
+    for (int i = VAR_A; i <= VAR_C; ++i)
+    {
+        model.radial = model.radial || model.values[i] != 0.0 || model.params[i] >= 0;
+    };
+    model.translation = false;
+    for (int i = VAR_TRX; i <= VAR_TRZ; ++i)
+    {
+        model.translation = model.translation || model.values[i] != 0.0 || model.params[i] >= 0;
+    };
+}
+
+/** calculates the undistorted radius for the distorted radius rd, this inverts the
+ *  radial distortion polynomial of libpano13 */
+template <class T>
+T invertRadialDistortion(const T& a, const T& b, const T& c, const T& rd)
+{
+    const double av = value(a);
+    const double bv = value(b);
+    const double cv = value(c);
+    const double dv = 1.0 - av - bv - cv;
+    const double target = value(rd);
+    // Newton iteration on the values only
+    double rs = target;
+    for (int iter = 0; iter < 100; ++iter)
+    {
+        const double f = (((av * rs + bv) * rs + cv) * rs + dv) * rs - target;
+        const double df = ((4.0 * av * rs + 3.0 * bv) * rs + 2.0 * cv) * rs + dv;
+        if (df == 0.0)
+        {
+            break;
+        };
+        const double step = f / df;
+        rs -= step;
+        if (std::abs(step) < 1e-14 * (1.0 + std::abs(rs)))
+        {
+            break;
+        };
+    };
+    // a last Newton step with the derivatives, the value does not change anymore,
+    // but the derivatives of the solution are taken over (implicit function theorem)
+    const double df = ((4.0 * av * rs + 3.0 * bv) * rs + 2.0 * cv) * rs + dv;
+    const T f = (((a * rs + b) * rs + c) * rs + (1.0 - a - b - c)) * rs - rd;
+    return rs - f / df;
+}
+
+/** calculates the direction of the ray in the camera coordinate system for the
+ *  undistorted position (x, y) relative to the image center
+ *  @return false, if the position is outside of the valid range of the projection */
+template <class T>
+bool cameraRay(const ImageModel& img, const T& hfov, const T& x, const T& y, T* dir)
+{
+    switch (img.projection)
+    {
+        case SrcPanoImage::RECTILINEAR:
+            dir[0] = x;
+            dir[1] = y;
+            dir[2] = img.width / (2.0 * tan(hfov / 2.0));
+            return true;
+        case SrcPanoImage::PANORAMIC:
+            {
+                const T f = img.width / hfov;
+                const T lon = x / f;
+                dir[0] = sin(lon);
+                dir[1] = y / f;
+                dir[2] = cos(lon);
+            };
+            return true;
+        case SrcPanoImage::EQUIRECTANGULAR:
+            {
+                const T f = img.width / hfov;
+                const T lon = x / f;
+                const T lat = y / f;
+                const T cosLat = cos(lat);
+                dir[0] = cosLat * sin(lon);
+                dir[1] = sin(lat);
+                dir[2] = cosLat * cos(lon);
+            };
+            return true;
+        default:
+            break;
+    };
+    // fisheye projections, the angle to the optical axis depends only on the radius
+    const T r2 = x * x + y * y;
+    T f;
+    switch (img.projection)
+    {
+        case SrcPanoImage::FISHEYE_STEREOGRAPHIC:
+            f = img.width / (4.0 * tan(hfov / 4.0));
+            break;
+        case SrcPanoImage::FISHEYE_ORTHOGRAPHIC:
+            f = img.width / (2.0 * sin(hfov / 2.0));
+            break;
+        case SrcPanoImage::FISHEYE_EQUISOLID:
+            f = img.width / (4.0 * sin(hfov / 4.0));
+            break;
+        case SrcPanoImage::FISHEYE_THOBY:
+            f = img.width / (2.0 * 1.47 * sin(0.713 * hfov / 2.0));
+            break;
+        default:
+            f = img.width / hfov;
+            break;
+    };
+    if (value(r2) < 1e-20)
+    {
+        // near the optical axis all fisheye projections are equidistant
+        const double scale = (img.projection == SrcPanoImage::FISHEYE_THOBY) ? 1.47 * 0.713 : 1.0;
+        dir[0] = x;
+        dir[1] = y;
+        dir[2] = f * scale;
+        return true;
+    };
+    const T r = sqrt(r2);
+    T theta;
+    switch (img.projection)
+    {
+        case SrcPanoImage::FISHEYE_STEREOGRAPHIC:
+            theta = 2.0 * atan(r / (2.0 * f));
+            break;
+        case SrcPanoImage::FISHEYE_ORTHOGRAPHIC:
+            if (value(r) >= value(f))
+            {
+                return false;
+            };
+            theta = asin(r / f);
+            break;
+        case SrcPanoImage::FISHEYE_EQUISOLID:
+            if (value(r) >= 2.0 * value(f))
+            {
+                return false;
+            };
+            theta = 2.0 * asin(r / (2.0 * f));
+            break;
+        case SrcPanoImage::FISHEYE_THOBY:
+            if (value(r) >= 1.47 * value(f))
+            {
+                return false;
+            };
+            theta = asin(r / (1.47 * f)) / 0.713;
+            break;
+        default:
+            theta = r / f;
+            break;
+    };
+    const T s = sin(theta) / r;
+    dir[0] = s * x;
+    dir[1] = s * y;
+    dir[2] = cos(theta);
+    return true;
+}
+
+/** calculates the direction of the ray through the pixel (x, y) of the image in the
+ *  panorama coordinate system (x right, y down, z forward). Follows the inverse
+ *  transformation stack of libpano13.
+ *  @param var values of the variables of the image
+ *  @return false, if the pixel can not be mapped */
+template <class T>
+bool imageToSphere(const ImageModel& img, const T* var, const double x, const double y, T* dir)
+{
+    const double degToRad = M_PI / 180.0;
+    // shift of the optical center
+    T px = (x - img.centerX) - var[VAR_D];
+    T py = (y - img.centerY) - var[VAR_E];
+    // radial distortion
+    if (img.radial)
+    {
+        const T r2 = px * px + py * py;
+        if (value(r2) > 1e-20)
+        {
+            const T rd = sqrt(r2) / img.radius;
+            const T scale = invertRadialDistortion(var[VAR_A], var[VAR_B], var[VAR_C], rd) / rd;
+            px = px * scale;
+            py = py * scale;
+        };
+    };
+    // image projection
+    T v[3];
+    if (!cameraRay(img, T(var[VAR_HFOV] * degToRad), px, py, v))
+    {
+        return false;
+    };
+    // pitch and roll, persp_sphere with the matrix Rz(roll) * Rx(pitch)
+    const T pitch = var[VAR_PITCH] * degToRad;
+    const T roll = var[VAR_ROLL] * degToRad;
+    const T sp = sin(pitch);
+    const T cp = cos(pitch);
+    const T sr = sin(roll);
+    const T cr = cos(roll);
+    const T w0 = v[0] * cr - v[1] * sr;
+    const T w1 = (v[0] * sr + v[1] * cr) * cp - v[2] * sp;
+    const T w2 = (v[0] * sr + v[1] * cr) * sp + v[2] * cp;
+    // yaw, rotate_erect
+    const T yaw = var[VAR_YAW] * degToRad;
+    const T sy = sin(yaw);
+    const T cy = cos(yaw);
+    dir[0] = w0 * cy + w2 * sy;
+    dir[1] = w1;
+    dir[2] = w2 * cy - w0 * sy;
+    // translation, the ray starts at the camera position and is intersected
+    // with the remapping plane, which is at distance 1 from the panorama center
+    if (img.translation)
+    {
+        const T planeYaw = var[VAR_TPY] * degToRad;
+        const T planePitch = var[VAR_TPP] * degToRad;
+        const T cosPlanePitch = cos(planePitch);
+        const T n0 = sin(planeYaw) * cosPlanePitch;
+        const T n1 = -sin(planePitch);
+        const T n2 = cos(planeYaw) * cosPlanePitch;
+        const T denominator = n0 * dir[0] + n1 * dir[1] + n2 * dir[2];
+        if (value(denominator) <= 1e-12)
+        {
+            return false;
+        };
+        const T t0 = var[VAR_TRX];
+        const T t1 = var[VAR_TRY];
+        const T t2 = -var[VAR_TRZ];
+        const T s = (1.0 - (n0 * t0 + n1 * t1 + n2 * t2)) / denominator;
+        dir[0] = t0 + s * dir[0];
+        dir[1] = t1 + s * dir[1];
+        dir[2] = t2 + s * dir[2];
+    };
+    return true;
+}
+
+/** returns the longitude and the latitude of the direction */
+template <class T>
+void sphericalCoordinates(const T* dir, T& lon, T& lat)
+{
+    lon = atan2(dir[0], dir[2]);
+    lat = atan2(dir[1], sqrt(dir[0] * dir[0] + dir[2] * dir[2]));
+}
+
+/** wraps the difference of two longitudes into -pi..pi */
+template <class T>
+T wrapLongitude(const T& dlon)
+{
+    if (value(dlon) < -M_PI)
+    {
+        return dlon + 2.0 * M_PI;
+    };
+    if (value(dlon) > M_PI)
+    {
+        return dlon - 2.0 * M_PI;
+    };
+    return dlon;
+}
+
+/** the normal equations (J^T J + D) delta = -J^T r of a Levenberg-Marquardt step.
+ *
+ *  The parameters are ordered in blocks: first the pose blocks, which contain the
+ *  parameters of a single image or of a stack of images with linked positions,
+ *  followed by the lens parameters shared by several images. J^T J is stored as
+ *  sparse block matrix for the pose blocks, only blocks connected by control points
+ *  are stored, and as dense matrices for the rows of the shared parameters. So the
+ *  memory grows with the number of image connections and not quadratic with the
+ *  number of parameters.
+ *
+ *  Small systems are solved with a dense Cholesky decomposition. For larger systems
+ *  the shared parameters are eliminated (Schur complement) and the remaining sparse
+ *  system of the poses is solved with the conjugate gradient method, preconditioned
+ *  with the diagonal blocks.
+ */
+class NormalEquations
+{
+public:
+    /** sets the block structure
+     *  @param blockStart first parameter of each block, the last entry is the number of parameters
+     *  @param nrPoseBlocks number of pose blocks, the parameters of the following block are shared
+     *  @param connections pairs (i, j) with i < j of pose blocks, which are connected by control points */
+    void init(const std::vector<size_t>& blockStart, const size_t nrPoseBlocks, const std::set<std::pair<size_t, size_t> >& connections)
+    {
+        m_blockStart = blockStart;
+        m_nrPoseBlocks = nrPoseBlocks;
+        const size_t nrParams = m_blockStart.back();
+        m_nrPoseParams = m_blockStart[m_nrPoseBlocks];
+        m_nrSharedParams = nrParams - m_nrPoseParams;
+        m_paramBlock.resize(nrParams);
+        for (size_t block = 0; block + 1 < m_blockStart.size(); ++block)
+        {
+            std::fill(m_paramBlock.begin() + m_blockStart[block], m_paramBlock.begin() + m_blockStart[block + 1], block);
+        };
+        // the diagonal blocks and the connected blocks, sorted by column
+        m_blockRows.assign(m_nrPoseBlocks, std::vector<std::pair<size_t, size_t> >());
+        size_t offset = 0;
+        std::set<std::pair<size_t, size_t> >::const_iterator it = connections.begin();
+        for (size_t row = 0; row < m_nrPoseBlocks; ++row)
+        {
+            m_blockRows[row].push_back(std::make_pair(row, offset));
+            offset += getBlockSize(row) * getBlockSize(row);
+            for (; it != connections.end() && it->first == row; ++it)
+            {
+                m_blockRows[row].push_back(std::make_pair(it->second, offset));
+                offset += getBlockSize(row) * getBlockSize(it->second);
+            };
+        };
+        m_poseData.resize(offset);
+        m_poseShared.resize(m_nrPoseParams * m_nrSharedParams);
+        m_shared.resize(m_nrSharedParams * m_nrSharedParams);
+        m_Jtr.resize(nrParams);
+        m_diagonal.resize(nrParams);
+    };
+
+    /** sets J^T J and J^T r to zero */
+    void clear()
+    {
+        std::fill(m_poseData.begin(), m_poseData.end(), 0.0);
+        std::fill(m_poseShared.begin(), m_poseShared.end(), 0.0);
+        std::fill(m_shared.begin(), m_shared.end(), 0.0);
+        std::fill(m_Jtr.begin(), m_Jtr.end(), 0.0);
+    };
+
+    /** adds a residual
+     *  @param params indices of the parameters with a derivative
+     *  @param gradient the derivatives of the residual
+     *  @param n number of parameters
+     *  @param r value of the residual */
+    void add(const int* params, const double* gradient, const int n, const double r)
+    {
+        for (int k = 0; k < n; ++k)
+        {
+            const size_t pk = params[k];
+            m_Jtr[pk] += gradient[k] * r;
+            const size_t blockK = m_paramBlock[pk];
+            if (pk < m_nrPoseParams)
+            {
+                const size_t rowInBlock = pk - m_blockStart[blockK];
+                for (int l = 0; l < n; ++l)
+                {
+                    const size_t pl = params[l];
+                    if (pl < m_nrPoseParams)
+                    {
+                        // only the upper block triangle is stored
+                        const size_t blockL = m_paramBlock[pl];
+                        if (blockL >= blockK)
+                        {
+                            double* block = getBlock(blockK, blockL);
+                            block[rowInBlock * getBlockSize(blockL) + pl - m_blockStart[blockL]] += gradient[k] * gradient[l];
+                        };
+                    }
+                    else
+                    {
+                        m_poseShared[pk * m_nrSharedParams + pl - m_nrPoseParams] += gradient[k] * gradient[l];
+                    };
+                };
+            }
+            else
+            {
+                double* row = &m_shared[(pk - m_nrPoseParams) * m_nrSharedParams];
+                for (int l = 0; l < n; ++l)
+                {
+                    const size_t pl = params[l];
+                    if (pl >= m_nrPoseParams)
+                    {
+                        row[pl - m_nrPoseParams] += gradient[k] * gradient[l];
+                    };
+                };
+            };
+        };
+    };
+
+    /** updates the diagonal of J^T J, has to be called after all residuals are added
+     *  @return the largest diagonal element */
+    double finish()
+    {
+        double maxDiagonal = 0;
+        for (size_t block = 0; block < m_nrPoseBlocks; ++block)
+        {
+            const double* data = &m_poseData[m_blockRows[block][0].second];
+            const size_t size = getBlockSize(block);
+            for (size_t i = 0; i < size; ++i)
+            {
+                m_diagonal[m_blockStart[block] + i] = data[i * size + i];
+            };
+        };
+        for (size_t i = 0; i < m_nrSharedParams; ++i)
+        {
+            m_diagonal[m_nrPoseParams + i] = m_shared[i * m_nrSharedParams + i];
+        };
+        for (size_t i = 0; i < m_diagonal.size(); ++i)
+        {
+            maxDiagonal = std::max(maxDiagonal, m_diagonal[i]);
+        };
+        return maxDiagonal;
+    };
+
+    /** solves the normal equations with the damping lambda * diag(J^T J)
+     *  @return false, if the system could not be solved */
+    bool solve(const double lambda, const double maxDiagonal, std::vector<double>& delta) const
+    {
+        // Marquardt's scaling with the diagonal makes the step independent of the units
+        std::vector<double> damping(m_diagonal.size());
+        for (size_t i = 0; i < damping.size(); ++i)
+        {
+            damping[i] = lambda * std::max(m_diagonal[i], 1e-12 * maxDiagonal);
+        };
+        delta.resize(m_diagonal.size());
+        for (size_t i = 0; i < delta.size(); ++i)
+        {
+            delta[i] = -m_Jtr[i];
+        };
+        if (delta.size() <= maxDenseParams)
+        {
+            return solveDense(damping, delta);
+        };
+        return solveSparse(damping, delta);
+    };
+
+private:
+    /** systems up to this size are solved with a dense decomposition */
+    static const size_t maxDenseParams = 300;
+
+    size_t getBlockSize(const size_t block) const
+    {
+        return m_blockStart[block + 1] - m_blockStart[block];
+    };
+
+    /** returns the stored block (row, col) of the pose blocks, row <= col */
+    double* getBlock(const size_t row, const size_t col)
+    {
+        const std::vector<std::pair<size_t, size_t> >& blocks = m_blockRows[row];
+        const std::vector<std::pair<size_t, size_t> >::const_iterator it =
+            std::lower_bound(blocks.begin(), blocks.end(), std::make_pair(col, size_t(0)));
+        return &m_poseData[it->second];
+    };
+
+    /** solves the system with the Cholesky decomposition of the full matrix */
+    bool solveDense(const std::vector<double>& damping, std::vector<double>& b) const
+    {
+        const size_t n = b.size();
+        std::vector<double> A(n * n, 0.0);
+        for (size_t row = 0; row < m_nrPoseBlocks; ++row)
+        {
+            const size_t rowSize = getBlockSize(row);
+            for (size_t k = 0; k < m_blockRows[row].size(); ++k)
+            {
+                const size_t col = m_blockRows[row][k].first;
+                const size_t colSize = getBlockSize(col);
+                const double* block = &m_poseData[m_blockRows[row][k].second];
+                for (size_t i = 0; i < rowSize; ++i)
+                {
+                    for (size_t j = 0; j < colSize; ++j)
+                    {
+                        const size_t pi = m_blockStart[row] + i;
+                        const size_t pj = m_blockStart[col] + j;
+                        A[pi * n + pj] = block[i * colSize + j];
+                        A[pj * n + pi] = block[i * colSize + j];
+                    };
+                };
+            };
+        };
+        for (size_t i = 0; i < m_nrPoseParams; ++i)
+        {
+            for (size_t j = 0; j < m_nrSharedParams; ++j)
+            {
+                A[i * n + m_nrPoseParams + j] = m_poseShared[i * m_nrSharedParams + j];
+                A[(m_nrPoseParams + j) * n + i] = m_poseShared[i * m_nrSharedParams + j];
+            };
+        };
+        for (size_t i = 0; i < m_nrSharedParams; ++i)
+        {
+            std::copy(m_shared.begin() + i * m_nrSharedParams, m_shared.begin() + (i + 1) * m_nrSharedParams, A.begin() + (m_nrPoseParams + i) * n + m_nrPoseParams);
+        };
+        for (size_t i = 0; i < n; ++i)
+        {
+            A[i * n + i] += damping[i];
+        };
+        if (!hugin_utils::choleskyDecompose(&A[0], n))
+        {
+            return false;
+        };
+        hugin_utils::choleskySolve(&A[0], &b[0], n);
+        return true;
+    };
+
+    /** y = (U + D) x for the pose part U of J^T J */
+    void multiplyPose(const std::vector<double>& damping, const std::vector<double>& x, std::vector<double>& y) const
+    {
+        for (size_t i = 0; i < m_nrPoseParams; ++i)
+        {
+            y[i] = damping[i] * x[i];
+        };
+        for (size_t row = 0; row < m_nrPoseBlocks; ++row)
+        {
+            const size_t rowStart = m_blockStart[row];
+            const size_t rowSize = getBlockSize(row);
+            for (size_t k = 0; k < m_blockRows[row].size(); ++k)
+            {
+                const size_t col = m_blockRows[row][k].first;
+                const size_t colStart = m_blockStart[col];
+                const size_t colSize = getBlockSize(col);
+                const double* block = &m_poseData[m_blockRows[row][k].second];
+                for (size_t i = 0; i < rowSize; ++i)
+                {
+                    for (size_t j = 0; j < colSize; ++j)
+                    {
+                        y[rowStart + i] += block[i * colSize + j] * x[colStart + j];
+                        if (col != row)
+                        {
+                            y[colStart + j] += block[i * colSize + j] * x[rowStart + i];
+                        };
+                    };
+                };
+            };
+        };
+    };
+
+    /** y = W^T x for the coupling W between poses and shared parameters */
+    void multiplyPoseSharedTransposed(const std::vector<double>& x, std::vector<double>& y) const
+    {
+        std::fill(y.begin(), y.end(), 0.0);
+        for (size_t i = 0; i < m_nrPoseParams; ++i)
+        {
+            const double* row = &m_poseShared[i * m_nrSharedParams];
+            for (size_t j = 0; j < m_nrSharedParams; ++j)
+            {
+                y[j] += row[j] * x[i];
+            };
+        };
+    };
+
+    /** y -= W x */
+    void subtractPoseShared(const std::vector<double>& x, std::vector<double>& y) const
+    {
+        for (size_t i = 0; i < m_nrPoseParams; ++i)
+        {
+            const double* row = &m_poseShared[i * m_nrSharedParams];
+            double s = 0;
+            for (size_t j = 0; j < m_nrSharedParams; ++j)
+            {
+                s += row[j] * x[j];
+            };
+            y[i] -= s;
+        };
+    };
+
+    /** solves the system by eliminating the shared parameters and solving the reduced
+     *  system (U - W V^-1 W^T) x_pose = b_pose - W V^-1 b_shared with preconditioned
+     *  conjugate gradients, the reduced matrix is never formed */
+    bool solveSparse(const std::vector<double>& damping, std::vector<double>& b) const
+    {
+        const size_t np = m_nrPoseParams;
+        const size_t ns = m_nrSharedParams;
+        // decomposition of V
+        std::vector<double> V(m_shared);
+        for (size_t i = 0; i < ns; ++i)
+        {
+            V[i * ns + i] += damping[np + i];
+        };
+        if (ns > 0 && !hugin_utils::choleskyDecompose(&V[0], ns))
+        {
+            return false;
+        };
+        // preconditioner, decompositions of the diagonal blocks of U
+        std::vector<double> preconditioner;
+        std::vector<size_t> preconditionerOffset(m_nrPoseBlocks);
+        for (size_t block = 0; block < m_nrPoseBlocks; ++block)
+        {
+            const size_t size = getBlockSize(block);
+            preconditionerOffset[block] = preconditioner.size();
+            const double* data = &m_poseData[m_blockRows[block][0].second];
+            preconditioner.insert(preconditioner.end(), data, data + size * size);
+            double* diagBlock = &preconditioner[preconditionerOffset[block]];
+            for (size_t i = 0; i < size; ++i)
+            {
+                diagBlock[i * size + i] += damping[m_blockStart[block] + i];
+            };
+            if (!hugin_utils::choleskyDecompose(diagBlock, size))
+            {
+                return false;
+            };
+        };
+        // reduced right hand side
+        std::vector<double> shared(b.begin() + np, b.end());
+        std::vector<double> temp(shared);
+        if (ns > 0)
+        {
+            hugin_utils::choleskySolve(&V[0], &temp[0], ns);
+        };
+        std::vector<double> residual(b.begin(), b.begin() + np);
+        subtractPoseShared(temp, residual);
+        // conjugate gradients
+        std::vector<double> x(np, 0.0);
+        std::vector<double> z(residual);
+        std::vector<double> p(np);
+        std::vector<double> Ap(np);
+        applyPreconditioner(preconditioner, preconditionerOffset, z);
+        p = z;
+        double rz = dot(residual, z);
+        const double tolerance = 1e-20 * dot(residual, residual);
+        const size_t maxIterations = std::max<size_t>(100, np);
+        for (size_t iter = 0; iter < maxIterations && dot(residual, residual) > tolerance; ++iter)
+        {
+            multiplyPose(damping, p, Ap);
+            if (ns > 0)
+            {
+                multiplyPoseSharedTransposed(p, temp);
+                hugin_utils::choleskySolve(&V[0], &temp[0], ns);
+                subtractPoseShared(temp, Ap);
+            };
+            const double pAp = dot(p, Ap);
+            if (pAp <= 0.0)
+            {
+                break;
+            };
+            const double alpha = rz / pAp;
+            for (size_t i = 0; i < np; ++i)
+            {
+                x[i] += alpha * p[i];
+                residual[i] -= alpha * Ap[i];
+            };
+            z = residual;
+            applyPreconditioner(preconditioner, preconditionerOffset, z);
+            const double rzNew = dot(residual, z);
+            const double beta = rzNew / rz;
+            rz = rzNew;
+            for (size_t i = 0; i < np; ++i)
+            {
+                p[i] = z[i] + beta * p[i];
+            };
+        };
+        // back substitution of the shared parameters, V x_shared = b_shared - W^T x_pose
+        if (ns > 0)
+        {
+            multiplyPoseSharedTransposed(x, temp);
+            for (size_t i = 0; i < ns; ++i)
+            {
+                shared[i] -= temp[i];
+            };
+            hugin_utils::choleskySolve(&V[0], &shared[0], ns);
+        };
+        std::copy(x.begin(), x.end(), b.begin());
+        std::copy(shared.begin(), shared.end(), b.begin() + np);
+        return true;
+    };
+
+    void applyPreconditioner(const std::vector<double>& preconditioner, const std::vector<size_t>& offset, std::vector<double>& x) const
+    {
+        for (size_t block = 0; block < m_nrPoseBlocks; ++block)
+        {
+            hugin_utils::choleskySolve(&preconditioner[offset[block]], &x[m_blockStart[block]], getBlockSize(block));
+        };
+    };
+
+    static double dot(const std::vector<double>& a, const std::vector<double>& b)
+    {
+        double s = 0;
+        for (size_t i = 0; i < a.size(); ++i)
+        {
+            s += a[i] * b[i];
+        };
+        return s;
+    };
+
+    std::vector<size_t> m_blockStart;
+    /** block of each parameter */
+    std::vector<size_t> m_paramBlock;
+    size_t m_nrPoseBlocks;
+    size_t m_nrPoseParams;
+    size_t m_nrSharedParams;
+    /** for each pose block the stored blocks of the row (column block, offset in m_poseData),
+     *  the first one is the diagonal block */
+    std::vector<std::vector<std::pair<size_t, size_t> > > m_blockRows;
+    /** the upper block triangle of J^T J of the poses, each block is row major */
+    std::vector<double> m_poseData;
+    /** J^T J between poses and shared parameters, row major */
+    std::vector<double> m_poseShared;
+    /** J^T J of the shared parameters */
+    std::vector<double> m_shared;
+    std::vector<double> m_Jtr;
+    std::vector<double> m_diagonal;
+};
+
+/** the problem, the control point residuals as function of the optimized variables */
+class GeometricProblem
+{
+public:
+    /** reads the images and control points of the panorama
+     *  @return false, if the project contains unsupported features */
+    bool init(const PanoramaData& pano)
+    {
+        const PanoramaOptions& opts = pano.getOptions();
+        m_factor = opts.getWidth() / (opts.getHFOV() * M_PI / 180.0);
+        const bool equirectPano = opts.getProjection() == PanoramaOptions::EQUIRECTANGULAR;
+        const OptimizeVector& optvec = pano.getOptimizeVector();
+        const size_t nrImages = pano.getNrOfImages();
+        if (nrImages == 0 || optvec.size() != nrImages)
+        {
+            return false;
+        };
+        m_images.resize(nrImages);
+        m_params.clear();
+        m_paramOwner.clear();
+        for (size_t i = 0; i < nrImages; ++i)
+        {
+            const SrcPanoImage& img = pano.getImage(i);
+            if (!isSupportedProjection(img.getProjection()))
+            {
+                return false;
+            };
+            // shear is not implemented
+            if (img.getVar("g") != 0.0 || img.getVar("t") != 0.0 || set_contains(optvec[i], "g") || set_contains(optvec[i], "t"))
+            {
+                return false;
+            };
+            ImageModel& model = m_images[i];
+            initImageModel(img, model);
+            for (int var = 0; var < VAR_COUNT; ++var)
+            {
+                // linked variables are optimized as one parameter, the first image
+                // decides if it is optimized (like in the PTOptimizer script)
+                size_t linkedImg = i;
+                for (size_t j = 0; j < i; ++j)
+                {
+                    if (isLinked(img, pano.getImage(j), var))
+                    {
+                        linkedImg = j;
+                        break;
+                    };
+                };
+                if (linkedImg < i)
+                {
+                    model.params[var] = m_images[linkedImg].params[var];
+                }
+                else
+                {
+                    if (set_contains(optvec[i], variableNames[var]))
+                    {
+                        model.params[var] = static_cast<int>(m_params.size());
+                        m_params.push_back(model.values[var]);
+                        m_paramOwner.push_back(std::make_pair(i, var));
+                    };
+                };
+            };
+            updateImageModelFlags(model);
+            if (!checkImageModel(img, model))
+            {
+                return false;
+            };
+        };
+        // control points
+        const CPVector& cps = pano.getCtrlPoints();
+        m_cps.resize(cps.size());
+        for (size_t i = 0; i < cps.size(); ++i)
+        {
+            const ControlPoint& cp = cps[i];
+            if (cp.mode > ControlPoint::Y)
+            {
+                // line control points are not implemented
+                return false;
+            };
+            if (cp.mode != ControlPoint::X_Y && !equirectPano)
+            {
+                // the distance of vertical and horizontal control points is
+                // measured in the panorama projection, only equirectangular is implemented
+                return false;
+            };
+            CPModel& model = m_cps[i];
+            model.image1 = cp.image1Nr;
+            model.image2 = cp.image2Nr;
+            model.x1 = cp.x1;
+            model.y1 = cp.y1;
+            model.x2 = cp.x2;
+            model.y2 = cp.y2;
+            model.mode = cp.mode;
+            // ignore control points, which can not be mapped with the initial values
+            double residuals[2];
+            model.used = calcResiduals(model, m_params, residuals) > 0;
+        };
+        initBlocks();
+        return true;
+    };
+
+    /** returns the initial values of the parameters */
+    const std::vector<double>& getInitialParams() const
+    {
+        return m_params;
+    };
+
+    /** returns true, if the parameters are inside the valid range */
+    bool isValid(const std::vector<double>& x) const
+    {
+        for (size_t i = 0; i < m_paramOwner.size(); ++i)
+        {
+            if (m_paramOwner[i].second == VAR_HFOV)
+            {
+                const double hfov = x[i];
+                const SrcPanoImage::Projection projection = m_images[m_paramOwner[i].first].projection;
+                if (hfov <= 0.0 || (hfov >= 180.0 && (projection == SrcPanoImage::RECTILINEAR || projection == SrcPanoImage::FISHEYE_ORTHOGRAPHIC)))
+                {
+                    return false;
+                };
+            };
+        };
+        return true;
+    };
+
+    /** returns the sum of the squared residuals, infinity if x is invalid */
+    double calcCost(const std::vector<double>& x) const
+    {
+        if (!isValid(x))
+        {
+            return std::numeric_limits<double>::infinity();
+        };
+        double cost = 0;
+        for (size_t i = 0; i < m_cps.size(); ++i)
+        {
+            if (!m_cps[i].used)
+            {
+                continue;
+            };
+            double residuals[2];
+            const int n = calcResiduals(m_cps[i], x, residuals);
+            if (n == 0)
+            {
+                return std::numeric_limits<double>::infinity();
+            };
+            for (int j = 0; j < n; ++j)
+            {
+                cost += residuals[j] * residuals[j];
+            };
+        };
+        return cost;
+    };
+
+    /** initializes the block structure of the normal equations */
+    void initNormalEquations(NormalEquations& normalEquations) const
+    {
+        normalEquations.init(m_blockStart, m_nrPoseBlocks, m_connections);
+    };
+
+    /** calculates J^T J and J^T r for the parameters x
+     *  @return the sum of the squared residuals */
+    double calcNormalEquations(const std::vector<double>& x, NormalEquations& normalEquations) const
+    {
+        normalEquations.clear();
+        double cost = 0;
+        for (size_t i = 0; i < m_cps.size(); ++i)
+        {
+            const CPModel& cp = m_cps[i];
+            if (!cp.used)
+            {
+                continue;
+            };
+            CPDual residuals[2];
+            const int nrResiduals = calcResiduals(cp, x, residuals);
+            // the parameters of both images, linked variables are combined
+            int params[nrOfSlots];
+            int slotParam[nrOfSlots];
+            int nrParams = 0;
+            for (int slot = 0; slot < nrOfSlots; ++slot)
+            {
+                const int param = (slot < VAR_COUNT) ? m_images[cp.image1].params[slot] : m_images[cp.image2].params[slot - VAR_COUNT];
+                slotParam[slot] = -1;
+                if (param >= 0)
+                {
+                    int* end = params + nrParams;
+                    int* found = std::find(params, end, param);
+                    if (found == end)
+                    {
+                        params[nrParams] = param;
+                        ++nrParams;
+                    };
+                    slotParam[slot] = static_cast<int>(found - params);
+                };
+            };
+            for (int j = 0; j < nrResiduals; ++j)
+            {
+                double gradient[nrOfSlots];
+                std::fill(gradient, gradient + nrParams, 0.0);
+                for (int slot = 0; slot < nrOfSlots; ++slot)
+                {
+                    if (slotParam[slot] >= 0)
+                    {
+                        gradient[slotParam[slot]] += residuals[j].d[slot];
+                    };
+                };
+                const double r = residuals[j].v;
+                cost += r * r;
+                normalEquations.add(params, gradient, nrParams, r);
+            };
+        };
+        return cost;
+    };
+
+    /** writes the parameters back into the panorama and updates the control point errors */
+    void updatePano(PanoramaData& pano, const std::vector<double>& x) const
+    {
+        VariableMapVector vars = pano.getVariables();
+        for (size_t i = 0; i < m_images.size(); ++i)
+        {
+            for (int var = 0; var < VAR_COUNT; ++var)
+            {
+                if (m_images[i].params[var] >= 0)
+                {
+                    map_get(vars[i], variableNames[var]).setValue(x[m_images[i].params[var]]);
+                };
+            };
+        };
+        pano.updateVariables(vars);
+        CPVector cps = pano.getCtrlPoints();
+        for (size_t i = 0; i < m_cps.size(); ++i)
+        {
+            double error;
+            if (calcError(m_cps[i], x, error))
+            {
+                cps[i].error = error;
+            };
+        };
+        pano.updateCtrlPointErrors(cps);
+    };
+
+private:
+    /** orders the parameters into the blocks of the normal equations. The parameters
+     *  used by the same images form a pose block, lens parameters linked between images
+     *  are shared and go into the last block. Two pose blocks are connected, if a control
+     *  point depends on both blocks */
+    void initBlocks()
+    {
+        const size_t nrParams = m_params.size();
+        std::vector<std::vector<size_t> > paramImages(nrParams);
+        for (size_t i = 0; i < m_images.size(); ++i)
+        {
+            for (int var = 0; var < VAR_COUNT; ++var)
+            {
+                if (m_images[i].params[var] >= 0)
+                {
+                    paramImages[m_images[i].params[var]].push_back(i);
+                };
+            };
+        };
+        std::map<std::vector<size_t>, size_t> blockOfImages;
+        std::vector<std::vector<size_t> > blocks;
+        std::vector<size_t> sharedParams;
+        for (size_t i = 0; i < nrParams; ++i)
+        {
+            const int var = m_paramOwner[i].second;
+            if (var >= VAR_HFOV && var <= VAR_E && paramImages[i].size() > 1)
+            {
+                sharedParams.push_back(i);
+            }
+            else
+            {
+                std::map<std::vector<size_t>, size_t>::iterator it = blockOfImages.find(paramImages[i]);
+                if (it == blockOfImages.end())
+                {
+                    it = blockOfImages.insert(std::make_pair(paramImages[i], blocks.size())).first;
+                    blocks.push_back(std::vector<size_t>());
+                };
+                blocks[it->second].push_back(i);
+            };
+        };
+        m_nrPoseBlocks = blocks.size();
+        if (!sharedParams.empty())
+        {
+            blocks.push_back(sharedParams);
+        };
+        // reorder the parameters by blocks
+        std::vector<int> newIndex(nrParams);
+        std::vector<double> params;
+        std::vector<std::pair<size_t, int> > paramOwner;
+        std::vector<size_t> paramBlock(nrParams);
+        m_blockStart.clear();
+        for (size_t block = 0; block < blocks.size(); ++block)
+        {
+            m_blockStart.push_back(params.size());
+            for (size_t i = 0; i < blocks[block].size(); ++i)
+            {
+                const size_t oldIndex = blocks[block][i];
+                newIndex[oldIndex] = static_cast<int>(params.size());
+                paramBlock[params.size()] = block;
+                params.push_back(m_params[oldIndex]);
+                paramOwner.push_back(m_paramOwner[oldIndex]);
+            };
+        };
+        m_blockStart.push_back(params.size());
+        m_params.swap(params);
+        m_paramOwner.swap(paramOwner);
+        // the pose blocks of each image
+        std::vector<std::vector<size_t> > imageBlocks(m_images.size());
+        for (size_t i = 0; i < m_images.size(); ++i)
+        {
+            for (int var = 0; var < VAR_COUNT; ++var)
+            {
+                int& param = m_images[i].params[var];
+                if (param >= 0)
+                {
+                    param = newIndex[param];
+                    if (paramBlock[param] < m_nrPoseBlocks)
+                    {
+                        imageBlocks[i].push_back(paramBlock[param]);
+                    };
+                };
+            };
+            std::sort(imageBlocks[i].begin(), imageBlocks[i].end());
+            imageBlocks[i].erase(std::unique(imageBlocks[i].begin(), imageBlocks[i].end()), imageBlocks[i].end());
+        };
+        m_connections.clear();
+        for (size_t i = 0; i < m_cps.size(); ++i)
+        {
+            if (!m_cps[i].used)
+            {
+                continue;
+            };
+            std::vector<size_t> cpBlocks(imageBlocks[m_cps[i].image1]);
+            cpBlocks.insert(cpBlocks.end(), imageBlocks[m_cps[i].image2].begin(), imageBlocks[m_cps[i].image2].end());
+            std::sort(cpBlocks.begin(), cpBlocks.end());
+            cpBlocks.erase(std::unique(cpBlocks.begin(), cpBlocks.end()), cpBlocks.end());
+            for (size_t j = 0; j < cpBlocks.size(); ++j)
+            {
+                for (size_t k = j + 1; k < cpBlocks.size(); ++k)
+                {
+                    m_connections.insert(std::make_pair(cpBlocks[j], cpBlocks[k]));
+                };
+            };
+        };
+    };
+
+    /** sets the variables of the image, the optimized variables get the derivative 1 in slotOffset + variable */
+    void loadVariables(const ImageModel& img, const std::vector<double>& x, const int slotOffset, double* var) const
+    {
+        for (int i = 0; i < VAR_COUNT; ++i)
+        {
+            var[i] = (img.params[i] >= 0) ? x[img.params[i]] : img.values[i];
+        };
+    };
+    void loadVariables(const ImageModel& img, const std::vector<double>& x, const int slotOffset, CPDual* var) const
+    {
+        for (int i = 0; i < VAR_COUNT; ++i)
+        {
+            if (img.params[i] >= 0)
+            {
+                var[i] = CPDual::variable(x[img.params[i]], slotOffset + i);
+            }
+            else
+            {
+                var[i] = CPDual(img.values[i]);
+            };
+        };
+    };
+
+    /** calculates the residuals of a control point like fcnPano of libpano13
+     *  @return the number of residuals, 0 if the control point can not be mapped */
+    template <class T>
+    int calcResiduals(const CPModel& cp, const std::vector<double>& x, T* residuals) const
+    {
+        T var1[VAR_COUNT];
+        T var2[VAR_COUNT];
+        loadVariables(m_images[cp.image1], x, 0, var1);
+        loadVariables(m_images[cp.image2], x, VAR_COUNT, var2);
+        T dir1[3];
+        T dir2[3];
+        if (!imageToSphere(m_images[cp.image1], var1, cp.x1, cp.y1, dir1) ||
+            !imageToSphere(m_images[cp.image2], var2, cp.x2, cp.y2, dir2))
+        {
+            return 0;
+        };
+        T lon1, lat1, lon2, lat2;
+        sphericalCoordinates(dir1, lon1, lat1);
+        sphericalCoordinates(dir2, lon2, lat2);
+        const T dlon = wrapLongitude(lon1 - lon2);
+        switch (cp.mode)
+        {
+            case ControlPoint::X:
+                residuals[0] = dlon * m_factor;
+                return 1;
+            case ControlPoint::Y:
+                residuals[0] = (lat1 - lat2) * m_factor;
+                return 1;
+            default:
+                // distSphere, the components of the distance in longitude and latitude
+                residuals[0] = dlon * cos((lat1 + lat2) * 0.5) * m_factor;
+                residuals[1] = (lat1 - lat2) * m_factor;
+                return 2;
+        };
+    };
+
+    /** calculates the error of the control point in pixels of the panorama */
+    bool calcError(const CPModel& cp, const std::vector<double>& x, double& error) const
+    {
+        double residuals[2];
+        const int n = calcResiduals(cp, x, residuals);
+        if (n == 0)
+        {
+            return false;
+        };
+        if (n == 1)
+        {
+            error = std::abs(residuals[0]);
+            return true;
+        };
+        // angle between both rays, 2*asin(|b1-b2|/2) is accurate for small angles
+        double var1[VAR_COUNT];
+        double var2[VAR_COUNT];
+        loadVariables(m_images[cp.image1], x, 0, var1);
+        loadVariables(m_images[cp.image2], x, VAR_COUNT, var2);
+        double dir1[3];
+        double dir2[3];
+        imageToSphere(m_images[cp.image1], var1, cp.x1, cp.y1, dir1);
+        imageToSphere(m_images[cp.image2], var2, cp.x2, cp.y2, dir2);
+        const double len1 = std::sqrt(dir1[0] * dir1[0] + dir1[1] * dir1[1] + dir1[2] * dir1[2]);
+        const double len2 = std::sqrt(dir2[0] * dir2[0] + dir2[1] * dir2[1] + dir2[2] * dir2[2]);
+        double dist2 = 0;
+        for (int i = 0; i < 3; ++i)
+        {
+            const double diff = dir1[i] / len1 - dir2[i] / len2;
+            dist2 += diff * diff;
+        };
+        error = 2.0 * std::asin(std::min(1.0, std::sqrt(dist2) / 2.0)) * m_factor;
+        return true;
+    };
+
+    /** compares the mapping of the model with the transformation of libpano13, so that
+     *  differences in the conventions (e.g. of a newer libpano13) are detected. Optimized
+     *  variables which are zero get a test value, so that all steps are checked */
+    bool checkImageModel(const SrcPanoImage& img, const ImageModel& model) const
+    {
+        const double testValues[VAR_COUNT] = { 0, 0, 0, 0, 0.01, -0.02, 0.015, 3.0, -2.0, 0.05, -0.03, 0.04, 5.0, -4.0 };
+        SrcPanoImage testImg(img);
+        ImageModel testModel(model);
+        for (int i = 0; i < VAR_COUNT; ++i)
+        {
+            testModel.params[i] = -1;
+            if (model.params[i] >= 0 && model.values[i] == 0.0 && testValues[i] != 0.0)
+            {
+                testImg.setVar(variableNames[i], testValues[i]);
+                testModel.values[i] = testValues[i];
+            };
+        };
+        testModel.radial = model.radial;
+        testModel.translation = model.translation;
+        PanoramaOptions opts;
+        opts.setProjection(PanoramaOptions::EQUIRECTANGULAR);
+        opts.setHFOV(360.0, false);
+        opts.setWidth(3600, false);
+        opts.setHeight(1800);
+        const double distance = 3600.0 / (2.0 * M_PI);
+        PTools::Transform transform;
+        transform.createInvTransform(testImg, opts);
+        const vigra::Size2D size = img.getSize();
+        for (int j = 1; j < 4; ++j)
+        {
+            for (int i = 1; i < 4; ++i)
+            {
+                const double x = size.width() * (0.25 * i - 0.1);
+                const double y = size.height() * (0.25 * j - 0.1);
+                double xt, yt;
+                if (!transform.transformImgCoord(xt, yt, x, y))
+                {
+                    continue;
+                };
+                double dir[3];
+                if (!imageToSphere(testModel, testModel.values, x, y, dir))
+                {
+                    return false;
+                };
+                double lon, lat;
+                sphericalCoordinates(dir, lon, lat);
+                const double ptLon = (xt - 1799.5) / distance;
+                const double ptLat = (yt - 899.5) / distance;
+                if (std::abs(wrapLongitude(lon - ptLon)) * std::cos(lat) > 1e-5 || std::abs(lat - ptLat) > 1e-5)
+                {
+                    DEBUG_DEBUG("native transformation differs from libpano13 at " << x << ", " << y << " of image " << img.getFilename());
+                    return false;
+                };
+            };
+        };
+        return true;
+    };
+
+    std::vector<ImageModel> m_images;
+    std::vector<CPModel> m_cps;
+    /** the values of the parameters */
+    std::vector<double> m_params;
+    /** image and variable of each parameter */
+    std::vector<std::pair<size_t, int> > m_paramOwner;
+    /** converts angles on the sphere into pixels of the panorama */
+    double m_factor;
+    /** first parameter of each block, the last entry is the number of parameters */
+    std::vector<size_t> m_blockStart;
+    size_t m_nrPoseBlocks;
+    /** pairs of connected pose blocks */
+    std::set<std::pair<size_t, size_t> > m_connections;
+};
+
+/** minimizes the sum of the squared residuals with the Levenberg-Marquardt algorithm
+ *  @param x initial parameters, contains the solution */
+void runLevenbergMarquardt(const GeometricProblem& problem, std::vector<double>& x)
+{
+    const int maxIterations = 200;
+    const double ftol = 1e-10;
+    const double xtol = 1e-12;
+    const size_t n = x.size();
+    NormalEquations normalEquations;
+    problem.initNormalEquations(normalEquations);
+    std::vector<double> delta;
+    std::vector<double> xNew(n);
+    double cost = problem.calcNormalEquations(x, normalEquations);
+    double lambda = 1e-3;
+    for (int iter = 0; iter < maxIterations; ++iter)
+    {
+        const double maxDiagonal = normalEquations.finish();
+        if (maxDiagonal == 0.0)
+        {
+            // no parameter has an influence on the residuals
+            return;
+        };
+        bool accepted = false;
+        double newCost = cost;
+        while (!accepted && lambda < 1e16)
+        {
+            if (normalEquations.solve(lambda, maxDiagonal, delta))
+            {
+                for (size_t i = 0; i < n; ++i)
+                {
+                    xNew[i] = x[i] + delta[i];
+                };
+                newCost = problem.calcCost(xNew);
+                accepted = newCost < cost;
+            };
+            if (!accepted)
+            {
+                lambda *= 10.0;
+            };
+        };
+        if (!accepted)
+        {
+            return;
+        };
+        double stepNorm = 0;
+        double xNorm = 0;
+        for (size_t i = 0; i < n; ++i)
+        {
+            stepNorm += delta[i] * delta[i];
+            xNorm += x[i] * x[i];
+        };
+        const bool converged = cost - newCost <= ftol * cost || stepNorm <= xtol * xtol * (xNorm + xtol);
+        x.swap(xNew);
+        cost = newCost;
+        lambda = std::max(lambda * 0.1, 1e-12);
+        if (converged)
+        {
+            return;
+        };
+        cost = problem.calcNormalEquations(x, normalEquations);
+    };
+}
+
+} // namespace
+
+bool NativeOptimizer::isSupported(const PanoramaData& pano)
+{
+    GeometricProblem problem;
+    return problem.init(pano);
+}
+
+bool NativeOptimizer::optimize(PanoramaData& pano)
+{
+    GeometricProblem problem;
+    if (!problem.init(pano))
+    {
+        return false;
+    };
+    std::vector<double> x(problem.getInitialParams());
+    if (!x.empty())
+    {
+        runLevenbergMarquardt(problem, x);
+    };
+    problem.updatePano(pano, x);
+    return true;
+}
+
+bool NativeOptimizer::calcCtrlPointErrors(PanoramaData& pano)
+{
+    GeometricProblem problem;
+    if (!problem.init(pano))
+    {
+        return false;
+    };
+    problem.updatePano(pano, problem.getInitialParams());
+    return true;
+}
+
+} // namespace
@@ -0,0 +1,70 @@
+// -*- c-basic-offset: 4 -*-
+/** @file NativeOptimizer.h
+ *
+ *  @brief in-process optimizer for the geometric image variables
+ *
+ */
+/*  This is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public
+ *  License along with this software. If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _NATIVEOPTIMIZER_H
+#define _NATIVEOPTIMIZER_H
+
+#include <hugin_shared.h>
+#include <panodata/PanoramaData.h>
+
+namespace HuginBase {
+
+/** optimizes the geometric variables of a panorama without libpano13.
+ *
+ *  The control point errors are calculated directly from the variables of
+ *  the SrcPanoImage's with the same error function as libpano13 (distance on
+ *  the sphere for normal control points, distance in the equirectangular
+ *  panorama for vertical and horizontal control points). The derivatives are
+ *  computed by forward mode automatic differentiation, so each iteration of the
+ *  Levenberg-Marquardt solver needs only a single pass over the control points
+ *  and there is no round trip through a PTOptimizer script.
+ *
+ *  The normal equations are stored block sparse following the connections of the
+ *  images by control points. Larger projects are solved by eliminating the shared
+ *  lens parameters and solving the remaining system of the image poses with
+ *  preconditioned conjugate gradients, so that projects with thousands of images
+ *  need neither quadratic memory nor cubic time.
+ *
+ *  Supported are the variables y, p, r, v, a, b, c, d, e, TrX, TrY, TrZ, Tpy and Tpp
+ *  and the rectilinear, panoramic, equirectangular and fisheye projections.
+ *  Projects with line control points or shear are not supported, for these
+ *  PTools::optimize has to be used.
+ */
+class IMPEX NativeOptimizer
+{
+public:
+    /** returns true, if all images, optimized variables and control points of pano are supported */
+    static bool isSupported(const PanoramaData& pano);
+
+    /** optimizes the variables given by the optimize vector of pano and updates the
+     *  control point errors
+     *  @return false if the project is not supported, pano is not modified in this case */
+    static bool optimize(PanoramaData& pano);
+
+    /** calculates the errors of the control points with the current variables
+     *  @return false if the project is not supported, pano is not modified in this case */
+    static bool calcCtrlPointErrors(PanoramaData& pano);
+};
+
+} // namespace
+
+#endif // _NATIVEOPTIMIZER_H
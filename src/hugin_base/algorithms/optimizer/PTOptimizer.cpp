@@ -28,9 +28,12 @@
 #include "PTOptimizer.h"
 
 #include "ImageGraph.h"
+#include "NativeOptimizer.h"
+#include "panodata/ImageVariableTranslate.h"
 #include "panodata/StandardImageVariableGroups.h"
 #include <panotools/PanoToolsOptimizerWrapper.h>
 #include <panotools/PanoToolsInterface.h>
+#include <panotools/PanoToolsUtils.h>
 #include <algorithms/basic/CalculateCPStatistics.h>
 #include <algorithms/nona/CenterHorizontally.h>
 #include <algorithms/nona/CalculateFOV.h>
@@ -48,9 +51,137 @@
 
 namespace HuginBase {
 
+void PTOptimizer::optimize(PanoramaData& pano, Backend backend)
+{
+    if (backend == NATIVE && NativeOptimizer::optimize(pano))
+    {
+        return;
+    };
+    PTools::optimize(pano);
+}
+
+/** returns true, if the variable var of image imgNr is linked with an image, which is not in images */
+static bool isLinkedOutside(const PanoramaData& pano, const unsigned int imgNr, const std::string& var, const UIntSet& images)
+{
+    const SrcPanoImage& img = pano.getImage(imgNr);
+    for (unsigned int i = 0; i < pano.getNrOfImages(); ++i)
+    {
+        if (set_contains(images, i))
+        {
+            continue;
+        };
+#define image_variable(name, type, default_value)\
+        if (PTOVariableConverterFor##name::checkApplicability(var) && img.name##isLinkedWith(pano.getImage(i)))\
+        {\
+            return true;\
+        }
+#include "panodata/image_variables.h"
+#undef image_variable
+    };
+    return false;
+}
+
+/** returns the mean error of the control points between the images in region and the other images
+ *  @return false, if there are no such control points */
+static bool calcBorderError(const PanoramaData& pano, const UIntSet& region, double& error)
+{
+    const CPVector& cps = pano.getCtrlPoints();
+    error = 0;
+    size_t count = 0;
+    for (CPVector::const_iterator it = cps.begin(); it != cps.end(); ++it)
+    {
+        if (set_contains(region, it->image1Nr) != set_contains(region, it->image2Nr))
+        {
+            error += it->error;
+            ++count;
+        };
+    };
+    if (count == 0)
+    {
+        return false;
+    };
+    error /= count;
+    return true;
+}
+
+void PTOptimizer::optimizeIncremental(PanoramaData& pano, const UIntSet& modifiedImages, Backend backend, size_t hops)
+{
+    HuginGraph::ImageGraph graph(pano);
+    const UIntSet region = graph.GetNeighborhood(modifiedImages, hops);
+    if (region.empty() || region.size() == pano.getNrOfImages())
+    {
+        optimize(pano, backend);
+        return;
+    };
+    // the neighbours of the region are included as fixed anchors
+    const UIntSet localImages = graph.GetNeighborhood(region, 1);
+    // variables linked with images outside of the region are held fixed,
+    // they would also change the fixed images
+    const OptimizeVector& optvec = pano.getOptimizeVector();
+    OptimizeVector localOptvec;
+    UIntSet localRegion;
+    for (UIntSet::const_iterator it = localImages.begin(); it != localImages.end(); ++it)
+    {
+        std::set<std::string> vars;
+        if (set_contains(region, *it))
+        {
+            localRegion.insert(localOptvec.size());
+            for (std::set<std::string>::const_iterator var = optvec[*it].begin(); var != optvec[*it].end(); ++var)
+            {
+                if (!isLinkedOutside(pano, *it, *var, region))
+                {
+                    vars.insert(*var);
+                };
+            };
+        };
+        localOptvec.push_back(vars);
+    };
+    PanoramaData* localPano = pano.getNewSubset(localImages); // don't forget to delete
+    localPano->setOptimizeVector(localOptvec);
+    // the errors of the start values
+    if (backend != NATIVE || !NativeOptimizer::calcCtrlPointErrors(*localPano))
+    {
+        PTools::calcCtrlPointErrors(*localPano);
+    };
+    double oldBorderError = 0;
+    const bool hasBorder = calcBorderError(*localPano, localRegion, oldBorderError);
+    optimize(*localPano, backend);
+    double newBorderError = 0;
+    if (hasBorder && calcBorderError(*localPano, localRegion, newBorderError) && newBorderError > 1.1 * oldBorderError)
+    {
+        // the fixed images would need to move too
+        delete localPano;
+        optimize(pano, backend);
+        return;
+    };
+    // copy the optimized variables and the control point errors back
+    size_t localNr = 0;
+    for (UIntSet::const_iterator it = localImages.begin(); it != localImages.end(); ++it, ++localNr)
+    {
+        if (set_contains(region, *it))
+        {
+            pano.updateVariables(*it, localPano->getImageVariables(localNr));
+        };
+    };
+    // the control points of the subset are in the same order as in the panorama
+    CPVector cps = pano.getCtrlPoints();
+    const CPVector& localCps = localPano->getCtrlPoints();
+    size_t localCp = 0;
+    for (size_t i = 0; i < cps.size() && localCp < localCps.size(); ++i)
+    {
+        if (set_contains(localImages, cps[i].image1Nr) && set_contains(localImages, cps[i].image2Nr))
+        {
+            cps[i].error = localCps[localCp].error;
+            ++localCp;
+        };
+    };
+    pano.updateCtrlPointErrors(cps);
+    delete localPano;
+}
+
 bool PTOptimizer::runAlgorithm()
 {
-    PTools::optimize(o_panorama);
+    optimize(o_panorama, o_backend);
     return true; // let's hope so.
 }
 
@@ -271,7 +402,8 @@ private:
 };
 
 
-std::vector<int> RANSACOptimizer::findInliers(PanoramaData & pano, int i1, int i2, double maxError, Mode rmode)
+std::vector<int> RANSACOptimizer::findInliers(PanoramaData & pano, int i1, int i2, double maxError, Mode rmode,
+                                              bool sortedByQuality, bool preVerify)
 {
     bool optHFOV = false;
     bool optB = false;
@@ -295,7 +427,8 @@ std::vector<int> RANSACOptimizer::findInliers(PanoramaData & pano, int i1, int i
     std::copy(estimator.m_initParams.begin(),estimator.m_initParams.end(), parameters.begin());
     std::vector<int> inlier_idx;
     DEBUG_DEBUG("Number of control points: " << estimator.m_xy_cps.size() << " Initial parameter[0]" << parameters[0]);
-    std::vector<const ControlPoint *> inliers = Ransac::compute(parameters, inlier_idx, estimator, estimator.m_xy_cps, 0.999, 0.3);
+    std::vector<const ControlPoint *> inliers = Ransac::compute(parameters, inlier_idx, estimator, estimator.m_xy_cps, 0.999, 0.3,
+                                                                 sortedByQuality, preVerify);
     DEBUG_DEBUG("Number of inliers:" << inliers.size() << "optimized parameter[0]" << parameters[0]);
 
     // set parameters in pano object
@@ -320,8 +453,8 @@ bool RANSACOptimizer::runAlgorithm()
 class AutoOptimiseVisitor :public HuginGraph::BreadthFirstSearchVisitor
 {
 public:
-    explicit AutoOptimiseVisitor(PanoramaData* pano, const std::set<std::string>& optvec)
-        : m_opt(optvec), m_pano(pano)
+    explicit AutoOptimiseVisitor(PanoramaData* pano, const std::set<std::string>& optvec, PTOptimizer::Backend backend)
+        : m_opt(optvec), m_pano(pano), m_backend(backend)
     {};
     void Visit(const size_t vertex, const HuginBase::UIntSet& visitedNeighbors, const HuginBase::UIntSet& unvisitedNeighbors)
     {
@@ -348,7 +481,7 @@ public:
             OptimizeVector optvec(imgs.size());
             optvec[currImg] = m_opt;
             localPano->setOptimizeVector(optvec);
-            PTools::optimize(*localPano);
+            PTOptimizer::optimize(*localPano, m_backend);
             m_pano->updateVariables(vertex, localPano->getImageVariables(currImg));
             delete localPano;
         };
@@ -356,9 +489,10 @@ public:
 private:
     const std::set<std::string>& m_opt;
     PanoramaData* m_pano;
+    PTOptimizer::Backend m_backend;
 };
 
-void AutoOptimise::autoOptimise(PanoramaData& pano, bool optRoll)
+void AutoOptimise::autoOptimise(PanoramaData& pano, bool optRoll, Backend backend)
 {
     // remove all connected images, keep only a single image for each connected stack
     UIntSetVector imageGroups;
@@ -376,7 +510,7 @@ void AutoOptimise::autoOptimise(PanoramaData& pano, bool optRoll)
     // start a breadth first traversal of the graph, and optimize
     // the links found (every vertex just once.)
     HuginGraph::ImageGraph graph(*optPano);
-    AutoOptimiseVisitor visitor(optPano, optvars);
+    AutoOptimiseVisitor visitor(optPano, optvars, backend);
     graph.VisitAllImages(optPano->getOptions().optimizeReferenceImage, true, &visitor);
 
     // now translate to found positions to initial pano
@@ -388,7 +522,7 @@ void AutoOptimise::autoOptimise(PanoramaData& pano, bool optRoll)
 }
 
 
-void SmartOptimise::smartOptimize(PanoramaData& optPano)
+void SmartOptimise::smartOptimize(PanoramaData& optPano, Backend backend)
 {
     // use m-estimator with sigma 2
     PanoramaOptions opts = optPano.getOptions();
@@ -406,13 +540,13 @@ void SmartOptimise::smartOptimize(PanoramaData& optPano)
         }
     }
     optPano.setCtrlPoints(newCP);
-    AutoOptimise::autoOptimise(optPano);
+    AutoOptimise::autoOptimise(optPano, true, backend);
     
     // do global optimisation of position with all control points.
     optPano.setCtrlPoints(cps);
     OptimizeVector optvars = createOptVars(optPano, OPT_POS, optPano.getOptions().optimizeReferenceImage);
     optPano.setOptimizeVector(optvars);
-    PTools::optimize(optPano);
+    optimize(optPano, backend);
     
     //Find lenses.
     StandardImageVariableGroups variable_groups(optPano);
@@ -498,7 +632,7 @@ void SmartOptimise::smartOptimize(PanoramaData& optPano)
         optPano.setOptimizeVector(optvars);
         // global optimisation.
         DEBUG_DEBUG("before opt 1: newVars[0].b: " << const_map_get(optPano.getVariables()[0],"b").getValue());
-        PTools::optimize(optPano);
+        optimize(optPano, backend);
         // --------------------------------------------------------------
         // do some plausibility checks and reoptimize with less variables
         // if something smells fishy
@@ -540,7 +674,7 @@ void SmartOptimise::smartOptimize(PanoramaData& optPano)
             optPano.setOptimizeVector(optvars);
             DEBUG_DEBUG("recover optimisation: " << optmode);
             // global optimisation.
-            PTools::optimize(optPano);
+            optimize(optPano, backend);
     
             // check again, maybe b shouldn't be optimized either
             bool highDist = false;
@@ -560,7 +694,7 @@ void SmartOptimise::smartOptimize(PanoramaData& optPano)
                 optvars = createOptVars(optPano, optmode, optPano.getOptions().optimizeReferenceImage);
                 optPano.setOptimizeVector(optvars);
                 // global optimisation.
-                PTools::optimize(optPano);
+                optimize(optPano, backend);
                 const VariableMapVector & vars = optPano.getVariables();
                 DEBUG_DEBUG("after opt 3: newVars[0].b: " << const_map_get(vars[0],"b").getValue());
                 DEBUG_DEBUG("after opt 3: oldVars[0].b: " << const_map_get(oldVars[0],"b").getValue());
@@ -43,9 +43,12 @@ namespace HuginBase {
     {
     
         public:
+            /// optimizer used for the geometric variables
+            enum Backend {PANOTOOLS, NATIVE};
+
             ///
-            explicit PTOptimizer(PanoramaData& panorama)
-             : PanoramaAlgorithm(panorama)
+            explicit PTOptimizer(PanoramaData& panorama, Backend backend=PANOTOOLS)
+             : PanoramaAlgorithm(panorama), o_backend(backend)
             {};
         
             ///
@@ -58,8 +61,23 @@ namespace HuginBase {
             virtual bool modifiesPanoramaData() const
                 { return true; }
             
-            /// calls PTools::optimize()
+            /** optimizes the geometric variables with the given backend, the NATIVE
+             *  backend falls back to PTools::optimize() for unsupported projects */
+            static void optimize(PanoramaData& pano, Backend backend);
+
+            /** optimizes only the images, which are at most hops edges in the image graph
+             *  away from the modified images, all other images are held fixed. The current
+             *  values of the variables are used as start values. If the mean error of the
+             *  control points connecting the optimized region with the fixed images increases,
+             *  the whole panorama is optimized instead.
+             *  @param modifiedImages images with added, removed or changed control points */
+            static void optimizeIncremental(PanoramaData& pano, const UIntSet& modifiedImages, Backend backend, size_t hops=2);
+
+            /// calls optimize()
             virtual bool runAlgorithm();
+
+        protected:
+            Backend o_backend;
     };
     
     /// Pairwise ransac optimisation 
@@ -84,8 +102,12 @@ namespace HuginBase {
             virtual bool modifiesPanoramaData() const
                 { return true; }
 
+	    /** returns the indices of the control points between i1 and i2 which fit the model
+	     *  @param sortedByQuality the control points are sorted by decreasing quality, the
+	     *                         samples are drawn from the best control points first
+	     *  @param preVerify reject bad models early with a sequential probability ratio test */
 	    static std::vector<int> findInliers(PanoramaData & pano, int i1, int i2, double maxError,
-						Mode mode=RPY);
+						Mode mode=RPY, bool sortedByQuality=false, bool preVerify=false);
             
             /// calls PTools::optimize()
             virtual bool runAlgorithm();
@@ -104,8 +126,8 @@ namespace HuginBase {
         
         public:
             ///
-            AutoOptimise(PanoramaData& panorama, bool optRoll=true)
-             : PTOptimizer(panorama)
+            AutoOptimise(PanoramaData& panorama, bool optRoll=true, Backend backend=PANOTOOLS)
+             : PTOptimizer(panorama, backend), o_optRoll(optRoll)
             {};
         
             ///
@@ -115,16 +137,18 @@ namespace HuginBase {
         
         public:
             ///
-            static void autoOptimise(PanoramaData& pano, bool optRoll=true);
+            static void autoOptimise(PanoramaData& pano, bool optRoll=true, Backend backend=PANOTOOLS);
 
         public:
             ///
             virtual bool runAlgorithm()
             {
-                autoOptimise(o_panorama);
+                autoOptimise(o_panorama, o_optRoll, o_backend);
                 return true; // let's hope so.
             }
 
+        private:
+            bool o_optRoll;
     };
     
     ///
@@ -155,8 +179,8 @@ namespace HuginBase {
         
         public:
             ///
-            explicit SmartOptimise(PanoramaData& panorama)
-             : PTOptimizer(panorama)
+            explicit SmartOptimise(PanoramaData& panorama, Backend backend=PANOTOOLS)
+             : PTOptimizer(panorama, backend)
             {};
         
             ///
@@ -165,14 +189,14 @@ namespace HuginBase {
         
         public:
             ///
-            static void smartOptimize(PanoramaData& pano);
+            static void smartOptimize(PanoramaData& pano, Backend backend=PANOTOOLS);
         
             
         public:
             ///
             virtual bool runAlgorithm()
             {
-                smartOptimize(o_panorama);
+                smartOptimize(o_panorama, o_backend);
                 return true; // let's hope so.
             }
 
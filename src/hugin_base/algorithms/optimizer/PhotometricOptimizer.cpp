@@ -24,8 +24,12 @@
 #include "PhotometricOptimizer.h"
 
 #include <fstream>
-#include <foreign/levmar/levmar.h>
+#include <algorithm>
+#include <hugin_math/hugin_math.h>
+#include <hugin_utils/openmp_lock.h>
 #include <photometric/ResponseTransform.h>
+#include <vigra_ext/emor.h>
+#include <vigra_ext/lut.h>
 #include <algorithms/basic/LayerStacks.h>
 
 #ifdef DEBUG
@@ -44,6 +48,208 @@ inline double weightHuber(double x, double sigma)
     return x;
 }
 
+namespace
+{
+
+/** the photometric variables of an image, VAR_RA to VAR_RA+4 are the EMoR parameters */
+enum PhotometricVariable
+{
+    VAR_EEV = 0,
+    VAR_ER,
+    VAR_EB,
+    VAR_RA,
+    VAR_VA = VAR_RA + 5,
+    VAR_VX = VAR_VA + 4,
+    VAR_VY,
+    NR_PHOTOMETRIC_VARS
+};
+
+/** returns the PhotometricVariable of the variable name, -1 for all other variables */
+int getPhotometricVariable(const std::string& name)
+{
+    static const char* names[NR_PHOTOMETRIC_VARS] = { "Eev", "Er", "Eb", "Ra", "Rb", "Rc", "Rd", "Re", "Va", "Vb", "Vc", "Vd", "Vx", "Vy" };
+    for (int i = 0; i < NR_PHOTOMETRIC_VARS; ++i)
+    {
+        if (name == names[i])
+        {
+            return i;
+        };
+    };
+    return -1;
+}
+
+/** sorts the samples by the image pair */
+struct CompareImagePair
+{
+    explicit CompareImagePair(const std::vector<vigra_ext::PointPairRGB>& data) : m_data(data) {};
+    bool operator()(const size_t a, const size_t b) const
+    {
+        if (m_data[a].imgNr1 != m_data[b].imgNr1)
+        {
+            return m_data[a].imgNr1 < m_data[b].imgNr1;
+        };
+        return m_data[a].imgNr2 < m_data[b].imgNr2;
+    };
+    const std::vector<vigra_ext::PointPairRGB>& m_data;
+};
+
+/** position of a value in a lookup table */
+struct LutPosition
+{
+    LutPosition() : index(0), weight(0), slope(0), constant(true) {};
+    /// lower table entry and weight of the upper table entry
+    size_t index;
+    double weight;
+    /// derivative of the interpolated value
+    double slope;
+    /// true, if the value does not depend on the table entries
+    bool constant;
+};
+
+/** looks up v (scaled to 0..1) in lut with linear interpolation,
+ *  gives the same result as vigra_ext::LUTFunctor */
+double lookupLut(const std::vector<double>& lut, const double v, LutPosition& pos)
+{
+    pos = LutPosition();
+    if (v > 1)
+    {
+        pos.index = lut.size() - 1;
+        pos.constant = false;
+        return lut.back();
+    };
+    if (v < 0)
+    {
+        return 0;
+    };
+    double x = v * (lut.size() - 1);
+    const size_t i = static_cast<size_t>(x);
+    x = x - i;
+    pos.index = i;
+    pos.constant = false;
+    if (i + 1 < lut.size())
+    {
+        pos.weight = x;
+        pos.slope = (lut[i + 1] - lut[i]) * (lut.size() - 1);
+        return (1 - x) * lut[i] + x * lut[i + 1];
+    };
+    return lut[i];
+}
+
+/** adds factor times the derivatives of the value at pos for the nrParams parameters of lutDeriv to deriv */
+void addLutDeriv(const std::vector<double>& lutDeriv, const size_t nrParams, const LutPosition& pos, const double factor, double* deriv)
+{
+    if (pos.constant)
+    {
+        return;
+    };
+    for (size_t k = 0; k < nrParams; ++k)
+    {
+        deriv[k] += factor * (1 - pos.weight) * lutDeriv[pos.index * nrParams + k];
+    };
+    if (pos.weight != 0)
+    {
+        for (size_t k = 0; k < nrParams; ++k)
+        {
+            deriv[k] += factor * pos.weight * lutDeriv[(pos.index + 1) * nrParams + k];
+        };
+    };
+}
+
+/** inverts the monotonic lut, gives the same result as vigra_ext::InvLUTFunctor.
+ *  invDeriv receives the derivatives of the inverse for the nrParams parameters of lutDeriv */
+void invertLut(const std::vector<double>& lut, const std::vector<double>& lutDeriv, const size_t nrParams,
+               std::vector<double>& invLut, std::vector<double>& invDeriv)
+{
+    const size_t lutSize = lut.size();
+    invLut.assign(lutSize, 0.0);
+    invDeriv.assign(lutSize * nrParams, 0.0);
+    for (size_t i = 0; i < lutSize; ++i)
+    {
+        const double v = static_cast<double>(i) / (lutSize - 1);
+        if (v >= lut.back())
+        {
+            invLut[i] = lut.back();
+            for (size_t k = 0; k < nrParams; ++k)
+            {
+                invDeriv[i * nrParams + k] = lutDeriv[(lutSize - 1) * nrParams + k];
+            };
+            continue;
+        };
+        if (v < lut[0])
+        {
+            continue;
+        };
+        const size_t x = std::lower_bound(lut.begin(), lut.end(), v) - lut.begin();
+        if (v == 1)
+        {
+            invLut[i] = 1;
+        }
+        else
+        {
+            if (x > 0)
+            {
+                if (v == lut[x])
+                {
+                    invLut[i] = x / (lutSize - 1.0);
+                }
+                else
+                {
+                    // interpolate between the neighbouring entries
+                    const double lower = lut[x - 1];
+                    const double upper = lut[x];
+                    const double t = (v - lower) / (upper - lower);
+                    invLut[i] = (x - 1 + t) / (lutSize - 1.0);
+                    // dt/dlower = (t-1)/(upper-lower), dt/dupper = -t/(upper-lower)
+                    const double factor = 1.0 / ((upper - lower) * (lutSize - 1.0));
+                    for (size_t k = 0; k < nrParams; ++k)
+                    {
+                        invDeriv[i * nrParams + k] = factor * ((t - 1) * lutDeriv[(x - 1) * nrParams + k] - t * lutDeriv[x * nrParams + k]);
+                    };
+                };
+            };
+        };
+    };
+}
+
+/** adds the residual r with the derivatives deriv for the variables index to J^T J and J^T x */
+void addResidual(const std::vector<int>& index, const double* deriv, const double r, std::vector<double>& JtJ, std::vector<double>& Jtx)
+{
+    const size_t n = index.size();
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (deriv[i] == 0)
+        {
+            continue;
+        };
+        Jtx[i] += deriv[i] * r;
+        for (size_t j = i; j < n; ++j)
+        {
+            JtJ[i * n + j] += deriv[i] * deriv[j];
+        };
+    };
+}
+
+/** adds the system of the local variables index (only the upper triangle of localJtJ is used)
+ *  to the system of all m variables */
+void addLocalSystem(const std::vector<int>& index, const std::vector<double>& localJtJ, const std::vector<double>& localJtx,
+                    double* JtJ, double* Jtx, const size_t m)
+{
+    const size_t n = index.size();
+    for (size_t i = 0; i < n; ++i)
+    {
+        Jtx[index[i]] += localJtx[i];
+        for (size_t j = i; j < n; ++j)
+        {
+            JtJ[index[i] * m + index[j]] += localJtJ[i * n + j];
+            if (j != i)
+            {
+                JtJ[index[j] * m + index[i]] += localJtJ[i * n + j];
+            };
+        };
+    };
+}
+
+} // namespace
 
 
 PhotometricOptimizer::OptimData::OptimData(const PanoramaData & pano, const OptimizeVector & optvars,
@@ -116,6 +322,37 @@ PhotometricOptimizer::OptimData::OptimData(const PanoramaData & pano, const Opti
             m_vars.push_back(var);
         }
     }
+
+    // remember which variable belongs to which image
+    m_varIndex.assign(pano.getNrOfImages() * NR_PHOTOMETRIC_VARS, -1);
+    for (size_t i = 0; i < m_vars.size(); ++i)
+    {
+        const int var = getPhotometricVariable(m_vars[i].type);
+        if (var >= 0)
+        {
+            for (std::set<unsigned>::const_iterator it = m_vars[i].imgs.begin(); it != m_vars[i].imgs.end(); ++it)
+            {
+                m_varIndex[*it * NR_PHOTOMETRIC_VARS + var] = i;
+            };
+        };
+    };
+    m_responses.resize(pano.getNrOfImages());
+
+    // group the samples by image pair, all samples of a pair depend on the same variables
+    m_sampleOrder.resize(m_data.size());
+    for (size_t i = 0; i < m_sampleOrder.size(); ++i)
+    {
+        m_sampleOrder[i] = i;
+    };
+    std::stable_sort(m_sampleOrder.begin(), m_sampleOrder.end(), CompareImagePair(m_data));
+    for (size_t i = 0; i < m_sampleOrder.size(); ++i)
+    {
+        if (i == 0 || CompareImagePair(m_data)(m_sampleOrder[i - 1], m_sampleOrder[i]))
+        {
+            m_pairStart.push_back(i);
+        };
+    };
+    m_pairStart.push_back(m_sampleOrder.size());
 }
 
 void PhotometricOptimizer::OptimData::ToX(double * x)
@@ -147,18 +384,354 @@ void PhotometricOptimizer::OptimData::FromX(double * x)
     }
 }
 
+double PhotometricOptimizer::OptimData::calcResiduals(double* x, double* JtJ, double* Jtx)
+{
+    const size_t nImg = m_imgs.size();
+    const size_t m = m_vars.size();
+    const bool calcJacobian = (JtJ != NULL && Jtx != NULL);
+    if (calcJacobian)
+    {
+        std::fill(JtJ, JtJ + m * m, 0.0);
+        std::fill(Jtx, Jtx + m, 0.0);
+    };
+    double sqError = 0;
+    for (size_t i = 0; i < nImg; ++i)
+    {
+        ImageResponse& resp = m_responses[i];
+        resp.update(m_imgs[i]);
+        // the monotonicity error
+        x[i] = resp.monotonicityError;
+        sqError += x[i] * x[i];
+        if (calcJacobian && resp.monotonicityError > 0)
+        {
+            for (size_t k = 0; k < resp.monotonicityDeriv.size(); ++k)
+            {
+                const int index = m_varIndex[i * NR_PHOTOMETRIC_VARS + VAR_RA + k];
+                if (index >= 0)
+                {
+                    Jtx[index] += resp.monotonicityDeriv[k] * x[i];
+                    for (size_t l = 0; l < resp.monotonicityDeriv.size(); ++l)
+                    {
+                        const int index2 = m_varIndex[i * NR_PHOTOMETRIC_VARS + VAR_RA + l];
+                        if (index2 >= 0)
+                        {
+                            JtJ[index * m + index2] += resp.monotonicityDeriv[k] * resp.monotonicityDeriv[l];
+                        };
+                    };
+                };
+            };
+        };
+    };
+
+    // the samples of each image pair are processed together, so that the derivatives
+    // can be summed up for the few variables of the pair before they are added to J^T J
+    hugin_omp::Lock lock;
+    const int nrPairs = static_cast<int>(m_pairStart.size()) - 1;
+#pragma omp parallel for schedule(dynamic) reduction(+: sqError)
+    for (int pair = 0; pair < nrPairs; ++pair)
+    {
+        const vigra_ext::PointPairRGB& firstSample = m_data[m_sampleOrder[m_pairStart[pair]]];
+        const ImageResponse& resp1 = m_responses[firstSample.imgNr1];
+        const ImageResponse& resp2 = m_responses[firstSample.imgNr2];
+        // the optimized variables of both images
+        std::vector<int> slots;
+        std::vector<int> index;
+        if (calcJacobian)
+        {
+            for (int i = 0; i < 2 * NR_PHOTOMETRIC_VARS; ++i)
+            {
+                const size_t img = (i < NR_PHOTOMETRIC_VARS) ? firstSample.imgNr1 : firstSample.imgNr2;
+                const int varIndex = m_varIndex[img * NR_PHOTOMETRIC_VARS + i % NR_PHOTOMETRIC_VARS];
+                if (varIndex >= 0)
+                {
+                    slots.push_back(i);
+                    index.push_back(varIndex);
+                };
+            };
+        };
+        std::vector<double> localJtJ(index.size() * index.size(), 0.0);
+        std::vector<double> localJtx(index.size(), 0.0);
+        std::vector<double> rowDeriv(index.size());
+        double error[6];
+        // derivatives for the variables of image 1 and image 2 for all 6 residuals
+        double deriv[6][2 * NR_PHOTOMETRIC_VARS];
+        for (size_t i = m_pairStart[pair]; i < m_pairStart[pair + 1]; ++i)
+        {
+            const size_t sampleIndex = m_sampleOrder[i];
+            const vigra_ext::PointPairRGB& sample = m_data[sampleIndex];
+            double derivFrom[3 * NR_PHOTOMETRIC_VARS];
+            double derivTo[3 * NR_PHOTOMETRIC_VARS];
+            // error in image 1, transfer the value from image 2 into image 1
+            calcTransferError(resp2, sample.i2, sample.p2, resp1, sample.i1, sample.p1, error, derivFrom, derivTo);
+            for (int c = 0; c < 3; ++c)
+            {
+                std::copy(derivTo + c * NR_PHOTOMETRIC_VARS, derivTo + (c + 1) * NR_PHOTOMETRIC_VARS, deriv[c]);
+                std::copy(derivFrom + c * NR_PHOTOMETRIC_VARS, derivFrom + (c + 1) * NR_PHOTOMETRIC_VARS, deriv[c] + NR_PHOTOMETRIC_VARS);
+            };
+            // calcuate the error in image 2 as well.
+            //TODO: weighting dependent on the pixel value? check if outside of i2 range?
+            calcTransferError(resp1, sample.i1, sample.p1, resp2, sample.i2, sample.p2, error + 3, derivFrom, derivTo);
+            for (int c = 0; c < 3; ++c)
+            {
+                std::copy(derivFrom + c * NR_PHOTOMETRIC_VARS, derivFrom + (c + 1) * NR_PHOTOMETRIC_VARS, deriv[c + 3]);
+                std::copy(derivTo + c * NR_PHOTOMETRIC_VARS, derivTo + (c + 1) * NR_PHOTOMETRIC_VARS, deriv[c + 3] + NR_PHOTOMETRIC_VARS);
+            };
+            double* residual = x + nImg + 6 * sampleIndex;
+            for (int j = 0; j < 6; ++j)
+            {
+                double r = error[j];
+                double factor = 1.0;
+                // use huber robust estimator
+                if (huberSigma > 0)
+                {
+                    const double absError = fabs(error[j]);
+                    r = weightHuber(absError, huberSigma);
+                    factor = (error[j] < 0) ? -1.0 : 1.0;
+                    if (absError > huberSigma)
+                    {
+                        factor *= huberSigma / r;
+                    };
+                };
+                residual[j] = r;
+                sqError += r * r;
+                if (calcJacobian)
+                {
+                    for (size_t k = 0; k < slots.size(); ++k)
+                    {
+                        rowDeriv[k] = factor * deriv[j][slots[k]];
+                    };
+                    addResidual(index, rowDeriv.data(), r, localJtJ, localJtx);
+                };
+            };
+        };
+        if (calcJacobian)
+        {
+            hugin_omp::ScopedLock sl(lock);
+            addLocalSystem(index, localJtJ, localJtx, JtJ, Jtx, m);
+        };
+    };
+    return sqError;
+}
+
+PhotometricOptimizer::ImageResponse::ImageResponse()
+    : responseType(-1), gamma(0), monotonicityError(0), exposure(1), radialVig(false), radiusScale(0)
+{
+    whiteBalance[0] = 1;
+    whiteBalance[1] = 1;
+    whiteBalance[2] = 1;
+    for (int i = 0; i < 4; ++i)
+    {
+        vigCoeff[i] = 0;
+    };
+}
+
+void PhotometricOptimizer::ImageResponse::update(const SrcPanoImage& img)
+{
+    exposure = img.getExposure();
+    whiteBalance[0] = img.getWhiteBalanceRed();
+    whiteBalance[2] = img.getWhiteBalanceBlue();
+    radialVig = (img.getVigCorrMode() & SrcPanoImage::VIGCORR_RADIAL) != 0;
+    const std::vector<double> coeff = img.getRadialVigCorrCoeff();
+    for (size_t i = 0; i < 4 && i < coeff.size(); ++i)
+    {
+        vigCoeff[i] = coeff[i];
+    };
+    vigCenter = img.getRadialVigCorrCenter();
+    radiusScale = 1.0 / sqrt(img.getSize().x / 2.0 * img.getSize().x / 2.0 + img.getSize().y / 2.0 * img.getSize().y / 2.0);
 
+    // the lookup tables are only recalculated when the response curve has changed
+    switch (img.getResponseType())
+    {
+        case SrcPanoImage::RESPONSE_EMOR:
+            {
+                if (responseType == SrcPanoImage::RESPONSE_EMOR && emorParams == img.getEMoRParams())
+                {
+                    return;
+                };
+                emorParams = img.getEMoRParams();
+                std::vector<double> curve;
+                vigra_ext::EMoR::createEMoRLUT(emorParams, curve);
+                const size_t nrParams = emorParams.size();
+                const size_t lutSize = curve.size();
+                // calculate the monotonicity error
+                monotonicityError = 0;
+                monotonicityDeriv.assign(nrParams, 0.0);
+                for (size_t j = 0; j + 1 < lutSize; ++j)
+                {
+                    const double d = curve[j] - curve[j + 1];
+                    if (d > 0)
+                    {
+                        monotonicityError += d * d * lutSize;
+                        for (size_t k = 0; k < nrParams; ++k)
+                        {
+                            monotonicityDeriv[k] += 2 * d * lutSize * (vigra_ext::EMoR::h[k][j] - vigra_ext::EMoR::h[k][j + 1]);
+                        };
+                    };
+                };
+                // enforce a monotonous response curve like vigra_ext::enforceMonotonicity,
+                // remember from which entry each entry was taken for the derivatives
+                std::vector<size_t> source(lutSize);
+                for (size_t j = 0; j < lutSize; ++j)
+                {
+                    source[j] = j;
+                };
+                const double maxValue = curve.back();
+                for (size_t j = 0; j + 1 < lutSize; ++j)
+                {
+                    if (curve[j + 1] > maxValue)
+                    {
+                        curve[j + 1] = maxValue;
+                        source[j + 1] = lutSize - 1;
+                    }
+                    else
+                    {
+                        if (curve[j + 1] < curve[j])
+                        {
+                            curve[j + 1] = curve[j];
+                            source[j + 1] = source[j];
+                        };
+                    };
+                };
+                lut.swap(curve);
+                lutDeriv.resize(lutSize * nrParams);
+                for (size_t j = 0; j < lutSize; ++j)
+                {
+                    for (size_t k = 0; k < nrParams; ++k)
+                    {
+                        lutDeriv[j * nrParams + k] = vigra_ext::EMoR::h[k][source[j]];
+                    };
+                };
+                invertLut(lut, lutDeriv, nrParams, invLut, invLutDeriv);
+            }
+            break;
+        case SrcPanoImage::RESPONSE_GAMMA:
+            if (responseType == SrcPanoImage::RESPONSE_GAMMA && gamma == img.getGamma())
+            {
+                return;
+            };
+            gamma = img.getGamma();
+            emorParams.clear();
+            lut.resize(1 << 10);
+            vigra_ext::createGammaLUT(gamma, lut);
+            vigra_ext::enforceMonotonicity(lut);
+            lutDeriv.clear();
+            invertLut(lut, lutDeriv, 0, invLut, invLutDeriv);
+            monotonicityError = 0;
+            monotonicityDeriv.clear();
+            break;
+        default:
+            emorParams.clear();
+            lut.clear();
+            lutDeriv.clear();
+            invLut.clear();
+            invLutDeriv.clear();
+            monotonicityError = 0;
+            monotonicityDeriv.clear();
+            break;
+    };
+    responseType = img.getResponseType();
+}
+
+double PhotometricOptimizer::ImageResponse::calcVigFactor(const hugin_utils::FDiff2D& pos, double* deriv) const
+{
+    std::fill(deriv, deriv + 6, 0.0);
+    if (!radialVig)
+    {
+        return 1;
+    };
+    const double dx = (pos.x - vigCenter.x) * radiusScale;
+    const double dy = (pos.y - vigCenter.y) * radiusScale;
+    const double r2 = dx * dx + dy * dy;
+    double vig = vigCoeff[0];
+    double r = r2;
+    deriv[0] = 1;
+    for (unsigned int i = 1; i < 4; i++)
+    {
+        vig += vigCoeff[i] * r;
+        deriv[i] = r;
+        r *= r2;
+    };
+    // the center shift Vx and Vy moves the center
+    const double vigDerivR2 = vigCoeff[1] + 2 * vigCoeff[2] * r2 + 3 * vigCoeff[3] * r2 * r2;
+    deriv[4] = -2 * dx * radiusScale * vigDerivR2;
+    deriv[5] = -2 * dy * radiusScale * vigDerivR2;
+    return vig;
+}
+
+void PhotometricOptimizer::calcTransferError(const ImageResponse& from, const vigra::RGBValue<float>& valueFrom, const hugin_utils::FDiff2D& posFrom,
+                                             const ImageResponse& to, const vigra::RGBValue<float>& valueTo, const hugin_utils::FDiff2D& posTo,
+                                             double* error, double* derivFrom, double* derivTo)
+{
+    double vigDerivFrom[6];
+    double vigDerivTo[6];
+    const double vigFrom = from.calcVigFactor(posFrom, vigDerivFrom);
+    const double vigTo = to.calcVigFactor(posTo, vigDerivTo);
+    for (int c = 0; c < 3; ++c)
+    {
+        double* dFrom = derivFrom + c * NR_PHOTOMETRIC_VARS;
+        double* dTo = derivTo + c * NR_PHOTOMETRIC_VARS;
+        std::fill(dFrom, dFrom + NR_PHOTOMETRIC_VARS, 0.0);
+        std::fill(dTo, dTo + NR_PHOTOMETRIC_VARS, 0.0);
+        // inverse response of image from
+        double irradiance = valueFrom[c];
+        LutPosition invPos;
+        if (!from.invLut.empty())
+        {
+            irradiance = lookupLut(from.invLut, valueFrom[c], invPos);
+        };
+        // inverse vignetting, exposure and white balance of image from, followed by
+        // vignetting, exposure and white balance of image to
+        const double scale = (vigTo * to.exposure * to.whiteBalance[c]) / (vigFrom * from.exposure * from.whiteBalance[c]);
+        const double u = irradiance * scale;
+        // response of image to
+        double value = u;
+        double slope = 1.0;
+        LutPosition pos;
+        if (!to.lut.empty())
+        {
+            value = lookupLut(to.lut, u, pos);
+            slope = pos.slope;
+        };
+        error[c] = valueTo[c] - value;
+
+        // derivatives of the response curves
+        if (!to.lutDeriv.empty())
+        {
+            addLutDeriv(to.lutDeriv, to.emorParams.size(), pos, -1.0, dTo + VAR_RA);
+        };
+        if (!from.invLutDeriv.empty())
+        {
+            addLutDeriv(from.invLutDeriv, from.emorParams.size(), invPos, -slope * scale, dFrom + VAR_RA);
+        };
+        // exposure, white balance and vignetting scale u, so the derivatives
+        // follow from the derivative of the error for log(u)
+        // the exposure is 2^-Eev
+        const double derivLog = -slope * u;
+        dTo[VAR_EEV] = -log(2.0) * derivLog;
+        dFrom[VAR_EEV] = log(2.0) * derivLog;
+        if (c == 0)
+        {
+            dTo[VAR_ER] = derivLog / to.whiteBalance[0];
+            dFrom[VAR_ER] = -derivLog / from.whiteBalance[0];
+        };
+        if (c == 2)
+        {
+            dTo[VAR_EB] = derivLog / to.whiteBalance[2];
+            dFrom[VAR_EB] = -derivLog / from.whiteBalance[2];
+        };
+        for (int i = 0; i < 6; ++i)
+        {
+            dTo[VAR_VA + i] = derivLog * vigDerivTo[i] / vigTo;
+            dFrom[VAR_VA + i] = -derivLog * vigDerivFrom[i] / vigFrom;
+        };
+    };
+}
 
 void PhotometricOptimizer::photometricError(double *p, double *x, int m, int n, void * data)
 {
 #ifdef DEBUG_LOG_VIG
     static int iter = 0;
 #endif
-    typedef Photometric::ResponseTransform<vigra::RGBValue<double> > RespFunc;
-    typedef Photometric::InvResponseTransform<vigra::RGBValue<double>, vigra::RGBValue<double> > InvRespFunc;
-
-    int xi = 0 ;
-
     OptimData * dat = static_cast<OptimData*>(data);
     dat->FromX(p);
 #ifdef DEBUG_LOG_VIG
@@ -178,81 +751,12 @@ void PhotometricOptimizer::photometricError(double *p, double *x, int m, int n,
     dat->m_pano.printPanoramaScript(script, optvars, dat->m_pano.getOptions(), imgs, false, "");
 #endif
 
-    size_t nImg = dat->m_imgs.size();
-    std::vector<RespFunc> resp(nImg);
-    std::vector<InvRespFunc> invResp(nImg);
-    for (size_t i=0; i < nImg; i++) {
-        resp[i] = RespFunc(dat->m_imgs[i]);
-        invResp[i] = InvRespFunc(dat->m_imgs[i]);
-        // calculate the monotonicity error
-        double monErr = 0;
-        if (dat->m_imgs[i].getResponseType() == SrcPanoImage::RESPONSE_EMOR) {
-            // calculate monotonicity error
-            int lutsize = resp[i].m_lutR.size();
-            for (int j=0; j < lutsize-1; j++)
-            {
-                double d = resp[i].m_lutR[j] - resp[i].m_lutR[j+1];
-                if (d > 0) {
-                    monErr += d*d*lutsize;
-                }
-            }
-        }
-        x[xi++] = monErr;
-		// enforce a montonous response curves
-		resp[i].enforceMonotonicity();
-		invResp[i].enforceMonotonicity();
-    }
-
 #ifdef DEBUG
-    double sqerror=0;
+    const double sqerror = dat->calcResiduals(x, NULL, NULL);
+#else
+    dat->calcResiduals(x, NULL, NULL);
 #endif
-    // loop over all points to calculate the error
-#ifdef DEBUG_LOG_VIG
-    log << "VIGval = [ ";
-#endif
-
-    for (std::vector<vigra_ext::PointPairRGB>::const_iterator it = dat->m_data.begin();
-         it != dat->m_data.end(); ++it)
-    {
-        vigra::RGBValue<double> l2 = invResp[it->imgNr2](it->i2, it->p2);
-        vigra::RGBValue<double> i2ini1 = resp[it->imgNr1](l2, it->p1);
-        vigra::RGBValue<double> error = it->i1 - i2ini1;
-
-
-        // if requested, calcuate the error in image 2 as well.
-        //TODO: weighting dependent on the pixel value? check if outside of i2 range?
-        vigra::RGBValue<double> l1 = invResp[it->imgNr1](it->i1, it->p1);
-        vigra::RGBValue<double> i1ini2 = resp[it->imgNr2](l1, it->p2);
-        vigra::RGBValue<double> error2 = it->i2 - i1ini2;
-
-#ifdef DEBUG
-        for (int i=0; i < 3; i++) {
-            sqerror += error[i]*error[i];
-            sqerror += error2[i]*error2[i];
-        }
-#endif
-
-        // use huber robust estimator
-        if (dat->huberSigma > 0) {
-            for (int i=0; i < 3; i++) {
-                x[xi++] = weightHuber(fabs(error[i]), dat->huberSigma);
-                x[xi++] = weightHuber(fabs(error2[i]), dat->huberSigma);
-            }
-        } else {
-            x[xi++] = error[0];
-            x[xi++] = error[1];
-            x[xi++] = error[2];
-            x[xi++] = error2[0];
-            x[xi++] = error2[1];
-            x[xi++] = error2[2];
-        }
 
-#ifdef DEBUG_LOG_VIG
-        log << it->i1.green()  << " "<< l1.green()  << " " << i1ini2.green() << "   " 
-             << it->i2.green()  << " "<< l2.green()  << " " << i2ini1.green() << ";  " << std::endl;
-#endif
-
-    }
 #ifdef DEBUG_LOG_VIG
     log << std::endl << "VIGerr = [";
     for (int i = 0; i < n; i++) {
@@ -275,6 +779,91 @@ int PhotometricOptimizer::photometricVis(double *p, double *x, int m, int n, int
     return dat->m_progress->updateDisplay(std::string(tmp)) ? 1 : 0 ;
 }
 
+int PhotometricOptimizer::runLevenbergMarquardt(OptimData& data, double* p, int m, int n, double errorThreshold)
+{
+    const double ftol = 1e-10;
+    const double xtol = 1e-12;
+    std::vector<double> x(n);
+    std::vector<double> xNew(n);
+    std::vector<double> JtJ(m * m);
+    std::vector<double> Jtx(m);
+    std::vector<double> A(m * m);
+    std::vector<double> delta(m);
+    std::vector<double> pNew(m);
+    data.FromX(p);
+    double cost = data.calcResiduals(&x[0], &JtJ[0], &Jtx[0]);
+    double lambda = 1e-3;
+    int iter = 0;
+    for (; iter < data.m_maxIter; ++iter)
+    {
+        // report progress, stop when the user has cancelled
+        if (photometricVis(p, &x[0], m, n, iter, cost, &data) == 0 || cost <= errorThreshold)
+        {
+            break;
+        };
+        double maxDiagonal = 0;
+        for (int i = 0; i < m; ++i)
+        {
+            maxDiagonal = std::max(maxDiagonal, JtJ[i * m + i]);
+        };
+        if (maxDiagonal == 0.0)
+        {
+            // no variable has an influence on the residuals
+            break;
+        };
+        bool accepted = false;
+        double newCost = cost;
+        while (!accepted && lambda < 1e16)
+        {
+            A = JtJ;
+            for (int i = 0; i < m; ++i)
+            {
+                A[i * m + i] += lambda * std::max(JtJ[i * m + i], 1e-12 * maxDiagonal);
+                delta[i] = -Jtx[i];
+            };
+            if (hugin_utils::choleskyDecompose(&A[0], m))
+            {
+                hugin_utils::choleskySolve(&A[0], &delta[0], m);
+                for (int i = 0; i < m; ++i)
+                {
+                    pNew[i] = p[i] + delta[i];
+                };
+                data.FromX(&pNew[0]);
+                newCost = data.calcResiduals(&xNew[0], NULL, NULL);
+                accepted = newCost < cost;
+            };
+            if (!accepted)
+            {
+                lambda *= 10.0;
+            };
+        };
+        if (!accepted)
+        {
+            break;
+        };
+        double stepNorm = 0;
+        double pNorm = 0;
+        for (int i = 0; i < m; ++i)
+        {
+            stepNorm += delta[i] * delta[i];
+            pNorm += p[i] * p[i];
+            p[i] = pNew[i];
+        };
+        const bool converged = cost - newCost <= ftol * cost || stepNorm <= xtol * xtol * (pNorm + xtol);
+        cost = newCost;
+        lambda = std::max(lambda * 0.1, 1e-12);
+        if (converged)
+        {
+            ++iter;
+            break;
+        };
+        // m_imgs contain already the new values
+        cost = data.calcResiduals(&x[0], &JtJ[0], &Jtx[0]);
+    };
+    data.FromX(p);
+    return iter;
+}
+
 void PhotometricOptimizer::optimizePhotometric(PanoramaData & pano, const OptimizeVector & vars,
                                                const std::vector<vigra_ext::PointPairRGB> & correspondences,
                                                const float imageStepSize,
@@ -307,8 +896,6 @@ void PhotometricOptimizer::optimizePhotometric(PanoramaData & pano, const Optimi
     int nMaxIter = 250;
     OptimData data(pano, photometricVars, correspondences, 5 * imageStepSize, false, nMaxIter, progress);
 
-    double info[LM_INFO_SZ];
-
     // parameters
     int m=data.m_vars.size();
     vigra::ArrayVector<double> p(m, 0.0);
@@ -325,18 +912,13 @@ void PhotometricOptimizer::optimizePhotometric(PanoramaData & pano, const Optimi
     printf("\n");
 #endif
 
-    // TODO: setup optimisation options with some good defaults.
-    double optimOpts[5];
-    
-    optimOpts[0] = LM_INIT_MU;  // init mu
-    // stop thresholds
-    optimOpts[1] = LM_STOP_THRESH;   // ||J^T e||_inf
-    optimOpts[2] = LM_STOP_THRESH;   // ||Dp||_2
-    optimOpts[3] = std::pow(imageStepSize*0.1f, 2);   // ||e||_2
-    // difference mode
-    optimOpts[4] = LM_DIFF_DELTA;
-    
-    dlevmar_dif(&photometricError, &photometricVis, &(p[0]), &(x[0]), m, n, nMaxIter, optimOpts, info, NULL,NULL, &data);  // no jacobian
+    // stop when the squared error is below the accuracy of the image values
+    const double errorThreshold = std::pow(imageStepSize*0.1f, 2);
+#ifdef DEBUG
+    const int iterations = runLevenbergMarquardt(data, &(p[0]), m, n, errorThreshold);
+#else
+    runLevenbergMarquardt(data, &(p[0]), m, n, errorThreshold);
+#endif
 
     // copy to source images (data.m_imgs)
     data.FromX(p.begin());
@@ -350,12 +932,9 @@ void PhotometricOptimizer::optimizePhotometric(PanoramaData & pano, const Optimi
     error = sqrt(error/n);
 
 #ifdef DEBUG
-    printf("Levenberg-Marquardt returned in %g iter, reason %g\nSolution: ", info[5], info[6]);
+    printf("Levenberg-Marquardt returned after %d iterations\nSolution: ", iterations);
     for(int i=0; i<m; ++i)
         printf("%.7g ", p[i]);
-    printf("\n\nMinimization info:\n");
-    for(int i=0; i<LM_INFO_SZ; ++i)
-        printf("%g ", info[i]);
     printf("\n");
 #endif
 
@@ -71,6 +71,42 @@ namespace HuginBase
                 std::set<unsigned> imgs;
             };
 
+            /** response curve, exposure, white balance and vignetting of an image together
+             *  with their derivatives for the photometric variables. The lookup tables of the
+             *  response curve are only recalculated when its parameters change. */
+            struct ImageResponse
+            {
+                ///
+                ImageResponse();
+
+                /// updates the cached values from the variables of img
+                void update(const SrcPanoImage& img);
+
+                /** calculates the vignetting factor at pos,
+                 *  deriv receives the derivatives for Va, Vb, Vc, Vd, Vx and Vy */
+                double calcVigFactor(const hugin_utils::FDiff2D& pos, double* deriv) const;
+
+                int responseType;
+                std::vector<float> emorParams;
+                double gamma;
+                /// monotonic response curve and its derivatives for the EMoR parameters
+                std::vector<double> lut;
+                std::vector<double> lutDeriv;
+                /// inverse response curve and its derivatives for the EMoR parameters
+                std::vector<double> invLut;
+                std::vector<double> invLutDeriv;
+                /// penalty for a non monotonic EMoR curve and its derivatives
+                double monotonicityError;
+                std::vector<double> monotonicityDeriv;
+
+                double exposure;
+                double whiteBalance[3];
+                bool radialVig;
+                double vigCoeff[4];
+                hugin_utils::FDiff2D vigCenter;
+                double radiusScale;
+            };
+
             ///
             struct OptimData
             {
@@ -85,6 +121,13 @@ namespace HuginBase
                 int m_maxIter;
                 AppBase::ProgressDisplay* m_progress;
 
+                std::vector<ImageResponse> m_responses;
+                /// index of the variable for each image and photometric variable, -1 if not optimized
+                std::vector<int> m_varIndex;
+                /// the samples sorted by image pair, m_pairStart contains the first sample of each pair
+                std::vector<size_t> m_sampleOrder;
+                std::vector<size_t> m_pairStart;
+
 
                 ///
                 OptimData(const PanoramaData& pano, const OptimizeVector& optvars,
@@ -97,6 +140,11 @@ namespace HuginBase
 
                 /// copy new values from x to into this->m_imgs
                 void FromX(double * x);
+
+                /** calculates the residuals x for the variables in m_imgs. If JtJ and Jtx are
+                 *  not NULL, also J^T J (m x m) and J^T x of the Jacobian J are calculated.
+                 *  @return the sum of the squared residuals */
+                double calcResiduals(double* x, double* JtJ, double* Jtx);
                 
             };
             
@@ -105,6 +153,19 @@ namespace HuginBase
             ///
             static void photometricError(double* p, double* x, int m, int n, void* data);
 
+            /** calculates the errors of the values valueTo in image to, when the values valueFrom
+             *  are transferred from image from into image to, and the derivatives of the errors
+             *  for the photometric variables of both images */
+            static void calcTransferError(const ImageResponse& from, const vigra::RGBValue<float>& valueFrom, const hugin_utils::FDiff2D& posFrom,
+                                          const ImageResponse& to, const vigra::RGBValue<float>& valueTo, const hugin_utils::FDiff2D& posTo,
+                                          double* error, double* derivFrom, double* derivTo);
+
+            /** minimizes the residuals with the Levenberg-Marquardt algorithm
+             *  @param p initial values of the variables, contains the solution
+             *  @param errorThreshold stop when the sum of the squared residuals drops below
+             *  @return number of iterations */
+            static int runLevenbergMarquardt(OptimData& data, double* p, int m, int n, double errorThreshold);
+
 
         public:
             ///
@@ -38,4 +38,58 @@ namespace hugin_utils
         return _gcd(abs(a), abs(b));
     }
 
+    bool choleskyDecompose(double* A, const size_t n)
+    {
+        for (size_t j = 0; j < n; ++j)
+        {
+            double* rowJ = A + j * n;
+            double sum = rowJ[j];
+            for (size_t k = 0; k < j; ++k)
+            {
+                sum -= rowJ[k] * rowJ[k];
+            };
+            if (sum <= 0.0)
+            {
+                return false;
+            };
+            rowJ[j] = std::sqrt(sum);
+            for (size_t i = j + 1; i < n; ++i)
+            {
+                double* rowI = A + i * n;
+                double s = rowI[j];
+                for (size_t k = 0; k < j; ++k)
+                {
+                    s -= rowI[k] * rowJ[k];
+                };
+                rowI[j] = s / rowJ[j];
+            };
+        };
+        return true;
+    }
+
+    void choleskySolve(const double* L, double* b, const size_t n)
+    {
+        // forward substitution L y = b
+        for (size_t i = 0; i < n; ++i)
+        {
+            const double* rowI = L + i * n;
+            double s = b[i];
+            for (size_t k = 0; k < i; ++k)
+            {
+                s -= rowI[k] * b[k];
+            };
+            b[i] = s / rowI[i];
+        };
+        // back substitution L^T x = y
+        for (size_t i = n; i-- > 0;)
+        {
+            double s = b[i];
+            for (size_t k = i + 1; k < n; ++k)
+            {
+                s -= L[k * n + i] * b[k];
+            };
+            b[i] = s / L[i * n + i];
+        };
+    }
+
 } // namespace
@@ -232,6 +232,14 @@ namespace hugin_utils
      *  both arguments should be >=0 */
     int IMPEX gcd(int a, int b);
 
+    /** decomposes the symmetric positive definite matrix A (n x n, row major) into L L^T,
+     *  L is stored in the lower triangle of A
+     *  @return false, if A is not positive definite */
+    bool IMPEX choleskyDecompose(double* A, const size_t n);
+
+    /** solves L L^T x = b with the decomposition of choleskyDecompose, b contains the solution */
+    void IMPEX choleskySolve(const double* L, double* b, const size_t n);
+
 } // namespace
 
 template <class T>
@@ -89,6 +89,11 @@ SmallRemappedImageCache::getRemapped(const PanoramaData& pano,
 
     MRemappedImage *remapped = new MRemappedImage;
     remapped->m_ICCProfile = *(e->iccProfile);
+    // the preview is usually much smaller than the source image,
+    // so sample from reduced versions of the source image
+    Nona::AdvancedOptions advOptions(m_advancedOptions);
+    Nona::SetAdvancedOption(advOptions, "pyramidSampling", true);
+    remapped->setAdvancedOptions(advOptions);
     SrcPanoImage srcPanoImg = pano.getSrcImage(imgNr);
     // adjust distortion parameters for small preview image
     srcPanoImg.resize(srcImgSize);
@@ -28,10 +28,20 @@
 #define _NONA_IMAGEREMAPPER_H
 
 
+#include <map>
+#include <deque>
+#include <memory>
+#include <future>
+#include <mutex>
+#include <algorithm>
+
 #include <panodata/PanoramaData.h>
 #include <nona/RemappedPanoImage.h>
 #include <vigra_ext/impexalpha.hxx>
 
+// default memory for prefetched source images (in MB)
+#define NONA_DEFAULT_PREFETCH_MEMORY 1024.0f
+
 namespace HuginBase {
 namespace Nona {
 
@@ -64,27 +74,57 @@ namespace Nona {
 
             ///
             virtual	void release(RemappedPanoImage<ImageType,AlphaType>* d) = 0;
+
+            /** returns true, if getRemapped and release can be called
+             *  concurrently from several threads */
+            virtual bool isThreadSafe() const
+            {
+                return false;
+            }
+
+            /** tell the remapper in which order the images will be requested
+             *  by getRemapped, images can occur several times. Remappers can
+             *  use this to load the next images in advance. */
+            virtual void setImageOrder(const PanoramaData & pano, const PanoramaOptions & opts, const UIntVector & images)
+            {
+            }
         protected:
             HuginBase::Nona::AdvancedOptions m_advancedOptions;
         
     };
 
 
-    /** functor to create a remapped image, loads image from disk */
+    /** functor to create a remapped image, loads image from disk.
+     *
+     *  If the advanced option prefetchImages is set and the image order is
+     *  known (see setImageOrder), the next images are decoded in background
+     *  threads while the current image is remapped. The number of images loaded
+     *  in advance is limited by the estimated memory of the decoded images
+     *  (advanced option prefetchMemory in MB).
+     */
     template <typename ImageType, typename AlphaType>
     class FileRemapper : public SingleImageRemapper<ImageType, AlphaType>
     {
         
     public:
-        FileRemapper() : SingleImageRemapper<ImageType, AlphaType>()
+        FileRemapper() : SingleImageRemapper<ImageType, AlphaType>(), m_prefetchMemory(0), m_extendWidth(false)
         {
-            m_remapped = 0;
         }
 
         virtual ~FileRemapper() {};
 
     typedef std::vector<float> LUT;
 
+        /** decoded source image with alpha channel and flatfield */
+        struct SourceImage
+        {
+            ImageType image;
+            AlphaType alpha;
+            vigra::BasicImage<float> flatfield;
+            vigra::ImageImportInfo::ICCProfile iccProfile;
+        };
+        typedef std::shared_ptr<SourceImage> SourceImagePtr;
+
 
     public:
         ///
@@ -103,10 +143,37 @@ namespace Nona {
         virtual void release(RemappedPanoImage<ImageType,AlphaType>* d)
             { delete d; }
 
+        /** each call loads and remaps its own image, so the images can be
+         *  remapped in parallel */
+        virtual bool isThreadSafe() const
+            { return true; }
 
-    protected:
-        RemappedPanoImage<ImageType,AlphaType> * m_remapped;
+        /** start loading the first images of the order in the background */
+        virtual void setImageOrder(const PanoramaData & pano, const PanoramaOptions & opts, const UIntVector & images);
+
+        /** load the source image, with alpha channel and flatfield
+         *  @param img image to load
+         *  @param extendWidth extend the width to a multiple of 8 (for the GPU)
+         *  @param progress progress display, can be NULL
+         */
+        static SourceImagePtr loadSourceImage(const SrcPanoImage & img, bool extendWidth, AppBase::ProgressDisplay* progress);
 
+    protected:
+        /** returns the prefetched source image or loads it now */
+        SourceImagePtr getSourceImage(const PanoramaData & pano, const PanoramaOptions & opts,
+                                      unsigned int imgNr, AppBase::ProgressDisplay* progress);
+        /** start loading the next images of the order, until the memory limit
+         *  is reached. m_prefetchMutex has to be locked by the caller. */
+        void startPrefetching();
+        /** estimated memory of the decoded image (in bytes) */
+        double getImageMemory(unsigned int imgNr) const;
+
+        std::mutex m_prefetchMutex;
+        std::deque<unsigned int> m_imageOrder;
+        std::map<unsigned int, SrcPanoImage> m_orderImages;
+        std::map<unsigned int, std::future<SourceImagePtr> > m_prefetched;
+        double m_prefetchMemory;
+        bool m_extendWidth;
     };
 
 
@@ -144,27 +211,13 @@ namespace Nona {
     
     
 template <typename ImageType, typename AlphaType>
-RemappedPanoImage<ImageType, AlphaType>*
-    FileRemapper<ImageType,AlphaType>::getRemapped(const PanoramaData & pano, const PanoramaOptions & opts,
-                              unsigned int imgNr, vigra::Rect2D outputROI,
-                              AppBase::ProgressDisplay* progress)
+typename FileRemapper<ImageType, AlphaType>::SourceImagePtr
+    FileRemapper<ImageType, AlphaType>::loadSourceImage(const SrcPanoImage & img, bool extendWidth,
+                                                        AppBase::ProgressDisplay* progress)
 {
     typedef typename ImageType::value_type PixelType;
-    
-    //typedef typename vigra::NumericTraits<PixelType>::RealPromote RPixelType;
-    //        typedef typename vigra::BasicImage<RPixelType> RImportImageType;
-    typedef typename vigra::BasicImage<float> FlatImgType;
-    
-    FlatImgType ffImg;
-    AlphaType srcAlpha;
-    
-    // choose image type...
-    const SrcPanoImage & img = pano.getImage(imgNr);
-    
-    vigra::Size2D destSize(opts.getWidth(), opts.getHeight());
-    
-    m_remapped = new RemappedPanoImage<ImageType, AlphaType>;
-    
+
+    SourceImagePtr src(new SourceImage);
     // load image
     
     vigra::ImageImportInfo info(img.getFilename().c_str());
@@ -172,32 +225,31 @@ RemappedPanoImage<ImageType, AlphaType>*
     int width = info.width();
     int height = info.height();
 
-    if (opts.remapUsingGPU) {
+    if (extendWidth) {
         // Extend image width to multiple of 8 for fast GPU transfers.
         const int r = width % 8;
         if (r != 0) width += 8 - r;
     }
 
-    ImageType srcImg(width, height);
-    m_remapped->m_ICCProfile = info.getICCProfile();
+    src->image.resize(width, height);
+    src->iccProfile = info.getICCProfile();
     
     if (info.numExtraBands() > 0) {
-        srcAlpha.resize(width, height);
+        src->alpha.resize(width, height);
     }
     //int nb = info.numBands() - info.numExtraBands();
     bool alpha = info.numExtraBands() > 0;
-    std::string type = info.getPixelType();
-    
-    SrcPanoImage src = pano.getSrcImage(imgNr);
     
     // import the image
-    progress->setMessage("loading", hugin_utils::stripPath(img.getFilename()));
+    if (progress) {
+        progress->setMessage("loading", hugin_utils::stripPath(img.getFilename()));
+    }
     
     if (alpha) {
-        vigra::importImageAlpha(info, vigra::destImage(srcImg),
-                                vigra::destImage(srcAlpha));
+        vigra::importImageAlpha(info, vigra::destImage(src->image),
+                                vigra::destImage(src->alpha));
     } else {
-        vigra::importImage(info, vigra::destImage(srcImg));
+        vigra::importImage(info, vigra::destImage(src->image));
     }
     // check if the image needs to be scaled to 0 .. 1,
     // this only works for int -> float, since the image
@@ -206,7 +258,7 @@ RemappedPanoImage<ImageType, AlphaType>*
     if (maxv != vigra_ext::LUTTraits<PixelType>::max()) {
         double scale = ((double)vigra_ext::LUTTraits<PixelType>::max()) /  maxv;
         //std::cout << "Scaling input image (pixel type: " << info.getPixelType() << " with: " << scale << std::endl;
-        transformImage(vigra::srcImageRange(srcImg), destImage(srcImg),
+        transformImage(vigra::srcImageRange(src->image), destImage(src->image),
                        vigra::functor::Arg1()*vigra::functor::Param(scale));
     }
     
@@ -214,22 +266,145 @@ RemappedPanoImage<ImageType, AlphaType>*
     if (img.getVigCorrMode() & SrcPanoImage::VIGCORR_FLATFIELD) {
         // load flatfield image.
         vigra::ImageImportInfo ffInfo(img.getFlatfieldFilename().c_str());
-        progress->setMessage("flatfield vignetting correction", hugin_utils::stripPath(img.getFilename()));
+        if (progress) {
+            progress->setMessage("flatfield vignetting correction", hugin_utils::stripPath(img.getFilename()));
+        }
         vigra_precondition(( ffInfo.numBands() == 1),
                            "flatfield vignetting correction: "
                            "Only single channel flatfield images are supported\n");
-        ffImg.resize(ffInfo.width(), ffInfo.height());
-        vigra::importImage(ffInfo, vigra::destImage(ffImg));
+        src->flatfield.resize(ffInfo.width(), ffInfo.height());
+        vigra::importImage(ffInfo, vigra::destImage(src->flatfield));
     }
-    m_remapped->setAdvancedOptions(SingleImageRemapper<ImageType, AlphaType>::m_advancedOptions);
+    return src;
+}
+
+template <typename ImageType, typename AlphaType>
+void FileRemapper<ImageType, AlphaType>::setImageOrder(const PanoramaData & pano, const PanoramaOptions & opts,
+                                                       const UIntVector & images)
+{
+    std::lock_guard<std::mutex> lock(m_prefetchMutex);
+    const AdvancedOptions& advOptions = SingleImageRemapper<ImageType, AlphaType>::m_advancedOptions;
+    m_prefetchMemory = 0;
+    if (GetAdvancedOption(advOptions, "prefetchImages", false))
+    {
+        m_prefetchMemory = GetAdvancedOption(advOptions, "prefetchMemory", NONA_DEFAULT_PREFETCH_MEMORY) * 1024.0 * 1024.0;
+    };
+    m_extendWidth = opts.remapUsingGPU;
+    m_imageOrder.clear();
+    m_orderImages.clear();
+    if (m_prefetchMemory > 0)
+    {
+        m_imageOrder.assign(images.begin(), images.end());
+        for (UIntVector::const_iterator it = images.begin(); it != images.end(); ++it)
+        {
+            m_orderImages[*it] = pano.getSrcImage(*it);
+        };
+    };
+    // drop images, which were loaded for an old order
+    for (typename std::map<unsigned int, std::future<SourceImagePtr> >::iterator it = m_prefetched.begin(); it != m_prefetched.end();)
+    {
+        if (std::find(m_imageOrder.begin(), m_imageOrder.end(), it->first) == m_imageOrder.end())
+        {
+            it = m_prefetched.erase(it);
+        }
+        else
+        {
+            ++it;
+        };
+    };
+    startPrefetching();
+}
+
+template <typename ImageType, typename AlphaType>
+void FileRemapper<ImageType, AlphaType>::startPrefetching()
+{
+    double usedMemory = 0;
+    for (typename std::map<unsigned int, std::future<SourceImagePtr> >::const_iterator it = m_prefetched.begin(); it != m_prefetched.end(); ++it)
+    {
+        usedMemory += getImageMemory(it->first);
+    };
+    for (std::deque<unsigned int>::const_iterator it = m_imageOrder.begin(); it != m_imageOrder.end(); ++it)
+    {
+        if (m_prefetched.find(*it) != m_prefetched.end())
+        {
+            continue;
+        };
+        const double imageMemory = getImageMemory(*it);
+        // load at least one image in advance, even if it is larger than the limit
+        if (usedMemory + imageMemory > m_prefetchMemory && !m_prefetched.empty())
+        {
+            break;
+        };
+        m_prefetched[*it] = std::async(std::launch::async, &FileRemapper<ImageType, AlphaType>::loadSourceImage,
+                                       m_orderImages[*it], m_extendWidth, static_cast<AppBase::ProgressDisplay*>(NULL));
+        usedMemory += imageMemory;
+    };
+}
+
+template <typename ImageType, typename AlphaType>
+double FileRemapper<ImageType, AlphaType>::getImageMemory(unsigned int imgNr) const
+{
+    typename std::map<unsigned int, SrcPanoImage>::const_iterator it = m_orderImages.find(imgNr);
+    if (it == m_orderImages.end())
+    {
+        return 0;
+    };
+    return static_cast<double>(it->second.getSize().area()) *
+        (sizeof(typename ImageType::value_type) + sizeof(typename AlphaType::value_type));
+}
+
+template <typename ImageType, typename AlphaType>
+typename FileRemapper<ImageType, AlphaType>::SourceImagePtr
+    FileRemapper<ImageType, AlphaType>::getSourceImage(const PanoramaData & pano, const PanoramaOptions & opts,
+                                                       unsigned int imgNr, AppBase::ProgressDisplay* progress)
+{
+    std::future<SourceImagePtr> prefetched;
+    {
+        std::lock_guard<std::mutex> lock(m_prefetchMutex);
+        std::deque<unsigned int>::iterator it = std::find(m_imageOrder.begin(), m_imageOrder.end(), imgNr);
+        if (it != m_imageOrder.end())
+        {
+            m_imageOrder.erase(it);
+        };
+        typename std::map<unsigned int, std::future<SourceImagePtr> >::iterator prefetchIt = m_prefetched.find(imgNr);
+        if (prefetchIt != m_prefetched.end() && opts.remapUsingGPU == m_extendWidth)
+        {
+            prefetched = std::move(prefetchIt->second);
+            m_prefetched.erase(prefetchIt);
+        };
+        // the memory of this image is free now for the next ones
+        startPrefetching();
+    }
+    if (prefetched.valid())
+    {
+        if (progress)
+        {
+            progress->setMessage("loading", hugin_utils::stripPath(pano.getImage(imgNr).getFilename()));
+        };
+        return prefetched.get();
+    };
+    return loadSourceImage(pano.getImage(imgNr), opts.remapUsingGPU, progress);
+}
+
+template <typename ImageType, typename AlphaType>
+RemappedPanoImage<ImageType, AlphaType>*
+    FileRemapper<ImageType,AlphaType>::getRemapped(const PanoramaData & pano, const PanoramaOptions & opts,
+                              unsigned int imgNr, vigra::Rect2D outputROI,
+                              AppBase::ProgressDisplay* progress)
+{
+    SourceImagePtr src = getSourceImage(pano, opts, imgNr, progress);
+
+    RemappedPanoImage<ImageType, AlphaType>* remapped = new RemappedPanoImage<ImageType, AlphaType>;
+    remapped->m_ICCProfile = src->iccProfile;
+    remapped->setAdvancedOptions(SingleImageRemapper<ImageType, AlphaType>::m_advancedOptions);
     // remap the image
     
-    remapImage(srcImg, srcAlpha, ffImg,
+    remapImage(src->image, src->alpha, src->flatfield,
                pano.getSrcImage(imgNr), opts,
                outputROI,
-               *m_remapped,
+               *remapped,
                progress);
-    return m_remapped;
+    return remapped;
 }
 
 
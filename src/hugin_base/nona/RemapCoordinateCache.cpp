@@ -0,0 +1,203 @@
+// -*- c-basic-offset: 4 -*-
+/** @file nona/RemapCoordinateCache.cpp
+ *
+ *  Persistent cache for the coordinate maps of the remapping
+ *
+ *  This is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public
+ *  License along with this software. If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "RemapCoordinateCache.h"
+
+#include <sstream>
+#include <iomanip>
+#include <vector>
+#include <cstdio>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <tiffio.h>
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+#include "hugin_utils/utils.h"
+
+namespace HuginBase
+{
+namespace Nona
+{
+
+std::string getCoordinateCacheKey(const SrcPanoImage& src, const PanoramaOptions& dest,
+                                  const vigra::Rect2D& rect, double tolerance)
+{
+    std::ostringstream key;
+    key << std::setprecision(17);
+    key << "hugin coordinate map 1" << std::endl;
+    // source image, same variables as used by PTools::Transform::createTransform
+    key << "src " << src.getSize().width() << " " << src.getSize().height() << " " << src.getProjection()
+        << " v" << src.getHFOV();
+    const std::vector<double> radialDist = src.getRadialDistortion();
+    key << " a" << radialDist[0] << " b" << radialDist[1] << " c" << radialDist[2]
+        << " d" << src.getRadialDistortionCenterShift().x << " e" << src.getRadialDistortionCenterShift().y
+        << " g" << src.getShear().x << " t" << src.getShear().y
+        << " r" << src.getRoll() << " p" << src.getPitch() << " y" << src.getYaw()
+        << " TrX" << src.getX() << " TrY" << src.getY() << " TrZ" << src.getZ()
+        << " Tpy" << src.getTranslationPlaneYaw() << " Tpp" << src.getTranslationPlanePitch() << std::endl;
+    // panorama
+    key << "dest " << dest.getWidth() << " " << dest.getHeight() << " " << dest.getProjection()
+        << " v" << dest.getHFOV();
+    const std::vector<double>& params = dest.getProjectionParameters();
+    for (size_t i = 0; i < params.size(); ++i)
+    {
+        key << " " << params[i];
+    };
+    key << std::endl;
+    key << "rect " << rect.left() << " " << rect.top() << " " << rect.width() << " " << rect.height() << std::endl;
+    key << "tolerance " << tolerance;
+    return key.str();
+};
+
+std::string getCoordinateCacheFilename(const std::string& cacheDir, const std::string& key)
+{
+    // 64 bit FNV-1a hash of the key, the full key is stored in the file
+    // and compared when reading, so collisions only cause a cache miss
+    unsigned long long hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < key.size(); ++i)
+    {
+        hash ^= static_cast<unsigned char>(key[i]);
+        hash *= 1099511628211ULL;
+    };
+    std::ostringstream filename;
+    filename << cacheDir;
+    if (!cacheDir.empty() && cacheDir[cacheDir.size() - 1] != '/' && cacheDir[cacheDir.size() - 1] != '\\')
+    {
+        filename << "/";
+    };
+    filename << "coords_" << std::hex << std::setfill('0') << std::setw(16) << hash << ".tif";
+    return filename.str();
+};
+
+bool loadCoordinateMap(const std::string& filename, const std::string& key, const vigra::Rect2D& rect,
+                       vigra_ext::CoordinateMap& map)
+{
+    if (!hugin_utils::FileExists(filename))
+    {
+        return false;
+    };
+    TIFF* tiff = TIFFOpen(filename.c_str(), "r");
+    if (tiff == NULL)
+    {
+        return false;
+    };
+    bool success = false;
+    char* description = NULL;
+    uint32 width = 0;
+    uint32 height = 0;
+    uint16 samplesPerPixel = 0;
+    uint16 bitsPerSample = 0;
+    uint16 sampleFormat = 0;
+    if (TIFFGetField(tiff, TIFFTAG_IMAGEDESCRIPTION, &description) && description != NULL && key == description &&
+        TIFFGetField(tiff, TIFFTAG_IMAGEWIDTH, &width) && TIFFGetField(tiff, TIFFTAG_IMAGELENGTH, &height) &&
+        TIFFGetFieldDefaulted(tiff, TIFFTAG_SAMPLESPERPIXEL, &samplesPerPixel) &&
+        TIFFGetFieldDefaulted(tiff, TIFFTAG_BITSPERSAMPLE, &bitsPerSample) &&
+        TIFFGetFieldDefaulted(tiff, TIFFTAG_SAMPLEFORMAT, &sampleFormat) &&
+        static_cast<int>(width) == rect.width() && static_cast<int>(height) == rect.height() &&
+        samplesPerPixel == 2 && bitsPerSample == 32 && sampleFormat == SAMPLEFORMAT_IEEEFP)
+    {
+        map.resize(rect);
+        success = true;
+        for (int y = 0; y < rect.height() && success; ++y)
+        {
+            success = TIFFReadScanline(tiff, map.getRow(y), y, 0) == 1;
+        };
+    };
+    TIFFClose(tiff);
+    if (!success)
+    {
+        map.resize(vigra::Rect2D());
+    };
+    return success;
+};
+
+/** returns a name for the temporary file, which is unique for each process, thread and call */
+static std::string getTempFilename(const std::string& filename)
+{
+    static std::atomic<unsigned int> counter(0);
+    std::ostringstream tempFilename;
+#ifdef _WIN32
+    tempFilename << filename << "." << _getpid();
+#else
+    tempFilename << filename << "." << getpid();
+#endif
+    tempFilename << "." << std::hash<std::thread::id>()(std::this_thread::get_id()) << "." << counter++ << ".part";
+    return tempFilename.str();
+}
+
+bool saveCoordinateMap(const std::string& filename, const std::string& key, const vigra_ext::CoordinateMap& map)
+{
+    const vigra::Rect2D& rect = map.getRect();
+    if (rect.isEmpty())
+    {
+        return false;
+    };
+    // write into a temporary file with a unique name first, so that concurrent runs
+    // and threads never write into the same file or see a partial file
+    const std::string tempFilename = getTempFilename(filename);
+    TIFF* tiff = TIFFOpen(tempFilename.c_str(), "w");
+    if (tiff == NULL)
+    {
+        return false;
+    };
+    const uint16 extraSample = EXTRASAMPLE_UNSPECIFIED;
+    TIFFSetField(tiff, TIFFTAG_IMAGEWIDTH, static_cast<uint32>(rect.width()));
+    TIFFSetField(tiff, TIFFTAG_IMAGELENGTH, static_cast<uint32>(rect.height()));
+    TIFFSetField(tiff, TIFFTAG_SAMPLESPERPIXEL, 2);
+    TIFFSetField(tiff, TIFFTAG_EXTRASAMPLES, 1, &extraSample);
+    TIFFSetField(tiff, TIFFTAG_BITSPERSAMPLE, 32);
+    TIFFSetField(tiff, TIFFTAG_SAMPLEFORMAT, SAMPLEFORMAT_IEEEFP);
+    TIFFSetField(tiff, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+    TIFFSetField(tiff, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISBLACK);
+    // neighbouring coordinates differ only slightly, the floating point
+    // predictor makes them compress well
+    TIFFSetField(tiff, TIFFTAG_COMPRESSION, COMPRESSION_ADOBE_DEFLATE);
+    TIFFSetField(tiff, TIFFTAG_PREDICTOR, PREDICTOR_FLOATINGPOINT);
+    TIFFSetField(tiff, TIFFTAG_ROWSPERSTRIP, TIFFDefaultStripSize(tiff, 0));
+    TIFFSetField(tiff, TIFFTAG_IMAGEDESCRIPTION, key.c_str());
+    // the predictor modifies the buffer, so copy each row
+    std::vector<float> row(2 * rect.width());
+    bool success = true;
+    for (int y = 0; y < rect.height() && success; ++y)
+    {
+        const float* mapRow = map.getRow(y);
+        std::copy(mapRow, mapRow + row.size(), row.begin());
+        success = TIFFWriteScanline(tiff, row.data(), y, 0) == 1;
+    };
+    TIFFClose(tiff);
+    if (success)
+    {
+        std::remove(filename.c_str());
+        success = std::rename(tempFilename.c_str(), filename.c_str()) == 0;
+    };
+    if (!success)
+    {
+        std::remove(tempFilename.c_str());
+    };
+    return success;
+};
+
+} // namespace Nona
+} // namespace HuginBase
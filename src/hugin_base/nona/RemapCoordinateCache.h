@@ -0,0 +1,64 @@
+// -*- c-basic-offset: 4 -*-
+/** @file nona/RemapCoordinateCache.h
+ *
+ *  Persistent cache for the coordinate maps of the remapping, so that
+ *  re-stitching with unchanged geometry can skip the coordinate transform.
+ *
+ *  This is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public
+ *  License along with this software. If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _NONA_REMAPCOORDINATECACHE_H
+#define _NONA_REMAPCOORDINATECACHE_H
+
+#include <string>
+#include <hugin_shared.h>
+#include <vigra/diff2d.hxx>
+#include <vigra_ext/CoordinateMap.h>
+#include <panodata/SrcPanoImage.h>
+#include <panodata/PanoramaOptions.h>
+
+namespace HuginBase
+{
+namespace Nona
+{
+
+/** returns a string which describes everything the coordinate transform of
+ *  the remapping depends on: the geometric variables, lens and size of the
+ *  source image, the projection, size and field of view of the panorama and
+ *  the remapped rectangle. Photometric variables are not included.
+ *  @param tolerance tolerance of the sparse grid transform, 0 for the exact transform
+ */
+IMPEX std::string getCoordinateCacheKey(const SrcPanoImage& src, const PanoramaOptions& dest,
+                                        const vigra::Rect2D& rect, double tolerance);
+
+/** returns the filename of the cache file for the given key in directory @p cacheDir */
+IMPEX std::string getCoordinateCacheFilename(const std::string& cacheDir, const std::string& key);
+
+/** read the coordinate map for rectangle @p rect from the cache file
+ *  @return true if the file exists and was created for the same @p key
+ */
+IMPEX bool loadCoordinateMap(const std::string& filename, const std::string& key, const vigra::Rect2D& rect,
+                             vigra_ext::CoordinateMap& map);
+
+/** write the coordinate map as compressed float TIFF into the cache
+ *  @return true if the file was written successfully
+ */
+IMPEX bool saveCoordinateMap(const std::string& filename, const std::string& key, const vigra_ext::CoordinateMap& map);
+
+} // namespace Nona
+} // namespace HuginBase
+
+#endif // _NONA_REMAPCOORDINATECACHE_H
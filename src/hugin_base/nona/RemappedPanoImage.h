@@ -33,9 +33,12 @@
 #include <vigra/flatmorphology.hxx>
 #include <vigra_ext/ROIImage.h>
 #include <vigra_ext/openmp_vigra.h>
+#include <vigra_ext/SparseGridTransform.h>
+#include <vigra_ext/CoordinateMap.h>
 
 #include <appbase/ProgressDisplay.h>
 #include <nona/StitcherOptions.h>
+#include <nona/RemapCoordinateCache.h>
 
 #include <panodata/SrcPanoImage.h>
 #include <panodata/Mask.h>
@@ -45,6 +48,11 @@
 // default values for exposure cutoff
 #define NONA_DEFAULT_EXPOSURE_LOWER_CUTOFF 1/255.0f
 #define NONA_DEFAULT_EXPOSURE_UPPER_CUTOFF 250/255.0f
+// default values for sparse grid transform
+#define NONA_DEFAULT_SPARSE_GRID_TOLERANCE 0.1f
+#define NONA_SPARSE_GRID_CELL_SIZE 16
+// size of the tiles for which the pyramid level is selected
+#define NONA_PYRAMID_SAMPLING_TILE_SIZE 64
 
 
 namespace HuginBase {
@@ -151,6 +159,53 @@ class RemappedPanoImage : public vigra_ext::ROIImage<RemapImage, AlphaImage>
                         vigra_ext::Interpolator interp,
                         AppBase::ProgressDisplay* progress, bool singleThreaded = false);
         
+    protected:
+        /** load the source coordinates of the remapped rectangle from the cache
+         *  directory given in the advanced option coordinateCache. If the cache
+         *  contains no map for the current geometry, the map is calculated and
+         *  stored in the cache.
+         *  @return false if no cache directory is set */
+        bool getCachedCoordinateMap(vigra_ext::CoordinateMap& map, bool singleThreaded);
+
+        /** remap the image on the cpu, uses the coordinate cache, the sparse grid
+         *  transform and the tabulated interpolator weights if requested in the
+         *  advanced options */
+        template <class ImgIter, class ImgAccessor, class PixelTransform>
+        void transformImageCPU(vigra::triple<ImgIter, ImgIter, ImgAccessor> srcImg,
+                               PixelTransform& pixelTransform,
+                               vigra_ext::Interpolator interp,
+                               AppBase::ProgressDisplay* progress, bool singleThreaded);
+
+        /** remap the image with alpha channel on the cpu, uses the coordinate cache,
+         *  the sparse grid transform and the tabulated interpolator weights if
+         *  requested in the advanced options */
+        template <class ImgIter, class ImgAccessor,
+                  class AlphaIter, class AlphaAccessor, class PixelTransform>
+        void transformImageAlphaCPU(vigra::triple<ImgIter, ImgIter, ImgAccessor> srcImg,
+                                    std::pair<AlphaIter, AlphaAccessor> alphaImg,
+                                    PixelTransform& pixelTransform,
+                                    vigra_ext::Interpolator interp,
+                                    AppBase::ProgressDisplay* progress, bool singleThreaded);
+
+        /** remap the image with the given transform, samples from a pyramid level
+         *  of the source image if requested in the advanced options */
+        template <class ImgIter, class ImgAccessor, class TRANSFORM, class PixelTransform>
+        void transformImageCPUIntern(vigra::triple<ImgIter, ImgIter, ImgAccessor> srcImg,
+                                     TRANSFORM& transform,
+                                     PixelTransform& pixelTransform,
+                                     vigra_ext::Interpolator interp,
+                                     AppBase::ProgressDisplay* progress, bool singleThreaded);
+
+        /** remap the image with alpha channel with the given transform, samples from
+         *  a pyramid level of the source image if requested in the advanced options */
+        template <class ImgIter, class ImgAccessor,
+                  class AlphaIter, class AlphaAccessor, class TRANSFORM, class PixelTransform>
+        void transformImageAlphaCPUIntern(vigra::triple<ImgIter, ImgIter, ImgAccessor> srcImg,
+                                          std::pair<AlphaIter, AlphaAccessor> alphaImg,
+                                          TRANSFORM& transform,
+                                          PixelTransform& pixelTransform,
+                                          vigra_ext::Interpolator interp,
+                                          AppBase::ProgressDisplay* progress, bool singleThreaded);
         
     public:
         ///
@@ -190,6 +245,7 @@ void remapImage(SrcImgType & srcImg,
 
 #include <photometric/ResponseTransform.h>
 #include <vigra_ext/ImageTransforms.h>
+#include <vigra_ext/PyramidTransform.h>
 #include <vigra_ext/ImageTransformsGPU.h>
 
 // #define DEBUG_REMAP 1
@@ -427,6 +483,183 @@ ImageType CopyImageNewSize(const ImageType& image, const vigra::Size2D& newSize)
     return newImage;
 };
 
+/** load or calculate the coordinate map */
+template<class RemapImage, class AlphaImage>
+bool RemappedPanoImage<RemapImage,AlphaImage>::getCachedCoordinateMap(vigra_ext::CoordinateMap& map, bool singleThreaded)
+{
+    const std::string cacheDir = Nona::GetAdvancedOption(m_advancedOptions, "coordinateCache", std::string());
+    if (cacheDir.empty() || Base::boundingBox().isEmpty())
+    {
+        return false;
+    };
+    const bool sparseGrid = Nona::GetAdvancedOption(m_advancedOptions, "sparseGridTransform", false);
+    const float tolerance = sparseGrid ? Nona::GetAdvancedOption(m_advancedOptions, "sparseGridTolerance", NONA_DEFAULT_SPARSE_GRID_TOLERANCE) : 0.0f;
+    const std::string key = getCoordinateCacheKey(m_srcImg, m_destImg, Base::boundingBox(), tolerance);
+    const std::string filename = getCoordinateCacheFilename(cacheDir, key);
+    if (loadCoordinateMap(filename, key, Base::boundingBox(), map))
+    {
+        return true;
+    };
+    if (sparseGrid)
+    {
+        vigra_ext::SparseGridTransform<PTools::Transform> gridTransf(m_transf, Base::boundingBox(), tolerance, NONA_SPARSE_GRID_CELL_SIZE, singleThreaded);
+        map.calculate(gridTransf, Base::boundingBox(), singleThreaded);
+    }
+    else
+    {
+        map.calculate(m_transf, Base::boundingBox(), singleThreaded);
+    };
+    // if the map can't be written, the next run calculates it again
+    saveCoordinateMap(filename, key, map);
+    return true;
+}
+
+/** remap the image on the cpu */
+template<class RemapImage, class AlphaImage>
+template<class ImgIter, class ImgAccessor, class PixelTransform>
+void RemappedPanoImage<RemapImage,AlphaImage>::transformImageCPU(vigra::triple<ImgIter, ImgIter, ImgAccessor> srcImg,
+                                                                 PixelTransform& pixelTransform,
+                                                                 vigra_ext::Interpolator interp,
+                                                                 AppBase::ProgressDisplay* progress, bool singleThreaded)
+{
+    vigra_ext::CoordinateMap coordMap;
+    if (getCachedCoordinateMap(coordMap, singleThreaded))
+    {
+        // the geometry was already remapped before, only resample the image
+        vigra_ext::CoordinateMapTransform<PTools::Transform> mapTransf(coordMap, m_transf);
+        transformImageCPUIntern(srcImg, mapTransf, pixelTransform, interp, progress, singleThreaded);
+    }
+    else if (Nona::GetAdvancedOption(m_advancedOptions, "sparseGridTransform", false))
+    {
+        // evaluate the exact transform only on a sparse grid and interpolate in between
+        const float tolerance = Nona::GetAdvancedOption(m_advancedOptions, "sparseGridTolerance", NONA_DEFAULT_SPARSE_GRID_TOLERANCE);
+        vigra_ext::SparseGridTransform<PTools::Transform> gridTransf(m_transf, Base::boundingBox(), tolerance, NONA_SPARSE_GRID_CELL_SIZE, singleThreaded);
+        transformImageCPUIntern(srcImg, gridTransf, pixelTransform, interp, progress, singleThreaded);
+    }
+    else
+    {
+        transformImageCPUIntern(srcImg, m_transf, pixelTransform, interp, progress, singleThreaded);
+    };
+}
+
+/** remap the image with alpha channel on the cpu */
+template<class RemapImage, class AlphaImage>
+template<class ImgIter, class ImgAccessor,
+         class AlphaIter, class AlphaAccessor, class PixelTransform>
+void RemappedPanoImage<RemapImage,AlphaImage>::transformImageAlphaCPU(vigra::triple<ImgIter, ImgIter, ImgAccessor> srcImg,
+                                                                      std::pair<AlphaIter, AlphaAccessor> alphaImg,
+                                                                      PixelTransform& pixelTransform,
+                                                                      vigra_ext::Interpolator interp,
+                                                                      AppBase::ProgressDisplay* progress, bool singleThreaded)
+{
+    vigra_ext::CoordinateMap coordMap;
+    if (getCachedCoordinateMap(coordMap, singleThreaded))
+    {
+        // the geometry was already remapped before, only resample the image
+        vigra_ext::CoordinateMapTransform<PTools::Transform> mapTransf(coordMap, m_transf);
+        transformImageAlphaCPUIntern(srcImg, alphaImg, mapTransf, pixelTransform, interp, progress, singleThreaded);
+    }
+    else if (Nona::GetAdvancedOption(m_advancedOptions, "sparseGridTransform", false))
+    {
+        // evaluate the exact transform only on a sparse grid and interpolate in between
+        const float tolerance = Nona::GetAdvancedOption(m_advancedOptions, "sparseGridTolerance", NONA_DEFAULT_SPARSE_GRID_TOLERANCE);
+        vigra_ext::SparseGridTransform<PTools::Transform> gridTransf(m_transf, Base::boundingBox(), tolerance, NONA_SPARSE_GRID_CELL_SIZE, singleThreaded);
+        transformImageAlphaCPUIntern(srcImg, alphaImg, gridTransf, pixelTransform, interp, progress, singleThreaded);
+    }
+    else
+    {
+        transformImageAlphaCPUIntern(srcImg, alphaImg, m_transf, pixelTransform, interp, progress, singleThreaded);
+    };
+}
+
+/** remap the image with the given transform */
+template<class RemapImage, class AlphaImage>
+template<class ImgIter, class ImgAccessor, class TRANSFORM, class PixelTransform>
+void RemappedPanoImage<RemapImage,AlphaImage>::transformImageCPUIntern(vigra::triple<ImgIter, ImgIter, ImgAccessor> srcImg,
+                                                                       TRANSFORM& transform,
+                                                                       PixelTransform& pixelTransform,
+                                                                       vigra_ext::Interpolator interp,
+                                                                       AppBase::ProgressDisplay* progress, bool singleThreaded)
+{
+    const bool tabulatedWeights = Nona::GetAdvancedOption(m_advancedOptions, "tabulatedInterpolation", false);
+    if (Nona::GetAdvancedOption(m_advancedOptions, "pyramidSampling", false))
+    {
+        // sample from a reduced version of the source image where the image is scaled down
+        vigra_ext::transformImagePyramid(srcImg,
+                                         destImageRange(Base::m_image),
+                                         destImage(Base::m_mask),
+                                         Base::boundingBox().upperLeft(),
+                                         transform,
+                                         pixelTransform,
+                                         m_srcImg.horizontalWarpNeeded(),
+                                         interp,
+                                         progress,
+                                         singleThreaded,
+                                         tabulatedWeights,
+                                         NONA_PYRAMID_SAMPLING_TILE_SIZE);
+    }
+    else
+    {
+        vigra_ext::transformImage(srcImg,
+                                  destImageRange(Base::m_image),
+                                  destImage(Base::m_mask),
+                                  Base::boundingBox().upperLeft(),
+                                  transform,
+                                  pixelTransform,
+                                  m_srcImg.horizontalWarpNeeded(),
+                                  interp,
+                                  progress,
+                                  singleThreaded,
+                                  tabulatedWeights);
+    };
+}
+
+/** remap the image with alpha channel with the given transform */
+template<class RemapImage, class AlphaImage>
+template<class ImgIter, class ImgAccessor,
+         class AlphaIter, class AlphaAccessor, class TRANSFORM, class PixelTransform>
+void RemappedPanoImage<RemapImage,AlphaImage>::transformImageAlphaCPUIntern(vigra::triple<ImgIter, ImgIter, ImgAccessor> srcImg,
+                                                                            std::pair<AlphaIter, AlphaAccessor> alphaImg,
+                                                                            TRANSFORM& transform,
+                                                                            PixelTransform& pixelTransform,
+                                                                            vigra_ext::Interpolator interp,
+                                                                            AppBase::ProgressDisplay* progress, bool singleThreaded)
+{
+    const bool tabulatedWeights = Nona::GetAdvancedOption(m_advancedOptions, "tabulatedInterpolation", false);
+    if (Nona::GetAdvancedOption(m_advancedOptions, "pyramidSampling", false))
+    {
+        // sample from a reduced version of the source image where the image is scaled down
+        vigra_ext::transformImageAlphaPyramid(srcImg,
+                                              alphaImg,
+                                              destImageRange(Base::m_image),
+                                              destImage(Base::m_mask),
+                                              Base::boundingBox().upperLeft(),
+                                              transform,
+                                              pixelTransform,
+                                              m_srcImg.horizontalWarpNeeded(),
+                                              interp,
+                                              progress,
+                                              singleThreaded,
+                                              tabulatedWeights,
+                                              NONA_PYRAMID_SAMPLING_TILE_SIZE);
+    }
+    else
+    {
+        vigra_ext::transformImageAlpha(srcImg,
+                                       alphaImg,
+                                       destImageRange(Base::m_image),
+                                       destImage(Base::m_mask),
+                                       Base::boundingBox().upperLeft(),
+                                       transform,
+                                       pixelTransform,
+                                       m_srcImg.horizontalWarpNeeded(),
+                                       interp,
+                                       progress,
+                                       singleThreaded,
+                                       tabulatedWeights);
+    };
+}
+
 /** remap a image without alpha channel*/
 template<class RemapImage, class AlphaImage>
 template<class ImgIter, class ImgAccessor>
@@ -566,17 +799,7 @@ void RemappedPanoImage<RemapImage,AlphaImage>::remapImage(vigra::triple<ImgIter,
                 Base::m_region = newBoundingBox;
             };
         } else {
-            transformImageAlpha(srcImg,
-                                vigra::srcImage(alpha),
-                                destImageRange(Base::m_image),
-                                destImage(Base::m_mask),
-                                Base::boundingBox().upperLeft(),
-                                m_transf,
-                                invResponse,
-                                m_srcImg.horizontalWarpNeeded(),
-                                interpol,
-                                progress,
-                                singleThreaded);
+            transformImageAlphaCPU(srcImg, vigra::srcImage(alpha), invResponse, interpol, progress, singleThreaded);
         }
     } else {
         if (useGPU) {
@@ -620,16 +843,7 @@ void RemappedPanoImage<RemapImage,AlphaImage>::remapImage(vigra::triple<ImgIter,
                 Base::m_region = newBoundingBox;
             };
         } else {
-            transformImage(srcImg,
-                           destImageRange(Base::m_image),
-                           destImage(Base::m_mask),
-                           Base::boundingBox().upperLeft(),
-                           m_transf,
-                           invResponse,
-                           m_srcImg.horizontalWarpNeeded(),
-                           interpol,
-                           progress,
-                           singleThreaded);
+            transformImageCPU(srcImg, invResponse, interpol, progress, singleThreaded);
         }
     }
 }
@@ -761,17 +975,7 @@ void RemappedPanoImage<RemapImage,AlphaImage>::remapImage(vigra::triple<ImgIter,
                 Base::m_region = newBoundingBox;
             };
         } else {
-            vigra_ext::transformImageAlpha(srcImg,
-                                           vigra::srcImage(alpha),
-                                           destImageRange(Base::m_image),
-                                           destImage(Base::m_mask),
-                                           Base::boundingBox().upperLeft(),
-                                           m_transf,
-                                           invResponse,
-                                           m_srcImg.horizontalWarpNeeded(),
-                                           interp,
-                                           progress,
-                                           singleThreaded);
+            transformImageAlphaCPU(srcImg, vigra::srcImage(alpha), invResponse, interp, progress, singleThreaded);
         }
     } else {
         if (useGPU) {
@@ -796,17 +1000,7 @@ void RemappedPanoImage<RemapImage,AlphaImage>::remapImage(vigra::triple<ImgIter,
                 Base::m_region = newBoundingBox;
             };
         } else {
-            vigra_ext::transformImageAlpha(srcImg,
-                                           alphaImg,
-                                           destImageRange(Base::m_image),
-                                           destImage(Base::m_mask),
-                                           Base::boundingBox().upperLeft(),
-                                           m_transf,
-                                           invResponse,
-                                           m_srcImg.horizontalWarpNeeded(),
-                                           interp,
-                                           progress,
-                                           singleThreaded);
+            transformImageAlphaCPU(srcImg, alphaImg, invResponse, interp, progress, singleThreaded);
         }
     }
 }
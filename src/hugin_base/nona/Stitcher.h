@@ -35,6 +35,14 @@
 #include <utility>
 #include <cctype>
 #include <algorithm>
+#include <stdexcept>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #include <vigra/stdimage.hxx>
 #include <vigra/rgbvalue.hxx>
@@ -46,6 +54,7 @@
 
 #include <vigra_ext/StitchWatershed.h>
 #include <vigra_ext/tiffUtils.h>
+#include <ImfRgbaFile.h>
 #include <vigra_ext/ImageTransforms.h>
 
 #include <panodata/PanoramaData.h>
@@ -55,6 +64,12 @@
 #include <nona/StitcherOptions.h>
 #include <algorithms/basic/LayerStacks.h>
 
+// size of the tiles in tiled tiff files
+#define NONA_TIFF_TILE_SIZE 256
+// overlap between the regions when stitching region by region, reduces
+// but does not avoid seam mismatches at the region borders
+#define NONA_TILED_STITCHING_OVERLAP 64
+
 // somehow these are still
 #undef DIFFERENCE
 #undef min
@@ -111,6 +126,26 @@ protected:
         m_rois = HuginBase::ComputeImageROI::computeROIS(m_pano, opts, images);
     }
 
+    /** returns the order in which the images are remapped, when the regions
+     *  are processed one after another and for each region all images, which
+     *  intersect it, are remapped */
+    UIntVector getRegionImageOrder(const UIntSet & images, const std::vector<vigra::Rect2D> & regions) const
+    {
+        UIntVector order;
+        for (size_t r = 0; r < regions.size(); ++r)
+        {
+            size_t i = 0;
+            for (UIntSet::const_iterator it = images.begin(); it != images.end(); ++it, ++i)
+            {
+                if (!(m_rois[i] & regions[r]).isEmpty())
+                {
+                    order.push_back(*it);
+                };
+            };
+        };
+        return order;
+    }
+
     const PanoramaData & m_pano;
     AppBase::ProgressDisplay* m_progress;
     UIntSet m_images;
@@ -119,12 +154,58 @@ protected:
 
 namespace detail
 {
+    /** write the image into a tiled tiff, which covers @p roi of the panorama.
+     *  Only one tile is kept in memory, tiles outside of @p imageRect are
+     *  written as empty tiles.
+     *  @return false if writing failed
+     */
+    template<typename ImageType, typename AlphaType, typename TiffWriter>
+    bool writeTiledCanvas(const ImageType& image, const AlphaType& mask, const vigra::Rect2D& imageRect,
+        const vigra::Rect2D& roi, TiffWriter& writer)
+    {
+        const int tileSize = writer.getTileSize();
+        ImageType tileImage(tileSize, tileSize);
+        AlphaType tileMask(tileSize, tileSize);
+        for (int y = roi.top(); y < roi.bottom(); y += tileSize)
+        {
+            for (int x = roi.left(); x < roi.right(); x += tileSize)
+            {
+                const vigra::Rect2D tile = vigra::Rect2D(vigra::Point2D(x, y), vigra::Size2D(tileSize, tileSize)) & roi;
+                const vigra::Rect2D overlap = tile & imageRect;
+                const vigra::Point2D pos(tile.upperLeft() - roi.upperLeft());
+                if (overlap.isEmpty())
+                {
+                    if (!writer.writeEmptyRegion(vigra::Rect2D(pos, tile.size())))
+                    {
+                        return false;
+                    };
+                    continue;
+                };
+                tileImage.init(vigra::NumericTraits<typename ImageType::value_type>::zero());
+                tileMask.init(vigra::NumericTraits<typename AlphaType::value_type>::zero());
+                const vigra::Diff2D srcOffset(overlap.upperLeft() - imageRect.upperLeft());
+                const vigra::Diff2D destOffset(overlap.upperLeft() - tile.upperLeft());
+                vigra::copyImage(image.upperLeft() + srcOffset, image.upperLeft() + srcOffset + overlap.size(), image.accessor(),
+                    tileImage.upperLeft() + destOffset, tileImage.accessor());
+                vigra::copyImage(mask.upperLeft() + srcOffset, mask.upperLeft() + srcOffset + overlap.size(), mask.accessor(),
+                    tileMask.upperLeft() + destOffset, tileMask.accessor());
+                if (!writer.writeRegion(vigra::make_triple(tileImage.upperLeft(), tileImage.upperLeft() + tile.size(), tileImage.accessor()),
+                    vigra::srcImage(tileMask), pos))
+                {
+                    return false;
+                };
+            };
+        };
+        return true;
+    };
+
     template<typename ImageType, typename AlphaType>
     void saveRemapped(RemappedPanoImage<ImageType, AlphaType> & remapped,
         unsigned int imgNr, unsigned int nImg,
         const PanoramaOptions & opts,
         const std::string& basename,
         const bool useBigTIFF,
+        const double maxMemory,
         AppBase::ProgressDisplay* progress)
     {
         ImageType * final_img = 0;
@@ -167,10 +248,40 @@ namespace detail
             remapped.calcAlpha();
         }
 
+        std::string ext = opts.getOutputExtension();
+        typedef typename vigra_ext::TiffPixelChannels<typename ImageType::value_type>::component_type ComponentType;
+        // memory of the remapped image and of the full canvas with 8 bit mask
+        const double pixelSize = sizeof(typename ImageType::value_type) + sizeof(vigra::UInt8);
+        const double canvasMemory = (static_cast<double>(remapped.boundingBox().area()) + opts.getROI().area()) * pixelSize;
+        if (maxMemory > 0 && canvasMemory > maxMemory &&
+            !opts.tiff_saveROI && ext == "tif" &&
+            (opts.outputPixelType.empty() || opts.outputPixelType == vigra_ext::TiffAlphaTraits<ComponentType>::pixelType()))
+        {
+            // the full canvas does not fit into the given memory, write a tiled
+            // tiff, so that only a single tile of the canvas needs to be kept in memory
+            std::ostringstream filename;
+            filename << basename << std::setfill('0') << std::setw(4) << imgNr << "." + ext;
+            progress->setMessage("saving", hugin_utils::stripPath(filename.str()));
+            vigra::TiffImage * tiff = TIFFOpen(filename.str().c_str(), useBigTIFF ? "w8" : "w");
+            if (tiff == NULL)
+            {
+                throw std::runtime_error("Could not open " + filename.str() + " for writing");
+            };
+            vigra_ext::createTiffDirectory(tiff, hugin_utils::stripPath(filename.str()), basename, opts.tiffCompression,
+                1, 1, opts.getROI().upperLeft(), vigra::Size2D(opts.getWidth(), opts.getHeight()), remapped.m_ICCProfile);
+            vigra_ext::TiledAlphaTiffWriter<typename ImageType::value_type> writer(tiff, opts.getROI().size(), NONA_TIFF_TILE_SIZE);
+            const bool success = writeTiledCanvas(remapped.m_image, remapped.m_mask, remapped.boundingBox(), opts.getROI(), writer);
+            TIFFClose(tiff);
+            if (!success)
+            {
+                throw std::runtime_error("Error writing " + filename.str());
+            };
+            return;
+        };
+
         if (!opts.tiff_saveROI)
         {
-            // FIXME: this is stupid. Should not require space for full image...
-            // but this would need a lower level interface in vigra impex
+            // the full canvas is created, if it fits into memory or the format does not support tiled writing
             complete.resize(opts.getROI().size());
             alpha.resize(opts.getROI().size());
             vigra::Rect2D newOutRect = remapped.boundingBox() & opts.getROI();
@@ -194,7 +305,6 @@ namespace detail
             alpha_img = &remapped.m_mask;
         }
 
-        std::string ext = opts.getOutputExtension();
         std::ostringstream filename;
         filename << basename << std::setfill('0') << std::setw(4) << imgNr << "." + ext;
 
@@ -281,36 +391,39 @@ public:
         // setup the output.
         prepareOutputFile(opts, advOptions);
 
-        // remap each image and save
-        int i=0;
-        for (UIntSet::const_iterator it = images.begin();
-             it != images.end(); ++it)
+        if (GetAdvancedOption(advOptions, "parallelRemapping", false) && !opts.remapUsingGPU &&
+            remapper.isThreadSafe() && images.size() > 1)
         {
-            // get a remapped image.
-            PanoramaOptions modOptions(opts);
-            if (GetAdvancedOption(advOptions, "ignoreExposure", false))
+            stitchParallel(opts, images, remapper, advOptions);
+        }
+        else
+        {
+            remapper.setImageOrder(Base::m_pano, opts, UIntVector(images.begin(), images.end()));
+            // remap each image and save
+            int i=0;
+            for (UIntSet::const_iterator it = images.begin();
+                 it != images.end(); ++it)
             {
-                modOptions.outputExposureValue = Base::m_pano.getImage(*it).getExposureValue();
-                modOptions.outputRangeCompression = 0.0;
-            };
-            RemappedPanoImage<ImageType, AlphaType> *
-                remapped = remapper.getRemapped(Base::m_pano, modOptions, *it, 
-                                                Base::m_rois[i], Base::m_progress);
-            try {
-                saveRemapped(*remapped, *it, Base::m_pano.getNrOfImages(), opts, advOptions);
-            } catch (vigra::PreconditionViolation & e) {
-                // this can be thrown, if an image
-                // is completely out of the pano
-                std::cerr << e.what();
+                // get a remapped image.
+                RemappedPanoImage<ImageType, AlphaType> *
+                    remapped = remapper.getRemapped(Base::m_pano, getImageOptions(opts, *it, advOptions), *it,
+                                                    Base::m_rois[i], Base::m_progress);
+                saveRemappedImage(*remapped, *it, opts, advOptions, Base::m_progress);
+                // free remapped image
+                remapper.release(remapped);
+                i++;
             }
-            // free remapped image
-            remapper.release(remapped);
-            i++;
-        }
+        };
         finalizeOutputFile(opts);
         Base::m_progress->taskFinished();
     }
 
+    /** returns true, if saveRemapped can be called concurrently for different images */
+    virtual bool canSaveInParallel() const
+    {
+        return true;
+    }
+
     /** prepare the output file (setup file structures etc.) */
     virtual void prepareOutputFile(const PanoramaOptions & opts, const AdvancedOptions& advOptions)
     {
@@ -321,15 +434,17 @@ public:
     virtual void saveRemapped(RemappedPanoImage<ImageType, AlphaType> & remapped,
                               unsigned int imgNr, unsigned int nImg,
                               const PanoramaOptions & opts,
-                              const AdvancedOptions& advOptions)
+                              const AdvancedOptions& advOptions,
+                              AppBase::ProgressDisplay* progress)
     {
-        detail::saveRemapped(remapped, imgNr, nImg, opts, m_basename, GetAdvancedOption(advOptions, "useBigTIFF", false), Base::m_progress);
+        detail::saveRemapped(remapped, imgNr, nImg, opts, m_basename, GetAdvancedOption(advOptions, "useBigTIFF", false),
+            GetAdvancedOption(advOptions, "maxMemory", 0.0f) * 1024.0 * 1024.0, progress);
 
         if (opts.saveCoordImgs) {
             vigra::UInt16Image xImg;
             vigra::UInt16Image yImg;
 
-            Base::m_progress->setMessage("creating coordinate images");
+            progress->setMessage("creating coordinate images");
 
             remapped.calcSrcCoordImgs(xImg, yImg);
             vigra::UInt16Image dist;
@@ -384,6 +499,215 @@ public:
     }
 
 protected:
+    /** returns the output options for the given image */
+    PanoramaOptions getImageOptions(const PanoramaOptions & opts, unsigned int imgNr, const AdvancedOptions& advOptions) const
+    {
+        PanoramaOptions modOptions(opts);
+        if (GetAdvancedOption(advOptions, "ignoreExposure", false))
+        {
+            modOptions.outputExposureValue = Base::m_pano.getImage(imgNr).getExposureValue();
+            modOptions.outputRangeCompression = 0.0;
+        };
+        return modOptions;
+    }
+
+    /** save the remapped image, ignores images which are outside the panorama */
+    void saveRemappedImage(RemappedPanoImage<ImageType, AlphaType> & remapped, unsigned int imgNr,
+                           const PanoramaOptions & opts, const AdvancedOptions& advOptions,
+                           AppBase::ProgressDisplay* progress)
+    {
+        try {
+            saveRemapped(remapped, imgNr, Base::m_pano.getNrOfImages(), opts, advOptions, progress);
+        } catch (vigra::PreconditionViolation & e) {
+            // this can be thrown, if an image
+            // is completely out of the pano
+            std::cerr << e.what();
+        }
+    }
+
+    /** estimate the memory needed for loading and remapping the given image (in bytes) */
+    double estimateMemory(unsigned int imgNr, const vigra::Rect2D & roi) const
+    {
+        const double bytesPerPixel = sizeof(typename ImageType::value_type) + sizeof(typename AlphaType::value_type);
+        // the source image and the remapped image are kept in memory
+        return (static_cast<double>(Base::m_pano.getImage(imgNr).getSize().area()) + roi.area()) * bytesPerPixel;
+    }
+
+    /** remap the images with a pool of worker threads.
+     *
+     *  Each worker loads and remaps a different image, so loading, remapping
+     *  and saving of consecutive images overlap. The remapping itself uses
+     *  only a share of the cores in each worker. If the images can be saved
+     *  in parallel, the workers save them directly, otherwise the calling
+     *  thread saves them in the order of @p images. The number of images in
+     *  flight is bounded by twice the number of workers and by the advanced
+     *  option maxMemory (in MB), but at least one image is always processed.
+     *
+     *  The progress display is only used from the calling thread.
+     */
+    void stitchParallel(const PanoramaOptions & opts, const UIntSet & images,
+                        SingleImageRemapper<ImageType, AlphaType> & remapper,
+                        const AdvancedOptions& advOptions)
+    {
+        typedef RemappedPanoImage<ImageType, AlphaType> RemappedImage;
+        const std::vector<unsigned int> imgNrs(images.begin(), images.end());
+        const size_t nImages = imgNrs.size();
+        const bool parallelSave = canSaveInParallel();
+
+        const unsigned int cores = std::max(1u, std::thread::hardware_concurrency());
+        unsigned int nrWorkers = static_cast<unsigned int>(std::max(0.0f, GetAdvancedOption(advOptions, "remapWorkers", 0.0f)));
+        if (nrWorkers == 0)
+        {
+            // loading and saving are single threaded, so use more workers than
+            // needed for the remapping alone
+            nrWorkers = std::max(2u, cores / 2);
+        };
+        nrWorkers = static_cast<unsigned int>(std::min<size_t>(nrWorkers, nImages));
+        const int threadsPerWorker = std::max(1u, cores / nrWorkers);
+        const size_t maxInFlight = 2 * nrWorkers;
+        const double maxMemory = GetAdvancedOption(advOptions, "maxMemory", 0.0f) * 1024.0 * 1024.0;
+
+        std::vector<double> memory(nImages);
+        for (size_t i = 0; i < nImages; ++i)
+        {
+            memory[i] = estimateMemory(imgNrs[i], Base::m_rois[i]);
+        };
+        std::vector<RemappedImage*> remappedImages(nImages, NULL);
+        std::vector<char> finished(nImages, 0);
+        size_t nextImage = 0;
+        size_t inFlight = 0;
+        double usedMemory = 0;
+        std::exception_ptr error;
+        std::mutex mutex;
+        std::condition_variable cond;
+
+        // remember the first error and stop all workers
+        auto setError = [&](std::exception_ptr e)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!error)
+            {
+                error = e;
+            };
+            cond.notify_all();
+        };
+        // image is finished, free the reserved resources
+        auto releaseImage = [&](size_t index)
+        {
+            --inFlight;
+            usedMemory -= memory[index];
+        };
+
+        auto worker = [&]()
+        {
+#ifdef _OPENMP
+            omp_set_num_threads(threadsPerWorker);
+#endif
+            AppBase::DummyProgressDisplay progress;
+            while (true)
+            {
+                size_t index;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    cond.wait(lock, [&]()
+                    {
+                        return error || nextImage >= nImages || inFlight == 0 ||
+                            (inFlight < maxInFlight && (maxMemory <= 0 || usedMemory + memory[nextImage] <= maxMemory));
+                    });
+                    if (error || nextImage >= nImages)
+                    {
+                        break;
+                    };
+                    index = nextImage++;
+                    ++inFlight;
+                    usedMemory += memory[index];
+                }
+                RemappedImage* remapped = NULL;
+                try
+                {
+                    remapped = remapper.getRemapped(Base::m_pano, getImageOptions(opts, imgNrs[index], advOptions),
+                                                    imgNrs[index], Base::m_rois[index], &progress);
+                    if (parallelSave)
+                    {
+                        saveRemappedImage(*remapped, imgNrs[index], opts, advOptions, &progress);
+                        remapper.release(remapped);
+                        remapped = NULL;
+                    };
+                }
+                catch (...)
+                {
+                    if (remapped)
+                    {
+                        remapper.release(remapped);
+                    };
+                    setError(std::current_exception());
+                    break;
+                }
+                std::lock_guard<std::mutex> lock(mutex);
+                remappedImages[index] = remapped;
+                finished[index] = 1;
+                if (parallelSave)
+                {
+                    releaseImage(index);
+                };
+                cond.notify_all();
+            }
+        };
+
+        std::vector<std::thread> workers;
+        for (unsigned int i = 0; i < nrWorkers; ++i)
+        {
+            workers.push_back(std::thread(worker));
+        };
+        // report the progress and save the images in order
+        for (size_t i = 0; i < nImages; ++i)
+        {
+            RemappedImage* remapped;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cond.wait(lock, [&]() { return error || finished[i]; });
+                if (error)
+                {
+                    break;
+                };
+                remapped = remappedImages[i];
+                remappedImages[i] = NULL;
+            }
+            Base::m_progress->setMessage("remapped", hugin_utils::stripPath(Base::m_pano.getImage(imgNrs[i]).getFilename()));
+            if (remapped)
+            {
+                try
+                {
+                    saveRemappedImage(*remapped, imgNrs[i], opts, advOptions, Base::m_progress);
+                }
+                catch (...)
+                {
+                    setError(std::current_exception());
+                }
+                remapper.release(remapped);
+                std::lock_guard<std::mutex> lock(mutex);
+                releaseImage(i);
+                cond.notify_all();
+            };
+        };
+        for (size_t i = 0; i < workers.size(); ++i)
+        {
+            workers[i].join();
+        };
+        // free images, which were not saved because of an error
+        for (size_t i = 0; i < nImages; ++i)
+        {
+            if (remappedImages[i])
+            {
+                remapper.release(remappedImages[i]);
+            };
+        };
+        if (error)
+        {
+            std::rethrow_exception(error);
+        };
+    }
+
     std::string m_basename;
 };
 
@@ -415,11 +739,18 @@ public:
         DEBUG_ASSERT(m_tiff && "could not open tiff output file");
     }
 
+    /** all layers are written into the same file, so they are saved in order */
+    virtual bool canSaveInParallel() const
+    {
+        return false;
+    }
+
     /** save the remapped image in a partial tiff layer */
     virtual void saveRemapped(RemappedPanoImage<ImageType, AlphaImageType> & remapped,
                               unsigned int imgNr, unsigned int nImg,
                               const PanoramaOptions & opts,
-                              const AdvancedOptions& advOptions)
+                              const AdvancedOptions& advOptions,
+                              AppBase::ProgressDisplay* progress)
     {
         if (remapped.boundingBox().isEmpty())
            return;
@@ -488,6 +819,7 @@ public:
         {
             images = HuginBase::getEstimatedBlendingOrder(Base::m_pano, imgSet, opts.colorReferenceImage);
         };
+        remapper.setImageOrder(Base::m_pano, opts, images);
         for (UIntVector::const_iterator it = images.begin(); it != images.end(); ++it)
         {
             // get a remapped image.
@@ -515,7 +847,8 @@ public:
                 {
                     finalFilename.append(suffix);
                 };
-                detail::saveRemapped(*remapped, *it, nImg, modOptions, finalFilename, GetAdvancedOption(advOptions, "useBigTIFF", false), Base::m_progress);
+                detail::saveRemapped(*remapped, *it, nImg, modOptions, finalFilename, GetAdvancedOption(advOptions, "useBigTIFF", false),
+                    GetAdvancedOption(advOptions, "maxMemory", 0.0f) * 1024.0 * 1024.0, Base::m_progress);
             }
             Base::m_progress->setMessage("blending", hugin_utils::stripPath(Base::m_pano.getImage(*it).getFilename()));
             // add image to pano and panoalpha, adjusts panoROI as well.
@@ -547,24 +880,29 @@ public:
     {
         Base::stitch(opts, imgSet, filename, remapper);
 
-        std::string basename = filename;
+        const double maxMemory = GetAdvancedOption(advOptions, "maxMemory", 0.0f) * 1024.0 * 1024.0;
+        typedef typename vigra_ext::TiffPixelChannels<typename ImageType::value_type>::component_type ComponentType;
+        // the tiled tiff is written without conversion, so the output pixel type must match
+        // the seams of the tiled stitching differ from the full canvas, so it has to be enabled explicitly
+        if (maxMemory > 0 && GetAdvancedOption(advOptions, "tiledStitching", false) && opts.outputFormat == PanoramaOptions::TIFF &&
+            (opts.outputPixelType.empty() || opts.outputPixelType == vigra_ext::TiffAlphaTraits<ComponentType>::pixelType()) &&
+            GetAdvancedOption(advOptions, "hardSeam", true) &&
+            !GetAdvancedOption(advOptions, "saveIntermediateImages", false) &&
+            estimateMemory(opts, imgSet, vigra::Rect2D(0, 0, opts.getWidth(), opts.getHeight())) > maxMemory)
+        {
+            // the full canvas does not fit into the given memory
+            stitchTiled(opts, imgSet, filename, remapper, advOptions, maxMemory);
+            return;
+        };
 
 	// create panorama canvas
         ImageType pano(opts.getWidth(), opts.getHeight());
         AlphaType panoMask(opts.getWidth(), opts.getHeight());
 
         stitch(opts, imgSet, filename, pano, panoMask, remapper, advOptions);
-	
-	    std::string ext = opts.getOutputExtension();
-        std::string cext = hugin_utils::tolower(hugin_utils::getExtension(basename));
-        std::transform(cext.begin(),cext.end(), cext.begin(), (int(*)(int))std::tolower);
-        // remove extension only if it specifies the same file type, otherwise
-        // its probably part of the filename.
-        if (cext == ext) {
-            basename = hugin_utils::stripExtension(basename);
-        }
-        std::string outputfile = basename + "." + ext;
-        
+
+        const std::string outputfile = getOutputFilename(opts, filename);
+
 	// save the remapped image
         Base::m_progress->setMessage("saving result", hugin_utils::stripPath(outputfile));
         DEBUG_DEBUG("Saving panorama: " << outputfile);
@@ -606,7 +944,177 @@ public:
         */
     }
 
+    /** stitch the panorama region by region and write it into a tiled tiff file.
+     *
+     *  The size of the regions is chosen, so that the memory needed for
+     *  stitching stays below @p maxMemory (in bytes). Only the images, which
+     *  intersect a region, are remapped for this region, so images covering
+     *  several regions are loaded and remapped again for each region. Each
+     *  region is blended on its own with a small overlap to its neighbours.
+     *  The seams are calculated for each region separately, so they are not
+     *  guaranteed to continue across the region borders. Only hard seams are
+     *  supported. Because the result differs from stitching the full canvas,
+     *  it is only used when the advanced option tiledStitching is set.
+     */
+    void stitchTiled(const PanoramaOptions & opts, UIntSet & imgSet,
+                     const std::string & filename,
+                     SingleImageRemapper<ImageType, AlphaType> & remapper,
+                     const AdvancedOptions& advOptions,
+                     const double maxMemory)
+    {
+        typedef typename vigra_ext::TiffPixelChannels<typename ImageType::value_type> Channels;
+        typedef typename Channels::component_type ComponentType;
+        const vigra::Rect2D roi = opts.getROI();
+        const int tileSize = NONA_TIFF_TILE_SIZE;
+        const int overlap = NONA_TILED_STITCHING_OVERLAP;
+        const bool fullWrap = (opts.getHFOV() == 360.0) && (opts.getWidth() == roi.width());
+        UIntVector images;
+        std::copy(imgSet.begin(), imgSet.end(), std::back_inserter(images));
+        if (images.empty())
+        {
+            return;
+        };
+        // find the largest region, which fits into the memory
+        const double availableMemory = maxMemory - estimateMemory(opts, imgSet, vigra::Rect2D());
+        const double maxPixels = std::max<double>(availableMemory / getBytesPerPixel(), tileSize * tileSize);
+        int regionWidth = tileSize;
+        int regionHeight = tileSize;
+        if (static_cast<double>(roi.width() + 2 * overlap) * (tileSize + 2 * overlap) <= maxPixels)
+        {
+            // process stripes over the whole width
+            regionWidth = (roi.width() + tileSize - 1) / tileSize * tileSize;
+            regionHeight = std::max(tileSize, static_cast<int>((maxPixels / (roi.width() + 2 * overlap) - 2 * overlap) / tileSize) * tileSize);
+        }
+        else
+        {
+            regionWidth = std::max(tileSize, static_cast<int>((maxPixels / (tileSize + 2 * overlap) - 2 * overlap) / tileSize) * tileSize);
+        };
+
+        const std::string outputfile = getOutputFilename(opts, filename);
+        // use BigTIFF, if the uncompressed image could exceed the 4 GB limit of classic TIFF
+        const bool useBigTIFF = GetAdvancedOption(advOptions, "useBigTIFF", false) ||
+            static_cast<double>(roi.area()) * (Channels::channels + 1) * sizeof(ComponentType) > 4.0e9;
+        vigra::TiffImage * tiff = TIFFOpen(outputfile.c_str(), useBigTIFF ? "w8" : "w");
+        if (tiff == NULL)
+        {
+            throw std::runtime_error("Could not open " + outputfile + " for writing");
+        };
+        iccProfile = vigra::ImageImportInfo(Base::m_pano.getImage(images[0]).getFilename().c_str()).getICCProfile();
+        // createTiffDirectory sets the same resolution of 150 dpi as the export of the full canvas
+        vigra_ext::createTiffDirectory(tiff, hugin_utils::stripPath(outputfile), outputfile, opts.tiffCompression,
+            1, 1, roi.upperLeft(), vigra::Size2D(opts.getWidth(), opts.getHeight()), iccProfile);
+        vigra_ext::TiledAlphaTiffWriter<typename ImageType::value_type> writer(tiff, roi.size(), tileSize);
+
+        std::vector<vigra::Rect2D> regions;
+        std::vector<vigra::Rect2D> areas;
+        for (int y = roi.top(); y < roi.bottom(); y += regionHeight)
+        {
+            for (int x = roi.left(); x < roi.right(); x += regionWidth)
+            {
+                regions.push_back(vigra::Rect2D(vigra::Point2D(x, y), vigra::Size2D(regionWidth, regionHeight)) & roi);
+                // blend a slightly larger area, so that the seams of neighbouring
+                // regions are calculated with mostly the same image content
+                vigra::Rect2D area(regions.back());
+                area.addBorder(overlap);
+                area &= roi;
+                areas.push_back(area);
+            };
+        };
+        remapper.setImageOrder(Base::m_pano, opts, Base::getRegionImageOrder(imgSet, areas));
+
+        try
+        {
+            for (size_t r = 0; r < regions.size(); ++r)
+            {
+                const vigra::Rect2D& region = regions[r];
+                const vigra::Rect2D& area = areas[r];
+                const bool wrap = fullWrap && area.width() == roi.width();
+                ImageType areaImage(area.size());
+                AlphaType areaMask(area.size());
+                for (UIntVector::const_iterator it = images.begin(); it != images.end(); ++it)
+                {
+                    const vigra::Rect2D imgROI = Base::m_rois[std::distance(imgSet.begin(), imgSet.find(*it))] & area;
+                    if (imgROI.isEmpty())
+                    {
+                        continue;
+                    };
+                    PanoramaOptions modOptions(opts);
+                    if (GetAdvancedOption(advOptions, "ignoreExposure", false))
+                    {
+                        modOptions.outputExposureValue = Base::m_pano.getImage(*it).getExposureValue();
+                        modOptions.outputRangeCompression = 0.0;
+                    };
+                    RemappedPanoImage<ImageType, AlphaType> * remapped = remapper.getRemapped(Base::m_pano, modOptions, *it, imgROI, Base::m_progress);
+                    Base::m_progress->setMessage("blending", hugin_utils::stripPath(Base::m_pano.getImage(*it).getFilename()));
+                    try
+                    {
+                        if (!remapped->boundingBox().isEmpty())
+                        {
+                            vigra_ext::MergeImages<ImageType, AlphaType>(areaImage, areaMask, remapped->m_image, remapped->m_mask,
+                                remapped->boundingBox().upperLeft() - area.upperLeft(), wrap, true);
+                        };
+                    }
+                    catch (vigra::PreconditionViolation & e)
+                    {
+                        DEBUG_ERROR("exception during stitching" << e.what());
+                    }
+                    remapper.release(remapped);
+                };
+                // write only the region itself, the overlap belongs to the neighbours
+                const vigra::Diff2D offset(region.upperLeft() - area.upperLeft());
+                Base::m_progress->setMessage("saving result", hugin_utils::stripPath(outputfile));
+                if (!writer.writeRegion(vigra::make_triple(areaImage.upperLeft() + offset, areaImage.upperLeft() + offset + region.size(), areaImage.accessor()),
+                    std::make_pair(areaMask.upperLeft() + offset, areaMask.accessor()), vigra::Point2D(region.upperLeft() - roi.upperLeft())))
+                {
+                    throw std::runtime_error("Error writing " + outputfile);
+                };
+            };
+        }
+        catch (...)
+        {
+            TIFFClose(tiff);
+            throw;
+        };
+        TIFFClose(tiff);
+        m_panoROI = roi;
+    }
+
 protected:
+    /** returns the name of the output file, the extension is added if necessary */
+    std::string getOutputFilename(const PanoramaOptions & opts, const std::string & filename) const
+    {
+        std::string basename = filename;
+        std::string ext = opts.getOutputExtension();
+        std::string cext = hugin_utils::tolower(hugin_utils::getExtension(basename));
+        std::transform(cext.begin(),cext.end(), cext.begin(), (int(*)(int))std::tolower);
+        // remove extension only if it specifies the same file type, otherwise
+        // its probably part of the filename.
+        if (cext == ext) {
+            basename = hugin_utils::stripExtension(basename);
+        }
+        return basename + "." + ext;
+    }
+
+    /** bytes needed for each pixel of a stitched region: the panorama and the
+     *  remapped image with their masks and the temporary images of MergeImages */
+    static double getBytesPerPixel()
+    {
+        return 2.0 * (sizeof(typename ImageType::value_type) + sizeof(typename AlphaType::value_type)) + sizeof(double) + 2;
+    }
+
+    /** estimate the memory (in bytes) needed for stitching the given region of the panorama */
+    double estimateMemory(const PanoramaOptions & opts, const UIntSet & imgSet, const vigra::Rect2D & region) const
+    {
+        // the largest source image is kept in memory during remapping
+        double srcImageSize = 0;
+        for (UIntSet::const_iterator it = imgSet.begin(); it != imgSet.end(); ++it)
+        {
+            srcImageSize = std::max<double>(srcImageSize, Base::m_pano.getImage(*it).getSize().area());
+        };
+        return srcImageSize * (sizeof(typename ImageType::value_type) + sizeof(typename AlphaType::value_type)) +
+            static_cast<double>(region.area()) * getBytesPerPixel();
+    }
+
     vigra::ImageImportInfo::ICCProfile iccProfile;
     vigra::Rect2D m_panoROI;
 };
@@ -687,17 +1195,10 @@ public:
                 FUNCTOR & reduce,
                 const AdvancedOptions& advOptions)
     {
+        typedef typename vigra_ext::TiffPixelChannels<typename ImageType::value_type>::component_type ComponentType;
         Base::stitch(opts, imgSet, filename, remapper);
 
         std::string basename = filename;
-
-    // create panorama canvas
-        ImageType pano(opts.getWidth(), opts.getHeight());
-        AlphaType panoMask(opts.getWidth(), opts.getHeight());
-
-        stitch(opts, imgSet, vigra::destImageRange(pano), vigra::destImage(panoMask),
-               remapper, reduce);
-
     	std::string ext = opts.getOutputExtension();
         std::string cext = hugin_utils::tolower(hugin_utils::getExtension(basename));
         // remove extension only if it specifies the same file type, otherwise
@@ -707,6 +1208,66 @@ public:
         }
         std::string outputfile = basename + "." + ext;
 
+        // process the panorama in horizontal bands, if it does not fit into the given memory
+        const double maxMemory = GetAdvancedOption(advOptions, "maxMemory", 0.0f) * 1024.0 * 1024.0;
+        const bool tiledTiff = opts.outputFormat == PanoramaOptions::TIFF &&
+            (opts.outputPixelType.empty() || opts.outputPixelType == vigra_ext::TiffAlphaTraits<ComponentType>::pixelType());
+        if (maxMemory > 0 && tiledTiff && getBandHeight(opts, imgSet, maxMemory, true, 1) < opts.getHeight())
+        {
+            // write the bands directly into a tiled tiff, without keeping the canvas in memory,
+            // the bands have to start at a tile border
+            int tiledBandHeight = getBandHeight(opts, imgSet, maxMemory, false, NONA_TIFF_TILE_SIZE);
+            if (tiledBandHeight == 0)
+            {
+                tiledBandHeight = warnMemoryLimit(maxMemory, NONA_TIFF_TILE_SIZE);
+            };
+            stitchTiled(opts, imgSet, outputfile, remapper, reduce, advOptions, tiledBandHeight);
+            return;
+        };
+        if (maxMemory > 0 && opts.outputFormat == PanoramaOptions::EXR && getBandHeight(opts, imgSet, maxMemory, true, 1) < opts.getHeight())
+        {
+            // write the bands directly as scanlines into the exr file, without keeping the canvas in memory
+            int exrBandHeight = getBandHeight(opts, imgSet, maxMemory, false, 1);
+            if (exrBandHeight == 0)
+            {
+                exrBandHeight = warnMemoryLimit(maxMemory, 1);
+            };
+            stitchEXR(opts, imgSet, outputfile, remapper, reduce, exrBandHeight);
+            return;
+        };
+        int bandHeight = opts.getHeight();
+        if (maxMemory > 0)
+        {
+            bandHeight = getBandHeight(opts, imgSet, maxMemory, true, 1);
+            if (bandHeight == 0)
+            {
+                // the other formats need the full canvas
+                std::ostringstream error;
+                error << "The panorama canvas does not fit into the memory limit of " << maxMemory / (1024.0 * 1024.0)
+                    << " MB, use TIFF or EXR output to stitch the panorama in bands";
+                throw std::runtime_error(error.str());
+            };
+        };
+
+    // create panorama canvas
+        ImageType pano(opts.getWidth(), opts.getHeight());
+        AlphaType panoMask(opts.getWidth(), opts.getHeight());
+
+        Base::m_progress->setMessage("Stitching");
+        std::vector<vigra::Rect2D> bands;
+        for (int y = 0; y < opts.getHeight(); y += bandHeight)
+        {
+            bands.push_back(vigra::Rect2D(0, y, opts.getWidth(), std::min(y + bandHeight, opts.getHeight())));
+        };
+        remapper.setImageOrder(Base::m_pano, opts, Base::getRegionImageOrder(imgSet, bands));
+        for (size_t b = 0; b < bands.size(); ++b)
+        {
+            const vigra::Rect2D& region = bands[b];
+            stitchRegion(imgSet, region, pano.upperLeft() + region.upperLeft(), pano.accessor(),
+                         panoMask.upperLeft() + region.upperLeft(), panoMask.accessor(),
+                         opts, remapper, reduce);
+        };
+
 //        Base::m_progress.setMessage("saving result: " + hugin_utils::stripPath(outputfile));
         DEBUG_DEBUG("Saving panorama: " << outputfile);
         vigra::ImageExportInfo exinfo(outputfile.c_str(), GetAdvancedOption(advOptions, "useBigTIFF", false) ? "w8" : "w");
@@ -749,62 +1310,301 @@ public:
                 SingleImageRemapper<ImageType, AlphaType> & remapper,
                 FUNCTOR & reduce)
     {
-        typedef typename vigra::NumericTraits<typename ImageType::value_type> Traits;
-        typedef typename AlphaAccessor::value_type MaskType;
-
         Base::stitch(opts, imgSet, "dummy", remapper);
 
-        // remap all images..
-        typedef std::vector<RemappedPanoImage<ImageType, AlphaType> *> RemappedVector;
-        unsigned int nImg = imgSet.size();
-
         Base::m_progress->setMessage("Stitching");
-        // empty ROI
-        //	vigra::Rect2D panoROI;
-        // remap all images..
-        RemappedVector remapped(nImg);
+        const vigra::Diff2D size =  pano.second - pano.first;
+        stitchRegion(imgSet, vigra::Rect2D(vigra::Size2D(size.x, size.y)), pano.first, pano.third, alpha.first, alpha.second,
+                     opts, remapper, reduce);
+    }
 
+protected:
+    /** remap all images, which intersect the given region of the panorama, and
+     *  reduce them into the region. Only the intersecting part of each image
+     *  is remapped, the remapped images are released afterwards.
+     *  @param imgSet images, Base::stitch has to be called before
+     *  @param region region of the panorama, which should be stitched
+     *  @param panoUL, panoAcc upper left corner of the region in the output image
+     *  @param alphaUL, alphaAcc upper left corner of the region in the output mask
+     */
+    template<class ImgIter, class ImgAccessor,
+             class AlphaIter, class AlphaAccessor,
+             class FUNCTOR>
+    void stitchRegion(const UIntSet & imgSet, const vigra::Rect2D & region,
+                      ImgIter panoUL, ImgAccessor panoAcc,
+                      AlphaIter alphaUL, AlphaAccessor alphaAcc,
+                      const PanoramaOptions & opts,
+                      SingleImageRemapper<ImageType, AlphaType> & remapper,
+                      const FUNCTOR & reduce)
+    {
+        typedef std::vector<RemappedPanoImage<ImageType, AlphaType> *> RemappedVector;
+        RemappedVector remapped;
         int i=0;
-        // remap each image and blend into main pano image
+        // remap the part of each image, which intersects the region
         for (UIntSet::const_iterator it = imgSet.begin();
-                it != imgSet.end(); ++it)
+                it != imgSet.end(); ++it, ++i)
         {
-            // get a copy of the remapped image.
-            // not very good, keeps all images in memory,
-            // but should be enought for the preview.
-            remapped[i] = remapper.getRemapped(Base::m_pano, opts, *it,
-                                               Base::m_rois[i], Base::m_progress);
+            const vigra::Rect2D imgROI = Base::m_rois[i] & region;
+            if (imgROI.isEmpty())
+            {
+                continue;
+            };
+            remapped.push_back(remapper.getRemapped(Base::m_pano, opts, *it,
+                                                    imgROI, Base::m_progress));
             if(iccProfile.empty())
             {
-                iccProfile=remapped[i]->m_ICCProfile;
+                iccProfile=remapped.back()->m_ICCProfile;
             };
-            i++;
         }
-        vigra::Diff2D size =  pano.second - pano.first;
-        ImgIter output = pano.first;
-        // iterate over the whole image...
-        // calculate something on the pixels that belong together..
-        for (int y=0; y < size.y; y++) {
-            for (int x=0; x < size.x; x++) {
-                reduce.reset();
-                MaskType maskRes=0;
-                for (unsigned int i=0; i< nImg; i++) {
-                    MaskType a = remapped[i]->getMask(x,y);
-                    if (a) {
-                        maskRes = vigra_ext::LUTTraits<MaskType>::max();
-                        reduce(remapped[i]->operator()(x,y), a);
+        reduceImages(remapped, region, panoUL, panoAcc, alphaUL, alphaAcc, reduce);
+        for (typename RemappedVector::iterator it=remapped.begin();
+             it != remapped.end(); ++it)
+        {
+            remapper.release(*it);
+        }
+    }
+
+    /** apply the reduce functor to all pixels of the region, the rows are
+     *  processed in parallel with a copy of the functor for each thread */
+    template<class ImgIter, class ImgAccessor,
+             class AlphaIter, class AlphaAccessor,
+             class FUNCTOR>
+    static void reduceImages(const std::vector<RemappedPanoImage<ImageType, AlphaType> *> & remapped,
+                             const vigra::Rect2D & region,
+                             ImgIter panoUL, ImgAccessor panoAcc,
+                             AlphaIter alphaUL, AlphaAccessor alphaAcc,
+                             const FUNCTOR & reduce)
+    {
+        typedef typename vigra::NumericTraits<typename ImageType::value_type> Traits;
+        typedef typename AlphaAccessor::value_type MaskType;
+#pragma omp parallel
+        {
+            FUNCTOR threadReduce(reduce);
+            // images, which cover the current row
+            std::vector<RemappedPanoImage<ImageType, AlphaType> *> rowImages;
+            rowImages.reserve(remapped.size());
+#pragma omp for schedule(dynamic)
+            for (int y = region.top(); y < region.bottom(); ++y)
+            {
+                rowImages.clear();
+                for (size_t i = 0; i < remapped.size(); ++i)
+                {
+                    if (remapped[i]->boundingBox().top() <= y && y < remapped[i]->boundingBox().bottom())
+                    {
+                        rowImages.push_back(remapped[i]);
+                    };
+                };
+                ImgIter xd(panoUL);
+                xd.y += y - region.top();
+                AlphaIter xa(alphaUL);
+                xa.y += y - region.top();
+                for (int x = region.left(); x < region.right(); ++x, ++xd.x, ++xa.x)
+                {
+                    threadReduce.reset();
+                    MaskType maskRes=0;
+                    for (size_t i = 0; i < rowImages.size(); ++i)
+                    {
+                        MaskType a = rowImages[i]->getMask(x,y);
+                        if (a) {
+                            maskRes = vigra_ext::LUTTraits<MaskType>::max();
+                            threadReduce(rowImages[i]->operator()(x,y), a);
+                        }
                     }
+                    panoAcc.set(Traits::fromRealPromote(threadReduce()), xd);
+                    alphaAcc.set(maskRes, xa);
                 }
-                pano.third.set(Traits::fromRealPromote(reduce()), output, vigra::Diff2D(x,y));
-                alpha.second.set(maskRes, alpha.first, vigra::Diff2D(x,y));
             }
         }
+    }
 
-        for (typename RemappedVector::iterator it=remapped.begin();
-             it != remapped.end(); ++it)
+    /** stitch the panorama band by band and write it into a tiled tiff file,
+     *  only the remapped images of the current band are kept in memory */
+    template <class FUNCTOR>
+    void stitchTiled(const PanoramaOptions & opts, const UIntSet & imgSet,
+                     const std::string & outputfile,
+                     SingleImageRemapper<ImageType, AlphaType> & remapper,
+                     const FUNCTOR & reduce,
+                     const AdvancedOptions& advOptions,
+                     const int bandHeight)
+    {
+        typedef typename vigra_ext::TiffPixelChannels<typename ImageType::value_type> Channels;
+        typedef typename Channels::component_type ComponentType;
+        const vigra::Rect2D roi = opts.getROI();
+        if (imgSet.empty())
         {
-            remapper.release(*it);
+            return;
+        };
+        // use BigTIFF, if the uncompressed image could exceed the 4 GB limit of classic TIFF
+        const bool useBigTIFF = GetAdvancedOption(advOptions, "useBigTIFF", false) ||
+            static_cast<double>(roi.area()) * (Channels::channels + 1) * sizeof(ComponentType) > 4.0e9;
+        vigra::TiffImage * tiff = TIFFOpen(outputfile.c_str(), useBigTIFF ? "w8" : "w");
+        if (tiff == NULL)
+        {
+            throw std::runtime_error("Could not open " + outputfile + " for writing");
+        };
+        iccProfile = vigra::ImageImportInfo(Base::m_pano.getImage(*imgSet.begin()).getFilename().c_str()).getICCProfile();
+        vigra_ext::createTiffDirectory(tiff, hugin_utils::stripPath(outputfile), outputfile, opts.tiffCompression,
+            1, 1, roi.upperLeft(), vigra::Size2D(opts.getWidth(), opts.getHeight()), iccProfile);
+        vigra_ext::TiledAlphaTiffWriter<typename ImageType::value_type> writer(tiff, roi.size(), NONA_TIFF_TILE_SIZE);
+
+        std::vector<vigra::Rect2D> bands;
+        for (int y = roi.top(); y < roi.bottom(); y += bandHeight)
+        {
+            bands.push_back(vigra::Rect2D(roi.left(), y, roi.right(), std::min(y + bandHeight, roi.bottom())));
+        };
+        remapper.setImageOrder(Base::m_pano, opts, Base::getRegionImageOrder(imgSet, bands));
+
+        try
+        {
+            for (size_t b = 0; b < bands.size(); ++b)
+            {
+                const vigra::Rect2D& region = bands[b];
+                ImageType bandImage(region.size());
+                AlphaType bandMask(region.size());
+                Base::m_progress->setMessage("Stitching");
+                stitchRegion(imgSet, region, bandImage.upperLeft(), bandImage.accessor(),
+                             bandMask.upperLeft(), bandMask.accessor(), opts, remapper, reduce);
+                Base::m_progress->setMessage("saving result", hugin_utils::stripPath(outputfile));
+                if (!writer.writeRegion(vigra::srcImageRange(bandImage), vigra::srcImage(bandMask),
+                    vigra::Point2D(region.upperLeft() - roi.upperLeft())))
+                {
+                    throw std::runtime_error("Error writing " + outputfile);
+                };
+            };
         }
+        catch (...)
+        {
+            TIFFClose(tiff);
+            throw;
+        };
+        TIFFClose(tiff);
+    }
+
+    /** stitch the panorama band by band and write the bands as scanlines into
+     *  an exr file, only the remapped images of the current band and a single
+     *  row of the output file are kept in memory */
+    template <class FUNCTOR>
+    void stitchEXR(const PanoramaOptions & opts, const UIntSet & imgSet,
+                   const std::string & outputfile,
+                   SingleImageRemapper<ImageType, AlphaType> & remapper,
+                   const FUNCTOR & reduce,
+                   const int bandHeight)
+    {
+        const vigra::Rect2D roi = opts.getROI();
+        if (imgSet.empty())
+        {
+            return;
+        };
+        // the data window contains only the cropped area of the panorama
+        const Imath::Box2i displayWindow(Imath::V2i(0, 0), Imath::V2i(opts.getWidth() - 1, opts.getHeight() - 1));
+        const Imath::Box2i dataWindow(Imath::V2i(roi.left(), roi.top()), Imath::V2i(roi.right() - 1, roi.bottom() - 1));
+        Imf::RgbaOutputFile exr(outputfile.c_str(), displayWindow, dataWindow, Imf::WRITE_RGBA);
+        std::vector<Imf::Rgba> row(roi.width());
+
+        std::vector<vigra::Rect2D> bands;
+        for (int y = roi.top(); y < roi.bottom(); y += bandHeight)
+        {
+            bands.push_back(vigra::Rect2D(roi.left(), y, roi.right(), std::min(y + bandHeight, roi.bottom())));
+        };
+        remapper.setImageOrder(Base::m_pano, opts, Base::getRegionImageOrder(imgSet, bands));
+
+        for (size_t b = 0; b < bands.size(); ++b)
+        {
+            const vigra::Rect2D& region = bands[b];
+            ImageType bandImage(region.size());
+            AlphaType bandMask(region.size());
+            Base::m_progress->setMessage("Stitching");
+            stitchRegion(imgSet, region, bandImage.upperLeft(), bandImage.accessor(),
+                         bandMask.upperLeft(), bandMask.accessor(), opts, remapper, reduce);
+            Base::m_progress->setMessage("saving result", hugin_utils::stripPath(outputfile));
+            for (int y = 0; y < region.height(); ++y)
+            {
+                for (int x = 0; x < region.width(); ++x)
+                {
+                    setRgba(row[x], bandImage(x, y));
+                    row[x].a = bandMask(x, y) > 0 ? 1.0f : 0.0f;
+                };
+                // the frame buffer is addressed with the panorama coordinates of the current row
+                exr.setFrameBuffer(&row[0] - roi.left() - static_cast<ptrdiff_t>(region.top() + y) * roi.width(), 1, roi.width());
+                exr.writePixels(1);
+            };
+        };
+    }
+
+    /** stores a pixel in the color channels of an exr pixel */
+    template <class T>
+    static void setRgba(Imf::Rgba & pixel, const vigra::RGBValue<T> & value)
+    {
+        pixel.r = static_cast<float>(value.red());
+        pixel.g = static_cast<float>(value.green());
+        pixel.b = static_cast<float>(value.blue());
+    }
+
+    template <class T>
+    static void setRgba(Imf::Rgba & pixel, const T & value)
+    {
+        pixel.r = pixel.g = pixel.b = static_cast<float>(value);
+    }
+
+    /** returns the height of the bands, so that stitching a band needs less
+     *  than @p maxMemory bytes. If @p keepCanvas is true, the memory for the
+     *  full panorama canvas is taken into account.
+     *  The memory of a row is the band itself and the remapped parts of all
+     *  images, which cover this row, the row with the most covering images is used.
+     *  The height is a multiple of @p alignment, except when the whole panorama fits.
+     *  Base::stitch has to be called before.
+     *  @return the height of the bands, 0 if not even @p alignment rows fit into @p maxMemory */
+    int getBandHeight(const PanoramaOptions & opts, const UIntSet & imgSet, const double maxMemory,
+                      const bool keepCanvas, const int alignment) const
+    {
+        const double pixelSize = sizeof(typename ImageType::value_type) + sizeof(typename AlphaType::value_type);
+        // the largest source image is kept in memory during remapping
+        double srcImageSize = 0;
+        for (UIntSet::const_iterator it = imgSet.begin(); it != imgSet.end(); ++it)
+        {
+            srcImageSize = std::max<double>(srcImageSize, Base::m_pano.getImage(*it).getSize().area());
+        };
+        double availableMemory = maxMemory - srcImageSize * pixelSize;
+        if (keepCanvas)
+        {
+            availableMemory -= static_cast<double>(opts.getWidth()) * opts.getHeight() * pixelSize;
+        };
+        // each row needs the band and the remapped parts of the images covering it,
+        // the maximum of the covered width is reached at the top of one of the images
+        double maxCoveredWidth = 0;
+        for (size_t i = 0; i < Base::m_rois.size(); ++i)
+        {
+            double coveredWidth = 0;
+            for (size_t j = 0; j < Base::m_rois.size(); ++j)
+            {
+                if (Base::m_rois[j].top() <= Base::m_rois[i].top() && Base::m_rois[i].top() < Base::m_rois[j].bottom())
+                {
+                    coveredWidth += Base::m_rois[j].width();
+                };
+            };
+            maxCoveredWidth = std::max(maxCoveredWidth, coveredWidth);
+        };
+        const double bytesPerRow = (opts.getROI().width() + maxCoveredWidth) * pixelSize;
+        const int height = keepCanvas ? opts.getHeight() : opts.getROI().height();
+        const double rows = availableMemory / bytesPerRow;
+        if (rows >= height)
+        {
+            return height;
+        };
+        if (rows < alignment)
+        {
+            return 0;
+        };
+        return static_cast<int>(rows / alignment) * alignment;
+    }
+
+    /** warns that the memory limit is too small for the smallest possible band,
+     *  and returns the height of this band */
+    static int warnMemoryLimit(const double maxMemory, const int minBandHeight)
+    {
+        std::cerr << "Warning: the memory limit of " << maxMemory / (1024.0 * 1024.0) << " MB is too small to stitch "
+            << minBandHeight << (minBandHeight == 1 ? " row" : " rows") << " of the panorama at once, it will be exceeded." << std::endl;
+        return minBandHeight;
     }
 
 public:
@@ -990,6 +1790,7 @@ static void stitchPanoIntern(const PanoramaData & pano,
             if (opts.outputMode == PanoramaOptions::OUTPUT_HDR) {
                 vigra_ext::ReduceToHDRFunctor<typename ImageType::value_type> hdrmerge;
                 ReduceStitcher<ImageType, AlphaType> stitcher(pano, progress);
+                m.setAdvancedOptions(advOptions);
                 stitcher.stitch(opts, imgs, basename, m, hdrmerge, advOptions);
             } else {
                 WeightedStitcher<ImageType, AlphaType> stitcher(pano, progress);
@@ -1012,6 +1813,7 @@ static void stitchPanoIntern(const PanoramaData & pano,
         case PanoramaOptions::TIFF_multilayer:
         {
             TiffMultiLayerRemapper<ImageType, AlphaType> stitcher(pano, progress);
+            m.setAdvancedOptions(advOptions);
             stitcher.stitch(opts, imgs, basename, m, advOptions);
             break;
         }
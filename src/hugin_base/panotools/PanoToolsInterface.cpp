@@ -182,6 +182,8 @@ void Transform::createTransform(const vigra::Diff2D & srcSize,
                  destSize, destProj, destProjParam, destHFOV);
     // create the actual stack
     SetMakeParams( m_stack, &m_mp, &m_srcImage , &m_dstImage, 0 );
+    // use native implementation if possible
+    initNativeTransform();
 }
 
 
@@ -232,6 +234,8 @@ void Transform::createInvTransform(const vigra::Diff2D & srcSize,
                  destHFOV);
     // create the actual stack
     SetInvMakeParams( m_stack, &m_mp, &m_srcImage , &m_dstImage, 0 );
+    // the inverse stack is not implemented natively
+    m_nativeFunc = NULL;
 }
 
 
@@ -259,6 +263,12 @@ bool Transform::transform(hugin_utils::FDiff2D& dest, const hugin_utils::FDiff2D
 bool Transform::transformImgCoord(double & x_dest, double & y_dest,
                        double x_src, double y_src) const
 {
+    if (m_nativeFunc)
+    {
+        char valid;
+        m_nativeFunc(m_nativeParams, &x_src, &y_src, 1, &x_dest, &y_dest, &valid);
+        return valid != 0;
+    };
     x_src -= m_srcTX - 0.5 ;
     y_src -= m_srcTY - 0.5;
     
@@ -101,6 +101,33 @@ namespace HuginBase { class PanoramaData; }
 namespace HuginBase { namespace PTools {
 
 
+/** parameters for the natively implemented transformation, they are
+ *  extracted from the libpano13 stack, see PanoToolsTransformNative.cpp */
+struct NativeTransformParams
+{
+    /** offset of the source coordinates (screen -> cartesian) */
+    double srcOffset[2];
+    /** offset of the destination coordinates (cartesian -> screen) */
+    double destOffset[2];
+    /** distance parameter of all projection functions */
+    double distance;
+    /** parameters of rotate_erect: 180 deg in screen points, yaw in screen points */
+    double rot[2];
+    /** rotation matrix for pitch and roll */
+    double mt[3][3];
+    /** scale factors */
+    double scale[2];
+    /** radial distortion polynomial, radius and correction radius */
+    double rad[6];
+    /** shift of the optical center (horizontal, vertical) */
+    double shift[2];
+};
+
+/** function type for the natively implemented transformations */
+typedef void (*NativeTransformFunc)(const NativeTransformParams& params,
+                                    const double* x_src, const double* y_src, const int n,
+                                    double* x_dest, double* y_dest, char* valid);
+
 /** Holds transformations for Image -> Pano and the other way */
 class IMPEX Transform
 {
@@ -114,7 +141,7 @@ class IMPEX Transform
          */
         Transform()
           : m_initialized(false), m_srcTX(0), m_srcTY(0),
-            m_destTX(0), m_destTY(0)
+            m_destTX(0), m_destTY(0), m_nativeFunc(NULL)
         {
             // initialize pointer
             m_srcImage.data = NULL;
@@ -215,6 +242,23 @@ class IMPEX Transform
 
         bool transformImgCoordPartial(double & x_dest, double & y_dest, double x_src, double y_src) const;
 
+        /** transform n points with one call, works like transformImgCoord for each point.
+         *  This is only a batched interface, the points are transformed one after the
+         *  other by a scalar loop. It avoids the per point overhead of the libpano13 stack
+         *  when a native implementation is available, but it is not vectorized.
+         *  @param x_src, y_src arrays with n coordinates which should be transformed
+         *  @param n number of points
+         *  @param x_dest, y_dest arrays for n transformed coordinates
+         *  @param valid array for n flags, set to non-zero when the point could be transformed
+         *  @return true if all points could be transformed
+         */
+        bool transformImgCoordBatch(const double* x_src, const double* y_src, const int n,
+                                    double* x_dest, double* y_dest, char* valid) const;
+
+        /** returns true if the transform is calculated by the native implementation
+         *  instead of the libpano13 function stack */
+        bool hasNativeTransform() const { return m_nativeFunc != NULL; };
+
         ///
         bool transformImgCoord(hugin_utils::FDiff2D& dest, const hugin_utils::FDiff2D & src) const
             { return transformImgCoord(dest.x, dest.y, src.x, src.y); }
@@ -232,6 +276,10 @@ class IMPEX Transform
                           const std::vector<double> & destProjParam,
                           double destHFOV);
 
+        /** checks if the stack consists only of functions, which are also
+         *  implemented natively, and setup the native transform in this case */
+        void initNativeTransform();
+
         
     private:
         bool m_initialized;
@@ -244,6 +292,10 @@ class IMPEX Transform
         // used to convert from screen to cartesian coordinates
         double m_srcTX, m_srcTY;
         double m_destTX, m_destTY;
+
+        // native implementation of the stack, NULL if not available
+        NativeTransformParams m_nativeParams;
+        NativeTransformFunc m_nativeFunc;
         
 };
 
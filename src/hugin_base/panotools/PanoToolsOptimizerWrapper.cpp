@@ -30,6 +30,7 @@
 
 #include <sstream>
 #include <hugin_utils/utils.h>
+#include <hugin_utils/openmp_lock.h>
 
 // libpano includes ------------------------------------------------------------
 
@@ -57,6 +58,10 @@
 
 namespace HuginBase { namespace PTools {
 
+// the optimizer of libpano13 works on the global AlignInfo set by SetGlobalPtr,
+// so only one optimisation can run at the same time
+static hugin_omp::Lock optimizerLock;
+
 unsigned int optimize(PanoramaData& pano,
                       const char * userScript)
 {
@@ -76,6 +81,7 @@ unsigned int optimize(PanoramaData& pano,
     OptInfo		opt;
 	AlignInfo	ainf;
 
+    hugin_omp::ScopedLock sl(optimizerLock);
     if (ParseScript( script, &ainf ) == 0)
 	{
 		if( CheckParams( &ainf ) == 0 )
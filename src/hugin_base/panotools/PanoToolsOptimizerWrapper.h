@@ -54,6 +54,8 @@ namespace PTools
      * \param progDisplay progress display
      * @return 0:good, 1:parser error, 2: parameter error
      *
+     * libpano13 keeps the state of the optimizer in global variables, so
+     * concurrent calls are serialized.
      */
     IMPEX unsigned int optimize(PanoramaData & pano,
                   const char * script = 0);
@@ -0,0 +1,441 @@
+// -*- c-basic-offset: 4 -*-
+
+/** @file PanoToolsTransformNative.cpp
+ *
+ *  @brief native implementation of the most common PTools::Transform stacks
+ *
+ *  The libpano13 transformation stack calls a function pointer for each
+ *  step and each point. For the common combinations of input and output
+ *  projection the complete stack is composed at compile time into a single
+ *  function, which is called once for a whole row of points. This saves the
+ *  indirect calls of the stack, but the points are still transformed one
+ *  after the other, the computation is not vectorized (SIMD).
+ *  The parameters are taken directly from the stack created by libpano13,
+ *  so both implementations use the same values.
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public
+ *  License along with this software. If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <hugin_config.h>
+
+#include "PanoToolsInterface.h"
+
+#include <cmath>
+#include <algorithm>
+
+namespace HuginBase { namespace PTools {
+
+namespace
+{
+
+/** panorama projections, which are implemented natively */
+enum NativePanoProjection
+{
+    NATIVE_PANO_EQUIRECTANGULAR,
+    NATIVE_PANO_CYLINDRICAL,
+    NATIVE_PANO_STEREOGRAPHIC
+};
+
+/** image projections, which are implemented natively */
+enum NativeImageProjection
+{
+    NATIVE_IMAGE_RECTILINEAR,
+    NATIVE_IMAGE_FISHEYE,
+    NATIVE_IMAGE_EQUIRECTANGULAR
+};
+
+/** transform n points from panorama to image coordinates.
+ *  All steps are inlined, the switches on the template parameters are
+ *  resolved at compile time. The points are transformed in a scalar loop.
+ *  The single steps follow the functions of libpano13 (math.c) */
+template <int PanoProjection, int ImageProjection, bool Radial>
+void transformNative(const NativeTransformParams& p,
+                     const double* x_src, const double* y_src, const int n,
+                     double* x_dest, double* y_dest, char* valid)
+{
+    const double d = p.distance;
+    for (int i = 0; i < n; ++i)
+    {
+        double x = x_src[i] - p.srcOffset[0];
+        double y = y_src[i] - p.srcOffset[1];
+        bool ok = true;
+        // panorama projection -> equirectangular
+        if (PanoProjection == NATIVE_PANO_CYLINDRICAL)
+        {
+            // erect_pano
+            y = d * atan(y / d);
+        };
+        if (PanoProjection == NATIVE_PANO_STEREOGRAPHIC)
+        {
+            // erect_stereographic
+            const double xs = x / d;
+            const double ys = y / d;
+            const double rh = sqrt(xs * xs + ys * ys);
+            const double c = 2.0 * atan(rh / 2.0);
+            const double sin_c = sin(c);
+            const double cos_c = cos(c);
+            if (fabs(rh) <= 1.0e-10 || (fabs(cos_c) < 1.0e-10 && fabs(xs) < 1.0e-10))
+            {
+                ok = false;
+            }
+            else
+            {
+                y = asin((ys * sin_c) / rh) * d;
+                x = atan2(xs * sin_c, cos_c * rh) * d;
+            };
+        };
+        // rotate_erect
+        x += p.rot[1];
+        while (x < -p.rot[0])
+        {
+            x += 2 * p.rot[0];
+        };
+        while (x > p.rot[0])
+        {
+            x -= 2 * p.rot[0];
+        };
+        // sphere_tp_erect
+        {
+            double phi = x / d;
+            double theta = -y / d + M_PI / 2.0;
+            if (theta < 0)
+            {
+                theta = -theta;
+                phi += M_PI;
+            };
+            if (theta > M_PI)
+            {
+                theta = M_PI - (theta - M_PI);
+                phi += M_PI;
+            };
+            const double s = sin(theta);
+            const double v0 = s * sin(phi);
+            const double v1 = cos(theta);
+            const double r = sqrt(v0 * v0 + v1 * v1);
+            theta = d * atan2(r, s * cos(phi));
+            x = theta * v0 / r;
+            y = theta * v1 / r;
+        };
+        // persp_sphere
+        {
+            double r = sqrt(x * x + y * y);
+            double theta = r / d;
+            const double s = (r == 0.0) ? 0.0 : sin(theta) / r;
+            const double v0 = s * x;
+            const double v1 = s * y;
+            const double v2 = cos(theta);
+            const double u0 = p.mt[0][0] * v0 + p.mt[1][0] * v1 + p.mt[2][0] * v2;
+            const double u1 = p.mt[0][1] * v0 + p.mt[1][1] * v1 + p.mt[2][1] * v2;
+            const double u2 = p.mt[0][2] * v0 + p.mt[1][2] * v1 + p.mt[2][2] * v2;
+            r = sqrt(u0 * u0 + u1 * u1);
+            theta = (r == 0.0) ? 0.0 : d * atan2(r, u2) / r;
+            x = theta * u0;
+            y = theta * u1;
+        };
+        // spherical -> image projection
+        if (ImageProjection == NATIVE_IMAGE_RECTILINEAR)
+        {
+            // rect_sphere_tp
+            const double theta = sqrt(x * x + y * y) / d;
+            double rho;
+            if (theta >= M_PI / 2.0)
+            {
+                rho = 1.6e16;
+            }
+            else
+            {
+                rho = (theta == 0.0) ? 1.0 : tan(theta) / theta;
+            };
+            x *= rho;
+            y *= rho;
+        };
+        if (ImageProjection == NATIVE_IMAGE_EQUIRECTANGULAR)
+        {
+            // erect_sphere_tp
+            const double r = sqrt(x * x + y * y);
+            const double theta = r / d;
+            const double s = (theta == 0.0) ? 1.0 / d : sin(theta) / r;
+            const double v1 = s * x;
+            const double v0 = cos(theta);
+            x = d * atan2(v1, v0);
+            y = d * atan(s * y / sqrt(v0 * v0 + v1 * v1));
+        };
+        // resize
+        x *= p.scale[0];
+        y *= p.scale[1];
+        if (Radial)
+        {
+            // radial
+            const double r = sqrt(x * x + y * y) / p.rad[4];
+            const double scale = (r < p.rad[5]) ? ((p.rad[3] * r + p.rad[2]) * r + p.rad[1]) * r + p.rad[0] : 1000.0;
+            x *= scale;
+            y *= scale;
+        };
+        // horiz and vert
+        x += p.shift[0];
+        y += p.shift[1];
+        if (ok)
+        {
+            x_dest[i] = x + p.destOffset[0];
+            y_dest[i] = y + p.destOffset[1];
+            valid[i] = 1;
+        }
+        else
+        {
+            // same as Transform::transformImgCoord
+            x_dest[i] = -1;
+            y_dest[i] = -1;
+            valid[i] = 0;
+        };
+    };
+}
+
+/** select the matching template instance */
+template <int PanoProjection, int ImageProjection>
+NativeTransformFunc selectNativeTransform(const bool radial)
+{
+    if (radial)
+    {
+        return &transformNative<PanoProjection, ImageProjection, true>;
+    };
+    return &transformNative<PanoProjection, ImageProjection, false>;
+}
+
+template <int PanoProjection>
+NativeTransformFunc selectNativeTransform(const NativeImageProjection imageProjection, const bool radial)
+{
+    switch (imageProjection)
+    {
+        case NATIVE_IMAGE_RECTILINEAR:
+            return selectNativeTransform<PanoProjection, NATIVE_IMAGE_RECTILINEAR>(radial);
+        case NATIVE_IMAGE_FISHEYE:
+            return selectNativeTransform<PanoProjection, NATIVE_IMAGE_FISHEYE>(radial);
+        case NATIVE_IMAGE_EQUIRECTANGULAR:
+            return selectNativeTransform<PanoProjection, NATIVE_IMAGE_EQUIRECTANGULAR>(radial);
+    };
+    return NULL;
+}
+
+NativeTransformFunc selectNativeTransform(const NativePanoProjection panoProjection, const NativeImageProjection imageProjection, const bool radial)
+{
+    switch (panoProjection)
+    {
+        case NATIVE_PANO_EQUIRECTANGULAR:
+            return selectNativeTransform<NATIVE_PANO_EQUIRECTANGULAR>(imageProjection, radial);
+        case NATIVE_PANO_CYLINDRICAL:
+            return selectNativeTransform<NATIVE_PANO_CYLINDRICAL>(imageProjection, radial);
+        case NATIVE_PANO_STEREOGRAPHIC:
+            return selectNativeTransform<NATIVE_PANO_STEREOGRAPHIC>(imageProjection, radial);
+    };
+    return NULL;
+}
+
+/** reads the distance parameter of a stack entry */
+bool checkDistance(const fDesc* stack, const double distance)
+{
+    return *((double*)stack->param) == distance;
+}
+
+} // namespace
+
+void Transform::initNativeTransform()
+{
+    m_nativeFunc = NULL;
+    const fDesc* stack = m_stack;
+    if (stack->func == NULL)
+    {
+        return;
+    };
+    NativeTransformParams params;
+    params.srcOffset[0] = m_srcTX - 0.5;
+    params.srcOffset[1] = m_srcTY - 0.5;
+    params.destOffset[0] = m_destTX - 0.5;
+    params.destOffset[1] = m_destTY - 0.5;
+    // panorama projection
+    NativePanoProjection panoProjection = NATIVE_PANO_EQUIRECTANGULAR;
+    if (stack->func == erect_pano)
+    {
+        panoProjection = NATIVE_PANO_CYLINDRICAL;
+        ++stack;
+    }
+    else
+    {
+        if (stack->func == erect_stereographic)
+        {
+            panoProjection = NATIVE_PANO_STEREOGRAPHIC;
+            ++stack;
+        };
+    };
+    // yaw
+    if (stack->func != rotate_erect)
+    {
+        return;
+    };
+    params.rot[0] = ((double*)stack->param)[0];
+    params.rot[1] = ((double*)stack->param)[1];
+    ++stack;
+    if (stack->func != sphere_tp_erect)
+    {
+        return;
+    };
+    params.distance = *((double*)stack->param);
+    if (panoProjection != NATIVE_PANO_EQUIRECTANGULAR && !checkDistance(m_stack, params.distance))
+    {
+        return;
+    };
+    ++stack;
+    // pitch and roll
+    if (stack->func != persp_sphere)
+    {
+        return;
+    };
+    {
+        const double(*m)[3] = (double(*)[3]) ((void**)stack->param)[0];
+        for (int i = 0; i < 3; ++i)
+        {
+            for (int j = 0; j < 3; ++j)
+            {
+                params.mt[i][j] = m[i][j];
+            };
+        };
+        if (*((double*)((void**)stack->param)[1]) != params.distance)
+        {
+            return;
+        };
+    };
+    ++stack;
+    // image projection
+    NativeImageProjection imageProjection = NATIVE_IMAGE_FISHEYE;
+    if (stack->func == rect_sphere_tp)
+    {
+        imageProjection = NATIVE_IMAGE_RECTILINEAR;
+    }
+    else
+    {
+        if (stack->func == erect_sphere_tp)
+        {
+            imageProjection = NATIVE_IMAGE_EQUIRECTANGULAR;
+        };
+    };
+    if (imageProjection != NATIVE_IMAGE_FISHEYE)
+    {
+        if (!checkDistance(stack, params.distance))
+        {
+            return;
+        };
+        ++stack;
+    };
+    // scale
+    if (stack->func != resize)
+    {
+        return;
+    };
+    params.scale[0] = ((double*)stack->param)[0];
+    params.scale[1] = ((double*)stack->param)[1];
+    ++stack;
+    // radial distortion
+    bool radialDistortion = false;
+    if (stack->func == radial)
+    {
+        radialDistortion = true;
+        for (int i = 0; i < 6; ++i)
+        {
+            params.rad[i] = ((double*)stack->param)[i];
+        };
+        ++stack;
+    }
+    else
+    {
+        std::fill(params.rad, params.rad + 6, 0.0);
+    };
+    // shift of optical center
+    params.shift[0] = 0;
+    params.shift[1] = 0;
+    while (stack->func == vert || stack->func == horiz)
+    {
+        if (stack->func == vert)
+        {
+            params.shift[1] += *((double*)stack->param);
+        }
+        else
+        {
+            params.shift[0] += *((double*)stack->param);
+        };
+        ++stack;
+    };
+    if (stack->func != NULL)
+    {
+        // there are other steps in the stack (e.g. shear, translation), which are not
+        // implemented natively
+        return;
+    };
+    NativeTransformFunc nativeFunc = selectNativeTransform(panoProjection, imageProjection, radialDistortion);
+    if (nativeFunc == NULL)
+    {
+        return;
+    };
+    // finally compare the native implementation with libpano13 on a grid
+    // over the panorama, so that changed implementations in libpano13 are detected
+    const int gridSize = 17;
+    for (int j = 0; j < gridSize; ++j)
+    {
+        for (int i = 0; i < gridSize; ++i)
+        {
+            double x = 2 * m_srcTX * i / (gridSize - 1);
+            double y = 2 * m_srcTY * j / (gridSize - 1);
+            double xNative, yNative;
+            char validNative;
+            nativeFunc(params, &x, &y, 1, &xNative, &yNative, &validNative);
+            double xPT, yPT;
+            const bool validPT = execute_stack_new(x - params.srcOffset[0], y - params.srcOffset[1], &xPT, &yPT, (void*)&m_stack) != 0;
+            if (validPT != (validNative != 0))
+            {
+                return;
+            };
+            if (validPT)
+            {
+                xPT += params.destOffset[0];
+                yPT += params.destOffset[1];
+                if (std::abs(xPT - xNative) > 1e-6 * std::max(1.0, std::abs(xPT)) ||
+                    std::abs(yPT - yNative) > 1e-6 * std::max(1.0, std::abs(yPT)))
+                {
+                    return;
+                };
+            };
+        };
+    };
+    m_nativeParams = params;
+    m_nativeFunc = nativeFunc;
+}
+
+bool Transform::transformImgCoordBatch(const double* x_src, const double* y_src, const int n,
+                                       double* x_dest, double* y_dest, char* valid) const
+{
+    if (m_nativeFunc)
+    {
+        m_nativeFunc(m_nativeParams, x_src, y_src, n, x_dest, y_dest, valid);
+    }
+    else
+    {
+        for (int i = 0; i < n; ++i)
+        {
+            valid[i] = transformImgCoord(x_dest[i], y_dest[i], x_src[i], y_src[i]) ? 1 : 0;
+        };
+    };
+    return std::find(valid, valid + n, 0) == valid + n;
+}
+
+}} // namespace
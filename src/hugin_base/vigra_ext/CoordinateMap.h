@@ -0,0 +1,160 @@
+// -*- c-basic-offset: 4 -*-
+/** @file vigra_ext/CoordinateMap.h
+ *
+ *  Stores the result of a coordinate transform for each pixel of a
+ *  rectangle, so that it can be reused for several remappings.
+ *
+ *  This is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public
+ *  License along with this software. If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _VIGRA_EXT_COORDINATEMAP_H
+#define _VIGRA_EXT_COORDINATEMAP_H
+
+#include <vector>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+#include <vigra/diff2d.hxx>
+#include <vigra_ext/ImageTransforms.h>
+
+namespace vigra_ext
+{
+
+/** source coordinates for each pixel of a rectangle in the destination image.
+ *
+ *  The coordinates are stored as interleaved x,y float pairs row by row.
+ *  Pixels which can't be transformed contain NaN.
+ */
+class CoordinateMap
+{
+public:
+    CoordinateMap() {};
+
+    /** resize the map to the given rectangle, all pixels are invalid afterwards */
+    void resize(const vigra::Rect2D& rect)
+    {
+        m_rect = rect;
+        m_coords.assign(2 * static_cast<size_t>(rect.area()), std::numeric_limits<float>::quiet_NaN());
+    };
+
+    /** evaluate the transform for all pixels of @p rect */
+    template <class TRANSFORM>
+    void calculate(TRANSFORM& transform, const vigra::Rect2D& rect, bool singleThreaded = false)
+    {
+        resize(rect);
+        const int width = rect.width();
+        const int height = rect.height();
+#pragma omp parallel if(!singleThreaded)
+        {
+            std::vector<double> destX(width);
+            std::vector<double> destY(width);
+            std::vector<double> srcX(width);
+            std::vector<double> srcY(width);
+            std::vector<char> valid(width);
+            for (int x = 0; x < width; ++x)
+            {
+                destX[x] = rect.left() + x;
+            };
+#pragma omp for schedule(dynamic)
+            for (int y = 0; y < height; ++y)
+            {
+                std::fill(destY.begin(), destY.end(), rect.top() + y);
+                transformImgCoordBatch(transform, destX.data(), destY.data(), width, srcX.data(), srcY.data(), valid.data());
+                float* row = getRow(y);
+                for (int x = 0; x < width; ++x)
+                {
+                    if (valid[x] && std::isfinite(srcX[x]) && std::isfinite(srcY[x]))
+                    {
+                        row[2 * x] = static_cast<float>(srcX[x]);
+                        row[2 * x + 1] = static_cast<float>(srcY[x]);
+                    };
+                };
+            };
+        }
+    };
+
+    /** returns the rectangle covered by the map */
+    const vigra::Rect2D& getRect() const { return m_rect; };
+
+    /** returns the interleaved coordinates of row @p y (relative to the rectangle) */
+    float* getRow(int y) { return &m_coords[2 * static_cast<size_t>(y) * m_rect.width()]; };
+    const float* getRow(int y) const { return &m_coords[2 * static_cast<size_t>(y) * m_rect.width()]; };
+
+    /** returns true if the destination point @p x, @p y is stored in the map,
+     *  @p stored is set to false for points outside or between the pixels */
+    bool lookup(double& x_src, double& y_src, double x, double y, bool& stored) const
+    {
+        const int ix = static_cast<int>(x);
+        const int iy = static_cast<int>(y);
+        stored = ix == x && iy == y && m_rect.contains(vigra::Point2D(ix, iy));
+        if (!stored)
+        {
+            return false;
+        };
+        const float* p = getRow(iy - m_rect.top()) + 2 * (ix - m_rect.left());
+        x_src = p[0];
+        y_src = p[1];
+        return !std::isnan(p[0]);
+    };
+
+private:
+    vigra::Rect2D m_rect;
+    std::vector<float> m_coords;
+};
+
+/** transform, which reads the coordinates from a CoordinateMap.
+ *
+ *  Points which are not stored in the map (e.g. sub pixel positions used
+ *  to estimate the local scale) are forwarded to the wrapped transform.
+ *  The map and the transform must stay valid as long as this object is used.
+ */
+template <class TRANSFORM>
+class CoordinateMapTransform
+{
+public:
+    CoordinateMapTransform(const CoordinateMap& map, TRANSFORM& transform)
+        : m_map(map), m_transform(transform)
+    {};
+
+    bool transformImgCoord(double & x_dest, double & y_dest, double x_src, double y_src) const
+    {
+        bool stored;
+        const bool valid = m_map.lookup(x_dest, y_dest, x_src, y_src, stored);
+        if (stored)
+        {
+            return valid;
+        };
+        return m_transform.transformImgCoord(x_dest, y_dest, x_src, y_src);
+    };
+
+    void transformImgCoordBatch(const double* x_src, const double* y_src, const int n,
+                                double* x_dest, double* y_dest, char* valid) const
+    {
+        for (int i = 0; i < n; ++i)
+        {
+            valid[i] = transformImgCoord(x_dest[i], y_dest[i], x_src[i], y_src[i]) ? 1 : 0;
+        };
+    };
+
+private:
+    const CoordinateMap& m_map;
+    TRANSFORM& m_transform;
+};
+
+} // namespace vigra_ext
+
+#endif // _VIGRA_EXT_COORDINATEMAP_H
@@ -28,6 +28,9 @@
 #define _VIGRA_EXT_IMAGETRANSFORMS_H
 
 #include <fstream>
+#include <vector>
+#include <algorithm>
+#include <type_traits>
 
 #include <vigra/basicimage.hxx>
 #include <vigra_ext/ROIImage.h>
@@ -62,6 +65,49 @@ vigra::RGBValue<T> zeroNegative(vigra::RGBValue<T> p)
 }
 
 
+namespace detail
+{
+/** checks if TRANSFORM provides a transformImgCoordBatch function */
+template <class TRANSFORM>
+class HasTransformImgCoordBatch
+{
+    template <class T> static char test(decltype(&T::transformImgCoordBatch));
+    template <class T> static long test(...);
+public:
+    enum { value = sizeof(test<TRANSFORM>(0)) == sizeof(char) };
+};
+
+template <class TRANSFORM>
+void transformImgCoordBatch(TRANSFORM & transform, const double* x_src, const double* y_src, const int n,
+                            double* x_dest, double* y_dest, char* valid, std::true_type)
+{
+    transform.transformImgCoordBatch(x_src, y_src, n, x_dest, y_dest, valid);
+}
+
+template <class TRANSFORM>
+void transformImgCoordBatch(TRANSFORM & transform, const double* x_src, const double* y_src, const int n,
+                            double* x_dest, double* y_dest, char* valid, std::false_type)
+{
+    for (int i = 0; i < n; ++i)
+    {
+        valid[i] = transform.transformImgCoord(x_dest[i], y_dest[i], x_src[i], y_src[i]) ? 1 : 0;
+    };
+}
+} // namespace detail
+
+/** transform n points at once
+ *
+ *  uses the batch interface of the transform (e.g. PTools::Transform::transformImgCoordBatch)
+ *  if it is available, otherwise transformImgCoord is called for each point
+ */
+template <class TRANSFORM>
+void transformImgCoordBatch(TRANSFORM & transform, const double* x_src, const double* y_src, const int n,
+                            double* x_dest, double* y_dest, char* valid)
+{
+    detail::transformImgCoordBatch(transform, x_src, y_src, n, x_dest, y_dest, valid,
+        std::integral_constant<bool, detail::HasTransformImgCoordBatch<TRANSFORM>::value>());
+}
+
 /** Transform an image into the panorama
  *
  *  It can be used for partial transformations as well, if the bounding
@@ -115,31 +161,48 @@ void transformImageIntern(vigra::triple<SrcImageIterator, SrcImageIterator, SrcA
         interpol(src, interp, warparound);
 
     // loop over the image and transform
-#pragma omp parallel for if(!singleThreaded) schedule(dynamic) 
-    for (int y = ystart; y < yend; ++y)
+#pragma omp parallel if(!singleThreaded)
     {
-        // create x iterators
-        DestImageIterator xd(dest.first);
-        xd.y += y - ystart;
-        AlphaImageIterator xdm(alpha.first);
-        xdm.y += y - ystart;
-        typename SrcAccessor::value_type tempval;
-        for (int x = xstart; x < xend; ++x, ++xd.x, ++xdm.x)
+        // buffers for the source coordinates of one row
+        std::vector<double> destX(destSize.x);
+        std::vector<double> destY(destSize.x);
+        std::vector<double> srcX(destSize.x);
+        std::vector<double> srcY(destSize.x);
+        std::vector<char> validCoord(destSize.x);
+        for (int x = xstart; x < xend; ++x)
+        {
+            destX[x - xstart] = x;
+        };
+#pragma omp for schedule(dynamic)
+        for (int y = ystart; y < yend; ++y)
         {
-            double sx, sy;
-            if (transform.transformImgCoord(sx, sy, x, y)) {
-                if (interpol.operator()(sx, sy, tempval)){
-                    // apply pixel transform and write to output
-                    dest.third.set(zeroNegative(pixelTransform(tempval, hugin_utils::FDiff2D(sx, sy))), xd);
-                    alpha.second.set(pixelTransform.hdrWeight(tempval, vigra::UInt8(255)), xdm);
+            // transform the whole row at once
+            std::fill(destY.begin(), destY.end(), y);
+            transformImgCoordBatch(transform, destX.data(), destY.data(), destSize.x, srcX.data(), srcY.data(), validCoord.data());
+            // create x iterators
+            DestImageIterator xd(dest.first);
+            xd.y += y - ystart;
+            AlphaImageIterator xdm(alpha.first);
+            xdm.y += y - ystart;
+            typename SrcAccessor::value_type tempval;
+            for (int i = 0; i < destSize.x; ++i, ++xd.x, ++xdm.x)
+            {
+                const double sx = srcX[i];
+                const double sy = srcY[i];
+                if (validCoord[i]) {
+                    if (interpol.operator()(sx, sy, tempval)){
+                        // apply pixel transform and write to output
+                        dest.third.set(zeroNegative(pixelTransform(tempval, hugin_utils::FDiff2D(sx, sy))), xd);
+                        alpha.second.set(pixelTransform.hdrWeight(tempval, vigra::UInt8(255)), xdm);
+                    }
+                    else {
+                        alpha.second.set(0, xdm);
+                    }
                 }
                 else {
                     alpha.second.set(0, xdm);
                 }
             }
-            else {
-                alpha.second.set(0, xdm);
-            }
         }
     }
 }
@@ -176,35 +239,118 @@ void transformImageAlphaIntern(vigra::triple<SrcImageIterator, SrcImageIterator,
                                     interpol (src, srcAlpha, interp, warparound);
 
     // loop over the image and transform
-#pragma omp parallel for if(!singleThreaded) schedule(dynamic)
-    for(int y=ystart; y < yend; ++y)
+#pragma omp parallel if(!singleThreaded)
     {
-        // create x iterators
-        DestImageIterator xd(dest.first);
-        xd.y += y - ystart;
-        AlphaImageIterator xdist(alpha.first);
-        xdist.y += y - ystart;
-        typename SrcAccessor::value_type tempval;
-        typename SrcAlphaAccessor::value_type alphaval;
-        for (int x = xstart; x < xend; ++x, ++xd.x, ++xdist.x)
+        // buffers for the source coordinates of one row
+        std::vector<double> destX(destSize.x);
+        std::vector<double> destY(destSize.x);
+        std::vector<double> srcX(destSize.x);
+        std::vector<double> srcY(destSize.x);
+        std::vector<char> validCoord(destSize.x);
+        for (int x = xstart; x < xend; ++x)
         {
-            double sx,sy;
-            if (transform.transformImgCoord(sx,sy,x,y)) {
-                // try to interpolate.
-                if (interpol(sx, sy, tempval, alphaval)) {
-                    dest.third.set(zeroNegative(pixelTransform(tempval, hugin_utils::FDiff2D(sx, sy))), xd);
-                    alpha.second.set(pixelTransform.hdrWeight(tempval, alphaval), xdist);
+            destX[x - xstart] = x;
+        };
+#pragma omp for schedule(dynamic)
+        for(int y=ystart; y < yend; ++y)
+        {
+            // transform the whole row at once
+            std::fill(destY.begin(), destY.end(), y);
+            transformImgCoordBatch(transform, destX.data(), destY.data(), destSize.x, srcX.data(), srcY.data(), validCoord.data());
+            // create x iterators
+            DestImageIterator xd(dest.first);
+            xd.y += y - ystart;
+            AlphaImageIterator xdist(alpha.first);
+            xdist.y += y - ystart;
+            typename SrcAccessor::value_type tempval;
+            typename SrcAlphaAccessor::value_type alphaval;
+            for (int i = 0; i < destSize.x; ++i, ++xd.x, ++xdist.x)
+            {
+                const double sx = srcX[i];
+                const double sy = srcY[i];
+                if (validCoord[i]) {
+                    // try to interpolate.
+                    if (interpol(sx, sy, tempval, alphaval)) {
+                        dest.third.set(zeroNegative(pixelTransform(tempval, hugin_utils::FDiff2D(sx, sy))), xd);
+                        alpha.second.set(pixelTransform.hdrWeight(tempval, alphaval), xdist);
+                    } else {
+                        // point outside of image or mask
+                        alpha.second.set(0, xdist);
+                    }
                 } else {
-                    // point outside of image or mask
                     alpha.second.set(0, xdist);
                 }
-            } else {
-                alpha.second.set(0, xdist);
             }
         }
     }
 };
 
+/** transform input image, uses the tabulated weights of @p interp if @p tabulated is true */
+template <class SrcImageIterator, class SrcAccessor,
+          class DestImageIterator, class DestAccessor,
+          class TRANSFORM,
+          class PixelTransform,
+          class AlphaImageIterator, class AlphaAccessor,
+          class Interpolator>
+void transformImageInternTabulated(vigra::triple<SrcImageIterator, SrcImageIterator, SrcAccessor> src,
+                                   vigra::triple<DestImageIterator, DestImageIterator, DestAccessor> dest,
+                                   std::pair<AlphaImageIterator, AlphaAccessor> alpha,
+                                   TRANSFORM & transform,
+                                   PixelTransform & pixelTransform,
+                                   vigra::Diff2D destUL,
+                                   Interpolator interp,
+                                   bool tabulated,
+                                   bool warparound,
+                                   AppBase::ProgressDisplay* progress,
+                                   bool singleThreaded)
+{
+    if (tabulated)
+    {
+        transformImageIntern(src, dest, alpha, transform, pixelTransform, destUL,
+                             vigra_ext::interp_tabulated<Interpolator>(), warparound,
+                             progress, singleThreaded);
+    }
+    else
+    {
+        transformImageIntern(src, dest, alpha, transform, pixelTransform, destUL,
+                             interp, warparound, progress, singleThreaded);
+    };
+}
+
+/** transform input image with alpha channel, uses the tabulated weights of @p interp if @p tabulated is true */
+template <class SrcImageIterator, class SrcAccessor,
+          class SrcAlphaIterator, class SrcAlphaAccessor,
+          class DestImageIterator, class DestAccessor,
+          class TRANSFORM,
+          class PixelTransform,
+          class AlphaImageIterator, class AlphaAccessor,
+          class Interpolator>
+void transformImageAlphaInternTabulated(vigra::triple<SrcImageIterator, SrcImageIterator, SrcAccessor> src,
+                                        std::pair<SrcAlphaIterator, SrcAlphaAccessor> srcAlpha,
+                                        vigra::triple<DestImageIterator, DestImageIterator, DestAccessor> dest,
+                                        std::pair<AlphaImageIterator, AlphaAccessor> alpha,
+                                        TRANSFORM & transform,
+                                        PixelTransform & pixelTransform,
+                                        vigra::Diff2D destUL,
+                                        Interpolator interp,
+                                        bool tabulated,
+                                        bool warparound,
+                                        AppBase::ProgressDisplay* progress,
+                                        bool singleThreaded)
+{
+    if (tabulated)
+    {
+        transformImageAlphaIntern(src, srcAlpha, dest, alpha, transform, pixelTransform, destUL,
+                                  vigra_ext::interp_tabulated<Interpolator>(), warparound,
+                                  progress, singleThreaded);
+    }
+    else
+    {
+        transformImageAlphaIntern(src, srcAlpha, dest, alpha, transform, pixelTransform, destUL,
+                                  interp, warparound, progress, singleThreaded);
+    };
+}
+
 /** Transform an image into the panorama
  *
  *  It can be used for partial transformations as well, if the boundig
@@ -227,6 +373,11 @@ void transformImageAlphaIntern(vigra::triple<SrcImageIterator, SrcImageIterator,
  *                src. This is useful to calculate nice seams. Use a null
  *                image if this information is not needed.
  *  @param interpol Interpolation algorithm that should be used.
+ *  @param tabulatedWeights if true, the interpolation weights are read from
+ *                precalculated tables (see interp_tabulated), this is
+ *                considerably faster for the spline and sinc interpolators.
+ *                The weights of bilinear and nearest neighbour interpolation
+ *                are always calculated directly.
  *
  */
 template <class SrcImageIterator, class SrcAccessor,
@@ -242,37 +393,38 @@ void transformImage(vigra::triple<SrcImageIterator, SrcImageIterator, SrcAccesso
                     PixelTransform & pixelTransform,
                     bool warparound,
                     Interpolator interpol,
-                    AppBase::ProgressDisplay* progress, bool singleThreaded = false)
+                    AppBase::ProgressDisplay* progress, bool singleThreaded = false,
+                    bool tabulatedWeights = false)
 {
     switch (interpol) {
     case INTERP_CUBIC:
 	DEBUG_DEBUG("using cubic interpolator");
-    transformImageIntern(src, dest, alpha, transform, pixelTransform, destUL,
-                                 vigra_ext::interp_cubic(), warparound,
+    transformImageInternTabulated(src, dest, alpha, transform, pixelTransform, destUL,
+                                 vigra_ext::interp_cubic(), tabulatedWeights, warparound,
                                  progress, singleThreaded);
 	break;
     case INTERP_SPLINE_16:
 	DEBUG_DEBUG("interpolator: spline16");
-    transformImageIntern(src, dest, alpha, transform, pixelTransform, destUL,
-                                 vigra_ext::interp_spline16(), warparound,
+    transformImageInternTabulated(src, dest, alpha, transform, pixelTransform, destUL,
+                                 vigra_ext::interp_spline16(), tabulatedWeights, warparound,
                                  progress, singleThreaded);
 	break;
     case INTERP_SPLINE_36:
 	DEBUG_DEBUG("interpolator: spline36");
-    transformImageIntern(src, dest, alpha, transform, pixelTransform, destUL,
-                                 vigra_ext::interp_spline36(), warparound,
+    transformImageInternTabulated(src, dest, alpha, transform, pixelTransform, destUL,
+                                 vigra_ext::interp_spline36(), tabulatedWeights, warparound,
                                  progress, singleThreaded);
 	break;
     case INTERP_SPLINE_64:
 	DEBUG_DEBUG("interpolator: spline64");
-    transformImageIntern(src, dest, alpha, transform, pixelTransform, destUL,
-                                 vigra_ext::interp_spline64(), warparound,
+    transformImageInternTabulated(src, dest, alpha, transform, pixelTransform, destUL,
+                                 vigra_ext::interp_spline64(), tabulatedWeights, warparound,
                                  progress, singleThreaded);
 	break;
     case INTERP_SINC_256:
 	DEBUG_DEBUG("interpolator: sinc 256");
-    transformImageIntern(src, dest, alpha, transform, pixelTransform, destUL,
-                                 vigra_ext::interp_sinc<8>(), warparound,
+    transformImageInternTabulated(src, dest, alpha, transform, pixelTransform, destUL,
+                                 vigra_ext::interp_sinc<8>(), tabulatedWeights, warparound,
                                  progress, singleThreaded);
 	break;
     case INTERP_BILINEAR:
@@ -286,8 +438,8 @@ void transformImage(vigra::triple<SrcImageIterator, SrcImageIterator, SrcAccesso
                                  progress, singleThreaded);
 	break;
     case INTERP_SINC_1024:
-        transformImageIntern(src, dest, alpha, transform, pixelTransform, destUL,
-                                 vigra_ext::interp_sinc<32>(), warparound,
+        transformImageInternTabulated(src, dest, alpha, transform, pixelTransform, destUL,
+                                 vigra_ext::interp_sinc<32>(), tabulatedWeights, warparound,
                                  progress, singleThreaded);
 	break;
     }
@@ -308,37 +460,38 @@ void transformImageAlpha(vigra::triple<SrcImageIterator, SrcImageIterator, SrcAc
                          PixelTransform & pixelTransform,
                          bool warparound,
                          Interpolator interpol,
-                         AppBase::ProgressDisplay* progress, bool singleThreaded = false)
+                         AppBase::ProgressDisplay* progress, bool singleThreaded = false,
+                         bool tabulatedWeights = false)
 {
     switch (interpol) {
     case INTERP_CUBIC:
 	DEBUG_DEBUG("using cubic interpolator");
-	transformImageAlphaIntern(src,srcAlpha, dest, alpha, transform, pixelTransform, destUL,
-				              vigra_ext::interp_cubic(), warparound,
+	transformImageAlphaInternTabulated(src,srcAlpha, dest, alpha, transform, pixelTransform, destUL,
+				              vigra_ext::interp_cubic(), tabulatedWeights, warparound,
                               progress, singleThreaded);
 	break;
     case INTERP_SPLINE_16:
 	DEBUG_DEBUG("interpolator: spline16");
-    transformImageAlphaIntern(src,srcAlpha, dest, alpha, transform, pixelTransform, destUL,
-                              vigra_ext::interp_spline16(), warparound,
+    transformImageAlphaInternTabulated(src,srcAlpha, dest, alpha, transform, pixelTransform, destUL,
+                              vigra_ext::interp_spline16(), tabulatedWeights, warparound,
                               progress, singleThreaded);
 	break;
     case INTERP_SPLINE_36:
 	DEBUG_DEBUG("interpolator: spline36");
-    transformImageAlphaIntern(src,srcAlpha, dest, alpha, transform, pixelTransform, destUL,
-                              vigra_ext::interp_spline36(),  warparound,
+    transformImageAlphaInternTabulated(src,srcAlpha, dest, alpha, transform, pixelTransform, destUL,
+                              vigra_ext::interp_spline36(), tabulatedWeights, warparound,
                               progress, singleThreaded);
 	break;
     case INTERP_SPLINE_64:
 	DEBUG_DEBUG("interpolator: spline64");
-    transformImageAlphaIntern(src,srcAlpha, dest, alpha, transform, pixelTransform, destUL,
-                              vigra_ext::interp_spline64(),  warparound,
+    transformImageAlphaInternTabulated(src,srcAlpha, dest, alpha, transform, pixelTransform, destUL,
+                              vigra_ext::interp_spline64(), tabulatedWeights, warparound,
                               progress, singleThreaded);
 	break;
     case INTERP_SINC_256:
 	DEBUG_DEBUG("interpolator: sinc 256");
-    transformImageAlphaIntern(src,srcAlpha, dest, alpha, transform, pixelTransform, destUL,
-                              vigra_ext::interp_sinc<8>(), warparound,
+    transformImageAlphaInternTabulated(src,srcAlpha, dest, alpha, transform, pixelTransform, destUL,
+                              vigra_ext::interp_sinc<8>(), tabulatedWeights, warparound,
                               progress, singleThreaded);
 	break;
     case INTERP_BILINEAR:
@@ -352,8 +505,8 @@ void transformImageAlpha(vigra::triple<SrcImageIterator, SrcImageIterator, SrcAc
                               progress, singleThreaded);
 	break;
     case INTERP_SINC_1024:
-        transformImageAlphaIntern(src,srcAlpha, dest, alpha, transform, pixelTransform, destUL,
-                              vigra_ext::interp_sinc<32>(), warparound,
+        transformImageAlphaInternTabulated(src,srcAlpha, dest, alpha, transform, pixelTransform, destUL,
+                              vigra_ext::interp_sinc<32>(), tabulatedWeights, warparound,
                               progress, singleThreaded);
 	break;
     }
@@ -33,9 +33,14 @@
 #include <math.h>
 #include <hugin_math/hugin_math.h>
 #include <algorithm>
+#include <vector>
+#include <type_traits>
 
 #include <vigra/accessor.hxx>
 #include <vigra/diff2d.hxx>
+#include <vigra/basicimage.hxx>
+#include <vigra/rgbvalue.hxx>
+#include <vigra_ext/InterpolatorsSIMD.h>
 
 using std::endl;
 
@@ -281,6 +286,176 @@ struct interp_sinc
 };
 
 
+/** interpolator weights read from a precalculated table.
+ *
+ *  The weights of INTERPOLATOR are tabulated for resolution+1 equidistant
+ *  offsets in [0,1] and linearly interpolated in between, so calc_coeff does
+ *  not need to evaluate any polynomial or transcendental function. The table
+ *  is created on first use and shared by all instances (and threads).
+ *
+ *  The error of the linear interpolation is bounded by h^2/8*max|w''| with
+ *  h=1/resolution. For the kernels in this file with the default resolution
+ *  of 1024 steps this is below 1e-6 for each weight, which is less than the
+ *  quantization step of 16 bit images. The real maximal deviation from the
+ *  exact weights is measured when creating the table and can be queried with
+ *  maxDeviation().
+ *
+ *  Only suitable for interpolators with continuous weights, so don't use it
+ *  with interp_nearest.
+ */
+template <class INTERPOLATOR, int resolution = 1024>
+struct interp_tabulated
+{
+    // size of neighbourhood
+    static const int size = INTERPOLATOR::size;
+
+    /** initialize weights for given offset @p x */
+    void calc_coeff(double x, double * w) const
+        {
+            const WeightTable& table = getTable();
+            const double pos = x * resolution;
+            const int index = std::min(std::max(static_cast<int>(pos), 0), resolution - 1);
+            const double t = pos - index;
+            const float* w0 = &table.weights[index * size];
+            const float* w1 = w0 + size;
+            for (int i = 0; i < size; ++i)
+            {
+                w[i] = w0[i] + t * (w1[i] - w0[i]);
+            }
+        }
+
+    /** returns the maximal deviation of the tabulated weights from the exact weights */
+    static double maxDeviation()
+        {
+            return getTable().maxDeviation;
+        }
+
+    void emitGLSL(std::ostringstream& oss) const {
+        INTERPOLATOR().emitGLSL(oss);
+    }
+
+private:
+    struct WeightTable
+    {
+        WeightTable() : weights((resolution + 1) * size), maxDeviation(0)
+        {
+            INTERPOLATOR inter;
+            double w[size];
+            for (int i = 0; i <= resolution; ++i)
+            {
+                inter.calc_coeff(static_cast<double>(i) / resolution, w);
+                for (int j = 0; j < size; ++j)
+                {
+                    weights[i * size + j] = static_cast<float>(w[j]);
+                }
+            }
+            // compare with the exact weights inside each step
+            const int subSteps = 8;
+            for (int i = 0; i < resolution; ++i)
+            {
+                for (int k = 1; k < subSteps; ++k)
+                {
+                    const double t = static_cast<double>(k) / subSteps;
+                    inter.calc_coeff((i + t) / resolution, w);
+                    for (int j = 0; j < size; ++j)
+                    {
+                        const double w0 = weights[i * size + j];
+                        const double w1 = weights[(i + 1) * size + j];
+                        maxDeviation = std::max(maxDeviation, fabs(w0 + t * (w1 - w0) - w[j]));
+                    }
+                }
+            }
+        }
+        std::vector<float> weights;
+        double maxDeviation;
+    };
+
+    static const WeightTable& getTable()
+        {
+            // initialization of local static variables is thread safe in C++11
+            static const WeightTable table;
+            return table;
+        }
+};
+
+
+namespace detail
+{
+/** channel types supported by the vectorized kernels in InterpolatorsSIMD.h */
+template <class T>
+struct SIMDChannel
+{
+    enum { supported = false };
+};
+
+template <> struct SIMDChannel<vigra::UInt8> { enum { supported = true }; };
+template <> struct SIMDChannel<vigra::UInt16> { enum { supported = true }; };
+template <> struct SIMDChannel<float> { enum { supported = true }; };
+
+/** RGB images stored in a vigra::BasicImage, which allow direct access to the channels */
+template <class ITERATOR>
+struct SIMDRGBImage
+{
+    enum { supported = false };
+};
+
+template <class T>
+struct SIMDRGBImage<vigra::BasicImageIterator<vigra::RGBValue<T>, vigra::RGBValue<T>**> >
+{
+    enum { supported = SIMDChannel<T>::supported };
+    typedef T channel_type;
+};
+
+template <class T>
+struct SIMDRGBImage<vigra::ConstBasicImageIterator<vigra::RGBValue<T>, vigra::RGBValue<T>**> >
+{
+    enum { supported = SIMDChannel<T>::supported };
+    typedef T channel_type;
+};
+
+/** masks stored in a vigra::BasicImage<vigra::UInt8> */
+template <class ITERATOR>
+struct SIMDMask
+{
+    enum { supported = false };
+};
+
+template <> struct SIMDMask<vigra::BasicImageIterator<vigra::UInt8, vigra::UInt8**> > { enum { supported = true }; };
+template <> struct SIMDMask<vigra::ConstBasicImageIterator<vigra::UInt8, vigra::UInt8**> > { enum { supported = true }; };
+
+/** accessors, which return the pixel unmodified */
+template <class ACCESSOR>
+struct SIMDAccessor
+{
+    enum { supported = false };
+};
+
+template <class T> struct SIMDAccessor<vigra::StandardAccessor<T> > { enum { supported = true }; };
+template <class T> struct SIMDAccessor<vigra::StandardValueAccessor<T> > { enum { supported = true }; };
+template <class T> struct SIMDAccessor<vigra::StandardConstAccessor<T> > { enum { supported = true }; };
+template <class T> struct SIMDAccessor<vigra::StandardConstValueAccessor<T> > { enum { supported = true }; };
+template <class T> struct SIMDAccessor<vigra::RGBAccessor<T> > { enum { supported = true }; };
+
+/** checks if the interior pixels of a RGB image can be interpolated with the
+ *  vectorized kernels: the pixels have to be stored in a vigra::BasicImage and
+ *  the accessor must not modify the values */
+template <class SrcImageIterator, class SrcAccessor, class INTERPOLATOR>
+struct SIMDInterpolation
+{
+    enum { supported = SIMDRGBImage<SrcImageIterator>::supported && SIMDAccessor<SrcAccessor>::supported &&
+                       INTERPOLATOR::size <= vigra_ext::simd::MaxInterpolatorSize };
+};
+
+/** the same for the mask, only vigra::UInt8 masks are supported */
+template <class SrcImageIterator, class SrcAccessor, class MaskIterator, class INTERPOLATOR>
+struct SIMDMaskInterpolation
+{
+    enum { supported = SIMDInterpolation<SrcImageIterator, SrcAccessor, INTERPOLATOR>::supported &&
+                       SIMDMask<MaskIterator>::supported };
+};
+
+} // namespace detail
+
 /** "wrapper" for efficient interpolation access to an image
  *
  *  Tailored for panorama remapping. Supports warparound boundary condition of left and right
@@ -422,6 +597,45 @@ public:
     /** Interpolate without boundary check and mask */
     bool interpolateNoMaskInside(int srcx, int srcy, double dx, double dy,
                                     PixelType & result) const
+    {
+        return interpolateNoMaskInside(srcx, srcy, dx, dy, result,
+            std::integral_constant<bool, detail::SIMDInterpolation<SrcImageIterator, SrcAccessor, INTERPOLATOR>::supported>());
+    }
+
+    void emitGLSL(std::ostringstream& oss) const {
+        m_inter.emitGLSL(oss);
+    }
+
+private:
+    /** Interpolate without boundary check and mask, vectorized version for RGB images */
+    bool interpolateNoMaskInside(int srcx, int srcy, double dx, double dy,
+                                    PixelType & result, std::true_type) const
+    {
+        typedef typename detail::SIMDRGBImage<SrcImageIterator>::channel_type ChannelType;
+        double w[INTERPOLATOR::size];
+        float wx[INTERPOLATOR::size];
+        float wy[INTERPOLATOR::size];
+        m_inter.calc_coeff(dx, w);
+        std::copy(w, w + INTERPOLATOR::size, wx);
+        m_inter.calc_coeff(dy, w);
+        std::copy(w, w + INTERPOLATOR::size, wy);
+
+        const ChannelType* rows[INTERPOLATOR::size];
+        SrcImageIterator ys(m_sIter + vigra::Diff2D(srcx - INTERPOLATOR::size/2 + 1,
+                                                    srcy - INTERPOLATOR::size/2 + 1));
+        for (int ky = 0; ky < INTERPOLATOR::size; ky++, ++(ys.y)) {
+            rows[ky] = reinterpret_cast<const ChannelType*>(&(*ys));
+        }
+        float p[3];
+        vigra_ext::simd::interpolateRGB(rows, INTERPOLATOR::size, wx, wy, p);
+
+        result = vigra::detail::RequiresExplicitCast<PixelType>::cast(RealPixelType(p[0], p[1], p[2]));
+        return true;
+    }
+
+    /** Interpolate without boundary check and mask, generic version */
+    bool interpolateNoMaskInside(int srcx, int srcy, double dx, double dy,
+                                    PixelType & result, std::false_type) const
     {
         double w[INTERPOLATOR::size];
         RealPixelType resX[INTERPOLATOR::size];
@@ -456,10 +670,6 @@ public:
         return true;
     }
 
-    void emitGLSL(std::ostringstream& oss) const {
-        m_inter.emitGLSL(oss);
-    }
-
 };
 
 
@@ -749,6 +959,58 @@ public:
     bool interpolateInside(int srcx, int srcy, double dx, double dy,
                                     PixelType & result, MaskType & mask) const
     {
+        return interpolateInside(srcx, srcy, dx, dy, result, mask,
+            std::integral_constant<bool, detail::SIMDMaskInterpolation<SrcImageIterator, SrcAccessor, MaskIterator, INTERPOLATOR>::supported>());
+    }
+
+private:
+    /** Interpolate without boundary check, vectorized version for RGB images */
+    bool interpolateInside(int srcx, int srcy, double dx, double dy,
+                                    PixelType & result, MaskType & mask, std::true_type) const
+    {
+        typedef typename detail::SIMDRGBImage<SrcImageIterator>::channel_type ChannelType;
+        double w[INTERPOLATOR::size];
+        float wx[INTERPOLATOR::size];
+        float wy[INTERPOLATOR::size];
+        m_inter.calc_coeff(dx, w);
+        std::copy(w, w + INTERPOLATOR::size, wx);
+        m_inter.calc_coeff(dy, w);
+        std::copy(w, w + INTERPOLATOR::size, wy);
+
+        const ChannelType* rows[INTERPOLATOR::size];
+        const vigra::UInt8* maskRows[INTERPOLATOR::size];
+        vigra::Diff2D offset(srcx - INTERPOLATOR::size/2 + 1,
+                             srcy - INTERPOLATOR::size/2 + 1);
+        SrcImageIterator ys(m_sIter + offset);
+        MaskIterator yms(m_mIter + offset);
+        for (int ky = 0; ky < INTERPOLATOR::size; ky++, ++(ys.y), ++(yms.y)) {
+            rows[ky] = reinterpret_cast<const ChannelType*>(&(*ys));
+            maskRows[ky] = &(*yms);
+        }
+        float p[3];
+        float m;
+        float weightsum;
+        vigra_ext::simd::interpolateRGBMask(rows, maskRows, INTERPOLATOR::size, wx, wy, p, m, weightsum);
+
+        // force a certain weight
+        if (weightsum <= 0.2) return false;
+        RealPixelType rp(p[0], p[1], p[2]);
+        double rm = m;
+        // Adjust filter for any ignored transparent pixels.
+        if (weightsum != 1.0) {
+            rp /= weightsum;
+            rm /= weightsum;
+        }
+
+        result = vigra::detail::RequiresExplicitCast<PixelType>::cast(rp);
+        mask = vigra::detail::RequiresExplicitCast<MaskType>::cast(rm);
+        return true;
+    }
+
+    /** Interpolate without boundary check, generic version */
+    bool interpolateInside(int srcx, int srcy, double dx, double dy,
+                                    PixelType & result, MaskType & mask, std::false_type) const
+    {
 
         double wx[INTERPOLATOR::size];
         double wy[INTERPOLATOR::size];
@@ -0,0 +1,501 @@
+// -*- c-basic-offset: 4 -*-
+/** @file InterpolatorsSIMD.cpp
+ *
+ *  vectorized interpolation kernels for the interior pixels of RGB images
+ *
+ *  The kernels are compiled for several instruction sets, the best one
+ *  supported by the cpu is selected at the first call. No special compiler
+ *  flags are needed, gcc and clang get the instruction set via the
+ *  target attribute of the functions.
+ *
+ *  This is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public
+ *  License along with this software. If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "InterpolatorsSIMD.h"
+
+#include <cstring>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define HAVE_X86_SIMD 1
+#include <immintrin.h>
+#if defined(__GNUC__) || defined(__clang__)
+#define TARGET_SSE41 __attribute__((target("sse4.1")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+// MSVC allows the intrinsics without special flags
+#define TARGET_SSE41
+#define TARGET_AVX2
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+namespace vigra_ext
+{
+namespace simd
+{
+
+namespace
+{
+
+/** the row pass for the channels, the same for all instruction sets, the size is small */
+inline void horizontalPass(const float* acc, const int size, const float* wx, float* result)
+{
+    float r = 0.0f;
+    float g = 0.0f;
+    float b = 0.0f;
+    for (int k = 0; k < size; ++k)
+    {
+        r += wx[k] * acc[3 * k];
+        g += wx[k] * acc[3 * k + 1];
+        b += wx[k] * acc[3 * k + 2];
+    };
+    result[0] = r;
+    result[1] = g;
+    result[2] = b;
+}
+
+/** the row pass for the weight and mask sums of the masked kernel */
+inline void horizontalMaskPass(const float* accWeight, const float* accMask, const int size, const float* wx,
+                               float& mask, float& weightSum)
+{
+    weightSum = 0.0f;
+    mask = 0.0f;
+    for (int k = 0; k < size; ++k)
+    {
+        weightSum += wx[k] * accWeight[k];
+        mask += wx[k] * accMask[k];
+    };
+}
+
+/** the column pass for the elements [start, end) of the rows */
+template <class T>
+inline void verticalPassScalar(const T* const* rows, const int size, const float* wy, const int start, const int end, float* acc)
+{
+    for (int i = start; i < end; ++i)
+    {
+        float sum = 0.0f;
+        for (int ky = 0; ky < size; ++ky)
+        {
+            sum += wy[ky] * static_cast<float>(rows[ky][i]);
+        };
+        acc[i] = sum;
+    };
+}
+
+/** returns true if one of the 4 bytes at p is 0 */
+inline bool hasZeroByte4(const vigra::UInt8* p)
+{
+    vigra::UInt32 v;
+    memcpy(&v, p, sizeof(v));
+    return ((v - 0x01010101u) & ~v & 0x80808080u) != 0;
+}
+
+/** returns true if one of the first size bytes is 0 */
+inline bool hasZeroByte(const vigra::UInt8* p, const int size)
+{
+    if (size < 4)
+    {
+        return memchr(p, 0, size) != NULL;
+    };
+    for (int i = 0; i + 4 <= size; i += 4)
+    {
+        if (hasZeroByte4(p + i))
+        {
+            return true;
+        };
+    };
+    // check the remaining bytes with an overlapping word
+    return size % 4 != 0 && hasZeroByte4(p + size - 4);
+}
+
+/** the part of the masked column pass which works on pixels instead of channels,
+ *  also creates the bit masks for selecting the channels of the valid pixels */
+inline void maskRowPass(const vigra::UInt8* maskRow, const int size, const float w,
+                        float* accWeight, float* accMask, vigra::UInt32* channelMask)
+{
+    for (int k = 0; k < size; ++k)
+    {
+        const vigra::UInt8 m = maskRow[k];
+        const vigra::UInt32 bits = m ? 0xFFFFFFFFu : 0u;
+        channelMask[3 * k] = bits;
+        channelMask[3 * k + 1] = bits;
+        channelMask[3 * k + 2] = bits;
+        accWeight[k] += m ? w : 0.0f;
+        accMask[k] += w * m;
+    };
+}
+
+/** returns the value of the channel, or 0 if the bit mask is 0 */
+template <class T>
+inline float maskedValue(const T value, const vigra::UInt32 bits)
+{
+    return bits ? static_cast<float>(value) : 0.0f;
+}
+
+// scalar versions, used on cpus without the necessary instruction set
+template <class T>
+void verticalPassScalar(const T* const* rows, const int size, const float* wy, const int n, float* acc)
+{
+    verticalPassScalar(rows, size, wy, 0, n, acc);
+}
+
+template <class T>
+void maskedVerticalPassScalar(const T* const* rows, const vigra::UInt8* const* maskRows, const int size,
+                              const float* wy, float* acc, float* accWeight, float* accMask)
+{
+    const int n = 3 * size;
+    vigra::UInt32 channelMask[3 * MaxInterpolatorSize];
+    for (int ky = 0; ky < size; ++ky)
+    {
+        maskRowPass(maskRows[ky], size, wy[ky], accWeight, accMask, channelMask);
+        for (int i = 0; i < n; ++i)
+        {
+            acc[i] += wy[ky] * maskedValue(rows[ky][i], channelMask[i]);
+        };
+    };
+}
+
+#ifdef HAVE_X86_SIMD
+// load 4 channels and convert them to float
+TARGET_SSE41 inline __m128 load4(const vigra::UInt8* p)
+{
+    int v;
+    memcpy(&v, p, sizeof(v));
+    return _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(v)));
+}
+
+TARGET_SSE41 inline __m128 load4(const vigra::UInt16* p)
+{
+    return _mm_cvtepi32_ps(_mm_cvtepu16_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p))));
+}
+
+TARGET_SSE41 inline __m128 load4(const float* p)
+{
+    return _mm_loadu_ps(p);
+}
+
+/** column pass for the 4 elements starting at i */
+template <class T>
+TARGET_SSE41 inline void verticalBlockSSE41(const T* const* rows, const int size, const float* wy, const int i, float* acc)
+{
+    __m128 sum = _mm_setzero_ps();
+    for (int ky = 0; ky < size; ++ky)
+    {
+        sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(wy[ky]), load4(rows[ky] + i)));
+    };
+    _mm_storeu_ps(acc + i, sum);
+}
+
+template <class T>
+TARGET_SSE41 void verticalPassSSE41(const T* const* rows, const int size, const float* wy, const int n, float* acc)
+{
+    if (n < 4)
+    {
+        verticalPassScalar(rows, size, wy, 0, n, acc);
+        return;
+    };
+    for (int i = 0; i + 4 <= n; i += 4)
+    {
+        verticalBlockSSE41(rows, size, wy, i, acc);
+    };
+    if (n % 4 != 0)
+    {
+        // the last block overlaps the previous one, the elements get the same value again,
+        // this avoids reading behind the last element
+        verticalBlockSSE41(rows, size, wy, n - 4, acc);
+    };
+}
+
+template <class T>
+TARGET_SSE41 void maskedVerticalPassSSE41(const T* const* rows, const vigra::UInt8* const* maskRows, const int size,
+                                          const float* wy, float* acc, float* accWeight, float* accMask)
+{
+    const int n = 3 * size;
+    vigra::UInt32 channelMask[3 * MaxInterpolatorSize];
+    for (int ky = 0; ky < size; ++ky)
+    {
+        maskRowPass(maskRows[ky], size, wy[ky], accWeight, accMask, channelMask);
+        const __m128 w = _mm_set1_ps(wy[ky]);
+        int i = 0;
+        for (; i + 4 <= n; i += 4)
+        {
+            // and with the bit mask, so that masked out nan or inf are ignored too
+            const __m128 value = _mm_and_ps(load4(rows[ky] + i), _mm_loadu_ps(reinterpret_cast<const float*>(channelMask + i)));
+            _mm_storeu_ps(acc + i, _mm_add_ps(_mm_loadu_ps(acc + i), _mm_mul_ps(w, value)));
+        };
+        for (; i < n; ++i)
+        {
+            acc[i] += wy[ky] * maskedValue(rows[ky][i], channelMask[i]);
+        };
+    };
+}
+
+// load 8 channels and convert them to float
+TARGET_AVX2 inline __m256 load8(const vigra::UInt8* p)
+{
+    return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p))));
+}
+
+TARGET_AVX2 inline __m256 load8(const vigra::UInt16* p)
+{
+    return _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p))));
+}
+
+TARGET_AVX2 inline __m256 load8(const float* p)
+{
+    return _mm256_loadu_ps(p);
+}
+
+/** column pass for the 8 elements starting at i */
+template <class T>
+TARGET_AVX2 inline void verticalBlockAVX2(const T* const* rows, const int size, const float* wy, const int i, float* acc)
+{
+    __m256 sum = _mm256_setzero_ps();
+    for (int ky = 0; ky < size; ++ky)
+    {
+        // no fused multiply-add, so that the result is the same as with the other instruction sets
+        sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_set1_ps(wy[ky]), load8(rows[ky] + i)));
+    };
+    _mm256_storeu_ps(acc + i, sum);
+}
+
+template <class T>
+TARGET_AVX2 void verticalPassAVX2(const T* const* rows, const int size, const float* wy, const int n, float* acc)
+{
+    if (n < 8)
+    {
+        verticalPassSSE41(rows, size, wy, n, acc);
+        return;
+    };
+    for (int i = 0; i + 8 <= n; i += 8)
+    {
+        verticalBlockAVX2(rows, size, wy, i, acc);
+    };
+    if (n % 8 != 0)
+    {
+        // overlapping last block, see verticalPassSSE41
+        verticalBlockAVX2(rows, size, wy, n - 8, acc);
+    };
+}
+
+template <class T>
+TARGET_AVX2 void maskedVerticalPassAVX2(const T* const* rows, const vigra::UInt8* const* maskRows, const int size,
+                                        const float* wy, float* acc, float* accWeight, float* accMask)
+{
+    const int n = 3 * size;
+    vigra::UInt32 channelMask[3 * MaxInterpolatorSize];
+    for (int ky = 0; ky < size; ++ky)
+    {
+        maskRowPass(maskRows[ky], size, wy[ky], accWeight, accMask, channelMask);
+        const __m256 w = _mm256_set1_ps(wy[ky]);
+        int i = 0;
+        for (; i + 8 <= n; i += 8)
+        {
+            const __m256 value = _mm256_and_ps(load8(rows[ky] + i), _mm256_loadu_ps(reinterpret_cast<const float*>(channelMask + i)));
+            _mm256_storeu_ps(acc + i, _mm256_add_ps(_mm256_loadu_ps(acc + i), _mm256_mul_ps(w, value)));
+        };
+        for (; i < n; ++i)
+        {
+            acc[i] += wy[ky] * maskedValue(rows[ky][i], channelMask[i]);
+        };
+    };
+}
+#endif
+
+enum InstructionSet
+{
+    ISA_SCALAR = 0,
+    ISA_SSE41,
+    ISA_AVX2
+};
+
+/** check which instruction sets are supported by the cpu and the os */
+InstructionSet DetectInstructionSet()
+{
+#ifdef HAVE_X86_SIMD
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    const int maxLeaf = info[0];
+    __cpuid(info, 1);
+    const bool sse41 = (info[2] & (1 << 19)) != 0;
+    // avx needs also support by the os for saving the ymm registers
+    const bool osAVX = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0 && (_xgetbv(0) & 6) == 6;
+    bool avx2 = false;
+    if (osAVX && maxLeaf >= 7)
+    {
+        __cpuidex(info, 7, 0);
+        avx2 = (info[1] & (1 << 5)) != 0;
+    };
+#else
+    __builtin_cpu_init();
+    const bool sse41 = __builtin_cpu_supports("sse4.1");
+    const bool avx2 = __builtin_cpu_supports("avx2");
+#endif
+    if (avx2)
+    {
+        return ISA_AVX2;
+    };
+    if (sse41)
+    {
+        return ISA_SSE41;
+    };
+#endif
+    return ISA_SCALAR;
+}
+
+InstructionSet GetInstructionSet()
+{
+    static const InstructionSet isa = DetectInstructionSet();
+    return isa;
+}
+
+/** the column passes for one channel type, selected for the instruction set of the cpu */
+template <class T>
+struct Kernels
+{
+    typedef void(*VerticalPassFunc)(const T* const*, const int, const float*, const int, float*);
+    typedef void(*MaskedVerticalPassFunc)(const T* const*, const vigra::UInt8* const*, const int,
+                                          const float*, float*, float*, float*);
+    Kernels()
+    {
+        switch (GetInstructionSet())
+        {
+#ifdef HAVE_X86_SIMD
+            case ISA_AVX2:
+                verticalPass = &verticalPassAVX2<T>;
+                maskedVerticalPass = &maskedVerticalPassAVX2<T>;
+                break;
+            case ISA_SSE41:
+                verticalPass = &verticalPassSSE41<T>;
+                maskedVerticalPass = &maskedVerticalPassSSE41<T>;
+                break;
+#endif
+            default:
+                verticalPass = &verticalPassScalar<T>;
+                maskedVerticalPass = &maskedVerticalPassScalar<T>;
+                break;
+        };
+    };
+    VerticalPassFunc verticalPass;
+    MaskedVerticalPassFunc maskedVerticalPass;
+};
+
+template <class T>
+const Kernels<T>& GetKernels()
+{
+    static const Kernels<T> kernels;
+    return kernels;
+}
+
+template <class T>
+void InterpolateRGB(const T* const* rows, const int size, const float* wx, const float* wy, float* result)
+{
+    float acc[3 * MaxInterpolatorSize];
+    GetKernels<T>().verticalPass(rows, size, wy, 3 * size, acc);
+    horizontalPass(acc, size, wx, result);
+}
+
+template <class T>
+void InterpolateRGBMask(const T* const* rows, const vigra::UInt8* const* maskRows, const int size,
+                        const float* wx, const float* wy, float* result, float& mask, float& weightSum)
+{
+    float acc[3 * MaxInterpolatorSize];
+    float accWeight[MaxInterpolatorSize];
+    float accMask[MaxInterpolatorSize];
+    bool allValid = true;
+    for (int ky = 0; ky < size && allValid; ++ky)
+    {
+        allValid = !hasZeroByte(maskRows[ky], size);
+    };
+    if (allValid)
+    {
+        // all pixels in the neighbourhood are valid, which is the usual case,
+        // so the channels and the mask can be interpolated like images without
+        // mask, this gives the same result as the masked column pass
+        GetKernels<T>().verticalPass(rows, size, wy, 3 * size, acc);
+        GetKernels<vigra::UInt8>().verticalPass(maskRows, size, wy, size, accMask);
+        float sumWeight = 0.0f;
+        for (int ky = 0; ky < size; ++ky)
+        {
+            sumWeight += wy[ky];
+        };
+        std::fill_n(accWeight, size, sumWeight);
+    }
+    else
+    {
+        std::fill_n(acc, 3 * size, 0.0f);
+        std::fill_n(accWeight, size, 0.0f);
+        std::fill_n(accMask, size, 0.0f);
+        GetKernels<T>().maskedVerticalPass(rows, maskRows, size, wy, acc, accWeight, accMask);
+    };
+    horizontalPass(acc, size, wx, result);
+    horizontalMaskPass(accWeight, accMask, size, wx, mask, weightSum);
+}
+
+} // namespace
+
+const char* getInstructionSet()
+{
+    switch (GetInstructionSet())
+    {
+        case ISA_AVX2:
+            return "avx2";
+        case ISA_SSE41:
+            return "sse4.1";
+        default:
+            return "scalar";
+    };
+}
+
+void interpolateRGB(const vigra::UInt8* const* rows, int size, const float* wx, const float* wy, float* result)
+{
+    InterpolateRGB(rows, size, wx, wy, result);
+}
+
+void interpolateRGB(const vigra::UInt16* const* rows, int size, const float* wx, const float* wy, float* result)
+{
+    InterpolateRGB(rows, size, wx, wy, result);
+}
+
+void interpolateRGB(const float* const* rows, int size, const float* wx, const float* wy, float* result)
+{
+    InterpolateRGB(rows, size, wx, wy, result);
+}
+
+void interpolateRGBMask(const vigra::UInt8* const* rows, const vigra::UInt8* const* maskRows, int size,
+                        const float* wx, const float* wy, float* result, float& mask, float& weightSum)
+{
+    InterpolateRGBMask(rows, maskRows, size, wx, wy, result, mask, weightSum);
+}
+
+void interpolateRGBMask(const vigra::UInt16* const* rows, const vigra::UInt8* const* maskRows, int size,
+                        const float* wx, const float* wy, float* result, float& mask, float& weightSum)
+{
+    InterpolateRGBMask(rows, maskRows, size, wx, wy, result, mask, weightSum);
+}
+
+void interpolateRGBMask(const float* const* rows, const vigra::UInt8* const* maskRows, int size,
+                        const float* wx, const float* wy, float* result, float& mask, float& weightSum)
+{
+    InterpolateRGBMask(rows, maskRows, size, wx, wy, result, mask, weightSum);
+}
+
+} // namespace simd
+} // namespace vigra_ext
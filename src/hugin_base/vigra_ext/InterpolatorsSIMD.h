@@ -0,0 +1,80 @@
+// -*- c-basic-offset: 4 -*-
+/** @file InterpolatorsSIMD.h
+ *
+ *  vectorized interpolation kernels for the interior pixels of RGB images
+ *
+ *  This is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public
+ *  License along with this software. If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef VIGRA_EXT_INTERPOLATORSSIMD_H
+#define VIGRA_EXT_INTERPOLATORSSIMD_H
+
+#include <hugin_shared.h>
+#include <vigra/sized_int.hxx>
+
+namespace vigra_ext
+{
+namespace simd
+{
+
+/** largest neighbourhood supported by the kernels (sinc1024) */
+const int MaxInterpolatorSize = 32;
+
+/** returns the name of the instruction set, which is used by the kernels.
+ *  It is selected at runtime depending on the capabilities of the cpu
+ *  ("avx2", "sse4.1" or "scalar") */
+IMPEX const char* getInstructionSet();
+
+/** interpolate a size x size neighbourhood of a RGB image with interleaved channels.
+ *
+ *  The calculation is done in float, first along the columns and then along
+ *  the row. All instruction sets give the same result.
+ *
+ *  @param rows pointers to the first channel of the first pixel of each row of the neighbourhood
+ *  @param size size of the neighbourhood, at most MaxInterpolatorSize
+ *  @param wx interpolation weights in x direction
+ *  @param wy interpolation weights in y direction
+ *  @param result array for the interpolated red, green and blue value
+ */
+IMPEX void interpolateRGB(const vigra::UInt8* const* rows, int size, const float* wx, const float* wy, float* result);
+IMPEX void interpolateRGB(const vigra::UInt16* const* rows, int size, const float* wx, const float* wy, float* result);
+IMPEX void interpolateRGB(const float* const* rows, int size, const float* wx, const float* wy, float* result);
+
+/** interpolate a size x size neighbourhood of a RGB image with mask.
+ *
+ *  Pixels with mask value 0 are ignored. The result is not normalized, the
+ *  caller has to divide @p result and @p mask by @p weightSum.
+ *
+ *  @param rows pointers to the first channel of the first pixel of each row of the neighbourhood
+ *  @param maskRows pointers to the first mask pixel of each row of the neighbourhood
+ *  @param size size of the neighbourhood, at most MaxInterpolatorSize
+ *  @param wx interpolation weights in x direction
+ *  @param wy interpolation weights in y direction
+ *  @param result array for the weighted sum of the red, green and blue values
+ *  @param mask weighted sum of the mask values
+ *  @param weightSum sum of the weights of all pixels with mask value > 0
+ */
+IMPEX void interpolateRGBMask(const vigra::UInt8* const* rows, const vigra::UInt8* const* maskRows, int size,
+                              const float* wx, const float* wy, float* result, float& mask, float& weightSum);
+IMPEX void interpolateRGBMask(const vigra::UInt16* const* rows, const vigra::UInt8* const* maskRows, int size,
+                              const float* wx, const float* wy, float* result, float& mask, float& weightSum);
+IMPEX void interpolateRGBMask(const float* const* rows, const vigra::UInt8* const* maskRows, int size,
+                              const float* wx, const float* wy, float* result, float& mask, float& weightSum);
+
+} // namespace simd
+} // namespace vigra_ext
+
+#endif // VIGRA_EXT_INTERPOLATORSSIMD_H
@@ -166,6 +166,37 @@ void reduceToNextLevel(ImageIn & in, ImageInMask & inMask, ImageOut & out, Image
                                 destImageRange(out), destImageRange(outMask));
 }
 
+/** reduce the image given by iterators to the next level,
+ *  set @p wraparound for images which cover 360 degrees */
+template <class SrcIterator, class SrcAccessor, class ImageOut>
+void reduceToNextLevel(vigra::triple<SrcIterator, SrcIterator, SrcAccessor> in, ImageOut & out, bool wraparound)
+{
+    typedef typename ImageOut::value_type vt;
+    typedef typename vigra::NumericTraits<vt>::RealPromote SKIPSMType;
+
+    const vigra::Diff2D size = in.second - in.first;
+    out.resize((size.x + 1) >> 1, (size.y + 1) >> 1);
+    enblend::reduce<SKIPSMType>(wraparound, in, destImageRange(out));
+}
+
+/** reduce the image and mask given by iterators to the next level,
+ *  set @p wraparound for images which cover 360 degrees */
+template <class SrcIterator, class SrcAccessor, class MaskIterator, class MaskAccessor,
+          class ImageOut, class ImageOutMask>
+void reduceToNextLevel(vigra::triple<SrcIterator, SrcIterator, SrcAccessor> in, std::pair<MaskIterator, MaskAccessor> inMask,
+                       ImageOut & out, ImageOutMask & outMask, bool wraparound)
+{
+    typedef typename ImageOut::value_type vt;
+    typedef typename vigra::NumericTraits<vt>::RealPromote SKIPSMType;
+    typedef double SKIPSMAlphaType;
+
+    const vigra::Diff2D size = in.second - in.first;
+    out.resize((size.x + 1) >> 1, (size.y + 1) >> 1);
+    outMask.resize(out.size());
+    enblend::reduce<SKIPSMType, SKIPSMAlphaType>(wraparound, in, inMask,
+                                destImageRange(out), destImageRange(outMask));
+}
+
 
 static const double AA = 0.4;
 static const double W[] = {0.25 - AA / 2.0, 0.25, AA, 0.25, 0.25 - AA / 2.0};
@@ -0,0 +1,344 @@
+// -*- c-basic-offset: 4 -*-
+/** @file vigra_ext/PyramidTransform.h
+ *
+ *  Remapping, which samples from a level of a Gaussian pyramid of the
+ *  source image, when the image is scaled down.
+ *
+ *  This is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public
+ *  License along with this software. If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _VIGRA_EXT_PYRAMIDTRANSFORM_H
+#define _VIGRA_EXT_PYRAMIDTRANSFORM_H
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <utility>
+
+#include <vigra/basicimage.hxx>
+#include <hugin_math/hugin_math.h>
+#include <vigra_ext/ImageTransforms.h>
+#include <vigra_ext/Pyramid.h>
+
+namespace vigra_ext
+{
+
+/** wrapper around a transform, which returns the coordinates in the given
+ *  level of a Gaussian pyramid (as created by reduceToNextLevel) of the
+ *  source image instead of the coordinates in the source image itself */
+template <class TRANSFORM>
+class PyramidLevelTransform
+{
+public:
+    PyramidLevelTransform(TRANSFORM& transform, int level)
+        : m_transform(transform), m_scale(1.0 / (1 << level))
+    {};
+
+    bool transformImgCoord(double & x_dest, double & y_dest, double x_src, double y_src) const
+    {
+        const bool valid = m_transform.transformImgCoord(x_dest, y_dest, x_src, y_src);
+        // pixel i of the next level is centered on pixel 2i of the current level
+        x_dest *= m_scale;
+        y_dest *= m_scale;
+        return valid;
+    };
+
+    void transformImgCoordBatch(const double* x_src, const double* y_src, const int n,
+                                double* x_dest, double* y_dest, char* valid) const
+    {
+        vigra_ext::transformImgCoordBatch(m_transform, x_src, y_src, n, x_dest, y_dest, valid);
+        for (int i = 0; i < n; ++i)
+        {
+            x_dest[i] *= m_scale;
+            y_dest[i] *= m_scale;
+        };
+    };
+
+private:
+    TRANSFORM& m_transform;
+    double m_scale;
+};
+
+/** wrapper around a pixel transform (e.g. Photometric::InvResponseTransform),
+ *  which converts the coordinates in the pyramid level back into the coordinates
+ *  of the source image, so that the vignetting correction works as before */
+template <class PixelTransform>
+class PyramidLevelPixelTransform
+{
+public:
+    PyramidLevelPixelTransform(PixelTransform& pixelTransform, int level)
+        : m_pixelTransform(pixelTransform), m_scale(1 << level)
+    {};
+
+    template <class T>
+    auto operator()(T v, const hugin_utils::FDiff2D & pos) const -> decltype(std::declval<PixelTransform&>()(v, pos))
+    {
+        return m_pixelTransform(v, hugin_utils::FDiff2D(pos.x * m_scale, pos.y * m_scale));
+    };
+
+    template <class T, class A>
+    A hdrWeight(T v, A a) const
+    {
+        return m_pixelTransform.hdrWeight(v, a);
+    };
+
+private:
+    PixelTransform& m_pixelTransform;
+    double m_scale;
+};
+
+/** estimate the local scale of the transform at the given destination point,
+ *  this is the number of source pixels covered by one destination pixel in the
+ *  direction with the smallest size reduction (smaller singular value of the
+ *  Jacobian). Returns 0 if the transform is not defined around the point.
+ */
+template <class TRANSFORM>
+double estimateLocalScale(TRANSFORM& transform, double x, double y)
+{
+    double xl, yl, xr, yr, xt, yt, xb, yb;
+    if (!transform.transformImgCoord(xl, yl, x - 0.5, y) || !transform.transformImgCoord(xr, yr, x + 0.5, y) ||
+        !transform.transformImgCoord(xt, yt, x, y - 0.5) || !transform.transformImgCoord(xb, yb, x, y + 0.5))
+    {
+        return 0;
+    };
+    const double a = xr - xl;
+    const double b = xb - xt;
+    const double c = yr - yl;
+    const double d = yb - yt;
+    const double sumSq = a * a + b * b + c * c + d * d;
+    const double det = a * d - b * c;
+    if (!std::isfinite(sumSq) || !std::isfinite(det))
+    {
+        return 0;
+    };
+    const double disc = sqrt(std::max(0.0, sumSq * sumSq - 4.0 * det * det));
+    return sqrt(std::max(0.0, 0.5 * (sumSq - disc)));
+};
+
+/** returns the number of pyramid levels, which can be created from an image of the given size */
+inline int getMaxPyramidLevel(vigra::Diff2D size)
+{
+    // don't reduce the image below 8 pixel, there is not much left to sample
+    int level = 0;
+    while (((size.x + 1) >> 1) >= 8 && ((size.y + 1) >> 1) >= 8)
+    {
+        size.x = (size.x + 1) >> 1;
+        size.y = (size.y + 1) >> 1;
+        ++level;
+    };
+    return level;
+};
+
+/** select the pyramid level, which should be used for the given rectangle in the
+ *  destination image. The smallest local scale inside the rectangle is used,
+ *  so that the sampling never gets coarser than the destination pixels.
+ */
+template <class TRANSFORM>
+int selectPyramidLevel(TRANSFORM& transform, const vigra::Rect2D& destRect, const int maxLevel)
+{
+    double minScale = -1;
+    for (int j = 0; j < 3; ++j)
+    {
+        const double y = destRect.top() + 0.5 * j * (destRect.height() - 1);
+        for (int i = 0; i < 3; ++i)
+        {
+            const double x = destRect.left() + 0.5 * i * (destRect.width() - 1);
+            const double scale = estimateLocalScale(transform, x, y);
+            if (scale > 0 && (minScale < 0 || scale < minScale))
+            {
+                minScale = scale;
+            };
+        };
+    };
+    if (minScale < 2.0)
+    {
+        return 0;
+    };
+    return std::min(static_cast<int>(floor(log2(minScale))), maxLevel);
+};
+
+namespace detail
+{
+/** split the destination image into tiles and select the pyramid level for each tile */
+template <class TRANSFORM>
+int selectTilePyramidLevels(TRANSFORM& transform, const vigra::Diff2D destSize, const vigra::Diff2D destUL,
+                            const vigra::Diff2D srcSize, const int tileSize, bool singleThreaded,
+                            std::vector<vigra::Rect2D>& tiles, std::vector<int>& tileLevels)
+{
+    for (int y = 0; y < destSize.y; y += tileSize)
+    {
+        for (int x = 0; x < destSize.x; x += tileSize)
+        {
+            tiles.push_back(vigra::Rect2D(x, y, std::min(x + tileSize, destSize.x), std::min(y + tileSize, destSize.y)));
+        };
+    };
+    tileLevels.resize(tiles.size(), 0);
+    const int maxLevel = getMaxPyramidLevel(srcSize);
+    if (maxLevel == 0)
+    {
+        return 0;
+    };
+#pragma omp parallel for if(!singleThreaded) schedule(dynamic)
+    for (int i = 0; i < static_cast<int>(tiles.size()); ++i)
+    {
+        tileLevels[i] = selectPyramidLevel(transform, vigra::Rect2D(tiles[i]).moveBy(destUL), maxLevel);
+    };
+    return tileLevels.empty() ? 0 : *std::max_element(tileLevels.begin(), tileLevels.end());
+};
+} // namespace detail
+
+/** transform the image into the panorama, but samples the source image from a
+ *  level of a Gaussian pyramid, when the image is scaled down.
+ *
+ *  The destination image is divided into tiles of @p tileSize pixels. For each
+ *  tile the local scale of the transform is estimated and the pyramid level,
+ *  which still has at least the resolution of the destination, is used
+ *  for the interpolation. This avoids aliasing and reduces the memory accessed
+ *  during the interpolation. The pyramid levels are only created when needed.
+ *
+ *  All other parameters are the same as for transformImage.
+ */
+template <class SrcImageIterator, class SrcAccessor,
+          class DestImageIterator, class DestAccessor,
+          class AlphaImageIterator, class AlphaAccessor,
+          class TRANSFORM,
+          class PixelTransform>
+void transformImagePyramid(vigra::triple<SrcImageIterator, SrcImageIterator, SrcAccessor> src,
+                           vigra::triple<DestImageIterator, DestImageIterator, DestAccessor> dest,
+                           std::pair<AlphaImageIterator, AlphaAccessor> alpha,
+                           vigra::Diff2D destUL,
+                           TRANSFORM & transform,
+                           PixelTransform & pixelTransform,
+                           bool warparound,
+                           Interpolator interpol,
+                           AppBase::ProgressDisplay* progress,
+                           bool singleThreaded = false,
+                           bool tabulatedWeights = false,
+                           int tileSize = 64)
+{
+    std::vector<vigra::Rect2D> tiles;
+    std::vector<int> tileLevels;
+    const int levels = detail::selectTilePyramidLevels(transform, dest.second - dest.first, destUL,
+        src.second - src.first, tileSize, singleThreaded, tiles, tileLevels);
+    if (levels == 0)
+    {
+        // no size reduction, sample the full resolution image
+        transformImage(src, dest, alpha, destUL, transform, pixelTransform, warparound,
+                       interpol, progress, singleThreaded, tabulatedWeights);
+        return;
+    };
+    typedef vigra::BasicImage<typename SrcAccessor::value_type> LevelImage;
+    std::vector<LevelImage> pyramid(levels);
+    reduceToNextLevel(src, pyramid[0], warparound);
+    for (int i = 1; i < levels; ++i)
+    {
+        reduceToNextLevel(vigra::srcImageRange(pyramid[i - 1]), pyramid[i], warparound);
+    };
+#pragma omp parallel for if(!singleThreaded) schedule(dynamic)
+    for (int i = 0; i < static_cast<int>(tiles.size()); ++i)
+    {
+        const vigra::Rect2D& tile = tiles[i];
+        vigra::triple<DestImageIterator, DestImageIterator, DestAccessor> tileDest(dest.first + tile.upperLeft(),
+            dest.first + tile.lowerRight(), dest.third);
+        std::pair<AlphaImageIterator, AlphaAccessor> tileAlpha(alpha.first + tile.upperLeft(), alpha.second);
+        const int level = tileLevels[i];
+        if (level == 0)
+        {
+            transformImage(src, tileDest, tileAlpha, destUL + tile.upperLeft(), transform, pixelTransform,
+                           warparound, interpol, progress, true, tabulatedWeights);
+        }
+        else
+        {
+            PyramidLevelTransform<TRANSFORM> levelTransform(transform, level);
+            PyramidLevelPixelTransform<PixelTransform> levelPixelTransform(pixelTransform, level);
+            transformImage(vigra::srcImageRange(pyramid[level - 1]), tileDest, tileAlpha, destUL + tile.upperLeft(),
+                           levelTransform, levelPixelTransform, warparound, interpol, progress, true, tabulatedWeights);
+        };
+    };
+};
+
+/** transform the image with alpha channel into the panorama, samples the source
+ *  image and mask from a level of a Gaussian pyramid, when the image is scaled down.
+ *  See transformImagePyramid for details.
+ */
+template <class SrcImageIterator, class SrcAccessor,
+          class SrcAlphaIterator, class SrcAlphaAccessor,
+          class DestImageIterator, class DestAccessor,
+          class AlphaImageIterator, class AlphaAccessor,
+          class TRANSFORM,
+          class PixelTransform>
+void transformImageAlphaPyramid(vigra::triple<SrcImageIterator, SrcImageIterator, SrcAccessor> src,
+                                std::pair<SrcAlphaIterator, SrcAlphaAccessor> srcAlpha,
+                                vigra::triple<DestImageIterator, DestImageIterator, DestAccessor> dest,
+                                std::pair<AlphaImageIterator, AlphaAccessor> alpha,
+                                vigra::Diff2D destUL,
+                                TRANSFORM & transform,
+                                PixelTransform & pixelTransform,
+                                bool warparound,
+                                Interpolator interpol,
+                                AppBase::ProgressDisplay* progress,
+                                bool singleThreaded = false,
+                                bool tabulatedWeights = false,
+                                int tileSize = 64)
+{
+    std::vector<vigra::Rect2D> tiles;
+    std::vector<int> tileLevels;
+    const int levels = detail::selectTilePyramidLevels(transform, dest.second - dest.first, destUL,
+        src.second - src.first, tileSize, singleThreaded, tiles, tileLevels);
+    if (levels == 0)
+    {
+        // no size reduction, sample the full resolution image
+        transformImageAlpha(src, srcAlpha, dest, alpha, destUL, transform, pixelTransform, warparound,
+                            interpol, progress, singleThreaded, tabulatedWeights);
+        return;
+    };
+    typedef vigra::BasicImage<typename SrcAccessor::value_type> LevelImage;
+    typedef vigra::BasicImage<typename SrcAlphaAccessor::value_type> LevelMask;
+    std::vector<LevelImage> pyramid(levels);
+    std::vector<LevelMask> pyramidMask(levels);
+    reduceToNextLevel(src, srcAlpha, pyramid[0], pyramidMask[0], warparound);
+    for (int i = 1; i < levels; ++i)
+    {
+        reduceToNextLevel(vigra::srcImageRange(pyramid[i - 1]), vigra::srcImage(pyramidMask[i - 1]),
+                          pyramid[i], pyramidMask[i], warparound);
+    };
+#pragma omp parallel for if(!singleThreaded) schedule(dynamic)
+    for (int i = 0; i < static_cast<int>(tiles.size()); ++i)
+    {
+        const vigra::Rect2D& tile = tiles[i];
+        vigra::triple<DestImageIterator, DestImageIterator, DestAccessor> tileDest(dest.first + tile.upperLeft(),
+            dest.first + tile.lowerRight(), dest.third);
+        std::pair<AlphaImageIterator, AlphaAccessor> tileAlpha(alpha.first + tile.upperLeft(), alpha.second);
+        const int level = tileLevels[i];
+        if (level == 0)
+        {
+            transformImageAlpha(src, srcAlpha, tileDest, tileAlpha, destUL + tile.upperLeft(), transform, pixelTransform,
+                                warparound, interpol, progress, true, tabulatedWeights);
+        }
+        else
+        {
+            PyramidLevelTransform<TRANSFORM> levelTransform(transform, level);
+            PyramidLevelPixelTransform<PixelTransform> levelPixelTransform(pixelTransform, level);
+            transformImageAlpha(vigra::srcImageRange(pyramid[level - 1]), vigra::srcImage(pyramidMask[level - 1]),
+                                tileDest, tileAlpha, destUL + tile.upperLeft(), levelTransform, levelPixelTransform,
+                                warparound, interpol, progress, true, tabulatedWeights);
+        };
+    };
+};
+
+} // namespace vigra_ext
+
+#endif // _VIGRA_EXT_PYRAMIDTRANSFORM_H
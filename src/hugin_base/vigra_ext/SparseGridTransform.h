@@ -0,0 +1,243 @@
+// -*- c-basic-offset: 4 -*-
+/** @file vigra_ext/SparseGridTransform.h
+ *
+ *  Approximates a coordinate transform by interpolation on an adaptively
+ *  refined sparse grid.
+ *
+ *  This is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2 of the License, or (at your option) any later version.
+ *
+ *  This software is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public
+ *  License along with this software. If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _VIGRA_EXT_SPARSEGRIDTRANSFORM_H
+#define _VIGRA_EXT_SPARSEGRIDTRANSFORM_H
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#include <vigra/diff2d.hxx>
+
+namespace vigra_ext
+{
+
+/** wrapper around a transform (e.g. PTools::Transform), which evaluates the
+ *  exact transform only on a coarse grid over the destination rectangle and
+ *  interpolates bilinearly in between.
+ *
+ *  Each cell of the grid is refined (by halving the node spacing) until the
+ *  bilinear interpolation reproduces the exact transform at the new nodes
+ *  within the given tolerance. Cells which can't be interpolated reliably,
+ *  e.g. because they contain a point which can't be transformed (horizon of
+ *  the projection), a pole or the 360 degree seam of the source image, fall
+ *  back to the exact transform for every pixel.
+ *
+ *  The grid is calculated in the constructor, afterwards transformImgCoord
+ *  does not modify the object and can be called from several threads.
+ *  The wrapped transform must stay valid as long as this object is used.
+ */
+template <class TRANSFORM>
+class SparseGridTransform
+{
+public:
+    /** create the interpolation grid
+     *  @param transform exact transform, which should be approximated
+     *  @param destRect rectangle in destination coordinates, for which the grid should be calculated
+     *  @param tolerance maximal allowed interpolation error in source pixels
+     *  @param cellSize size of the coarsest grid cell, should be a power of 2
+     *  @param singleThreaded if true, the grid is calculated in the current thread only
+     */
+    SparseGridTransform(const TRANSFORM& transform, const vigra::Rect2D& destRect,
+                        double tolerance = 0.1, int cellSize = 16, bool singleThreaded = false)
+        : m_transform(transform), m_rect(destRect), m_tolerance(tolerance), m_cellSize(cellSize)
+    {
+        m_cellsX = (m_rect.width() + m_cellSize - 1) / m_cellSize;
+        m_cellsY = (m_rect.height() + m_cellSize - 1) / m_cellSize;
+        m_cells.resize(static_cast<size_t>(m_cellsX) * m_cellsY);
+#pragma omp parallel for if(!singleThreaded) schedule(dynamic)
+        for (int cy = 0; cy < m_cellsY; ++cy)
+        {
+            for (int cx = 0; cx < m_cellsX; ++cx)
+            {
+                RefineCell(m_cells[cy * m_cellsX + cx], m_rect.left() + cx * m_cellSize, m_rect.top() + cy * m_cellSize);
+            };
+        };
+    };
+
+    /** transform the point, same semantic as PTools::Transform::transformImgCoord */
+    bool transformImgCoord(double & x_dest, double & y_dest, double x_src, double y_src) const
+    {
+        const double dx = x_src - m_rect.left();
+        const double dy = y_src - m_rect.top();
+        const int cx = static_cast<int>(std::floor(dx / m_cellSize));
+        const int cy = static_cast<int>(std::floor(dy / m_cellSize));
+        if (cx < 0 || cx >= m_cellsX || cy < 0 || cy >= m_cellsY)
+        {
+            return m_transform.transformImgCoord(x_dest, y_dest, x_src, y_src);
+        };
+        const GridCell& cell = m_cells[cy * m_cellsX + cx];
+        if (cell.nodes.empty())
+        {
+            // cell could not be approximated
+            return m_transform.transformImgCoord(x_dest, y_dest, x_src, y_src);
+        };
+        const double spacing = static_cast<double>(m_cellSize) / cell.steps;
+        const double fx = (dx - cx * m_cellSize) / spacing;
+        const double fy = (dy - cy * m_cellSize) / spacing;
+        const int ix = std::min(static_cast<int>(fx), cell.steps - 1);
+        const int iy = std::min(static_cast<int>(fy), cell.steps - 1);
+        const double tx = fx - ix;
+        const double ty = fy - iy;
+        const int stride = cell.steps + 1;
+        const GridNode& n00 = cell.nodes[iy * stride + ix];
+        const GridNode& n01 = cell.nodes[iy * stride + ix + 1];
+        const GridNode& n10 = cell.nodes[(iy + 1) * stride + ix];
+        const GridNode& n11 = cell.nodes[(iy + 1) * stride + ix + 1];
+        x_dest = (1 - ty) * ((1 - tx) * n00.x + tx * n01.x) + ty * ((1 - tx) * n10.x + tx * n11.x);
+        y_dest = (1 - ty) * ((1 - tx) * n00.y + tx * n01.y) + ty * ((1 - tx) * n10.y + tx * n11.y);
+        return true;
+    };
+
+    /** returns the fraction of the grid cells, which use the exact transform */
+    double getExactCellRatio() const
+    {
+        if (m_cells.empty())
+        {
+            return 0;
+        };
+        size_t exactCells = 0;
+        for (size_t i = 0; i < m_cells.size(); ++i)
+        {
+            if (m_cells[i].nodes.empty())
+            {
+                ++exactCells;
+            };
+        };
+        return static_cast<double>(exactCells) / m_cells.size();
+    };
+
+private:
+    struct GridNode
+    {
+        double x;
+        double y;
+        bool valid;
+    };
+    /** one cell of the coarse grid, contains (steps+1)x(steps+1) nodes,
+     *  no nodes means the exact transform is used for this cell */
+    struct GridCell
+    {
+        GridCell() : steps(0) {};
+        int steps;
+        std::vector<GridNode> nodes;
+    };
+
+    GridNode EvaluateNode(double x, double y) const
+    {
+        GridNode node;
+        node.valid = m_transform.transformImgCoord(node.x, node.y, x, y);
+        if (node.valid)
+        {
+            // catch nan and inf, which some projections return near the horizon
+            node.valid = std::isfinite(node.x) && std::isfinite(node.y);
+        };
+        return node;
+    };
+
+    /** refine the cell at the given position until the interpolation error is small enough */
+    void RefineCell(GridCell& cell, const int x0, const int y0) const
+    {
+        int steps = 1;
+        std::vector<GridNode> coarse(4);
+        coarse[0] = EvaluateNode(x0, y0);
+        coarse[1] = EvaluateNode(x0 + m_cellSize, y0);
+        coarse[2] = EvaluateNode(x0, y0 + m_cellSize);
+        coarse[3] = EvaluateNode(x0 + m_cellSize, y0 + m_cellSize);
+        // refine until the node spacing reaches 1 pixel, then the exact
+        // transform would be evaluated at every pixel anyway
+        while (m_cellSize / (2 * steps) >= 2)
+        {
+            const int fineSteps = 2 * steps;
+            const int coarseStride = steps + 1;
+            const int fineStride = fineSteps + 1;
+            const double fineSpacing = static_cast<double>(m_cellSize) / fineSteps;
+            std::vector<GridNode> fine(fineStride * fineStride);
+            bool accept = true;
+            for (int j = 0; j < fineStride; ++j)
+            {
+                for (int i = 0; i < fineStride; ++i)
+                {
+                    GridNode& node = fine[j * fineStride + i];
+                    if (i % 2 == 0 && j % 2 == 0)
+                    {
+                        // node already known from coarser level
+                        node = coarse[(j / 2) * coarseStride + i / 2];
+                        accept = accept && node.valid;
+                        continue;
+                    };
+                    node = EvaluateNode(x0 + i * fineSpacing, y0 + j * fineSpacing);
+                    if (!accept)
+                    {
+                        continue;
+                    };
+                    // compare with bilinear interpolation on the coarser level
+                    const int ci = std::min(i / 2, steps - 1);
+                    const int cj = std::min(j / 2, steps - 1);
+                    const double tx = 0.5 * i - ci;
+                    const double ty = 0.5 * j - cj;
+                    const GridNode& n00 = coarse[cj * coarseStride + ci];
+                    const GridNode& n01 = coarse[cj * coarseStride + ci + 1];
+                    const GridNode& n10 = coarse[(cj + 1) * coarseStride + ci];
+                    const GridNode& n11 = coarse[(cj + 1) * coarseStride + ci + 1];
+                    if (!node.valid || !n00.valid || !n01.valid || !n10.valid || !n11.valid)
+                    {
+                        accept = false;
+                        continue;
+                    };
+                    const double ix = (1 - ty) * ((1 - tx) * n00.x + tx * n01.x) + ty * ((1 - tx) * n10.x + tx * n11.x);
+                    const double iy = (1 - ty) * ((1 - tx) * n00.y + tx * n01.y) + ty * ((1 - tx) * n10.y + tx * n11.y);
+                    if (std::abs(ix - node.x) > m_tolerance || std::abs(iy - node.y) > m_tolerance)
+                    {
+                        accept = false;
+                    };
+                };
+            };
+            if (accept)
+            {
+                // the coarser level is already good enough, so use the finer
+                // level, the interpolation error there is even smaller
+                cell.steps = fineSteps;
+                cell.nodes.swap(fine);
+                return;
+            };
+            coarse.swap(fine);
+            steps = fineSteps;
+        };
+        // interpolation not possible, use exact transform in this cell
+        cell.steps = 0;
+        cell.nodes.clear();
+    };
+
+    const TRANSFORM& m_transform;
+    vigra::Rect2D m_rect;
+    double m_tolerance;
+    int m_cellSize;
+    int m_cellsX;
+    int m_cellsY;
+    std::vector<GridCell> m_cells;
+};
+
+} // namespace vigra_ext
+
+#endif // _VIGRA_EXT_SPARSEGRIDTRANSFORM_H
@@ -30,6 +30,7 @@
 
 #include <set>
 #include <vector>
+#include <algorithm>
 #include <stdlib.h>
 #include <cstring>
 #include <math.h>
@@ -88,7 +89,14 @@ public:
 	 * @param numForEstimate The number of data objects required for an exact fit.
 	 * @param desiredProbabilityForNoOutliers The probability that at least one of the selected subsets doesn't contains an
 	 *                                        outlier.
-	 * @param maximalOutlierPercentage The maximal expected percentage of outliers.
+	 * @param maximalOutlierPercentage The maximal expected percentage of outliers. This determines the
+	 *                                 maximal number of iterations, the number of iterations is reduced
+	 *                                 according to the inlier ratio of the best model found so far.
+	 * @param dataSortedByQuality If true, the data is sorted by decreasing quality (e.g. the distance ratio
+	 *                            of feature matches) and the samples are drawn progressively from the best
+	 *                            data objects first (PROSAC).
+	 * @param preVerify If true, each hypothesis is verified with a sequential probability ratio test, bad
+	 *                  hypotheses are rejected after testing only a few data objects.
 	 * @return Array with inliers
 	 */
         template<class Estimator, class S, class T>
@@ -97,7 +105,9 @@ public:
 					     const Estimator & paramEstimator ,
 					     const std::vector<T> &data, 
 					     double desiredProbabilityForNoOutliers,
-					     double maximalOutlierPercentage);
+					     double maximalOutlierPercentage,
+					     bool dataSortedByQuality = false,
+					     bool preVerify = false);
 
 
 	/**
@@ -126,6 +136,77 @@ public:
         static std::vector<const T*> compute(S &parameters, 
 					     const Estimator & paramEstimator ,
 					     const std::vector<T> &data);
+
+    /**
+     * Returns the number of iterations needed to draw at least one sample without outliers
+     * with the desired probability, but at most maxTries.
+     * @param inlierRatio ratio of inliers of the best model found so far
+     * @param rejectionProbability probability that a good model is rejected by the pre-verification
+     */
+    static unsigned int numberOfTries(double desiredProbabilityForNoOutliers, double inlierRatio,
+                                      unsigned int numForEstimate, unsigned int maxTries,
+                                      double rejectionProbability = 0.0);
+
+    /**
+     * Progressive sampling (PROSAC): the samples are drawn from the best data objects first,
+     * the sampled set grows with the number of iterations. After maxTries iterations the
+     * sampling is the same as the uniform sampling of RanSaC.
+     *
+     * Chum O., Matas J., "Matching with PROSAC - Progressive Sample Consensus", CVPR 2005
+     */
+    class ProsacSampler
+    {
+    public:
+        ProsacSampler(unsigned int numDataObjects, unsigned int numForEstimate, unsigned int maxTries);
+        /** draws the indices of the next sample, the data objects have to be sorted by decreasing quality */
+        template<class RNG>
+        void sample(RNG & rng, std::vector<int> & indices);
+
+    private:
+        unsigned int m_numDataObjects;
+        unsigned int m_numForEstimate;
+        unsigned int m_t;
+        unsigned int m_n;
+        double m_Tn;
+        double m_TnPrime;
+    };
+
+    /**
+     * Sequential probability ratio test for the verification of hypotheses. The data objects are
+     * tested in random order, the test rejects a hypothesis as soon as the likelihood ratio of
+     * being a bad model versus being a good model exceeds the decision threshold.
+     *
+     * Chum O., Matas J., "Optimal Randomized RANSAC", PAMI 30(8), 2008
+     */
+    class Sprt
+    {
+    public:
+        /** @param inlierRatio initial estimate of the inlier ratio of a good model
+         *  @param modelCost cost of estimating a model, measured in verifications of single data objects */
+        Sprt(double inlierRatio, double modelCost);
+        /** updates the inlier ratio of a good model, if a better model was found */
+        void setInlierRatio(double inlierRatio);
+        /** starts the test of a new hypothesis */
+        void start() { m_lambda = 1.0; };
+        /** adds the result of the next data object, returns false if the hypothesis is rejected */
+        bool update(bool agree);
+        /** updates the probability that a data object agrees with a bad model from a rejected hypothesis */
+        void addRejected(unsigned int numAgree, unsigned int numTested);
+        /** returns the probability that a good model is rejected */
+        double getRejectionProbability() const { return m_enabled ? 1.0 / m_threshold : 0.0; };
+
+    private:
+        void computeThreshold();
+
+        double m_epsilon;
+        double m_delta;
+        double m_modelCost;
+        double m_threshold;
+        double m_lambda;
+        bool m_enabled;
+        unsigned int m_rejected;
+        double m_rejectedAgreeSum;
+    };
 	
 private:
 
@@ -177,7 +258,9 @@ std::vector<const T *> Ransac::compute(S &parameters,
 				       const Estimator & paramEstimator,
 				       const std::vector<T> &data,
 				       double desiredProbabilityForNoOutliers,
-				       double maximalOutlierPercentage)
+				       double maximalOutlierPercentage,
+				       bool dataSortedByQuality,
+				       bool preVerify)
 {
     unsigned int numDataObjects = (int) data.size();
     unsigned int numForEstimate = paramEstimator.numForEstimate();
@@ -196,7 +279,6 @@ std::vector<const T *> Ransac::compute(S &parameters,
     SubSetIndexComparator subSetIndexComparator(numForEstimate);
     std::set<int *, SubSetIndexComparator > chosenSubSets(subSetIndexComparator);
     int *curSubSetIndexes;
-    // double outlierPercentage = maximalOutlierPercentage;
     double numerator = log(1.0-desiredProbabilityForNoOutliers);
     double denominator = log(1- pow((double)(1.0-maximalOutlierPercentage), (double)(numForEstimate)));
     int allTries = choose(numDataObjects,numForEstimate);
@@ -217,6 +299,19 @@ std::vector<const T *> Ransac::compute(S &parameters,
 
     //there are cases when the probablistic number of tries is greater than all possible sub-sets
     numTries = numTries<allTries ? numTries : allTries;
+    // the number of tries is reduced when a model with more inliers is found
+    const int maxTries = numTries;
+
+    ProsacSampler prosacSampler(numDataObjects, numForEstimate, maxTries);
+    std::vector<int> sampleIndexes;
+    // the pre-verification tests the data in random order, the order of the data itself
+    // is not random if it is sorted by quality
+    Sprt sprt(1.0-maximalOutlierPercentage, 100.0);
+    std::vector<int> verifyOrder(numDataObjects);
+    for(j=0; j<(int)numDataObjects; j++)
+        verifyOrder[j] = j;
+    if(preVerify)
+        std::shuffle(verifyOrder.begin(), verifyOrder.end(), rng);
 
     for(i=0; i<numTries; i++) {
         //randomly select data for exact model fit ('numForEstimate' objects).
@@ -225,19 +320,28 @@ std::vector<const T *> Ransac::compute(S &parameters,
 
         exactEstimateData.clear();
 
-        maxIndex = numDataObjects-1; 
-        for(l=0; l<(int)numForEstimate; l++) {
-            //selectedIndex is in [0,maxIndex]
-            unsigned int selectedIndex = randIndex();
-//            unsigned int selectedIndex = (unsigned int)(((float)rand()/(float)RAND_MAX)*maxIndex + 0.5);
-            for(j=-1,k=0; k<(int)numDataObjects && j<(int)selectedIndex; k++) {
-                if(notChosen[k])
-                    j++;
+        if(dataSortedByQuality) {
+            prosacSampler.sample(rng, sampleIndexes);
+            for(l=0; l<(int)numForEstimate; l++) {
+                exactEstimateData.push_back(&(data[sampleIndexes[l]]));
+                notChosen[sampleIndexes[l]] = 0;
+            }
+        }
+        else {
+            maxIndex = numDataObjects-1; 
+            for(l=0; l<(int)numForEstimate; l++) {
+                //selectedIndex is in [0,maxIndex]
+                unsigned int selectedIndex = randIndex();
+//                unsigned int selectedIndex = (unsigned int)(((float)rand()/(float)RAND_MAX)*maxIndex + 0.5);
+                for(j=-1,k=0; k<(int)numDataObjects && j<(int)selectedIndex; k++) {
+                    if(notChosen[k])
+                        j++;
+                }
+                k--;
+                exactEstimateData.push_back(&(data[k]));
+                notChosen[k] = 0;
+                maxIndex--;
             }
-            k--;
-            exactEstimateData.push_back(&(data[k]));
-            notChosen[k] = 0;
-            maxIndex--;
         }
         //get the indexes of the chosen objects so we can check that this sub-set hasn't been
         //chosen already
@@ -260,36 +364,41 @@ std::vector<const T *> Ransac::compute(S &parameters,
             //see how many agree on this estimate
             numVotesForCur = 0;
             memset(curVotes,'\0',numDataObjects*sizeof(short));
+            bool rejected = false;
+            sprt.start();
             for(j=0; j<(int)numDataObjects; j++) {
-                if(paramEstimator.agree(exactEstimateParameters, data[j])) {
-                    curVotes[j] = 1;
+                const int index = verifyOrder[j];
+                const bool agree = paramEstimator.agree(exactEstimateParameters, data[index]);
+                if(agree) {
+                    curVotes[index] = 1;
                     numVotesForCur++;
                 }
+                if(preVerify && !sprt.update(agree)) {
+                    sprt.addRejected(numVotesForCur, j+1);
+                    rejected = true;
+                    break;
+                }
             }
 	    // debug output
 	    #ifdef DEBUG_RANSAC
-	    std::cerr << "RANSAC iter " << i << ": inliers: " << numVotesForCur << " parameters:";
+	    std::cerr << "RANSAC iter " << i << ": inliers: " << numVotesForCur << (rejected ? " (rejected)" : "") << " parameters:";
 	    for (int jj=0; jj < exactEstimateParameters.size(); jj++)
 		std::cerr << " " << exactEstimateParameters[jj];
 	    std::cerr << std::endl;
 	    #endif
 
-            if(numVotesForCur > numVotesForBest) {
+            if(!rejected && numVotesForCur > numVotesForBest) {
                 numVotesForBest = numVotesForCur;
                 memcpy(bestVotes,curVotes, numDataObjects*sizeof(short));
 		parameters = exactEstimateParameters;
+                //update the estimate of outliers and the number of iterations we need
+                const double inlierRatio = (double)numVotesForBest/(double)numDataObjects;
+                if(preVerify)
+                    sprt.setInlierRatio(inlierRatio);
+                const int requiredTries = numberOfTries(desiredProbabilityForNoOutliers, inlierRatio, numForEstimate,
+                                                        maxTries, preVerify ? sprt.getRejectionProbability() : 0.0);
+                numTries = requiredTries<numTries ? requiredTries : numTries;
             }
-	    /*
-            //update the estimate of outliers and the number of iterations we need
-            outlierPercentage = 1 - (double)numVotesForCur/(double)numDataObjects;
-            if(outlierPercentage < maximalOutlierPercentage) {
-                maximalOutlierPercentage = outlierPercentage;
-                denominator = log(1- pow((double)(1.0-maximalOutlierPercentage), (double)(numForEstimate)));
-                numTries = (int)(numerator/denominator + 0.5);
-                //there are cases when the probablistic number of tries is greater than all possible sub-sets
-                numTries = numTries<allTries ? numTries : allTries;
-            }
-	    */
         }
         else {  //this sub set already appeared, don't count this iteration
             delete [] curSubSetIndexes;
@@ -417,6 +526,118 @@ void Ransac::estimate(const Estimator & paramEstimator, const std::vector<T> &da
 	}
 }
 /*****************************************************************************/
+inline unsigned int Ransac::numberOfTries(double desiredProbabilityForNoOutliers, double inlierRatio,
+                                          unsigned int numForEstimate, unsigned int maxTries,
+                                          double rejectionProbability)
+{
+    // probability to draw a sample without outliers, which is not rejected by the pre-verification
+    const double goodSample = pow(inlierRatio, (double)numForEstimate) * (1.0 - rejectionProbability);
+    if (goodSample <= 0.0)
+        return maxTries;
+    if (goodSample >= 1.0)
+        return 1;
+    const double tries = ceil(log(1.0 - desiredProbabilityForNoOutliers) / log(1.0 - goodSample));
+    return tries < maxTries ? (unsigned int)tries : maxTries;
+}
+/*****************************************************************************/
+inline Ransac::ProsacSampler::ProsacSampler(unsigned int numDataObjects, unsigned int numForEstimate, unsigned int maxTries)
+    : m_numDataObjects(numDataObjects), m_numForEstimate(numForEstimate),
+      m_t(0), m_n(numForEstimate), m_TnPrime(1.0)
+{
+    // average number of samples out of maxTries, which contain only the best numForEstimate data objects
+    m_Tn = maxTries;
+    for (unsigned int i = 0; i < numForEstimate; ++i)
+        m_Tn *= (double)(numForEstimate - i) / (double)(numDataObjects - i);
+}
+
+template<class RNG>
+void Ransac::ProsacSampler::sample(RNG & rng, std::vector<int> & indices)
+{
+    ++m_t;
+    // add the next data object to the sampled set, when the samples of the current set are used up
+    if (m_t >= m_TnPrime && m_n < m_numDataObjects)
+    {
+        const double TnNext = m_Tn * (m_n + 1) / (double)(m_n + 1 - m_numForEstimate);
+        m_TnPrime += ceil(TnNext - m_Tn);
+        m_Tn = TnNext;
+        ++m_n;
+    }
+    indices.clear();
+    unsigned int setSize = m_n;
+    if (m_TnPrime >= m_t && m_n < m_numDataObjects)
+    {
+        // while the set is still growing, the sample contains the last data object u_n
+        // of the set and random ones of the better data objects U_(n-1),
+        // otherwise it is drawn uniformly from U_n
+        indices.push_back(m_n - 1);
+        setSize = m_n - 1;
+    }
+    std::uniform_int_distribution<int> distribIndex(0, setSize - 1);
+    while (indices.size() < m_numForEstimate)
+    {
+        const int index = distribIndex(rng);
+        if (std::find(indices.begin(), indices.end(), index) == indices.end())
+            indices.push_back(index);
+    }
+}
+/*****************************************************************************/
+inline Ransac::Sprt::Sprt(double inlierRatio, double modelCost)
+    : m_epsilon(inlierRatio), m_delta(0.05), m_modelCost(modelCost), m_threshold(1.0), m_lambda(1.0),
+      m_enabled(false), m_rejected(0), m_rejectedAgreeSum(0.0)
+{
+    computeThreshold();
+}
+
+inline void Ransac::Sprt::setInlierRatio(double inlierRatio)
+{
+    m_epsilon = inlierRatio;
+    computeThreshold();
+}
+
+inline bool Ransac::Sprt::update(bool agree)
+{
+    if (!m_enabled)
+        return true;
+    // likelihood ratio of the hypothesis being bad versus being good
+    m_lambda *= agree ? m_delta / m_epsilon : (1.0 - m_delta) / (1.0 - m_epsilon);
+    return m_lambda <= m_threshold;
+}
+
+inline void Ransac::Sprt::addRejected(unsigned int numAgree, unsigned int numTested)
+{
+    m_rejected++;
+    m_rejectedAgreeSum += (double)numAgree / (double)numTested;
+    const double delta = std::max(0.01, m_rejectedAgreeSum / m_rejected);
+    // only recompute the threshold if the estimate changed noticeably
+    if (fabs(delta - m_delta) > 0.05 * m_delta)
+    {
+        m_delta = delta;
+        computeThreshold();
+    }
+}
+
+inline void Ransac::Sprt::computeThreshold()
+{
+    // the test can only distinguish good and bad models if good models have more inliers
+    m_enabled = m_epsilon > m_delta && m_epsilon < 1.0;
+    if (!m_enabled)
+        return;
+    // optimal threshold A = K + log(A), found by fixed point iteration
+    const double C = (1.0 - m_delta) * log((1.0 - m_delta) / (1.0 - m_epsilon)) + m_delta * log(m_delta / m_epsilon);
+    const double K = m_modelCost * C + 1.0;
+    m_threshold = K;
+    for (int i = 0; i < 20; ++i)
+    {
+        const double A = K + log(m_threshold);
+        if (fabs(A - m_threshold) < 1e-4 * m_threshold)
+        {
+            m_threshold = A;
+            break;
+        }
+        m_threshold = A;
+    }
+}
+/*****************************************************************************/
 inline unsigned int Ransac::choose(unsigned int n, unsigned int m)
 {
 	unsigned int denominatorEnd, numeratorStart, numerator,denominator; 
@@ -34,6 +34,8 @@
 #include <vigra_ext/FunctorAccessor.h>
 #include <hugin_utils/utils.h>
 
+#include <vector>
+#include <algorithm>
 #include <tiffio.h>
 
 // add this to the vigra_ext namespace
@@ -553,6 +555,173 @@ createAlphaTiffImage(vigra::triple<ImageIterator, ImageIterator, ImageAccessor>
 
 
 
+//***************************************************************************
+//
+//  functions to write tiled tiff files with a single alpha channel,
+//  the image is written region by region and has never to be kept
+//  completely in memory
+//
+//***************************************************************************
+
+/** sample format of the channels and scaling of the 8 bit alpha channel
+ *  for the different channel types, same as used by CreateAlphaTiffImage.
+ *  The alpha value is converted to T before scaling, so that the product
+ *  is not calculated in int, which would overflow for UINT32 */
+template <class T>
+struct TiffAlphaTraits;
+
+#define TIFF_ALPHA_TRAITS(T, format, name, scale) \
+template <> \
+struct TiffAlphaTraits<T> \
+{ \
+    static int sampleFormat() { return format; }; \
+    static const char* pixelType() { return name; }; \
+    static T scaleAlpha(vigra::UInt8 a) { return static_cast<T>(static_cast<T>(a) * scale); }; \
+};
+
+TIFF_ALPHA_TRAITS(unsigned char, SAMPLEFORMAT_UINT, "UINT8", 1)
+TIFF_ALPHA_TRAITS(short, SAMPLEFORMAT_INT, "INT16", 128)
+TIFF_ALPHA_TRAITS(unsigned short, SAMPLEFORMAT_UINT, "UINT16", 256)
+TIFF_ALPHA_TRAITS(int, SAMPLEFORMAT_INT, "INT32", 8388608)
+TIFF_ALPHA_TRAITS(unsigned int, SAMPLEFORMAT_UINT, "UINT32", 16777216)
+TIFF_ALPHA_TRAITS(float, SAMPLEFORMAT_IEEEFP, "FLOAT", 1.0f/255)
+TIFF_ALPHA_TRAITS(double, SAMPLEFORMAT_IEEEFP, "DOUBLE", 1.0/255)
+
+#undef TIFF_ALPHA_TRAITS
+
+/** stores the channels of a pixel in a tiff buffer */
+template <class T>
+struct TiffPixelChannels
+{
+    typedef T component_type;
+    enum { channels = 1 };
+    static void store(component_type* buf, const T& v)
+    {
+        buf[0] = v;
+    };
+};
+
+template <class T>
+struct TiffPixelChannels<vigra::RGBValue<T> >
+{
+    typedef T component_type;
+    enum { channels = 3 };
+    static void store(component_type* buf, const vigra::RGBValue<T>& v)
+    {
+        buf[0] = v.red();
+        buf[1] = v.green();
+        buf[2] = v.blue();
+    };
+};
+
+/** writes an image with alpha channel tile by tile into a tiled tiff file.
+ *
+ *  The tiff directory (compression, position, ...) should be set up with
+ *  createTiffDirectory before the writer is created. The regions passed to
+ *  writeRegion must start at a multiple of the tile size, their size must be
+ *  a multiple of the tile size, except at the right and bottom border.
+ */
+template <class PixelType>
+class TiledAlphaTiffWriter
+{
+public:
+    typedef TiffPixelChannels<PixelType> Channels;
+    typedef typename Channels::component_type component_type;
+
+    /** set up the image fields for an image of the given size */
+    TiledAlphaTiffWriter(vigra::TiffImage * tiff, const vigra::Size2D& size, const int tileSize = 256)
+        : m_tiff(tiff), m_size(size), m_tileSize(tileSize)
+    {
+        vigra_precondition(tileSize % 16 == 0, "TiledAlphaTiffWriter: tile size must be a multiple of 16");
+        TIFFSetField(m_tiff, TIFFTAG_IMAGEWIDTH, size.width());
+        TIFFSetField(m_tiff, TIFFTAG_IMAGELENGTH, size.height());
+        TIFFSetField(m_tiff, TIFFTAG_TILEWIDTH, tileSize);
+        TIFFSetField(m_tiff, TIFFTAG_TILELENGTH, tileSize);
+        TIFFSetField(m_tiff, TIFFTAG_BITSPERSAMPLE, sizeof(component_type) * 8);
+        TIFFSetField(m_tiff, TIFFTAG_SAMPLESPERPIXEL, Channels::channels + 1);
+        TIFFSetField(m_tiff, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+        TIFFSetField(m_tiff, TIFFTAG_SAMPLEFORMAT, TiffAlphaTraits<component_type>::sampleFormat());
+        TIFFSetField(m_tiff, TIFFTAG_PHOTOMETRIC, Channels::channels == 3 ? PHOTOMETRIC_RGB : PHOTOMETRIC_MINISBLACK);
+        // for alpha stuff, do not uses premultilied data
+        uint16 nextra_samples = 1;
+        uint16 extra_samples = EXTRASAMPLE_UNASSALPHA;
+        TIFFSetField(m_tiff, TIFFTAG_EXTRASAMPLES, nextra_samples, &extra_samples);
+        m_buffer.resize(TIFFTileSize(m_tiff) / sizeof(component_type));
+    };
+
+    /** returns the tile size */
+    int getTileSize() const { return m_tileSize; };
+
+    /** write the region of the image starting at @p pos
+     *  @param src image data of the region
+     *  @param alpha 8 bit alpha channel of the region
+     *  @param pos position of the region in the tiff image
+     *  @return false if writing failed
+     */
+    template <class ImageIterator, class ImageAccessor, class AlphaIterator, class AlphaAccessor>
+    bool writeRegion(vigra::triple<ImageIterator, ImageIterator, ImageAccessor> src,
+                     std::pair<AlphaIterator, AlphaAccessor> alpha,
+                     const vigra::Point2D& pos)
+    {
+        const vigra::Diff2D size = src.second - src.first;
+        vigra_precondition(pos.x % m_tileSize == 0 && pos.y % m_tileSize == 0,
+            "TiledAlphaTiffWriter: region does not start at a tile border");
+        vigra_precondition(pos.x + size.x <= m_size.width() && pos.y + size.y <= m_size.height(),
+            "TiledAlphaTiffWriter: region is outside of the image");
+        for (int ty = 0; ty < size.y; ty += m_tileSize)
+        {
+            for (int tx = 0; tx < size.x; tx += m_tileSize)
+            {
+                const int w = std::min(m_tileSize, size.x - tx);
+                const int h = std::min(m_tileSize, size.y - ty);
+                // pixels outside the image are padded with zeros
+                std::fill(m_buffer.begin(), m_buffer.end(), component_type());
+                ImageIterator ys(src.first + vigra::Diff2D(tx, ty));
+                AlphaIterator ya(alpha.first + vigra::Diff2D(tx, ty));
+                for (int y = 0; y < h; ++y, ++ys.y, ++ya.y)
+                {
+                    component_type* p = &m_buffer[static_cast<size_t>(y) * m_tileSize * (Channels::channels + 1)];
+                    ImageIterator xs(ys);
+                    AlphaIterator xa(ya);
+                    for (int x = 0; x < w; ++x, ++xs.x, ++xa.x, p += Channels::channels + 1)
+                    {
+                        Channels::store(p, src.third(xs));
+                        p[Channels::channels] = TiffAlphaTraits<component_type>::scaleAlpha(alpha.second(xa));
+                    };
+                };
+                if (TIFFWriteTile(m_tiff, &m_buffer[0], pos.x + tx, pos.y + ty, 0, 0) < 0)
+                {
+                    return false;
+                };
+            };
+        };
+        return true;
+    };
+
+    /** write empty tiles (all pixel transparent) for the given region */
+    bool writeEmptyRegion(const vigra::Rect2D& region)
+    {
+        std::fill(m_buffer.begin(), m_buffer.end(), component_type());
+        for (int y = region.top(); y < region.bottom(); y += m_tileSize)
+        {
+            for (int x = region.left(); x < region.right(); x += m_tileSize)
+            {
+                if (TIFFWriteTile(m_tiff, &m_buffer[0], x, y, 0, 0) < 0)
+                {
+                    return false;
+                };
+            };
+        };
+        return true;
+    };
+
+private:
+    vigra::TiffImage * m_tiff;
+    vigra::Size2D m_size;
+    int m_tileSize;
+    std::vector<component_type> m_buffer;
+};
+
 //***************************************************************************
 //
 //  functions to read tiff files with a single alpha channel,
@@ -0,0 +1,94 @@
+// -*- c-basic-offset: 4 ; tab-width: 4 -*-
+/*
+* This file is part of Hugin's cpfind.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, see
+* <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __detectpano_descriptordistance_h
+#define __detectpano_descriptordistance_h
+
+#include <cstddef>
+
+namespace DescriptorDistance
+{
+
+/** type used for summing up the squared differences,
+ *  8 bit descriptors are summed up exactly in integer arithmetic */
+template <class T>
+struct Accumulator
+{
+    typedef float Type;
+};
+template <>
+struct Accumulator<unsigned char>
+{
+    typedef int Type;
+};
+
+/** squared euclidean distance for the descriptors, can be used as distance
+ *  functor for flann instead of flann::L2.
+ *
+ *  In contrast to flann::L2 the loop has no early termination, but it sums
+ *  into 4 independent accumulators, so that the compiler can vectorize it.
+ */
+template <class T>
+struct L2
+{
+    typedef bool is_kdtree_distance;
+
+    typedef T ElementType;
+    typedef float ResultType;
+
+    template <typename Iterator1, typename Iterator2>
+    ResultType operator()(Iterator1 a, Iterator2 b, size_t size, ResultType /*worst_dist*/ = -1) const
+    {
+        typedef typename Accumulator<T>::Type AccType;
+        AccType sum0 = AccType();
+        AccType sum1 = AccType();
+        AccType sum2 = AccType();
+        AccType sum3 = AccType();
+        size_t i = 0;
+        for (; i + 4 <= size; i += 4)
+        {
+            const AccType diff0 = static_cast<AccType>(a[i]) - static_cast<AccType>(b[i]);
+            const AccType diff1 = static_cast<AccType>(a[i + 1]) - static_cast<AccType>(b[i + 1]);
+            const AccType diff2 = static_cast<AccType>(a[i + 2]) - static_cast<AccType>(b[i + 2]);
+            const AccType diff3 = static_cast<AccType>(a[i + 3]) - static_cast<AccType>(b[i + 3]);
+            sum0 += diff0 * diff0;
+            sum1 += diff1 * diff1;
+            sum2 += diff2 * diff2;
+            sum3 += diff3 * diff3;
+        };
+        for (; i < size; ++i)
+        {
+            const AccType diff = static_cast<AccType>(a[i]) - static_cast<AccType>(b[i]);
+            sum0 += diff * diff;
+        };
+        return static_cast<ResultType>((sum0 + sum1) + (sum2 + sum3));
+    };
+
+    /** partial distance in one dimension, used by the kd-tree during traversal */
+    template <typename U, typename V>
+    inline ResultType accum_dist(const U& a, const V& b, int) const
+    {
+        const ResultType diff = static_cast<ResultType>(a) - static_cast<ResultType>(b);
+        return diff * diff;
+    };
+};
+
+} // namespace DescriptorDistance
+
+#endif // __detectpano_descriptordistance_h
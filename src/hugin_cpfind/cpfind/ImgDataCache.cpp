@@ -0,0 +1,160 @@
+// -*- c-basic-offset: 4 ; tab-width: 4 -*-
+/*
+* This file is part of Hugin's cpfind.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, see
+* <http://www.gnu.org/licenses/>.
+*/
+
+#include "ImgDataCache.h"
+
+#include <algorithm>
+#include <map>
+#include <sstream>
+#include "Tracer.h"
+
+ImgDataCache::ImgDataCache(PanoDetector::ImgData_t& ioFilesData, const PanoDetector& iPanoDetector, unsigned long long iMaxMemory) :
+    m_filesData(ioFilesData), m_panoDetector(iPanoDetector), m_maxMemory(iMaxMemory), m_usage(0), m_peakUsage(0), m_loads(0)
+{
+}
+
+void ImgDataCache::load(const std::set<int>& iImages)
+{
+    // move the already loaded images to the front, so they are not released
+    std::vector<int> missing;
+    unsigned long long required = 0;
+    for (std::set<int>::const_iterator it = iImages.begin(); it != iImages.end(); ++it)
+    {
+        std::list<int>::iterator pos = std::find(m_loaded.begin(), m_loaded.end(), *it);
+        if (pos != m_loaded.end())
+        {
+            m_loaded.splice(m_loaded.begin(), m_loaded, pos);
+        }
+        else
+        {
+            if (!m_filesData[*it]._spillfilename.empty())
+            {
+                missing.push_back(*it);
+                required += m_filesData[*it]._memoryUsage;
+            };
+        };
+    };
+    // release the least recently used images, the images needed now are at the front
+    while (m_usage + required > m_maxMemory && !m_loaded.empty() && iImages.find(m_loaded.back()) == iImages.end())
+    {
+        evict(m_loaded.back());
+    };
+    if (missing.empty())
+    {
+        return;
+    };
+    TRACE_INFO("Loading keypoints of " << missing.size() << " images..." << std::endl);
+#pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < static_cast<int>(missing.size()); ++i)
+    {
+        PanoDetector::ReloadKeypoints(m_filesData[missing[i]], m_panoDetector);
+    };
+    for (size_t i = 0; i < missing.size(); ++i)
+    {
+        PanoDetector::ImgData& imgData = m_filesData[missing[i]];
+        // replace the estimate by the real value
+        imgData._memoryUsage = imgData.GetMemoryUsage();
+        m_usage += imgData._memoryUsage;
+        m_loaded.push_front(missing[i]);
+    };
+    m_loads += missing.size();
+    m_peakUsage = std::max(m_peakUsage, m_usage);
+}
+
+void ImgDataCache::evict(int imgNr)
+{
+    PanoDetector::ImgData& imgData = m_filesData[imgNr];
+    m_usage -= std::min<unsigned long long>(m_usage, imgData._memoryUsage);
+    imgData.ReleaseKeypoints();
+    m_loaded.remove(imgNr);
+}
+
+std::vector<std::vector<int> > ImgDataCache::splitImages(const std::vector<int>& iImages, unsigned long long iMaxMemory) const
+{
+    std::vector<std::vector<int> > groups;
+    unsigned long long groupUsage = 0;
+    for (size_t i = 0; i < iImages.size(); ++i)
+    {
+        const unsigned long long usage = m_filesData[iImages[i]]._memoryUsage;
+        if (groups.empty() || (groupUsage + usage > iMaxMemory && !groups.back().empty()))
+        {
+            groups.push_back(std::vector<int>());
+            groupUsage = 0;
+        };
+        groups.back().push_back(iImages[i]);
+        groupUsage += usage;
+    };
+    return groups;
+}
+
+std::vector<std::vector<size_t> > ImgDataCache::planBatches(const PanoDetector::MatchData_t& iMatchesData) const
+{
+    // split the images into blocks of half the memory limit, so that two blocks fit into memory
+    std::set<int> imageSet;
+    for (size_t i = 0; i < iMatchesData.size(); ++i)
+    {
+        imageSet.insert(iMatchesData[i]._i1->_number);
+        imageSet.insert(iMatchesData[i]._i2->_number);
+    };
+    const std::vector<std::vector<int> > blocks = splitImages(std::vector<int>(imageSet.begin(), imageSet.end()), m_maxMemory / 2);
+    std::map<int, size_t> imageBlock;
+    for (size_t i = 0; i < blocks.size(); ++i)
+    {
+        for (size_t j = 0; j < blocks[i].size(); ++j)
+        {
+            imageBlock[blocks[i][j]] = i;
+        };
+    };
+    // sort the pairs by the blocks of both images
+    std::map<std::pair<size_t, size_t>, std::vector<size_t> > blockPairs;
+    for (size_t i = 0; i < iMatchesData.size(); ++i)
+    {
+        size_t block1 = imageBlock[iMatchesData[i]._i1->_number];
+        size_t block2 = imageBlock[iMatchesData[i]._i2->_number];
+        if (block1 > block2)
+        {
+            std::swap(block1, block2);
+        };
+        blockPairs[std::make_pair(block1, block2)].push_back(i);
+    };
+    // the first block stays loaded while the second block runs through all other blocks,
+    // the direction alternates so that the last block of one row is still loaded for the next row
+    std::vector<std::vector<size_t> > batches;
+    for (size_t block1 = 0; block1 < blocks.size(); ++block1)
+    {
+        std::vector<size_t> secondBlocks(1, block1);
+        for (size_t block2 = block1 + 1; block2 < blocks.size(); ++block2)
+        {
+            secondBlocks.push_back(block2);
+        };
+        if (block1 % 2 == 1)
+        {
+            std::reverse(secondBlocks.begin() + 1, secondBlocks.end());
+        };
+        for (size_t i = 0; i < secondBlocks.size(); ++i)
+        {
+            std::map<std::pair<size_t, size_t>, std::vector<size_t> >::const_iterator it = blockPairs.find(std::make_pair(block1, secondBlocks[i]));
+            if (it != blockPairs.end())
+            {
+                batches.push_back(it->second);
+            };
+        };
+    };
+    return batches;
+}
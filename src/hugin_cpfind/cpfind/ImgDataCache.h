@@ -0,0 +1,73 @@
+// -*- c-basic-offset: 4 ; tab-width: 4 -*-
+/*
+* This file is part of Hugin's cpfind.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, see
+* <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __detectpano_imgdatacache_h
+#define __detectpano_imgdatacache_h
+
+#include <list>
+#include <set>
+#include <vector>
+#include "PanoDetector.h"
+
+/** keeps the keypoints and kd-trees of only a limited number of images in memory.
+ *
+ *  After the detection the keypoints of each image are written to a binary keyfile
+ *  and released. The matching loads the images when they are needed, if the memory
+ *  limit is reached the least recently used images are released again.
+ */
+class ImgDataCache
+{
+public:
+    /** @param iMaxMemory memory limit in bytes */
+    ImgDataCache(PanoDetector::ImgData_t& ioFilesData, const PanoDetector& iPanoDetector, unsigned long long iMaxMemory);
+
+    /** loads the given images, releases the least recently used other images if necessary */
+    void load(const std::set<int>& iImages);
+    /** splits the images into groups, the images of each group fit together into iMaxMemory */
+    std::vector<std::vector<int> > splitImages(const std::vector<int>& iImages, unsigned long long iMaxMemory) const;
+    /** splits the image pairs into batches, the images of each batch fit together into the memory limit.
+     *  The batches are ordered so that consecutive batches share as many images as possible.
+     *  @return for each batch the indices into iMatchesData */
+    std::vector<std::vector<size_t> > planBatches(const PanoDetector::MatchData_t& iMatchesData) const;
+
+    /** returns the memory limit in bytes */
+    unsigned long long getMaxMemory() const { return m_maxMemory; };
+    /** returns the highest memory used by the loaded images in bytes */
+    unsigned long long getPeakUsage() const { return m_peakUsage; };
+    /** returns how often images were loaded */
+    size_t getNrOfLoads() const { return m_loads; };
+
+private:
+    // prevent copying of class
+    ImgDataCache(const ImgDataCache&);
+    ImgDataCache& operator=(const ImgDataCache&);
+
+    void evict(int imgNr);
+
+    PanoDetector::ImgData_t& m_filesData;
+    const PanoDetector& m_panoDetector;
+    unsigned long long m_maxMemory;
+    unsigned long long m_usage;
+    unsigned long long m_peakUsage;
+    size_t m_loads;
+    /** the loaded images, the most recently used first */
+    std::list<int> m_loaded;
+};
+
+#endif // __detectpano_imgdatacache_h
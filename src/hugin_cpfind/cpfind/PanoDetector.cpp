@@ -44,6 +44,8 @@
 #include <algorithms/basic/CalculateOverlap.h>
 
 #include "ImageImport.h"
+#include "ImgDataCache.h"
+#include "Profiler.h"
 
 #ifdef _WIN32
 #include <direct.h>
@@ -101,11 +103,12 @@ std::string getKeyfilenameFor(std::string keyfilesPath, std::string filename)
 PanoDetector::PanoDetector() :
     _writeAllKeyPoints(false), _verbose(1),
     _sieve1Width(10), _sieve1Height(10), _sieve1Size(100),
-    _kdTreeSearchSteps(200), _kdTreeSecondDistance(0.25),
-    _minimumMatches(6), _ransacMode(HuginBase::RANSACOptimizer::AUTO), _ransacIters(1000), _ransacDistanceThres(50),
+    _kdTreeSearchSteps(200), _kdTreeSecondDistance(0.25), _descriptorType(DESCRIPTOR_FLOAT),
+    _minimumMatches(6), _ransacMode(HuginBase::RANSACOptimizer::AUTO), _ransacIters(1000), _ransacDistanceThres(50), _ransacPreVerify(false),
     _sieve2Width(5), _sieve2Height(5), _sieve2Size(1),
-    _matchingStrategy(ALLPAIRS), _linearMatchLen(1),
-    _test(false), _cores(0), _downscale(true), _cache(false), _cleanup(false),
+    _matchingStrategy(ALLPAIRS), _linearMatchLen(1), _globalIndexNeighbours(10),
+    _vocabTreePairs(10), _vocabTreeSize(10000),
+    _test(false), _cores(0), _maxMemory(0), _imgDataCache(NULL), _profiler(NULL), _downscale(true), _cache(false), _cleanup(false), _binaryKeyfiles(false),
     _celeste(false), _celesteThreshold(0.5), _celesteRadius(20), 
     _keypath(""), _outputFile("default.pto"), _outputGiven(false), svmModel(NULL)
 {
@@ -115,6 +118,23 @@ PanoDetector::PanoDetector() :
 PanoDetector::~PanoDetector()
 {
     delete _panoramaInfo;
+    if (_imgDataCache != NULL)
+    {
+        delete _imgDataCache;
+    };
+    if (_profiler != NULL)
+    {
+        delete _profiler;
+    };
+    // remove the temporary keyfiles, release the mapping of the keyfiles first
+    for (ImgDataIt_t aB = _filesData.begin(); aB != _filesData.end(); ++aB)
+    {
+        aB->second.ReleaseKeypoints();
+        if (!aB->second._spillfilename.empty() && aB->second._spillfilename != aB->second._keyfilename)
+        {
+            remove(aB->second._spillfilename.c_str());
+        };
+    };
 }
 
 bool PanoDetector::checkData()
@@ -173,6 +193,14 @@ void PanoDetector::printDetails()
     {
         std::cout << "Automatically cache keypoints files to disc." << std::endl;
     };
+    if(_maxMemory > 0)
+    {
+        std::cout << "Memory limit for keypoints : " << _maxMemory << " MB" << std::endl;
+    };
+    if(!_profileFile.empty())
+    {
+        std::cout << "Write profile to     : " << _profileFile << std::endl;
+    };
 #ifdef HAVE_OPENMP
     std::cout << "Number of threads  : " << (_cores>0 ? _cores : omp_get_max_threads()) << std::endl << std::endl;
 #endif
@@ -192,6 +220,7 @@ void PanoDetector::printDetails()
     std::cout << "KDTree Options" << std::endl;
     std::cout << "  Search steps : " << _kdTreeSearchSteps << std::endl;
     std::cout << "  Second match distance : " << _kdTreeSecondDistance << std::endl;
+    std::cout << "  Descriptors : " << (_descriptorType == DESCRIPTOR_UINT8 ? "8 bit" : "float") << std::endl;
     std::cout << "Matching Options" << std::endl;
     switch(_matchingStrategy)
     {
@@ -207,6 +236,13 @@ void PanoDetector::printDetails()
         case PREALIGNED:
             std::cout << "  Mode : Prealigned positions" << std::endl;
             break;
+        case GLOBALINDEX:
+            std::cout << "  Mode : Global index with " << _globalIndexNeighbours << " nearest neighbours" << std::endl;
+            break;
+        case VOCABULARYTREE:
+            std::cout << "  Mode : Vocabulary tree with " << _vocabTreeSize << " words, matching the "
+                      << _vocabTreePairs << " most similar images" << std::endl;
+            break;
     };
     std::cout << "  Distance threshold : " << _ransacDistanceThres << std::endl;
     std::cout << "RANSAC Options" << std::endl;
@@ -231,6 +267,7 @@ void PanoDetector::printDetails()
     }
     std::cout << "  Iterations : " << _ransacIters << std::endl;
     std::cout << "  Distance threshold : " << _ransacDistanceThres << std::endl;
+    std::cout << "  Pre-verification (SPRT) : " << (_ransacPreVerify ? "yes" : "no") << std::endl;
     std::cout << "Minimum matches per image pair: " << _minimumMatches << std::endl;
     std::cout << "Sieve 2 Options" << std::endl;
     std::cout << "  Width : " << _sieve2Width << std::endl;
@@ -305,8 +342,16 @@ public:
         PanoDetector::FilterKeyPointsInImage(_imgData, _panoDetector);
         PanoDetector::MakeKeyPointDescriptorsInImage(_imgData, _panoDetector);
         PanoDetector::RemapBackKeypoints(_imgData, _panoDetector);
-        PanoDetector::BuildKDTreesInImage(_imgData, _panoDetector);
         PanoDetector::FreeMemoryInImage(_imgData, _panoDetector);
+        if (_panoDetector.getImgDataCache() != NULL)
+        {
+            // the kd-tree is built when the image is needed for matching
+            PanoDetector::SpillImage(_imgData, _panoDetector);
+        }
+        else
+        {
+            PanoDetector::BuildKDTreesInImage(_imgData, _panoDetector);
+        };
     }
 private:
     const PanoDetector&			_panoDetector;
@@ -349,7 +394,14 @@ public:
     {
         TRACE_IMG("Loading keypoints...");
         PanoDetector::LoadKeypoints(_imgData, _panoDetector);
-        PanoDetector::BuildKDTreesInImage(_imgData, _panoDetector);
+        if (_panoDetector.getImgDataCache() != NULL)
+        {
+            PanoDetector::SpillImage(_imgData, _panoDetector);
+        }
+        else
+        {
+            PanoDetector::BuildKDTreesInImage(_imgData, _panoDetector);
+        };
     }
 
 private:
@@ -357,6 +409,24 @@ private:
     PanoDetector::ImgData&		_imgData;
 };
 
+// definition of a runnable class for MatchData, which contains already the putative matches
+class FilterMatchDataRunnable : public Runnable
+{
+public:
+    FilterMatchDataRunnable(PanoDetector::MatchData& iMatchData, const PanoDetector& iPanoDetector) :
+        _panoDetector(iPanoDetector), _matchData(iMatchData) {};
+
+    virtual void run()
+    {
+        PanoDetector::RansacMatchesInPair(_matchData, _panoDetector);
+        PanoDetector::FilterMatchesInPair(_matchData, _panoDetector);
+        TRACE_PAIR("Found " << _matchData._matches.size() << " matches");
+    }
+private:
+    const PanoDetector&			_panoDetector;
+    PanoDetector::MatchData&	_matchData;
+};
+
 // definition of a runnable class for MatchData
 class MatchDataRunnable : public Runnable
 {
@@ -409,11 +479,27 @@ typedef std::vector<Runnable*> RunnableVector;
 
 void RunQueue(std::vector<Runnable*>& queue)
 {
+#ifdef HAVE_OPENMP
+    // when there are less tasks than threads, e.g. a few large images,
+    // the remaining threads are used by the parallel loops inside the tasks
+    const int threadsPerTask = std::max(1, omp_get_max_threads() / std::max(1, static_cast<int>(queue.size())));
+    const int oldNested = omp_get_nested();
+    if (threadsPerTask > 1)
+    {
+        omp_set_nested(1);
+    };
+#endif
 #pragma omp parallel for schedule(dynamic)
     for (int i = 0; i < queue.size(); ++i)
     {
+#ifdef HAVE_OPENMP
+        omp_set_num_threads(threadsPerTask);
+#endif
         queue[i]->run();
     };
+#ifdef HAVE_OPENMP
+    omp_set_nested(oldNested);
+#endif
     // now clear queue
     while (!queue.empty())
     {
@@ -427,6 +513,11 @@ void PanoDetector::run()
     // init the random time generator
     srandom((unsigned int)time(NULL));
 
+    if (!_profileFile.empty())
+    {
+        _profiler = new Profiler();
+    };
+
     // Load the input project file
     if(!loadProject())
     {
@@ -495,6 +586,16 @@ void PanoDetector::run()
     };
     omp_set_num_threads(_cores);
 #endif
+    if (_profiler != NULL)
+    {
+        _profiler->setThreads(_cores);
+    };
+    // with limited memory only the images needed for the current matching step are kept in memory,
+    // the global index needs all images at once
+    if (_maxMemory > 0 && _keyPointsIdx.empty() && _matchingStrategy != GLOBALINDEX)
+    {
+        _imgDataCache = new ImgDataCache(_filesData, *this, static_cast<unsigned long long>(_maxMemory) * 1024 * 1024);
+    };
     RunnableVector queue;
     svmModel = NULL;
     if(_celeste)
@@ -570,7 +671,10 @@ void PanoDetector::run()
             }
         };
     }
-    RunQueue(queue);
+    {
+        Profiler::Phase profile(_profiler, "detection");
+        RunQueue(queue);
+    };
 
     if(svmModel!=NULL)
     {
@@ -584,9 +688,11 @@ void PanoDetector::run()
         return;
     }
 
-    if(_cache)
+    // with limited memory the keyfiles were already written after the detection
+    if(_cache && _imgDataCache == NULL)
     {
         TRACE_INFO(std::endl << "--- Cache keyfiles to disc ---" << std::endl);
+        Profiler::Phase profile(_profiler, "cache keyfiles");
         for (ImgDataIt_t aB = _filesData.begin(); aB != _filesData.end(); ++aB)
         {
             if (!aB->second._hasakeyfile)
@@ -600,6 +706,13 @@ void PanoDetector::run()
     // Detect matches if writeKeyPoints wasn't set
     if(_keyPointsIdx.empty())
     {
+        // the descriptors are now stored in the kd-trees,
+        // so release the copy in the keypoints
+        for (ImgDataIt_t aB = _filesData.begin(); aB != _filesData.end(); ++aB)
+        {
+            aB->second._kp.freeDescriptors();
+        };
+        Profiler::Phase profile(_profiler, "matching");
         switch (getMatchingStrategy())
         {
             case ALLPAIRS:
@@ -618,6 +731,24 @@ void PanoDetector::run()
                     return;
                 };
                 break;
+            case GLOBALINDEX:
+                {
+                    std::vector<HuginBase::UIntSet> imgPairs(_panoramaInfo->getNrOfImages());
+                    if(!matchGlobalIndex(imgPairs))
+                    {
+                        return;
+                    };
+                };
+                break;
+            case VOCABULARYTREE:
+                {
+                    std::vector<HuginBase::UIntSet> imgPairs(_panoramaInfo->getNrOfImages());
+                    if(!matchVocabularyTree(imgPairs))
+                    {
+                        return;
+                    };
+                };
+                break;
             case PREALIGNED:
                 {
                     //check, which image pairs are already connected by control points
@@ -645,9 +776,17 @@ void PanoDetector::run()
                 }
                 break;
         };
+        if (_imgDataCache != NULL)
+        {
+            TRACE_INFO(std::endl << "Memory limit: " << _maxMemory << " MB, peak memory used by keypoints and kd-trees: "
+                << _imgDataCache->getPeakUsage() / (1024 * 1024) << " MB" << std::endl
+                << "Loaded keypoints " << _imgDataCache->getNrOfLoads() << " times for " << _filesData.size() << " images" << std::endl
+                << "Peak memory usage of cpfind: " << utils::getPeakMemoryUsage() / (1024 * 1024) << " MB" << std::endl);
+        };
     }
 
     // 5. write output
+    Profiler::Phase profile(_profiler, "output");
     if (_keyPointsIdx.size() != 0)
     {
         //Write all keyfiles
@@ -673,10 +812,25 @@ void PanoDetector::run()
     };
 }
 
+void PanoDetector::writeProfile() const
+{
+    if (_profiler == NULL)
+    {
+        return;
+    };
+    if (_verbose > 0)
+    {
+        _profiler->printSummary(std::cout);
+    };
+    if (!_profiler->writeJSON(_profileFile))
+    {
+        std::cerr << "ERROR : Couldn't write profile to file '" << _profileFile << "'!" << std::endl;
+    };
+}
+
 bool PanoDetector::match(std::vector<HuginBase::UIntSet> &checkedPairs)
 {
     // 3. prepare matches
-    RunnableVector queue;
     MatchData_t matchesData;
     unsigned int aLen = _filesData.size();
     if (getMatchingStrategy()==LINEAR)
@@ -716,9 +870,75 @@ bool PanoDetector::match(std::vector<HuginBase::UIntSet> &checkedPairs)
     }
     // 4. find matches
     TRACE_INFO(std::endl<< "--- Find pair-wise matches ---" << std::endl);
+    matchPairs(matchesData);
+
+    // Add detected matches to _panoramaInfo
     for (size_t i = 0; i < matchesData.size(); ++i)
     {
-        queue.push_back(new MatchDataRunnable(matchesData[i], *this));
+        const MatchData& aM = matchesData[i];
+        for (size_t j = 0; j < aM._matches.size(); ++j)
+        {
+            const lfeat::PointMatch& aPM = aM._matches[j];
+            _panoramaInfo->addCtrlPoint(HuginBase::ControlPoint(aM._i1->_number, aPM._img1_x, aPM._img1_y,
+                aM._i2->_number, aPM._img2_x, aPM._img2_y));
+        };
+    };
+    return true;
+};
+
+void PanoDetector::matchPairs(MatchData_t& matchesData)
+{
+    RunnableVector queue;
+    if (_imgDataCache == NULL)
+    {
+        for (size_t i = 0; i < matchesData.size(); ++i)
+        {
+            queue.push_back(new MatchDataRunnable(matchesData[i], *this));
+        };
+        RunQueue(queue);
+        return;
+    };
+    // load only the images of the current batch
+    const std::vector<std::vector<size_t> > batches = _imgDataCache->planBatches(matchesData);
+    for (size_t i = 0; i < batches.size(); ++i)
+    {
+        std::set<int> images;
+        for (size_t j = 0; j < batches[i].size(); ++j)
+        {
+            images.insert(matchesData[batches[i][j]]._i1->_number);
+            images.insert(matchesData[batches[i][j]]._i2->_number);
+        };
+        _imgDataCache->load(images);
+        for (size_t j = 0; j < batches[i].size(); ++j)
+        {
+            queue.push_back(new MatchDataRunnable(matchesData[batches[i][j]], *this));
+        };
+        RunQueue(queue);
+    };
+};
+
+bool PanoDetector::matchGlobalIndex(std::vector<HuginBase::UIntSet> &checkedPairs)
+{
+    // 3. find putative matches and image pairs with the global index
+    TRACE_INFO(std::endl<< "--- Find matches with global index ---" << std::endl);
+    MatchData_t matchesData;
+    if (!FindMatchesInGlobalIndex(_filesData, matchesData, checkedPairs, *this))
+    {
+        return false;
+    };
+    for (size_t i = 0; i < matchesData.size(); ++i)
+    {
+        checkedPairs[matchesData[i]._i1->_number].insert(matchesData[i]._i2->_number);
+        checkedPairs[matchesData[i]._i2->_number].insert(matchesData[i]._i1->_number);
+    };
+    TRACE_INFO("Found " << matchesData.size() << " candidate image pairs." << std::endl);
+
+    // 4. filter matches
+    TRACE_INFO(std::endl<< "--- Filter pair-wise matches ---" << std::endl);
+    RunnableVector queue;
+    for (size_t i = 0; i < matchesData.size(); ++i)
+    {
+        queue.push_back(new FilterMatchDataRunnable(matchesData[i], *this));
     };
     RunQueue(queue);
 
@@ -728,9 +948,58 @@ bool PanoDetector::match(std::vector<HuginBase::UIntSet> &checkedPairs)
         const MatchData& aM = matchesData[i];
         for (size_t j = 0; j < aM._matches.size(); ++j)
         {
-            const lfeat::PointMatchPtr& aPM = aM._matches[j];
-            _panoramaInfo->addCtrlPoint(HuginBase::ControlPoint(aM._i1->_number, aPM->_img1_x, aPM->_img1_y,
-                aM._i2->_number, aPM->_img2_x, aPM->_img2_y));
+            const lfeat::PointMatch& aPM = aM._matches[j];
+            _panoramaInfo->addCtrlPoint(HuginBase::ControlPoint(aM._i1->_number, aPM._img1_x, aPM._img1_y,
+                aM._i2->_number, aPM._img2_x, aPM._img2_y));
+        };
+    };
+    return true;
+};
+
+bool PanoDetector::matchVocabularyTree(std::vector<HuginBase::UIntSet> &checkedPairs)
+{
+    // 3. select the most similar images
+    TRACE_INFO(std::endl<< "--- Find similar images with vocabulary tree ---" << std::endl);
+    std::vector<HuginBase::UIntSet> similarImages(_filesData.size());
+    if (!FindSimilarImages(_filesData, similarImages, *this))
+    {
+        return false;
+    };
+    MatchData_t matchesData;
+    for (unsigned int i1 = 0; i1 < similarImages.size(); ++i1)
+    {
+        for (HuginBase::UIntSet::const_iterator it = similarImages[i1].begin(); it != similarImages[i1].end(); ++it)
+        {
+            const unsigned int i2 = *it;
+            // similarImages is symmetric, so handle each pair only once
+            if (i2 <= i1 || set_contains(checkedPairs[i1], i2))
+            {
+                continue;
+            };
+            matchesData.push_back(MatchData());
+            MatchData& aM = matchesData.back();
+            aM._i1 = &(_filesData[i1]);
+            aM._i2 = &(_filesData[i2]);
+
+            checkedPairs[i1].insert(i2);
+            checkedPairs[i2].insert(i1);
+        };
+    };
+    TRACE_INFO("Selected " << matchesData.size() << " image pairs." << std::endl);
+
+    // 4. find matches
+    TRACE_INFO(std::endl<< "--- Find pair-wise matches ---" << std::endl);
+    matchPairs(matchesData);
+
+    // Add detected matches to _panoramaInfo
+    for (size_t i = 0; i < matchesData.size(); ++i)
+    {
+        const MatchData& aM = matchesData[i];
+        for (size_t j = 0; j < aM._matches.size(); ++j)
+        {
+            const lfeat::PointMatch& aPM = aM._matches[j];
+            _panoramaInfo->addCtrlPoint(HuginBase::ControlPoint(aM._i1->_number, aPM._img1_x, aPM._img1_y,
+                aM._i2->_number, aPM._img2_x, aPM._img2_y));
         };
     };
     return true;
@@ -937,7 +1206,6 @@ void PanoDetector::buildMultiRowImageSets()
 
 bool PanoDetector::matchMultiRow()
 {
-    RunnableVector queue;
     MatchData_t matchesData;
     //step 1
     std::vector<HuginBase::UIntSet> checkedImagePairs(_panoramaInfo->getNrOfImages());
@@ -993,11 +1261,7 @@ bool PanoDetector::matchMultiRow()
         };
     };
     TRACE_INFO(std::endl<< "--- Find matches ---" << std::endl);
-    for (size_t i = 0; i < matchesData.size(); ++i)
-    {
-        queue.push_back(new MatchDataRunnable(matchesData[i], *this));
-    };
-    RunQueue(queue);
+    matchPairs(matchesData);
 
     // Add detected matches to _panoramaInfo
     for (size_t i = 0; i < matchesData.size(); ++i)
@@ -1005,14 +1269,13 @@ bool PanoDetector::matchMultiRow()
         const MatchData& aM = matchesData[i];
         for (size_t j = 0; j < aM._matches.size(); ++j)
         {
-            const lfeat::PointMatchPtr& aPM = aM._matches[j];
-            _panoramaInfo->addCtrlPoint(HuginBase::ControlPoint(aM._i1->_number, aPM->_img1_x, aPM->_img1_y,
-                aM._i2->_number, aPM->_img2_x, aPM->_img2_y));
+            const lfeat::PointMatch& aPM = aM._matches[j];
+            _panoramaInfo->addCtrlPoint(HuginBase::ControlPoint(aM._i1->_number, aPM._img1_x, aPM._img1_y,
+                aM._i2->_number, aPM._img2_x, aPM._img2_y));
         };
     };
 
     // step 2: connect all image groups
-    queue.clear();
     matchesData.clear();
     HuginBase::Panorama mediumPano = _panoramaInfo->getSubset(_image_layer);
     HuginGraph::ImageGraph graph(mediumPano);
@@ -1061,25 +1324,20 @@ bool PanoDetector::matchMultiRow()
             };
         };
         TRACE_INFO(std::endl<< "--- Find matches in images groups ---" << std::endl);
-        for (size_t i = 0; i < matchesData.size(); ++i)
-        {
-            queue.push_back(new MatchDataRunnable(matchesData[i], *this));
-        };
-        RunQueue(queue);
+        matchPairs(matchesData);
 
         for (size_t i = 0; i < matchesData.size(); ++i)
         {
             const MatchData& aM = matchesData[i];
             for (size_t j = 0; j < aM._matches.size(); ++j)
             {
-                const lfeat::PointMatchPtr& aPM = aM._matches[j];
-                _panoramaInfo->addCtrlPoint(HuginBase::ControlPoint(aM._i1->_number, aPM->_img1_x, aPM->_img1_y,
-                    aM._i2->_number, aPM->_img2_x, aPM->_img2_y));
+                const lfeat::PointMatch& aPM = aM._matches[j];
+                _panoramaInfo->addCtrlPoint(HuginBase::ControlPoint(aM._i1->_number, aPM._img1_x, aPM._img1_y,
+                    aM._i2->_number, aPM._img2_x, aPM._img2_y));
             };
         };
     };
     // step 3: now connect all overlapping images
-    queue.clear();
     matchesData.clear();
     HuginBase::Panorama optPano=_panoramaInfo->getSubset(_image_layer);
     HuginGraph::ImageGraph graph2(optPano);
@@ -1178,7 +1436,6 @@ bool PanoDetector::matchMultiRow()
 
 bool PanoDetector::matchPrealigned(HuginBase::Panorama* pano, std::vector<HuginBase::UIntSet> &connectedImages, std::vector<size_t> imgMap, bool exactOverlap)
 {
-    RunnableVector queue;
     MatchData_t matchesData;
     HuginBase::Panorama tempPano = pano->duplicate();
     if(!exactOverlap)
@@ -1215,11 +1472,7 @@ bool PanoDetector::matchPrealigned(HuginBase::Panorama* pano, std::vector<HuginB
     };
 
     TRACE_INFO(std::endl<< "--- Find matches for overlapping images ---" << std::endl);
-    for (size_t i = 0; i < matchesData.size(); ++i)
-    {
-        queue.push_back(new MatchDataRunnable(matchesData[i], *this));
-    };
-    RunQueue(queue);
+    matchPairs(matchesData);
 
     // Add detected matches to _panoramaInfo
     for (size_t i = 0; i < matchesData.size(); ++i)
@@ -1227,9 +1480,9 @@ bool PanoDetector::matchPrealigned(HuginBase::Panorama* pano, std::vector<HuginB
         const MatchData& aM = matchesData[i];
         for (size_t j = 0; j < aM._matches.size(); ++j)
         {
-            const lfeat::PointMatchPtr& aPM = aM._matches[j];
-            _panoramaInfo->addCtrlPoint(HuginBase::ControlPoint(aM._i1->_number, aPM->_img1_x, aPM->_img1_y,
-                aM._i2->_number, aPM->_img2_x, aPM->_img2_y));
+            const lfeat::PointMatch& aPM = aM._matches[j];
+            _panoramaInfo->addCtrlPoint(HuginBase::ControlPoint(aM._i1->_number, aPM._img1_x, aPM._img1_y,
+                aM._i2->_number, aPM._img2_x, aPM._img2_y));
         };
     };
 
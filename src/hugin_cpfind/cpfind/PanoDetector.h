@@ -34,8 +34,10 @@
 
 #include <localfeatures/KeyPoint.h>
 #include <localfeatures/KeyPointDetector.h>
+#include <localfeatures/KeyPointIO.h>
 
 #include <flann/flann.hpp>
+#include "DescriptorDistance.h"
 
 #include <vigra_ext/ROIImage.h>
 
@@ -43,12 +45,15 @@
 #include <algorithms/optimizer/PTOptimizer.h>
 #include <celeste/Celeste.h>
 
+class ImgDataCache;
+class Profiler;
+
 class PanoDetector
 {
 public:
     typedef std::vector<std::string>						FileNameList_t;
     typedef std::vector<std::string>::iterator				FileNameListIt_t;
-    typedef KDTreeSpace::KDTree<KDElemKeyPoint, double>		KPKDTree;
+    typedef KDTreeSpace::KDTree<KDElemKeyPoint, float>		KPKDTree;
     typedef std::shared_ptr<KPKDTree>        KPKDTreePtr;
 
     typedef lfeat::KeyPointDetector KeyPointDetector;
@@ -59,7 +64,16 @@ public:
         ALLPAIRS=0,
         LINEAR,
         MULTIROW,
-        PREALIGNED
+        PREALIGNED,
+        GLOBALINDEX,
+        VOCABULARYTREE
+    };
+
+    /** for selecting the storage of the descriptors in the kd-tree */
+    enum DescriptorType
+    {
+        DESCRIPTOR_FLOAT=0,
+        DESCRIPTOR_UINT8
     };
 
     PanoDetector();
@@ -82,6 +96,18 @@ public:
         @return true, if detection was successful
     */
     bool matchPrealigned(HuginBase::Panorama* pano, std::vector<HuginBase::UIntSet> &connectedImages, std::vector<size_t> imgMap, bool exactOverlap=true);
+    /** matches all images with one kd-tree containing the descriptors of all images,
+        the image pairs are selected by the number of nearest neighbours found in the other images
+        @param checkedPairs contains a list of already connected or tested image pairs, which should be skipped
+        @return true, if detection was successful
+    */
+    bool matchGlobalIndex(std::vector<HuginBase::UIntSet> &checkedPairs);
+    /** matches each image only with the most similar images, the similarity is
+        determined with a vocabulary tree of the descriptors
+        @param checkedPairs contains a list of already connected or tested image pairs, which should be skipped
+        @return true, if detection was successful
+    */
+    bool matchVocabularyTree(std::vector<HuginBase::UIntSet> &checkedPairs);
 
 
     // accessors
@@ -158,6 +184,14 @@ public:
     {
         return _kdTreeSecondDistance;
     }
+    inline void setDescriptorType(DescriptorType iType)
+    {
+        _descriptorType = iType;
+    }
+    inline DescriptorType getDescriptorType() const
+    {
+        return _descriptorType;
+    }
 
     inline void setMinimumMatches(int iMatches)
     {
@@ -175,6 +209,10 @@ public:
     {
         _ransacMode = mode;
     }
+    inline void setRansacPreVerification(bool iPreVerify)
+    {
+        _ransacPreVerify = iPreVerify;
+    }
     inline int  getMinimumMatches() const
     {
         return _minimumMatches;
@@ -191,6 +229,10 @@ public:
     {
         return _ransacMode;
     }
+    inline bool getRansacPreVerification() const
+    {
+        return _ransacPreVerify;
+    }
 
     inline void setSieve2Width(int iWidth)
     {
@@ -233,6 +275,30 @@ public:
     {
         return _matchingStrategy;
     }
+    inline void setGlobalIndexNeighbours(int iNeighbours)
+    {
+        _globalIndexNeighbours = iNeighbours;
+    }
+    inline int getGlobalIndexNeighbours() const
+    {
+        return _globalIndexNeighbours;
+    }
+    inline void setVocabularyTreePairs(int iPairs)
+    {
+        _vocabTreePairs = iPairs;
+    }
+    inline int getVocabularyTreePairs() const
+    {
+        return _vocabTreePairs;
+    }
+    inline void setVocabularyTreeSize(int iSize)
+    {
+        _vocabTreeSize = iSize;
+    }
+    inline int getVocabularyTreeSize() const
+    {
+        return _vocabTreeSize;
+    }
 
     inline bool	getDownscale() const
     {
@@ -273,6 +339,14 @@ public:
     {
         _cleanup = iCleanup;
     }
+    inline bool getBinaryKeyfiles() const
+    {
+        return _binaryKeyfiles;
+    }
+    inline void setBinaryKeyfiles(bool iBinary)
+    {
+        _binaryKeyfiles = iBinary;
+    }
     inline bool getCeleste() const
     {
         return _celeste;
@@ -309,6 +383,36 @@ public:
     {
         _cores = iCores;
     }
+    /** sets the memory limit for the keypoints and kd-trees in MB, 0 means no limit */
+    inline void setMaxMemory(int iMaxMemory)
+    {
+        _maxMemory = iMaxMemory;
+    }
+    inline int getMaxMemory() const
+    {
+        return _maxMemory;
+    }
+    /** returns the cache of the loaded images, NULL if the memory is not limited */
+    inline ImgDataCache* getImgDataCache() const
+    {
+        return _imgDataCache;
+    }
+    /** sets the file for the profile of the run, an empty string disables the profiling */
+    inline void setProfileFile(const std::string& iProfileFile)
+    {
+        _profileFile = iProfileFile;
+    }
+    inline std::string getProfileFile() const
+    {
+        return _profileFile;
+    }
+    /** returns the profiler, NULL if the run is not profiled */
+    inline Profiler* getProfiler() const
+    {
+        return _profiler;
+    }
+    /** writes the profile file and prints the summary, if the run was profiled */
+    void writeProfile() const;
 
     // predeclaration
     struct ImgData;
@@ -332,11 +436,13 @@ private:
 
     int						_kdTreeSearchSteps;
     double					_kdTreeSecondDistance;
+    DescriptorType			_descriptorType;
 
     int						_minimumMatches;
     HuginBase::RANSACOptimizer::Mode	_ransacMode;
     int						_ransacIters;
     int						_ransacDistanceThres;
+    bool					_ransacPreVerify;
 
     int						_sieve2Width;
     int						_sieve2Height;
@@ -344,12 +450,20 @@ private:
 
     MatchingStrategy _matchingStrategy;
     int						_linearMatchLen;
+    int						_globalIndexNeighbours;
+    int						_vocabTreePairs;
+    int						_vocabTreeSize;
 
     bool						_test;
     int						_cores;
+    int						_maxMemory;
+    ImgDataCache*			_imgDataCache;
+    std::string				_profileFile;
+    Profiler*				_profiler;
     bool                 _downscale;
     bool        _cache;
     bool        _cleanup;
+    bool        _binaryKeyfiles;
     bool        _celeste;
     double      _celesteThreshold;
     int         _celesteRadius;
@@ -369,6 +483,9 @@ private:
 
     /** search for image layer and image stacks for the multirow matching step */
     void buildMultiRowImageSets();
+    /** matches the given image pairs, when the memory is limited the pairs are matched in batches,
+        so that only the images of the current batch need to be loaded */
+    void matchPairs(std::vector<MatchData>& matchesData);
 
     /** image set contains only the images with the median exposure of each stack */
     HuginBase::UIntSet _image_layer;
@@ -380,7 +497,11 @@ private:
     void CleanupKeyfiles();
 
     void					writeOutput();
-    void					writeKeyfile(ImgData& imgInfo);
+    /** writes the keypoints of the image to its keyfile, returns false if the file could not be written */
+    bool					writeKeyfile(ImgData& imgInfo) const;
+    bool					writeKeyfile(ImgData& imgInfo, const std::string& filename, bool binary) const;
+    /** returns the parameters of the keypoint detection, stored in binary keyfiles */
+    lfeat::DetectionParameters getDetectionParameters(const ImgData& imgInfo) const;
 
     // internals
 public:
@@ -401,14 +522,25 @@ public:
 
         bool 					_hasakeyfile;
         std::string _keyfilename;
+        // keyfile, from which the keypoints are loaded again when the memory is limited,
+        // empty if the image has no keypoints
+        std::string _spillfilename;
+        // memory used by keypoints and kd-tree in bytes, estimated as long as the image is not loaded
+        size_t _memoryUsage;
 
-        lfeat::KeyPointVect_t	_kp;
+        lfeat::KeyPointSet	_kp;
         int					_descLength;
         bool          	   _loadFail;
 
-        // kdtree
-        flann::Matrix<double> _flann_descriptors;
-        flann::Index<flann::L2<double> > * _flann_index;
+        // memory mapped binary keyfile, the kdtree uses the descriptors directly from the file
+        std::shared_ptr<lfeat::MappedKeyfile> _keyfile;
+
+        // kdtree, depending on the descriptor type either the float
+        // or the 8 bit quantized descriptors and index are used
+        flann::Matrix<float> _flann_descriptors;
+        flann::Index<DescriptorDistance::L2<float> > * _flann_index;
+        flann::Matrix<unsigned char> _flann_descriptors8;
+        flann::Index<DescriptorDistance::L2<unsigned char> > * _flann_index8;
 
         ImgData()
         {
@@ -420,25 +552,90 @@ public:
             _hasakeyfile = false;
             _descLength = 0;
             _flann_index = NULL;
+            _flann_index8 = NULL;
+            _memoryUsage = 0;
         }
 
         ~ImgData()
+        {
+            FreeKDTree();
+        }
+        /** deletes the kd-trees and the descriptors */
+        void FreeKDTree()
         {
             if (_flann_index != NULL)
             {
                 delete _flann_index;
+                _flann_index = NULL;
             };
-            if (_flann_descriptors.rows + _flann_descriptors.cols > 0)
+            if (_flann_descriptors.rows + _flann_descriptors.cols > 0 && !IsMappedDescriptor(_flann_descriptors.ptr()))
             {
                 delete[]_flann_descriptors.ptr();
             };
+            _flann_descriptors = flann::Matrix<float>();
+            if (_flann_index8 != NULL)
+            {
+                delete _flann_index8;
+                _flann_index8 = NULL;
+            };
+            if (_flann_descriptors8.rows + _flann_descriptors8.cols > 0 && !IsMappedDescriptor(_flann_descriptors8.ptr()))
+            {
+                delete[]_flann_descriptors8.ptr();
+            };
+            _flann_descriptors8 = flann::Matrix<unsigned char>();
+        }
+        /** frees the kd-trees, the keypoints and the mapped keyfile */
+        void ReleaseKeypoints()
+        {
+            FreeKDTree();
+            _kp.clear();
+            _keyfile.reset();
+        }
+        /** returns true, if keypoints were found, they may currently be unloaded */
+        bool HasKeypoints() const
+        {
+            return !_kp.empty() || !_spillfilename.empty();
+        }
+        /** returns the memory used by the keypoints and the kd-trees in bytes */
+        size_t GetMemoryUsage() const
+        {
+            size_t usage = _kp.usedMemory();
+            usage += _flann_descriptors.rows * _flann_descriptors.cols * sizeof(float);
+            usage += _flann_descriptors8.rows * _flann_descriptors8.cols;
+            if (_flann_index != NULL)
+            {
+                usage += _flann_index->usedMemory();
+            };
+            if (_flann_index8 != NULL)
+            {
+                usage += _flann_index8->usedMemory();
+            };
+            return usage;
         }
+        /** estimates the memory usage of an image with the given number of keypoints */
+        static size_t EstimateMemoryUsage(size_t nrKeypoints, int descLength, bool quantized)
+        {
+            // the kd-tree with 4 trees needs about 260 bytes per descriptor
+            return nrKeypoints * (kKeypointMemory + descLength * (quantized ? 1 : sizeof(float)) + 260);
+        }
+        /** returns true, if the descriptors are stored in the memory mapped keyfile */
+        bool IsMappedDescriptor(const void* descriptors) const
+        {
+            return _keyfile && _keyfile->getDescriptors() == descriptors;
+        };
+        /** returns the number of keypoints stored in the kd-tree */
+        size_t GetKDTreeSize() const
+        {
+            return _flann_descriptors8.rows > 0 ? _flann_descriptors8.rows : _flann_descriptors.rows;
+        };
         void SetSizeMode(const SizeMode newSizeMode) { m_sizeMode = newSizeMode; };
         SizeMode GetSizeMode() const { return m_sizeMode; };
         bool IsDownscale() const { return m_sizeMode == DOWNSCALED; };
         bool NeedsRemapping() const { return m_sizeMode == REMAPPED; };
     private:
         SizeMode m_sizeMode;
+        // position, scale, score, orientation and trace of a keypoint
+        static const size_t kKeypointMemory = 5 * sizeof(double) + sizeof(int);
     };
 
     typedef std::map<int, ImgData>					ImgData_t;
@@ -464,8 +661,14 @@ public:
     static bool             RemapBackKeypoints(ImgData& ioImgInfo, const PanoDetector& iPanoDetector);
     static bool				BuildKDTreesInImage(ImgData& ioImgInfo, const PanoDetector& iPanoDetector);
     static bool				FreeMemoryInImage(ImgData& ioImgInfo, const PanoDetector& iPanoDetector);
+    static bool				SpillImage(ImgData& ioImgInfo, const PanoDetector& iPanoDetector);
+    static bool				ReloadKeypoints(ImgData& ioImgInfo, const PanoDetector& iPanoDetector);
 
     static bool				FindMatchesInPair(MatchData& ioMatchData, const PanoDetector& iPanoDetector);
+    static bool				FindMatchesInGlobalIndex(ImgData_t& ioFilesData, MatchData_t& oMatchesData,
+                                                     const std::vector<HuginBase::UIntSet>& iCheckedPairs, const PanoDetector& iPanoDetector);
+    static bool				FindSimilarImages(ImgData_t& ioFilesData, std::vector<HuginBase::UIntSet>& oSimilarImages,
+                                              const PanoDetector& iPanoDetector);
     static bool				RansacMatchesInPair(MatchData& ioMatchData, const PanoDetector& iPanoDetector);
     static bool				RansacMatchesInPairCam(MatchData& ioMatchData, const PanoDetector& iPanoDetector);
     static bool				RansacMatchesInPairHomography(MatchData& ioMatchData, const PanoDetector& iPanoDetector);
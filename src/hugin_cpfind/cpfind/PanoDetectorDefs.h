@@ -29,17 +29,17 @@
 #include "Utils.h"
 
 
-// define KDTree element from a KeyPointPtr
+// define KDTree element from the descriptor of a keypoint
 // define a class to wrap an Ipoint and make it KDTree compliant.
-class KDElemKeyPoint : public KDTreeSpace::KDTreeElemInterface<double>
+class KDElemKeyPoint : public KDTreeSpace::KDTreeElemInterface<float>
 {
 public:
-    KDElemKeyPoint (lfeat::KeyPointPtr& iK, int iNumber) : _ivec(iK->_vec), _n(iNumber) {}
-    inline double& getVectorElem(int iPos) const
+    KDElemKeyPoint (float* iVec, int iNumber) : _ivec(iVec), _n(iNumber) {}
+    inline float& getVectorElem(int iPos) const
     {
         return _ivec[iPos];   // access to the vector elements.
     }
-    double* _ivec;
+    float* _ivec;
     size_t _n;
 };
 
@@ -24,6 +24,7 @@
 #include "PanoDetector.h"
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <vigra/distancetransform.hxx>
 #include "vigra_ext/impexalpha.hxx"
 #include "vigra_ext/cms.h"
@@ -32,6 +33,7 @@
 #include <localfeatures/PointMatch.h>
 #include <localfeatures/RansacFiltering.h>
 #include <localfeatures/KeyPointIO.h>
+#include <localfeatures/MathStuff.h>
 #include <localfeatures/CircularKeyPointDescriptor.h>
 
 /*
@@ -40,6 +42,9 @@
 */
 #include "Utils.h"
 #include "Tracer.h"
+#include "VocabularyTree.h"
+#include "ImgDataCache.h"
+#include "Profiler.h"
 
 #include <algorithms/nona/ComputeImageROI.h>
 #include <algorithms/optimizer/PTOptimizer.h>
@@ -56,36 +61,64 @@
 class KeyPointVectInsertor : public lfeat::KeyPointInsertor
 {
 public:
-    explicit KeyPointVectInsertor(lfeat::KeyPointVect_t& iVect) : _v(iVect) {};
+    explicit KeyPointVectInsertor(lfeat::KeyPointSet& iVect) : _v(iVect) {};
     inline virtual void operator()(const lfeat::KeyPoint& k)
     {
-        _v.push_back(lfeat::KeyPointPtr(new lfeat::KeyPoint(k)));
+        _v.add(k);
     }
 
 private:
-    lfeat::KeyPointVect_t& _v;
+    lfeat::KeyPointSet& _v;
 
 };
 
+// keypoint in the sieve, referenced by its index
+struct SieveKeyPoint
+{
+    double _score;
+    double _scale;
+    size_t _index;
+};
+
+class SieveKeyPointSort
+{
+public:
+    inline bool operator() (const SieveKeyPoint& a, const SieveKeyPoint& b) const
+    {
+        if (a._score < b._score)
+        {
+            return true;
+        }
+        else if (a._score > b._score)
+        {
+            return false;
+        }
+        else
+        {
+            // same score, order by scale
+            return (a._scale < b._scale);
+        }
+    }
+};
 
 // define a sieve extractor
-class SieveExtractorKP : public lfeat::SieveExtractor<lfeat::KeyPointPtr>
+class SieveExtractorKP : public lfeat::SieveExtractor<SieveKeyPoint>
 {
 public:
-    explicit SieveExtractorKP(lfeat::KeyPointVect_t& iV) : _v(iV) {};
-    inline virtual void operator()(const lfeat::KeyPointPtr& k)
+    explicit SieveExtractorKP(std::vector<size_t>& iV) : _v(iV) {};
+    inline virtual void operator()(const SieveKeyPoint& k)
     {
-        _v.push_back(k);
+        _v.push_back(k._index);
     }
 private:
-    lfeat::KeyPointVect_t& _v;
+    std::vector<size_t>& _v;
 };
 
-class SieveExtractorMatch : public lfeat::SieveExtractor<lfeat::PointMatchPtr>
+class SieveExtractorMatch : public lfeat::SieveExtractor<lfeat::PointMatch>
 {
 public:
     explicit SieveExtractorMatch(lfeat::PointMatchVector_t& iM) : _m(iM) {};
-    inline virtual void operator()(const lfeat::PointMatchPtr& m)
+    inline virtual void operator()(const lfeat::PointMatch& m)
     {
         _m.push_back(m);
     }
@@ -93,11 +126,43 @@ private:
     lfeat::PointMatchVector_t& _m;
 };
 
+// names of the images and pairs in the profile
+static std::string ProfileItem(const PanoDetector::ImgData& iImgData)
+{
+    std::ostringstream item;
+    item << "i" << iImgData._number;
+    return item.str();
+}
+
+static std::string ProfileItem(const PanoDetector::MatchData& iMatchData)
+{
+    std::ostringstream item;
+    item << "i" << iMatchData._i1->_number << "-i" << iMatchData._i2->_number;
+    return item.str();
+}
+
 bool PanoDetector::LoadKeypoints(ImgData& ioImgInfo, const PanoDetector& iPanoDetector)
 {
+    Profiler::Scope profile(iPanoDetector.getProfiler(), "load keyfile", ProfileItem(ioImgInfo));
     TRACE_IMG("Loading keypoints...");
 
-    lfeat::ImageInfo info = lfeat::loadKeypoints(ioImgInfo._keyfilename, ioImgInfo._kp);
+    lfeat::ImageInfo info;
+    std::shared_ptr<lfeat::MappedKeyfile> keyfile(new lfeat::MappedKeyfile());
+    if (keyfile->open(ioImgInfo._keyfilename))
+    {
+        // binary keyfile, the descriptors are not copied, but used directly from the mapped file
+        info = keyfile->getImageInfo();
+        keyfile->getKeyPoints(ioImgInfo._kp);
+        ioImgInfo._keyfile = keyfile;
+        if (keyfile->getDetectionParameters() != iPanoDetector.getDetectionParameters(ioImgInfo) && iPanoDetector.getVerbose() > 0)
+        {
+            TRACE_INFO("i" << ioImgInfo._number << " : Keyfile " << ioImgInfo._keyfilename << " was created with different detection parameters." << std::endl);
+        };
+    }
+    else
+    {
+        info = lfeat::loadKeypoints(ioImgInfo._keyfilename, ioImgInfo._kp);
+    };
     ioImgInfo._loadFail = (info.filename.empty());
 
     // update ImgData
@@ -180,6 +245,7 @@ void RemapImage(const HuginBase::SrcPanoImage& srcImage, const HuginBase::Panora
     const PixelTransform& pixelTransform,
     ImageType*& finalImage, vigra::BImage*& finalMask)
 {
+    Profiler::Scope profile("remap image");
     AppBase::DummyProgressDisplay dummy;
     HuginBase::PTools::Transform transform;
     transform.createTransform(srcImage, options);
@@ -217,6 +283,7 @@ void HandleDownscaleImage(const HuginBase::SrcPanoImage& srcImage, ImageType*& i
     size_t detectWidth, size_t detectHeight, bool downscale,
     ImageType*& finalImage, vigra::BImage*& finalMask)
 {
+    Profiler::Scope profile("downscale image");
     if (srcImage.hasActiveMasks() || (srcImage.getCropMode() != HuginBase::SrcPanoImage::NO_CROP && !srcImage.getCropRect().isEmpty()))
     {
         if (!mask)
@@ -258,6 +325,7 @@ void HandleDownscaleImage(const HuginBase::SrcPanoImage& srcImage, ImageType*& i
 // #define DEBUG_LOADING_REMAPPING
 bool PanoDetector::AnalyzeImage(ImgData& ioImgInfo, const PanoDetector& iPanoDetector)
 {
+    Profiler::Scope profile(iPanoDetector.getProfiler(), "load image", ProfileItem(ioImgInfo));
     vigra::DImage* final_img = NULL;
     vigra::BImage* final_mask = NULL;
 
@@ -435,6 +503,7 @@ bool PanoDetector::AnalyzeImage(ImgData& ioImgInfo, const PanoDetector& iPanoDet
                             if (iPanoDetector.getCeleste())
                             {
                                 TRACE_IMG("Mask areas with clouds...");
+                                Profiler::Scope profileCeleste("celeste");
                                 vigra::UInt16RGBImage* image16=new vigra::UInt16RGBImage(scaled->size());
                                 vigra::transformImage(vigra::srcImageRange(*scaled), vigra::destImage(*image16),
                                     vigra::linearIntensityTransform<vigra::RGBValue<vigra::UInt16> >(255));
@@ -508,6 +577,7 @@ bool PanoDetector::AnalyzeImage(ImgData& ioImgInfo, const PanoDetector& iPanoDet
                             if (iPanoDetector.getCeleste())
                             {
                                 TRACE_IMG("Mask areas with clouds...");
+                                Profiler::Scope profileCeleste("celeste");
                                 vigra::BImage* celeste_mask = celeste::getCelesteMask(iPanoDetector.svmModel, *scaled, radius, iPanoDetector.getCelesteThreshold(), 800, true, false);
 #ifdef DEBUG_LOADING_REMAPPING
                                 // DEBUG: export celeste mask
@@ -610,6 +680,7 @@ bool PanoDetector::AnalyzeImage(ImgData& ioImgInfo, const PanoDetector& iPanoDet
                             if (iPanoDetector.getCeleste())
                             {
                                 TRACE_IMG("Mask areas with clouds...");
+                                Profiler::Scope profileCeleste("celeste");
                                 vigra::UInt16RGBImage* image16 = new vigra::UInt16RGBImage(scaled->size());
                                 if (range255)
                                 {
@@ -675,8 +746,11 @@ bool PanoDetector::AnalyzeImage(ImgData& ioImgInfo, const PanoDetector& iPanoDet
 
         // Build integral image
         TRACE_IMG("Build integral image...");
-        ioImgInfo._ii.init(*final_img);
-        delete final_img;
+        {
+            Profiler::Scope profileIntegral("integral image");
+            ioImgInfo._ii.init(*final_img);
+            delete final_img;
+        };
 
         // compute distance map
         if(final_mask)
@@ -713,6 +787,7 @@ bool PanoDetector::AnalyzeImage(ImgData& ioImgInfo, const PanoDetector& iPanoDet
 
 bool PanoDetector::FindKeyPointsInImage(ImgData& ioImgInfo, const PanoDetector& iPanoDetector)
 {
+    Profiler::Scope profile(iPanoDetector.getProfiler(), "detect keypoints", ProfileItem(ioImgInfo));
     TRACE_IMG("Find keypoints...");
 
     // setup the detector
@@ -729,9 +804,10 @@ bool PanoDetector::FindKeyPointsInImage(ImgData& ioImgInfo, const PanoDetector&
 
 bool PanoDetector::FilterKeyPointsInImage(ImgData& ioImgInfo, const PanoDetector& iPanoDetector)
 {
+    Profiler::Scope profile(iPanoDetector.getProfiler(), "filter keypoints", ProfileItem(ioImgInfo));
     TRACE_IMG("Filtering keypoints...");
 
-    lfeat::Sieve<lfeat::KeyPointPtr, lfeat::KeyPointPtrSort > aSieve(iPanoDetector.getSieve1Width(),
+    lfeat::Sieve<SieveKeyPoint, SieveKeyPointSort > aSieve(iPanoDetector.getSieve1Width(),
             iPanoDetector.getSieve1Height(),
             iPanoDetector.getSieve1Size());
 
@@ -739,32 +815,36 @@ bool PanoDetector::FilterKeyPointsInImage(ImgData& ioImgInfo, const PanoDetector
     double aXF = (double)iPanoDetector.getSieve1Width() / (double)ioImgInfo._detectWidth;
     double aYF = (double)iPanoDetector.getSieve1Height() / (double)ioImgInfo._detectHeight;
 
+    const lfeat::KeyPointSet& aKP = ioImgInfo._kp;
     const bool distmap_valid=(ioImgInfo._distancemap.width()>0 && ioImgInfo._distancemap.height()>0);
-    for (size_t i = 0; i < ioImgInfo._kp.size(); ++i)
+    for (size_t i = 0; i < aKP.size(); ++i)
     {
-        lfeat::KeyPointPtr& aK = ioImgInfo._kp[i];
+        SieveKeyPoint aK = { aKP._score[i], aKP._scale[i], i };
+        const double x = aKP._x[i];
+        const double y = aKP._y[i];
         if(distmap_valid)
         {
-            if(aK->_x > 0 && aK->_x < ioImgInfo._distancemap.width() && aK->_y > 0 && aK->_y < ioImgInfo._distancemap.height()
-                    && ioImgInfo._distancemap((int)(aK->_x),(int)(aK->_y)) >aK->_scale*8)
+            if(x > 0 && x < ioImgInfo._distancemap.width() && y > 0 && y < ioImgInfo._distancemap.height()
+                    && ioImgInfo._distancemap((int)(x),(int)(y)) >aK._scale*8)
             {
-                //cout << " dist from border:" << ioImgInfo._distancemap((int)(aK->_x),(int)(aK->_y)) << " required dist: " << aK->_scale*12 << std::endl;
-                aSieve.insert(aK, (int)(aK->_x * aXF), (int)(aK->_y * aYF));
+                //cout << " dist from border:" << ioImgInfo._distancemap((int)(x),(int)(y)) << " required dist: " << aK._scale*12 << std::endl;
+                aSieve.insert(aK, (int)(x * aXF), (int)(y * aYF));
             }
         }
         else
         {
-            aSieve.insert(aK, (int)(aK->_x * aXF), (int)(aK->_y * aYF));
+            aSieve.insert(aK, (int)(x * aXF), (int)(y * aYF));
         };
     }
 
-    // pull remaining values from the sieve
-    ioImgInfo._kp.clear();
-
-    // make an extractor and pull the points
-    SieveExtractorKP aSieveExt(ioImgInfo._kp);
+    // make an extractor and pull the indices of the remaining points
+    std::vector<size_t> aKept;
+    SieveExtractorKP aSieveExt(aKept);
     aSieve.extract(aSieveExt);
 
+    // keep only the remaining points
+    ioImgInfo._kp.select(aKept);
+
     TRACE_IMG("Kept " << ioImgInfo._kp.size() << " interest points.");
 
     return true;
@@ -773,31 +853,41 @@ bool PanoDetector::FilterKeyPointsInImage(ImgData& ioImgInfo, const PanoDetector
 
 bool PanoDetector::MakeKeyPointDescriptorsInImage(ImgData& ioImgInfo, const PanoDetector& iPanoDetector)
 {
+    Profiler::Scope profile(iPanoDetector.getProfiler(), "descriptors", ProfileItem(ioImgInfo));
     TRACE_IMG("Make keypoint descriptors...");
 
     // build a keypoint descriptor
     lfeat::CircularKeyPointDescriptor aKPD(ioImgInfo._ii);
 
-    // vector for keypoints with more than one orientation
-    lfeat::KeyPointVect_t kp_new_ori;
-    for (size_t j = 0; j < ioImgInfo._kp.size(); ++j)
+    // assign the orientations, the keypoints are independent
+    const int nrKeypoints = static_cast<int>(ioImgInfo._kp.size());
+    std::vector<int> nrAngles(nrKeypoints);
+    std::vector<double> angles(4 * nrKeypoints);
+#pragma omp parallel for schedule(dynamic, 256)
+    for (int j = 0; j < nrKeypoints; ++j)
+    {
+        lfeat::KeyPoint aK = ioImgInfo._kp.get(j);
+        nrAngles[j] = aKPD.assignOrientation(aK, &angles[4 * j]);
+        ioImgInfo._kp._ori[j] = aK._ori;
+    }
+    // keypoints with more than one orientation are duplicated at the end
+    for (int j = 0; j < nrKeypoints; ++j)
     {
-        lfeat::KeyPointPtr& aK = ioImgInfo._kp[j];
-        double angles[4];
-        int nAngles = aKPD.assignOrientation(*aK, angles);
-        for (int i=0; i < nAngles; i++)
+        for (int i = 0; i < nrAngles[j]; i++)
         {
             // duplicate Keypoint with additional angles
-            lfeat::KeyPointPtr aKn = lfeat::KeyPointPtr ( new lfeat::KeyPoint ( *aK ) );
-            aKn->_ori = angles[i];
-            kp_new_ori.push_back(aKn);
+            lfeat::KeyPoint aKn = ioImgInfo._kp.get(j);
+            aKn._ori = angles[4 * j + i];
+            ioImgInfo._kp.add(aKn);
         }
     }
-    ioImgInfo._kp.insert(ioImgInfo._kp.end(), kp_new_ori.begin(), kp_new_ori.end());
 
-    for (size_t i = 0; i < ioImgInfo._kp.size(); ++i)
+    // the descriptors of all keypoints are stored in one block
+    ioImgInfo._kp.allocDescriptors(aKPD.getDescriptorLength());
+#pragma omp parallel for schedule(dynamic, 256)
+    for (int i = 0; i < static_cast<int>(ioImgInfo._kp.size()); ++i)
     {
-        aKPD.makeDescriptor(*(ioImgInfo._kp[i]));
+        aKPD.makeDescriptor(ioImgInfo._kp.get(i), ioImgInfo._kp.getDescriptor(i));
     }
     // store the descriptor length
     ioImgInfo._descLength = aKPD.getDescriptorLength();
@@ -810,10 +900,9 @@ bool PanoDetector::RemapBackKeypoints(ImgData& ioImgInfo, const PanoDetector& iP
     {
         for (size_t i = 0; i < ioImgInfo._kp.size(); ++i)
         {
-            lfeat::KeyPointPtr& aK = ioImgInfo._kp[i];
-            aK->_x *= 2.0;
-            aK->_y *= 2.0;
-            aK->_scale *= 2.0;
+            ioImgInfo._kp._x[i] *= 2.0;
+            ioImgInfo._kp._y[i] *= 2.0;
+            ioImgInfo._kp._scale[i] *= 2.0;
         };
     }
     else
@@ -830,14 +919,13 @@ bool PanoDetector::RemapBackKeypoints(ImgData& ioImgInfo, const PanoDetector& iP
 
             for (size_t i = 0; i < ioImgInfo._kp.size(); ++i)
             {
-                lfeat::KeyPointPtr& aK = ioImgInfo._kp[i];
                 double xout, yout;
-                if (trafo1.transformImgCoord(xout, yout, aK->_x + dx1, aK->_y + dy1))
+                if (trafo1.transformImgCoord(xout, yout, ioImgInfo._kp._x[i] + dx1, ioImgInfo._kp._y[i] + dy1))
                 {
                     // downscaling is take care of by the remapping transform
                     // no need for multiplying the scale factor...
-                    aK->_x = xout;
-                    aK->_y = yout;
+                    ioImgInfo._kp._x[i] = xout;
+                    ioImgInfo._kp._y[i] = yout;
                 };
             };
         };
@@ -845,27 +933,101 @@ bool PanoDetector::RemapBackKeypoints(ImgData& ioImgInfo, const PanoDetector& iP
     return true;
 }
 
+/** copies the descriptor of the keypoint with index i into descriptor,
+ *  the descriptor is stored either in the keypoint or in the mapped keyfile */
+static void GetDescriptor(const PanoDetector::ImgData& iImgInfo, size_t i, float* descriptor)
+{
+    const int descLength = iImgInfo._descLength;
+    if (iImgInfo._keyfile)
+    {
+        if (iImgInfo._keyfile->getDescriptorStorage() == lfeat::DESCRIPTOR_STORAGE_UINT8)
+        {
+            const unsigned char* vec = static_cast<const unsigned char*>(iImgInfo._keyfile->getDescriptors()) + i * descLength;
+            for (int j = 0; j < descLength; ++j)
+            {
+                descriptor[j] = lfeat::Math::DequantizeDescriptor(vec[j]);
+            };
+        }
+        else
+        {
+            memcpy(descriptor, static_cast<const float*>(iImgInfo._keyfile->getDescriptors()) + i * descLength, sizeof(float)*descLength);
+        };
+    }
+    else
+    {
+        memcpy(descriptor, iImgInfo._kp.getDescriptor(i), sizeof(float)*descLength);
+    };
+}
+
 bool PanoDetector::BuildKDTreesInImage(ImgData& ioImgInfo, const PanoDetector& iPanoDetector)
 {
+    Profiler::Scope profile(iPanoDetector.getProfiler(), "build kd-tree", ProfileItem(ioImgInfo));
     TRACE_IMG("Build KDTree...");
 
     if(ioImgInfo._kp.empty())
     {
         return false;
     };
-    // build a vector of KDElemKeyPointPtr
-
     // create feature vector matrix for flann
-    ioImgInfo._flann_descriptors = flann::Matrix<double>(new double[ioImgInfo._kp.size()*ioImgInfo._descLength],
-                                   ioImgInfo._kp.size(), ioImgInfo._descLength);
-    for (size_t i = 0; i < ioImgInfo._kp.size(); ++i)
+    // descriptors from a binary keyfile with matching type are used without copying,
+    // flann does not modify the data, so the read only mapping can be used
+    const bool useMapped = ioImgInfo._keyfile && ioImgInfo._keyfile->getNrOfKeyPoints() == ioImgInfo._kp.size();
+    if (iPanoDetector.getDescriptorType() == DESCRIPTOR_UINT8)
     {
-        memcpy(ioImgInfo._flann_descriptors[i], ioImgInfo._kp[i]->_vec, sizeof(double)*ioImgInfo._descLength);
+        if (useMapped && ioImgInfo._keyfile->getDescriptorStorage() == lfeat::DESCRIPTOR_STORAGE_UINT8)
+        {
+            ioImgInfo._flann_descriptors8 = flann::Matrix<unsigned char>(
+                static_cast<unsigned char*>(const_cast<void*>(ioImgInfo._keyfile->getDescriptors())),
+                ioImgInfo._kp.size(), ioImgInfo._descLength);
+        }
+        else
+        {
+            ioImgInfo._flann_descriptors8 = flann::Matrix<unsigned char>(new unsigned char[ioImgInfo._kp.size()*ioImgInfo._descLength],
+                                            ioImgInfo._kp.size(), ioImgInfo._descLength);
+            std::vector<float> vec(ioImgInfo._descLength);
+            for (size_t i = 0; i < ioImgInfo._kp.size(); ++i)
+            {
+                GetDescriptor(ioImgInfo, i, vec.data());
+                unsigned char* descriptor = ioImgInfo._flann_descriptors8[i];
+                for (int j = 0; j < ioImgInfo._descLength; ++j)
+                {
+                    descriptor[j] = lfeat::Math::QuantizeDescriptor(vec[j]);
+                };
+            }
+        };
+
+        // build query structure, not needed when matching with the global index
+        if (iPanoDetector.getMatchingStrategy() != GLOBALINDEX)
+        {
+            ioImgInfo._flann_index8 = new flann::Index<DescriptorDistance::L2<unsigned char> >(ioImgInfo._flann_descriptors8, flann::KDTreeIndexParams(4));
+            ioImgInfo._flann_index8->buildIndex();
+        };
     }
+    else
+    {
+        if (useMapped && ioImgInfo._keyfile->getDescriptorStorage() == lfeat::DESCRIPTOR_STORAGE_FLOAT32)
+        {
+            ioImgInfo._flann_descriptors = flann::Matrix<float>(
+                static_cast<float*>(const_cast<void*>(ioImgInfo._keyfile->getDescriptors())),
+                ioImgInfo._kp.size(), ioImgInfo._descLength);
+        }
+        else
+        {
+            ioImgInfo._flann_descriptors = flann::Matrix<float>(new float[ioImgInfo._kp.size()*ioImgInfo._descLength],
+                                           ioImgInfo._kp.size(), ioImgInfo._descLength);
+            for (size_t i = 0; i < ioImgInfo._kp.size(); ++i)
+            {
+                GetDescriptor(ioImgInfo, i, ioImgInfo._flann_descriptors[i]);
+            }
+        };
 
-    // build query structure
-    ioImgInfo._flann_index = new flann::Index<flann::L2<double> > (ioImgInfo._flann_descriptors, flann::KDTreeIndexParams(4));
-    ioImgInfo._flann_index->buildIndex();
+        // build query structure, not needed when matching with the global index
+        if (iPanoDetector.getMatchingStrategy() != GLOBALINDEX)
+        {
+            ioImgInfo._flann_index = new flann::Index<DescriptorDistance::L2<float> >(ioImgInfo._flann_descriptors, flann::KDTreeIndexParams(4));
+            ioImgInfo._flann_index->buildIndex();
+        };
+    };
 
     return true;
 }
@@ -880,28 +1042,92 @@ bool PanoDetector::FreeMemoryInImage(ImgData& ioImgInfo, const PanoDetector& iPa
     return true;
 }
 
-
-bool PanoDetector::FindMatchesInPair(MatchData& ioMatchData, const PanoDetector& iPanoDetector)
+bool PanoDetector::SpillImage(ImgData& ioImgInfo, const PanoDetector& iPanoDetector)
 {
-    TRACE_PAIR("Find Matches...");
+    Profiler::Scope profile(iPanoDetector.getProfiler(), "spill keypoints", ProfileItem(ioImgInfo));
+    if (!ioImgInfo._kp.empty())
+    {
+        TRACE_IMG("Writing keypoints to disc...");
+        if (ioImgInfo._keyfile)
+        {
+            // keypoints were loaded from a binary keyfile, load them again from there
+            ioImgInfo._spillfilename = ioImgInfo._keyfilename;
+        }
+        else
+        {
+            bool written;
+            if (!ioImgInfo._hasakeyfile && iPanoDetector.getCached() && iPanoDetector.getBinaryKeyfiles())
+            {
+                ioImgInfo._spillfilename = ioImgInfo._keyfilename;
+                written = iPanoDetector.writeKeyfile(ioImgInfo);
+            }
+            else
+            {
+                if (!ioImgInfo._hasakeyfile && iPanoDetector.getCached())
+                {
+                    iPanoDetector.writeKeyfile(ioImgInfo);
+                };
+                // temporary binary keyfile, removed at the end
+                ioImgInfo._spillfilename = ioImgInfo._keyfilename + ".spill";
+                written = iPanoDetector.writeKeyfile(ioImgInfo, ioImgInfo._spillfilename, true);
+            };
+            if (!written)
+            {
+                // the keypoints could not be reloaded from the incomplete file, so keep the image in memory
+                TRACE_INFO("i" << ioImgInfo._number << " : Could not write keypoints to " << ioImgInfo._spillfilename << ", keeping them in memory" << std::endl);
+                if (ioImgInfo._spillfilename != ioImgInfo._keyfilename)
+                {
+                    remove(ioImgInfo._spillfilename.c_str());
+                };
+                ioImgInfo._spillfilename.clear();
+                return BuildKDTreesInImage(ioImgInfo, iPanoDetector);
+            };
+        };
+        ioImgInfo._memoryUsage = ImgData::EstimateMemoryUsage(ioImgInfo._kp.size(), ioImgInfo._descLength,
+            iPanoDetector.getDescriptorType() == DESCRIPTOR_UINT8);
+    };
+    ioImgInfo.ReleaseKeypoints();
+    return true;
+}
 
-    // retrieve the KDTree of image 2
-    flann::Index<flann::L2<double> > * index2 = ioMatchData._i2->_flann_index;
+bool PanoDetector::ReloadKeypoints(ImgData& ioImgInfo, const PanoDetector& iPanoDetector)
+{
+    Profiler::Scope profile(iPanoDetector.getProfiler(), "reload keypoints", ProfileItem(ioImgInfo));
+    TRACE_IMG("Reloading keypoints...");
+    std::shared_ptr<lfeat::MappedKeyfile> keyfile(new lfeat::MappedKeyfile());
+    if (!keyfile->open(ioImgInfo._spillfilename))
+    {
+        TRACE_INFO("i" << ioImgInfo._number << " : Could not load keypoints from " << ioImgInfo._spillfilename << std::endl);
+        return false;
+    };
+    keyfile->getKeyPoints(ioImgInfo._kp);
+    ioImgInfo._keyfile = keyfile;
+    ioImgInfo._descLength = keyfile->getImageInfo().dimensions;
+    return BuildKDTreesInImage(ioImgInfo, iPanoDetector);
+}
 
-    // retrieve query points from image 1
-    flann::Matrix<double> & query = ioMatchData._i1->_flann_descriptors;
 
-    // storage for sorted 2 best matches
-    int nn = 2;
-    flann::Matrix<int> indices(new int[query.rows*nn], query.rows, nn);
-    flann::Matrix<double> dists(new double[query.rows*nn], query.rows, nn);
-
-    // perform matching using flann
-    index2->knnSearch(query, indices, dists, nn, flann::SearchParams(iPanoDetector.getKDTreeSearchSteps()));
+/** putative match, index of keypoint in image 1 and index of keypoint in image 2 and
+ *  the ratio of the distances to the nearest and second nearest neighbour */
+struct CandidateMatch_t
+{
+    CandidateMatch_t(unsigned int iFirst, int iSecond, float iRatio) :
+        first(iFirst), second(iSecond), ratio(iRatio) {};
+    unsigned int first;
+    int second;
+    float ratio;
+};
 
-    //typedef KDTreeSpace::BestMatch<KDElemKeyPoint>		BM_t;
-    //std::set<BM_t, std::greater<BM_t> >	aBestMatches;
+/** returns the ratio of the distances of the nearest and second nearest neighbour */
+static float DistanceRatio(float iDist1, float iDist2)
+{
+    return iDist2 > 0 ? iDist1 / iDist2 : 1.0f;
+}
 
+/** adds the candidate matches to ioMatchData. If several keypoints of image 1 match the same
+ *  keypoint in image 2, all these matches are removed */
+static void AddUniqueMatches(PanoDetector::MatchData& ioMatchData, const std::vector<CandidateMatch_t>& iCandidates)
+{
     // store the matches already found to avoid 2 points in image1
     // match the same point in image2
     // both matches will be removed.
@@ -909,42 +1135,32 @@ bool PanoDetector::FindMatchesInPair(MatchData& ioMatchData, const PanoDetector&
     std::set<int> aBadMatch;
 
     // unfiltered vector of matches
-    typedef std::pair<lfeat::KeyPointPtr, int> TmpPair_t;
-    std::vector<TmpPair_t>	aUnfilteredMatches;
+    std::vector<CandidateMatch_t> aUnfilteredMatches;
 
-    //PointMatchVector_t aMatches;
-
-    // go through all the keypoints of image 1
-    for (unsigned aKIt = 0; aKIt < query.rows; ++aKIt)
+    for (size_t i = 0; i < iCandidates.size(); ++i)
     {
-        // accept the match if the second match is far enough
-        // put a lower value for stronger matching default 0.15
-        if (dists[aKIt][0] > iPanoDetector.getKDTreeSecondDistance()  * dists[aKIt][1])
-        {
-            continue;
-        }
-
+        const int aMatch = iCandidates[i].second;
         // check if the kdtree match number is already in the already matched set
-        if (aAlreadyMatched.find(indices[aKIt][0]) != aAlreadyMatched.end())
+        if (aAlreadyMatched.find(aMatch) != aAlreadyMatched.end())
         {
             // add to delete list and continue
-            aBadMatch.insert(indices[aKIt][0]);
+            aBadMatch.insert(aMatch);
             continue;
         }
 
         // TODO: add check for duplicate matches (can happen if a keypoint gets multiple orientations)
 
         // add the match number in already matched set
-        aAlreadyMatched.insert(indices[aKIt][0]);
+        aAlreadyMatched.insert(aMatch);
 
         // add the match to the unfiltered list
-        aUnfilteredMatches.push_back(TmpPair_t(ioMatchData._i1->_kp[aKIt], indices[aKIt][0]));
+        aUnfilteredMatches.push_back(iCandidates[i]);
     }
 
     // now filter and fill the vector of matches
     for (size_t i = 0; i < aUnfilteredMatches.size(); ++i)
     {
-        TmpPair_t& aP = aUnfilteredMatches[i];
+        const CandidateMatch_t& aP = aUnfilteredMatches[i];
         // if the image2 match number is in the badmatch set, skip it.
         if (aBadMatch.find(aP.second) != aBadMatch.end())
         {
@@ -952,8 +1168,48 @@ bool PanoDetector::FindMatchesInPair(MatchData& ioMatchData, const PanoDetector&
         }
 
         // add the match in the output vector
-        ioMatchData._matches.push_back(lfeat::PointMatchPtr( new lfeat::PointMatch(aP.first, ioMatchData._i2->_kp[aP.second])));
+        ioMatchData._matches.push_back(lfeat::PointMatch(ioMatchData._i1->_kp, aP.first, ioMatchData._i2->_kp, aP.second, aP.ratio));
     }
+}
+
+bool PanoDetector::FindMatchesInPair(MatchData& ioMatchData, const PanoDetector& iPanoDetector)
+{
+    Profiler::Scope profile(iPanoDetector.getProfiler(), "knn search", ProfileItem(ioMatchData));
+    TRACE_PAIR("Find Matches...");
+
+    // number of query points from image 1
+    const size_t queryRows = ioMatchData._i1->GetKDTreeSize();
+
+    // storage for sorted 2 best matches
+    int nn = 2;
+    flann::Matrix<int> indices(new int[queryRows*nn], queryRows, nn);
+    flann::Matrix<float> dists(new float[queryRows*nn], queryRows, nn);
+
+    // perform matching using flann, query with the descriptors of image 1 the KDTree of image 2
+    if (ioMatchData._i2->_flann_index8 != NULL)
+    {
+        ioMatchData._i2->_flann_index8->knnSearch(ioMatchData._i1->_flann_descriptors8, indices, dists, nn,
+            flann::SearchParams(iPanoDetector.getKDTreeSearchSteps()));
+    }
+    else
+    {
+        ioMatchData._i2->_flann_index->knnSearch(ioMatchData._i1->_flann_descriptors, indices, dists, nn,
+            flann::SearchParams(iPanoDetector.getKDTreeSearchSteps()));
+    };
+
+    std::vector<CandidateMatch_t> aCandidates;
+    // go through all the keypoints of image 1
+    for (unsigned aKIt = 0; aKIt < queryRows; ++aKIt)
+    {
+        // accept the match if the second match is far enough
+        // put a lower value for stronger matching default 0.15
+        if (dists[aKIt][0] > iPanoDetector.getKDTreeSecondDistance()  * dists[aKIt][1])
+        {
+            continue;
+        }
+        aCandidates.push_back(CandidateMatch_t(aKIt, indices[aKIt][0], DistanceRatio(dists[aKIt][0], dists[aKIt][1])));
+    }
+    AddUniqueMatches(ioMatchData, aCandidates);
 
     delete[] indices.ptr();
     delete[] dists.ptr();
@@ -961,8 +1217,312 @@ bool PanoDetector::FindMatchesInPair(MatchData& ioMatchData, const PanoDetector&
     return true;
 }
 
+/** returns the descriptors of the image for the given type */
+template <class T>
+static flann::Matrix<T>& GetDescriptorMatrix(PanoDetector::ImgData& iImgData);
+
+template <>
+flann::Matrix<float>& GetDescriptorMatrix<float>(PanoDetector::ImgData& iImgData)
+{
+    return iImgData._flann_descriptors;
+}
+
+template <>
+flann::Matrix<unsigned char>& GetDescriptorMatrix<unsigned char>(PanoDetector::ImgData& iImgData)
+{
+    return iImgData._flann_descriptors8;
+}
+
+/** builds one kd-tree with the descriptors of all images and queries the descriptors of each image
+ *  for their nearest neighbours in the other images.
+ *  @param oCandidates contains for each image the candidate matches with all other images
+ */
+template <class T>
+static void QueryGlobalIndex(PanoDetector::ImgData_t& ioFilesData, const PanoDetector& iPanoDetector,
+                             std::vector<std::map<int, std::vector<CandidateMatch_t> > >& oCandidates)
+{
+    // collect the descriptors of all images in one matrix
+    std::vector<PanoDetector::ImgData*> images;
+    size_t rows = 0;
+    size_t cols = 0;
+    for (PanoDetector::ImgDataIt_t it = ioFilesData.begin(); it != ioFilesData.end(); ++it)
+    {
+        if (!it->second._kp.empty() && GetDescriptorMatrix<T>(it->second).rows > 0)
+        {
+            images.push_back(&(it->second));
+            rows += GetDescriptorMatrix<T>(it->second).rows;
+            cols = it->second._descLength;
+        };
+    };
+    if (images.size() < 2)
+    {
+        return;
+    };
+    flann::Matrix<T> descriptors(new T[rows*cols], rows, cols);
+    // image and keypoint number of each row
+    std::vector<int> rowImage(rows);
+    std::vector<int> rowKeypoint(rows);
+    size_t row = 0;
+    for (size_t i = 0; i < images.size(); ++i)
+    {
+        const flann::Matrix<T>& imgDescriptors = GetDescriptorMatrix<T>(*images[i]);
+        memcpy(descriptors[row], imgDescriptors.ptr(), sizeof(T)*imgDescriptors.rows*cols);
+        for (size_t j = 0; j < imgDescriptors.rows; ++j, ++row)
+        {
+            rowImage[row] = images[i]->_number;
+            rowKeypoint[row] = j;
+        };
+    };
+    flann::Index<DescriptorDistance::L2<T> > index(descriptors, flann::KDTreeIndexParams(4));
+    index.buildIndex();
+
+    const int k = iPanoDetector.getGlobalIndexNeighbours();
+    const float secondDistance = iPanoDetector.getKDTreeSecondDistance();
+#pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < static_cast<int>(images.size()); ++i)
+    {
+        const int imgNr = images[i]->_number;
+        flann::Matrix<T>& query = GetDescriptorMatrix<T>(*images[i]);
+        // each image writes only its own entry, so no locking is needed
+        std::map<int, std::vector<CandidateMatch_t> >& candidates = oCandidates[imgNr];
+        // the query point itself and similar keypoints of the same image also occupy places
+        // in the result, so search again with more neighbours for all keypoints with less
+        // than k neighbours in other images. The number of neighbours is limited, otherwise
+        // repetitive textures would result in an almost exhaustive search, keypoints which
+        // have still not enough neighbours in other images are dropped
+        const size_t maxNN = std::min<size_t>(std::min<size_t>(k + query.rows, 16 * (k + 1)), rows);
+        std::vector<size_t> pending(query.rows);
+        for (size_t q = 0; q < pending.size(); ++q)
+        {
+            pending[q] = q;
+        };
+        size_t nn = std::min<size_t>(k + 1, rows);
+        while (!pending.empty())
+        {
+            flann::Matrix<T> pendingQuery(new T[pending.size()*cols], pending.size(), cols);
+            for (size_t q = 0; q < pending.size(); ++q)
+            {
+                memcpy(pendingQuery[q], query[pending[q]], sizeof(T)*cols);
+            };
+            flann::Matrix<int> indices(new int[pending.size()*nn], pending.size(), nn);
+            flann::Matrix<float> dists(new float[pending.size()*nn], pending.size(), nn);
+            index.knnSearch(pendingQuery, indices, dists, nn, flann::SearchParams(iPanoDetector.getKDTreeSearchSteps()));
+            std::vector<size_t> stillPending;
+            for (size_t q = 0; q < pending.size(); ++q)
+            {
+                // for each other image the position of the nearest and second nearest neighbour
+                std::map<int, std::pair<size_t, int> > neighbours;
+                size_t lastValid = 0;
+                int foreignNeighbours = 0;
+                size_t n = 0;
+                for (; n < nn && foreignNeighbours < k; ++n)
+                {
+                    const int neighbour = indices[q][n];
+                    if (neighbour < 0)
+                    {
+                        break;
+                    };
+                    lastValid = n;
+                    const int otherImg = rowImage[neighbour];
+                    if (otherImg == imgNr)
+                    {
+                        continue;
+                    };
+                    ++foreignNeighbours;
+                    std::map<int, std::pair<size_t, int> >::iterator it = neighbours.find(otherImg);
+                    if (it == neighbours.end())
+                    {
+                        neighbours.insert(std::make_pair(otherImg, std::make_pair(n, -1)));
+                    }
+                    else
+                    {
+                        if (it->second.second < 0)
+                        {
+                            it->second.second = static_cast<int>(n);
+                        };
+                    };
+                };
+                if (foreignNeighbours < k && n == nn && nn < rows)
+                {
+                    // all places were used, but not enough neighbours in other images found
+                    if (nn < maxNN)
+                    {
+                        stillPending.push_back(pending[q]);
+                    };
+                    continue;
+                };
+                // ratio test per image: if the second nearest neighbour in the other image was not found,
+                // it is farther away than the last neighbour found, so use this distance as lower bound
+                for (std::map<int, std::pair<size_t, int> >::const_iterator it = neighbours.begin(); it != neighbours.end(); ++it)
+                {
+                    const float dist1 = dists[q][it->second.first];
+                    const float dist2 = dists[q][it->second.second >= 0 ? static_cast<size_t>(it->second.second) : lastValid];
+                    if (dist1 <= secondDistance * dist2)
+                    {
+                        candidates[it->first].push_back(CandidateMatch_t(pending[q], rowKeypoint[indices[q][it->second.first]], DistanceRatio(dist1, dist2)));
+                    };
+                };
+            };
+            delete[] pendingQuery.ptr();
+            delete[] indices.ptr();
+            delete[] dists.ptr();
+            pending.swap(stillPending);
+            nn = std::min(2 * nn, maxNN);
+        };
+    };
+    delete[] descriptors.ptr();
+}
+
+bool PanoDetector::FindMatchesInGlobalIndex(ImgData_t& ioFilesData, MatchData_t& oMatchesData,
+                                            const std::vector<HuginBase::UIntSet>& iCheckedPairs, const PanoDetector& iPanoDetector)
+{
+    Profiler::Scope profile(iPanoDetector.getProfiler(), "global index", "all");
+    std::vector<std::map<int, std::vector<CandidateMatch_t> > > candidates(ioFilesData.size());
+    if (iPanoDetector.getDescriptorType() == DESCRIPTOR_UINT8)
+    {
+        QueryGlobalIndex<unsigned char>(ioFilesData, iPanoDetector, candidates);
+    }
+    else
+    {
+        QueryGlobalIndex<float>(ioFilesData, iPanoDetector, candidates);
+    };
+    // select image pairs with enough candidate matches in both directions together
+    for (int i1 = 0; i1 < static_cast<int>(candidates.size()); ++i1)
+    {
+        for (std::map<int, std::vector<CandidateMatch_t> >::const_iterator it = candidates[i1].begin(); it != candidates[i1].end(); ++it)
+        {
+            const int i2 = it->first;
+            std::map<int, std::vector<CandidateMatch_t> >::const_iterator reverse = candidates[i2].find(i1);
+            const size_t reverseCount = (reverse == candidates[i2].end()) ? 0 : reverse->second.size();
+            // handle each pair only once, from the direction with more candidates
+            if (reverseCount > it->second.size() || (reverseCount == it->second.size() && i2 < i1))
+            {
+                continue;
+            };
+            if (set_contains(iCheckedPairs[i1], i2) ||
+                it->second.size() + reverseCount < (unsigned int)iPanoDetector.getMinimumMatches())
+            {
+                continue;
+            };
+            oMatchesData.push_back(MatchData());
+            MatchData& aM = oMatchesData.back();
+            aM._i1 = &(ioFilesData[i1]);
+            aM._i2 = &(ioFilesData[i2]);
+            AddUniqueMatches(aM, it->second);
+        };
+    };
+    return true;
+}
+
+/** returns the descriptors of the image as float matrix, 8 bit descriptors are converted into @p oBuffer */
+static flann::Matrix<float> GetFloatDescriptors(PanoDetector::ImgData& iImgData, const PanoDetector& iPanoDetector,
+                                                std::vector<float>& oBuffer)
+{
+    if (iPanoDetector.getDescriptorType() != PanoDetector::DESCRIPTOR_UINT8)
+    {
+        return iImgData._flann_descriptors;
+    };
+    const flann::Matrix<unsigned char>& descriptors = iImgData._flann_descriptors8;
+    oBuffer.resize(descriptors.rows * descriptors.cols);
+    const unsigned char* data = descriptors.ptr();
+    for (size_t i = 0; i < oBuffer.size(); ++i)
+    {
+        oBuffer[i] = lfeat::Math::DequantizeDescriptor(data[i]);
+    };
+    return flann::Matrix<float>(oBuffer.data(), descriptors.rows, descriptors.cols);
+}
+
+bool PanoDetector::FindSimilarImages(ImgData_t& ioFilesData, std::vector<HuginBase::UIntSet>& oSimilarImages,
+                                     const PanoDetector& iPanoDetector)
+{
+    Profiler::Scope profile(iPanoDetector.getProfiler(), "vocabulary tree", "all");
+    std::vector<int> images;
+    for (ImgDataIt_t it = ioFilesData.begin(); it != ioFilesData.end(); ++it)
+    {
+        if (it->second.HasKeypoints())
+        {
+            images.push_back(it->first);
+        };
+    };
+    if (images.size() < 2)
+    {
+        return true;
+    };
+    // when the memory is limited, process the images in groups which fit into memory
+    ImgDataCache* cache = iPanoDetector.getImgDataCache();
+    std::vector<std::vector<int> > groups;
+    if (cache != NULL)
+    {
+        groups = cache->splitImages(images, cache->getMaxMemory());
+    }
+    else
+    {
+        groups.push_back(images);
+    };
+    // train the vocabulary with an evenly distributed sample of the descriptors of all images,
+    // about 20 descriptors per word give stable cluster centers
+    VocabularyTree vocabulary(iPanoDetector.getVocabularyTreeSize());
+    const size_t trainingPerImage = std::max<size_t>(1, 20 * static_cast<size_t>(iPanoDetector.getVocabularyTreeSize()) / images.size());
+    for (size_t g = 0; g < groups.size(); ++g)
+    {
+        if (cache != NULL)
+        {
+            cache->load(std::set<int>(groups[g].begin(), groups[g].end()));
+        };
+        for (size_t i = 0; i < groups[g].size(); ++i)
+        {
+            std::vector<float> buffer;
+            vocabulary.addTrainingDescriptors(GetFloatDescriptors(ioFilesData[groups[g][i]], iPanoDetector, buffer), trainingPerImage);
+        };
+    };
+    if (!vocabulary.build())
+    {
+        TRACE_INFO("Not enough descriptors to build the vocabulary tree." << std::endl);
+        return false;
+    };
+    TRACE_INFO("Built vocabulary with " << vocabulary.getNrOfWords() << " words." << std::endl);
+    // quantize the descriptors of all images, the groups are processed in reverse order,
+    // so that the last loaded group is used first
+    for (size_t g = groups.size(); g-- > 0;)
+    {
+        const std::vector<int>& group = groups[g];
+        if (cache != NULL)
+        {
+            cache->load(std::set<int>(group.begin(), group.end()));
+        };
+        std::vector<ImgData*> groupData;
+        for (size_t i = 0; i < group.size(); ++i)
+        {
+            groupData.push_back(&(ioFilesData[group[i]]));
+        };
+        std::vector<VocabularyTree::BagOfWords> words(group.size());
+#pragma omp parallel for schedule(dynamic)
+        for (int i = 0; i < static_cast<int>(group.size()); ++i)
+        {
+            std::vector<float> buffer;
+            words[i] = vocabulary.getWords(GetFloatDescriptors(*groupData[i], iPanoDetector, buffer));
+        };
+        for (size_t i = 0; i < group.size(); ++i)
+        {
+            vocabulary.addImage(group[i], words[i]);
+        };
+    };
+    // a pair is matched if one of the images is in the list of the most similar images of the other
+    const std::map<int, std::vector<int> > similarImages = vocabulary.getSimilarImages(iPanoDetector.getVocabularyTreePairs());
+    for (std::map<int, std::vector<int> >::const_iterator it = similarImages.begin(); it != similarImages.end(); ++it)
+    {
+        for (size_t j = 0; j < it->second.size(); ++j)
+        {
+            oSimilarImages[it->first].insert(it->second[j]);
+            oSimilarImages[it->second[j]].insert(it->first);
+        };
+    };
+    return true;
+}
+
 bool PanoDetector::RansacMatchesInPair(MatchData& ioMatchData, const PanoDetector& iPanoDetector)
 {
+    Profiler::Scope profile(iPanoDetector.getProfiler(), "ransac", ProfileItem(ioMatchData));
     // Use panotools model for wide angle lenses
     HuginBase::RANSACOptimizer::Mode rmode = iPanoDetector._ransacMode;
     if (rmode == HuginBase::RANSACOptimizer::HOMOGRAPHY ||
@@ -1017,13 +1577,23 @@ bool PanoDetector::RansacMatchesInPairCam(MatchData& ioMatchData, const PanoDete
     {
         HuginBase::PanoramaData* panoSubset = iPanoDetector._panoramaInfo->getNewSubset(imgs);
 
-        // create control point vector
+        // create control point vector, sorted by the distance ratio of the matches
+        // so that the RANSAC starts with the most distinctive matches
+        std::vector<size_t> sortedMatches(ioMatchData._matches.size());
+        for (size_t i = 0; i < sortedMatches.size(); ++i)
+        {
+            sortedMatches[i] = i;
+        }
+        std::stable_sort(sortedMatches.begin(), sortedMatches.end(), [&ioMatchData](size_t a, size_t b)
+            {
+                return ioMatchData._matches[a]._ratio < ioMatchData._matches[b]._ratio;
+            });
         HuginBase::CPVector controlPoints(ioMatchData._matches.size());
-        for (size_t i = 0; i < ioMatchData._matches.size(); ++i)
+        for (size_t i = 0; i < sortedMatches.size(); ++i)
         {
-            lfeat::PointMatchPtr& aM=ioMatchData._matches[i];
-            controlPoints[i] = HuginBase::ControlPoint(pano_local_i1, aM->_img1_x, aM->_img1_y,
-                                            pano_local_i2, aM->_img2_x, aM->_img2_y);
+            const lfeat::PointMatch& aM=ioMatchData._matches[sortedMatches[i]];
+            controlPoints[i] = HuginBase::ControlPoint(pano_local_i1, aM._img1_x, aM._img1_y,
+                                            pano_local_i2, aM._img2_x, aM._img2_y);
         }
         panoSubset->setCtrlPoints(controlPoints);
 
@@ -1040,10 +1610,16 @@ bool PanoDetector::RansacMatchesInPairCam(MatchData& ioMatchData, const PanoDete
         // so make the threshold depending on the image size, use the given pixel distance relative to a 12 MPix image with 4000x3000 pixel
         const double threshold = iPanoDetector.getRansacDistanceThreshold() / 5000.0 * hypot(panoSubset->getImage(pano_local_i2).getWidth(), panoSubset->getImage(pano_local_i2).getHeight());
         inliers = HuginBase::RANSACOptimizer::findInliers(*panoSubset, pano_local_i1, pano_local_i2,
-                  threshold, rmode);
+                  threshold, rmode, true, iPanoDetector.getRansacPreVerification());
         PT_setProgressFcn(NULL);
         PT_setInfoDlgFcn(NULL);
         delete panoSubset;
+        // map back to the original order of the matches
+        for (size_t i = 0; i < inliers.size(); ++i)
+        {
+            inliers[i] = sortedMatches[inliers[i]];
+        }
+        std::sort(inliers.begin(), inliers.end());
     }
 
     TRACE_PAIR("Removed " << ioMatchData._matches.size() - inliers.size() << " matches. " << inliers.size() << " remaining.");
@@ -1071,7 +1647,7 @@ bool PanoDetector::RansacMatchesInPairCam(MatchData& ioMatchData, const PanoDete
     {
         aInlierMatches.push_back(ioMatchData._matches[inliers[i]]);
     }
-    ioMatchData._matches = aInlierMatches;
+    ioMatchData._matches.swap(aInlierMatches);
 
     /*
     if (iPanoDetector.getTest())
@@ -1104,6 +1680,7 @@ bool PanoDetector::RansacMatchesInPairHomography(MatchData& ioMatchData, const P
 
     lfeat::Ransac aRansacFilter;
     aRansacFilter.setIterations(iPanoDetector.getRansacIterations());
+    aRansacFilter.setPreVerification(iPanoDetector.getRansacPreVerification());
     int thresholdDistance=iPanoDetector.getRansacDistanceThreshold();
     //increase RANSAC distance if the image were remapped to not exclude
     //too much points in this case
@@ -1136,6 +1713,7 @@ bool PanoDetector::RansacMatchesInPairHomography(MatchData& ioMatchData, const P
 
 bool PanoDetector::FilterMatchesInPair(MatchData& ioMatchData, const PanoDetector& iPanoDetector)
 {
+    Profiler::Scope profile(iPanoDetector.getProfiler(), "filter matches", ProfileItem(ioMatchData));
     TRACE_PAIR("Clustering matches...");
 
     if (ioMatchData._matches.size() < 2)
@@ -1152,23 +1730,23 @@ bool PanoDetector::FilterMatchesInPair(MatchData& ioMatchData, const PanoDetecto
 
     for (size_t i = 0; i < ioMatchData._matches.size(); ++i)
     {
-        lfeat::PointMatchPtr& aM = ioMatchData._matches[i];
-        if (aM->_img1_x < aMinX)
+        const lfeat::PointMatch& aM = ioMatchData._matches[i];
+        if (aM._img1_x < aMinX)
         {
-            aMinX = aM->_img1_x;
+            aMinX = aM._img1_x;
         }
-        if (aM->_img1_x > aMaxX)
+        if (aM._img1_x > aMaxX)
         {
-            aMaxX = aM->_img1_x;
+            aMaxX = aM._img1_x;
         }
 
-        if (aM->_img1_y < aMinY)
+        if (aM._img1_y < aMinY)
         {
-            aMinY = aM->_img1_y;
+            aMinY = aM._img1_y;
         }
-        if (aM->_img1_y > aMaxY)
+        if (aM._img1_y > aMaxY)
         {
-            aMaxY = aM->_img1_y;
+            aMaxY = aM._img1_y;
         }
     }
 
@@ -1177,7 +1755,7 @@ bool PanoDetector::FilterMatchesInPair(MatchData& ioMatchData, const PanoDetecto
 
     //
 
-    lfeat::Sieve<lfeat::PointMatchPtr, lfeat::PointMatchPtrSort> aSieve(iPanoDetector.getSieve2Width(),
+    lfeat::Sieve<lfeat::PointMatch, lfeat::PointMatchSort> aSieve(iPanoDetector.getSieve2Width(),
             iPanoDetector.getSieve2Height(),
             iPanoDetector.getSieve2Size());
 
@@ -1186,8 +1764,8 @@ bool PanoDetector::FilterMatchesInPair(MatchData& ioMatchData, const PanoDetecto
     double aYF = (double)iPanoDetector.getSieve2Height() / aSizeY;
     for (size_t i = 0; i < ioMatchData._matches.size(); ++i)
     {
-        lfeat::PointMatchPtr& aM = ioMatchData._matches[i];
-        aSieve.insert(aM, (int)((aM->_img1_x - aMinX) * aXF), (int)((aM->_img1_y - aMinY) * aYF));
+        lfeat::PointMatch& aM = ioMatchData._matches[i];
+        aSieve.insert(aM, (int)((aM._img1_x - aMinX) * aXF), (int)((aM._img1_y - aMinY) * aYF));
     }
 
     // pull remaining values from the sieve
@@ -1224,13 +1802,32 @@ void PanoDetector::writeOutput()
     }
 }
 
-void PanoDetector::writeKeyfile(ImgData& imgInfo)
+bool PanoDetector::writeKeyfile(ImgData& imgInfo) const
+{
+    return writeKeyfile(imgInfo, imgInfo._keyfilename, _binaryKeyfiles);
+}
+
+bool PanoDetector::writeKeyfile(ImgData& imgInfo, const std::string& filename, bool binary) const
 {
     // Write output keyfile
 
-    std::ofstream aOut(imgInfo._keyfilename.c_str(), std::ios_base::trunc);
+    std::ofstream aOut(filename.c_str(), binary ? (std::ios_base::trunc | std::ios_base::binary) : std::ios_base::trunc);
+    if (!aOut.is_open())
+    {
+        return false;
+    };
 
-    lfeat::SIFTFormatWriter writer(aOut);
+    std::unique_ptr<lfeat::KeypointWriter> keypointWriter;
+    if (binary)
+    {
+        keypointWriter.reset(new lfeat::BinaryFormatWriter(aOut, getDetectionParameters(imgInfo),
+            _descriptorType == DESCRIPTOR_UINT8 ? lfeat::DESCRIPTOR_STORAGE_UINT8 : lfeat::DESCRIPTOR_STORAGE_FLOAT32));
+    }
+    else
+    {
+        keypointWriter.reset(new lfeat::SIFTFormatWriter(aOut));
+    };
+    lfeat::KeypointWriter& writer = *keypointWriter;
 
     int origImgWidth =  _panoramaInfo->getImage(imgInfo._number).getSize().width();
     int origImgHeight =  _panoramaInfo->getImage(imgInfo._number).getSize().height();
@@ -1239,12 +1836,24 @@ void PanoDetector::writeKeyfile(ImgData& imgInfo)
 
     writer.writeHeader ( img_info, imgInfo._kp.size(), imgInfo._descLength );
 
-    for(size_t i=0; i<imgInfo._kp.size(); ++i)
+    const lfeat::KeyPointSet& aKP = imgInfo._kp;
+    for(size_t i=0; i<aKP.size(); ++i)
     {
-        lfeat::KeyPointPtr& aK=imgInfo._kp[i];
-        writer.writeKeypoint ( aK->_x, aK->_y, aK->_scale, aK->_ori, aK->_score,
-                               imgInfo._descLength, aK->_vec );
+        writer.writeKeypoint ( aKP._x[i], aKP._y[i], aKP._scale[i], aKP._ori[i], aKP._score[i],
+                               imgInfo._descLength, aKP.getDescriptor(i) );
     }
     writer.writeFooter();
+    aOut.flush();
+    return aOut.good();
+}
+
+lfeat::DetectionParameters PanoDetector::getDetectionParameters(const ImgData& imgInfo) const
+{
+    lfeat::DetectionParameters parameters;
+    parameters.sieve1Width = _sieve1Width;
+    parameters.sieve1Height = _sieve1Height;
+    parameters.sieve1Size = _sieve1Size;
+    parameters.sizeMode = imgInfo.GetSizeMode();
+    return parameters;
 }
 
@@ -0,0 +1,300 @@
+// -*- c-basic-offset: 4 ; tab-width: 4 -*-
+/*
+* This file is part of Hugin's cpfind.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, see
+* <http://www.gnu.org/licenses/>.
+*/
+
+#include "Profiler.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <sstream>
+#include "Utils.h"
+
+// the innermost running step of the current thread
+static thread_local Profiler::Scope* currentScope = NULL;
+
+static double SecondsSince(const std::chrono::steady_clock::time_point& start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+Profiler::Scope::Scope(Profiler* profiler, const char* stage, const std::string& item) :
+    m_profiler(profiler), m_stage(stage), m_parent(NULL)
+{
+    if (m_profiler != NULL)
+    {
+        m_item = item;
+        start();
+    };
+}
+
+Profiler::Scope::Scope(const char* stage) :
+    m_profiler(NULL), m_stage(stage), m_parent(NULL)
+{
+    if (currentScope != NULL && currentScope->m_profiler != NULL)
+    {
+        m_profiler = currentScope->m_profiler;
+        m_item = currentScope->m_item;
+        start();
+    };
+}
+
+void Profiler::Scope::start()
+{
+    m_parent = currentScope;
+    currentScope = this;
+    m_nestedTime = 0;
+    m_nestedCPUTime = 0;
+    m_startCPUTime = utils::getThreadCPUTime();
+    m_startMemory = utils::getCurrentMemoryUsage();
+    m_startTime = std::chrono::steady_clock::now();
+}
+
+Profiler::Scope::~Scope()
+{
+    if (m_profiler == NULL)
+    {
+        return;
+    };
+    const double time = SecondsSince(m_startTime);
+    const double cpuTime = utils::getThreadCPUTime() - m_startCPUTime;
+    currentScope = m_parent;
+    if (m_parent != NULL)
+    {
+        m_parent->m_nestedTime += time;
+        m_parent->m_nestedCPUTime += cpuTime;
+    };
+    Record record;
+    record.name = m_stage;
+    record.item = m_item;
+    record.time = std::max(0.0, time - m_nestedTime);
+    record.cpuTime = std::max(0.0, cpuTime - m_nestedCPUTime);
+    record.memoryStart = m_startMemory;
+    record.memoryEnd = utils::getCurrentMemoryUsage();
+    m_profiler->addStep(record);
+}
+
+Profiler::Phase::Phase(Profiler* profiler, const char* name) :
+    m_profiler(profiler), m_name(name), m_startCPUTime(0), m_startMemory(0)
+{
+    if (m_profiler != NULL)
+    {
+        m_startCPUTime = utils::getProcessCPUTime();
+        m_startMemory = utils::getCurrentMemoryUsage();
+        m_startTime = std::chrono::steady_clock::now();
+    };
+}
+
+Profiler::Phase::~Phase()
+{
+    if (m_profiler == NULL)
+    {
+        return;
+    };
+    Record record;
+    record.name = m_name;
+    record.time = SecondsSince(m_startTime);
+    record.cpuTime = utils::getProcessCPUTime() - m_startCPUTime;
+    record.memoryStart = m_startMemory;
+    record.memoryEnd = utils::getCurrentMemoryUsage();
+    m_profiler->addPhase(record);
+}
+
+Profiler::Profiler() : m_threads(1)
+{
+    m_startCPUTime = utils::getProcessCPUTime();
+    m_startMemory = utils::getCurrentMemoryUsage();
+    m_startTime = std::chrono::steady_clock::now();
+}
+
+void Profiler::setThreads(int threads)
+{
+    m_threads = std::max(1, threads);
+}
+
+void Profiler::addStep(const Record& record)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_steps.push_back(record);
+}
+
+void Profiler::addPhase(const Record& record)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_phases.push_back(record);
+}
+
+std::vector<Profiler::StageSum> Profiler::getStageSums() const
+{
+    std::vector<StageSum> sums;
+    std::map<std::string, size_t> index;
+    for (size_t i = 0; i < m_steps.size(); ++i)
+    {
+        const Record& step = m_steps[i];
+        std::map<std::string, size_t>::iterator it = index.find(step.name);
+        if (it == index.end())
+        {
+            StageSum sum;
+            sum.name = step.name;
+            sum.count = 0;
+            sum.time = 0;
+            sum.cpuTime = 0;
+            sum.maxTime = 0;
+            sum.maxMemoryIncrease = 0;
+            it = index.insert(std::make_pair(step.name, sums.size())).first;
+            sums.push_back(sum);
+        };
+        StageSum& sum = sums[it->second];
+        sum.count++;
+        sum.time += step.time;
+        sum.cpuTime += step.cpuTime;
+        sum.maxTime = std::max(sum.maxTime, step.time);
+        // steps which free memory count as no growth
+        const long long memoryIncrease = static_cast<long long>(step.memoryEnd) - static_cast<long long>(step.memoryStart);
+        sum.maxMemoryIncrease = std::max(sum.maxMemoryIncrease, memoryIncrease);
+    };
+    return sums;
+}
+
+double Profiler::getUtilization(const Record& phase) const
+{
+    if (phase.time <= 0)
+    {
+        return 0;
+    };
+    return 100.0 * phase.cpuTime / (phase.time * m_threads);
+}
+
+/** returns the string quoted and escaped for JSON */
+static std::string JSONString(const std::string& s)
+{
+    std::ostringstream out;
+    out << "\"";
+    for (size_t i = 0; i < s.size(); ++i)
+    {
+        const unsigned char c = s[i];
+        if (c == '"' || c == '\\')
+        {
+            out << '\\' << c;
+        }
+        else
+        {
+            if (c < 0x20)
+            {
+                out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << static_cast<int>(c) << std::dec << std::setfill(' ');
+            }
+            else
+            {
+                out << c;
+            };
+        };
+    };
+    out << "\"";
+    return out.str();
+}
+
+bool Profiler::writeJSON(const std::string& filename) const
+{
+    std::ofstream out(filename.c_str(), std::ios_base::trunc);
+    if (!out)
+    {
+        return false;
+    };
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Record total;
+    total.name = "total";
+    total.time = SecondsSince(m_startTime);
+    total.cpuTime = utils::getProcessCPUTime() - m_startCPUTime;
+    total.memoryStart = m_startMemory;
+    total.memoryEnd = utils::getCurrentMemoryUsage();
+    out << std::setprecision(6);
+    out << "{" << std::endl
+        << "  \"threads\": " << m_threads << "," << std::endl
+        << "  \"total\": {\"wall_time\": " << total.time << ", \"cpu_time\": " << total.cpuTime
+        << ", \"thread_utilization\": " << getUtilization(total) << ", \"memory_start\": " << total.memoryStart
+        << ", \"memory_end\": " << total.memoryEnd << ", \"peak_memory\": " << utils::getPeakMemoryUsage() << "}," << std::endl;
+    out << "  \"phases\": [";
+    for (size_t i = 0; i < m_phases.size(); ++i)
+    {
+        const Record& phase = m_phases[i];
+        out << (i == 0 ? "" : ",") << std::endl
+            << "    {\"name\": " << JSONString(phase.name) << ", \"wall_time\": " << phase.time << ", \"cpu_time\": " << phase.cpuTime
+            << ", \"thread_utilization\": " << getUtilization(phase) << ", \"memory_start\": " << phase.memoryStart
+            << ", \"memory_end\": " << phase.memoryEnd << "}";
+    };
+    out << std::endl << "  ]," << std::endl;
+    const std::vector<StageSum> sums = getStageSums();
+    out << "  \"stages\": [";
+    for (size_t i = 0; i < sums.size(); ++i)
+    {
+        const StageSum& sum = sums[i];
+        out << (i == 0 ? "" : ",") << std::endl
+            << "    {\"name\": " << JSONString(sum.name) << ", \"count\": " << sum.count << ", \"wall_time\": " << sum.time
+            << ", \"cpu_time\": " << sum.cpuTime << ", \"max_wall_time\": " << sum.maxTime << ", \"max_memory_increase\": " << sum.maxMemoryIncrease << "}";
+    };
+    out << std::endl << "  ]," << std::endl;
+    out << "  \"steps\": [";
+    for (size_t i = 0; i < m_steps.size(); ++i)
+    {
+        const Record& step = m_steps[i];
+        out << (i == 0 ? "" : ",") << std::endl
+            << "    {\"stage\": " << JSONString(step.name) << ", \"item\": " << JSONString(step.item) << ", \"wall_time\": " << step.time
+            << ", \"cpu_time\": " << step.cpuTime << ", \"memory_start\": " << step.memoryStart << ", \"memory_end\": " << step.memoryEnd << "}";
+    };
+    out << std::endl << "  ]" << std::endl << "}" << std::endl;
+    return out.good();
+}
+
+void Profiler::printSummary(std::ostream& out) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const std::ios_base::fmtflags flags = out.flags();
+    const std::streamsize precision = out.precision();
+    out << std::fixed << std::setprecision(2);
+    out << std::endl << "--- Profile (" << m_threads << " threads) ---" << std::endl << std::endl;
+    out << std::left << std::setw(20) << "Phase" << std::right << std::setw(14) << "Wall [s]" << std::setw(14) << "CPU [s]"
+        << std::setw(14) << "Threads [%]" << std::setw(16) << "Mem start [MB]" << std::setw(16) << "Mem end [MB]" << std::endl;
+    for (size_t i = 0; i < m_phases.size(); ++i)
+    {
+        const Record& phase = m_phases[i];
+        out << std::left << std::setw(20) << phase.name << std::right << std::setw(14) << phase.time << std::setw(14) << phase.cpuTime
+            << std::setw(14) << getUtilization(phase) << std::setw(16) << phase.memoryStart / (1024.0 * 1024.0)
+            << std::setw(16) << phase.memoryEnd / (1024.0 * 1024.0) << std::endl;
+    };
+    Record total;
+    total.time = SecondsSince(m_startTime);
+    total.cpuTime = utils::getProcessCPUTime() - m_startCPUTime;
+    out << std::left << std::setw(20) << "total" << std::right << std::setw(14) << total.time << std::setw(14) << total.cpuTime
+        << std::setw(14) << getUtilization(total) << std::setw(16) << m_startMemory / (1024.0 * 1024.0)
+        << std::setw(16) << utils::getCurrentMemoryUsage() / (1024.0 * 1024.0) << std::endl;
+    out << "Peak memory usage: " << utils::getPeakMemoryUsage() / (1024.0 * 1024.0) << " MB" << std::endl;
+    out << std::endl;
+    out << std::left << std::setw(20) << "Stage" << std::right << std::setw(8) << "Count" << std::setw(14) << "Wall [s]"
+        << std::setw(14) << "CPU [s]" << std::setw(14) << "Max [s]" << std::setw(16) << "Max +Mem [MB]" << std::endl;
+    const std::vector<StageSum> sums = getStageSums();
+    for (size_t i = 0; i < sums.size(); ++i)
+    {
+        const StageSum& sum = sums[i];
+        out << std::left << std::setw(20) << sum.name << std::right << std::setw(8) << sum.count << std::setw(14) << sum.time
+            << std::setw(14) << sum.cpuTime << std::setw(14) << sum.maxTime << std::setw(16) << sum.maxMemoryIncrease / (1024.0 * 1024.0) << std::endl;
+    };
+    out << std::endl;
+    out.flags(flags);
+    out.precision(precision);
+}
@@ -0,0 +1,143 @@
+// -*- c-basic-offset: 4 ; tab-width: 4 -*-
+/*
+* This file is part of Hugin's cpfind.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, see
+* <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __detectpano_profiler_h
+#define __detectpano_profiler_h
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <ostream>
+
+/** records the run time and the memory usage of the processing steps of cpfind.
+ *
+ *  The steps of each image or image pair are measured with Profiler::Scope, the
+ *  phases of the whole run (detection, matching, ...) with Profiler::Phase.
+ *  A scope started inside another scope of the same thread measures a part of
+ *  the enclosing step, its time is subtracted from the enclosing step, so that
+ *  the times of all stages add up.
+ *  The cpu time of a step is the time of the thread running the step, parallel
+ *  loops inside a step are only contained in the wall time. The cpu time of a
+ *  phase contains all threads.
+ *  The memory usage is the current memory usage of the whole process at the
+ *  start and at the end of a step or phase, it contains the allocations of all
+ *  threads running at the same time.
+ */
+class Profiler
+{
+public:
+    /** measures one step of an image or image pair from construction to destruction */
+    class Scope
+    {
+    public:
+        /** starts a step, does nothing if profiler is NULL */
+        Scope(Profiler* profiler, const char* stage, const std::string& item);
+        /** starts a step inside the current step of this thread with the same profiler
+         *  and item, does nothing if there is no current step */
+        explicit Scope(const char* stage);
+        ~Scope();
+    private:
+        // prevent copying of class
+        Scope(const Scope&);
+        Scope& operator=(const Scope&);
+        void start();
+
+        Profiler* m_profiler;
+        const char* m_stage;
+        std::string m_item;
+        Scope* m_parent;
+        std::chrono::steady_clock::time_point m_startTime;
+        double m_startCPUTime;
+        unsigned long long m_startMemory;
+        // time of the nested steps
+        double m_nestedTime;
+        double m_nestedCPUTime;
+    };
+
+    /** measures a phase of the whole run from construction to destruction */
+    class Phase
+    {
+    public:
+        /** starts the phase, does nothing if profiler is NULL */
+        Phase(Profiler* profiler, const char* name);
+        ~Phase();
+    private:
+        // prevent copying of class
+        Phase(const Phase&);
+        Phase& operator=(const Phase&);
+
+        Profiler* m_profiler;
+        const char* m_name;
+        std::chrono::steady_clock::time_point m_startTime;
+        double m_startCPUTime;
+        unsigned long long m_startMemory;
+    };
+
+    Profiler();
+    /** sets the number of threads, used for the thread utilization */
+    void setThreads(int threads);
+    /** writes all measured steps, the sums of the stages and the phases as JSON file
+     *  @return false, if the file could not be written */
+    bool writeJSON(const std::string& filename) const;
+    /** prints a table with the phases and the sums of the stages */
+    void printSummary(std::ostream& out) const;
+
+private:
+    // prevent copying of class
+    Profiler(const Profiler&);
+    Profiler& operator=(const Profiler&);
+
+    struct Record
+    {
+        std::string name;
+        std::string item;
+        double time;
+        double cpuTime;
+        // current memory usage of the process at the start and at the end
+        unsigned long long memoryStart;
+        unsigned long long memoryEnd;
+    };
+    struct StageSum
+    {
+        std::string name;
+        size_t count;
+        double time;
+        double cpuTime;
+        double maxTime;
+        // largest growth of the memory usage during a single step
+        long long maxMemoryIncrease;
+    };
+    void addStep(const Record& record);
+    void addPhase(const Record& record);
+    /** returns the sums of the stages in the order of their first occurrence */
+    std::vector<StageSum> getStageSums() const;
+    /** returns the thread utilization of a phase in percent */
+    double getUtilization(const Record& phase) const;
+
+    mutable std::mutex m_mutex;
+    std::vector<Record> m_steps;
+    std::vector<Record> m_phases;
+    int m_threads;
+    std::chrono::steady_clock::time_point m_startTime;
+    double m_startCPUTime;
+    unsigned long long m_startMemory;
+};
+
+#endif // __detectpano_profiler_h
@@ -175,16 +175,16 @@ void TestCode::drawRansacMatches(std::string& i1, std::string& i2,
 
     for (size_t i = 0; i < iOK.size(); ++i)
     {
-        lfeat::PointMatchPtr& aV = iOK[i];
+        lfeat::PointMatch& aV = iOK[i];
         vigra::RGBValue<int> color(gen127(), 255 , gen127());
-        drawLine(out1,  aDoubleFactor * aV->_img1_x,
-                 aDoubleFactor * aV->_img1_y,
-                 aDoubleFactor *  aV->_img2_x + info1.width(),
-                 aDoubleFactor * aV->_img2_y, color);
+        drawLine(out1,  aDoubleFactor * aV._img1_x,
+                 aDoubleFactor * aV._img1_y,
+                 aDoubleFactor *  aV._img2_x + info1.width(),
+                 aDoubleFactor * aV._img2_y, color);
         //cout << "----------------------" << endl;
-        //cout << "x= " << aV->_img2_x + info1.width() << " y= " << aV->_img2_y << endl;
+        //cout << "x= " << aV._img2_x + info1.width() << " y= " << aV._img2_y << endl;
         double x1p, y1p;
-        iRansac.transform(aV->_img1_x, aV->_img1_y, x1p, y1p);
+        iRansac.transform(aV._img1_x, aV._img1_y, x1p, y1p);
         //cout << "xp= " << x1p << " yp= " << y1p << endl;
 
         if (x1p <0)
@@ -207,8 +207,8 @@ void TestCode::drawRansacMatches(std::string& i1, std::string& i2,
         }
 
         vigra::RGBValue<int> color2(0, 255 , 255);
-        drawLine(out1,  aDoubleFactor * aV->_img2_x + info1.width(),
-                 aDoubleFactor * aV->_img2_y,
+        drawLine(out1,  aDoubleFactor * aV._img2_x + info1.width(),
+                 aDoubleFactor * aV._img2_y,
                  aDoubleFactor * x1p         + info1.width(),
                  aDoubleFactor * y1p, color2);
 
@@ -216,16 +216,16 @@ void TestCode::drawRansacMatches(std::string& i1, std::string& i2,
 
     for(size_t i=0; i<iNOK.size(); ++i)
     {
-        lfeat::PointMatchPtr& aV = iNOK[i];
+        lfeat::PointMatch& aV = iNOK[i];
         vigra::RGBValue<int> color(255, gen127() , gen127());
-        drawLine(out1,  aDoubleFactor * aV->_img1_x,
-                 aDoubleFactor * aV->_img1_y,
-                 aDoubleFactor * aV->_img2_x + info1.width(),
-                 aDoubleFactor * aV->_img2_y, color);
+        drawLine(out1,  aDoubleFactor * aV._img1_x,
+                 aDoubleFactor * aV._img1_y,
+                 aDoubleFactor * aV._img2_x + info1.width(),
+                 aDoubleFactor * aV._img2_y, color);
         //cout << "----------------------" << endl;
-        //cout << "x= " << aV->_img2_x + info1.width() << " y= " << aV->_img2_y << endl;
+        //cout << "x= " << aV._img2_x + info1.width() << " y= " << aV._img2_y << endl;
         double x1p, y1p;
-        iRansac.transform(aV->_img1_x, aV->_img1_y, x1p, y1p);
+        iRansac.transform(aV._img1_x, aV._img1_y, x1p, y1p);
         //cout << "xp= " << x1p << " yp= " << y1p << endl;
 
         if (x1p <0)
@@ -247,8 +247,8 @@ void TestCode::drawRansacMatches(std::string& i1, std::string& i2,
         }
 
         vigra::RGBValue<int> color2(0, 255 , 255);
-        drawLine(out1,  aDoubleFactor * aV->_img2_x + info1.width(),
-                 aDoubleFactor * aV->_img2_y,
+        drawLine(out1,  aDoubleFactor * aV._img2_x + info1.width(),
+                 aDoubleFactor * aV._img2_y,
                  aDoubleFactor * x1p         + info1.width(),
                  aDoubleFactor * y1p, color2);
 
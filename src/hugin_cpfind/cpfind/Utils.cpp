@@ -24,11 +24,19 @@
 #endif
 #ifdef _WIN32
 #include <windows.h>
+#include <psapi.h>
 #include <algorithm>
 #elif defined __APPLE__
 #include <CoreServices/CoreServices.h>  //for gestalt
+#include <sys/resource.h>
+#include <mach/mach.h>
 #else
 #include <unistd.h>
+#include <sys/resource.h>
+#include <cstdio>
+#endif
+#ifndef _WIN32
+#include <time.h>
 #endif
 
 #ifdef _WIN32
@@ -69,3 +77,124 @@ unsigned long long utils::getTotalMemory()
     return pages * page_size;
 }
 #endif
+
+#ifdef _WIN32
+unsigned long long utils::getPeakMemoryUsage()
+{
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+    {
+        return counters.PeakWorkingSetSize;
+    };
+    return 0;
+}
+
+unsigned long long utils::getCurrentMemoryUsage()
+{
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+    {
+        return counters.WorkingSetSize;
+    };
+    return 0;
+}
+#else
+unsigned long long utils::getPeakMemoryUsage()
+{
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+    {
+#ifdef __APPLE__
+        // macOS returns the size in bytes
+        return usage.ru_maxrss;
+#else
+        // Linux returns the size in kilobytes
+        return static_cast<unsigned long long>(usage.ru_maxrss) * 1024;
+#endif
+    };
+    return 0;
+}
+
+#ifdef __APPLE__
+unsigned long long utils::getCurrentMemoryUsage()
+{
+    mach_task_basic_info_data_t info;
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+    if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, reinterpret_cast<task_info_t>(&info), &count) == KERN_SUCCESS)
+    {
+        return info.resident_size;
+    };
+    return 0;
+}
+#else
+unsigned long long utils::getCurrentMemoryUsage()
+{
+    // the second value in statm is the number of resident pages
+    unsigned long long resident = 0;
+    FILE* file = fopen("/proc/self/statm", "r");
+    if (file != NULL)
+    {
+        unsigned long long size;
+        if (fscanf(file, "%llu %llu", &size, &resident) != 2)
+        {
+            resident = 0;
+        };
+        fclose(file);
+    };
+    return resident * sysconf(_SC_PAGE_SIZE);
+}
+#endif
+#endif
+
+#ifdef _WIN32
+static double FileTimeToSeconds(const FILETIME& time)
+{
+    ULARGE_INTEGER value;
+    value.LowPart = time.dwLowDateTime;
+    value.HighPart = time.dwHighDateTime;
+    // FILETIME is given in units of 100 ns
+    return value.QuadPart * 1e-7;
+}
+
+double utils::getProcessCPUTime()
+{
+    FILETIME creationTime, exitTime, kernelTime, userTime;
+    if (GetProcessTimes(GetCurrentProcess(), &creationTime, &exitTime, &kernelTime, &userTime))
+    {
+        return FileTimeToSeconds(kernelTime) + FileTimeToSeconds(userTime);
+    };
+    return 0;
+}
+
+double utils::getThreadCPUTime()
+{
+    FILETIME creationTime, exitTime, kernelTime, userTime;
+    if (GetThreadTimes(GetCurrentThread(), &creationTime, &exitTime, &kernelTime, &userTime))
+    {
+        return FileTimeToSeconds(kernelTime) + FileTimeToSeconds(userTime);
+    };
+    return 0;
+}
+#else
+double utils::getProcessCPUTime()
+{
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+    {
+        return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec * 1e-6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec * 1e-6;
+    };
+    return 0;
+}
+
+double utils::getThreadCPUTime()
+{
+#ifdef CLOCK_THREAD_CPUTIME_ID
+    struct timespec time;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time) == 0)
+    {
+        return time.tv_sec + time.tv_nsec * 1e-9;
+    };
+#endif
+    return 0;
+}
+#endif
@@ -66,6 +66,14 @@ inline int os_TimeDiff(os_TIME* time1, os_TIME* time2)
 
 /** returns the total memory in byte */
 unsigned long long getTotalMemory();
+/** returns the highest memory usage of the process in byte, 0 if unknown */
+unsigned long long getPeakMemoryUsage();
+/** returns the current memory usage (resident set) of the process in byte, 0 if unknown */
+unsigned long long getCurrentMemoryUsage();
+/** returns the cpu time used by all threads of the process in seconds */
+double getProcessCPUTime();
+/** returns the cpu time used by the calling thread in seconds, 0 if unknown */
+double getThreadCPUTime();
 
 }
 
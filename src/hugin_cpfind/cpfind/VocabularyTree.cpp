@@ -0,0 +1,201 @@
+// -*- c-basic-offset: 4 ; tab-width: 4 -*-
+/*
+* This file is part of Hugin's cpfind.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, see
+* <http://www.gnu.org/licenses/>.
+*/
+
+#include "VocabularyTree.h"
+
+#include <cmath>
+#include <algorithm>
+
+VocabularyTree::VocabularyTree(int vocabularySize, int branching) :
+    m_vocabularySize(vocabularySize), m_branching(branching), m_dims(0), m_nrWords(0), m_wordIndex(NULL)
+{
+}
+
+VocabularyTree::~VocabularyTree()
+{
+    if (m_wordIndex != NULL)
+    {
+        delete m_wordIndex;
+    };
+}
+
+void VocabularyTree::addTrainingDescriptors(const flann::Matrix<float>& descriptors, size_t maxRows)
+{
+    if (descriptors.rows == 0 || maxRows == 0)
+    {
+        return;
+    };
+    m_dims = descriptors.cols;
+    const double step = std::max(1.0, static_cast<double>(descriptors.rows) / maxRows);
+    for (double row = 0; row < descriptors.rows; row += step)
+    {
+        const float* descriptor = descriptors[static_cast<size_t>(row)];
+        m_training.insert(m_training.end(), descriptor, descriptor + m_dims);
+    };
+}
+
+bool VocabularyTree::build()
+{
+    if (m_dims == 0)
+    {
+        return false;
+    };
+    const size_t rows = m_training.size() / m_dims;
+    if (rows < static_cast<size_t>(m_branching))
+    {
+        return false;
+    };
+    flann::Matrix<float> points(m_training.data(), rows, m_dims);
+    const size_t requestedWords = std::min(static_cast<size_t>(m_vocabularySize), rows);
+    m_centers.resize(requestedWords * m_dims);
+    flann::Matrix<float> centers(m_centers.data(), requestedWords, m_dims);
+    // the clustering returns the cut through the k-means tree with the lowest variance
+    m_nrWords = flann::hierarchicalClustering<DescriptorDistance::L2<float> >(points, centers,
+        flann::KMeansIndexParams(m_branching, 11, flann::FLANN_CENTERS_KMEANSPP));
+    m_centers.resize(m_nrWords * m_dims);
+    // the training set is no longer needed
+    std::vector<float>().swap(m_training);
+    if (m_nrWords == 0)
+    {
+        return false;
+    };
+    m_wordIndex = new flann::Index<DescriptorDistance::L2<float> >(flann::Matrix<float>(m_centers.data(), m_nrWords, m_dims),
+        flann::KDTreeIndexParams(4));
+    m_wordIndex->buildIndex();
+    return true;
+}
+
+VocabularyTree::BagOfWords VocabularyTree::getWords(const flann::Matrix<float>& descriptors, int searchChecks) const
+{
+    BagOfWords words;
+    if (m_wordIndex == NULL || descriptors.rows == 0)
+    {
+        return words;
+    };
+    flann::Matrix<int> indices(new int[descriptors.rows], descriptors.rows, 1);
+    flann::Matrix<float> dists(new float[descriptors.rows], descriptors.rows, 1);
+    m_wordIndex->knnSearch(descriptors, indices, dists, 1, flann::SearchParams(searchChecks));
+    for (size_t i = 0; i < descriptors.rows; ++i)
+    {
+        if (indices[i][0] >= 0)
+        {
+            words[indices[i][0]]++;
+        };
+    };
+    delete[] indices.ptr();
+    delete[] dists.ptr();
+    return words;
+}
+
+void VocabularyTree::addImage(int imgNr, const BagOfWords& words)
+{
+    m_images[imgNr] = words;
+}
+
+std::map<int, std::vector<int> > VocabularyTree::getSimilarImages(size_t k) const
+{
+    std::map<int, std::vector<int> > similarImages;
+    const size_t nrImages = m_images.size();
+    if (nrImages < 2 || m_nrWords == 0)
+    {
+        return similarImages;
+    };
+    // number of images, which contain each word
+    std::vector<unsigned int> documentFrequency(m_nrWords, 0);
+    std::vector<int> imageNumbers;
+    for (std::map<int, BagOfWords>::const_iterator it = m_images.begin(); it != m_images.end(); ++it)
+    {
+        imageNumbers.push_back(it->first);
+        for (BagOfWords::const_iterator word = it->second.begin(); word != it->second.end(); ++word)
+        {
+            documentFrequency[word->first]++;
+        };
+    };
+    // tf-idf weighted and normalized histograms, stored as inverted file:
+    // for each word the images containing it with their weights
+    typedef std::vector<std::pair<int, float> > WeightVector;
+    std::vector<WeightVector> imageWeights(nrImages);
+    std::vector<WeightVector> invertedFile(m_nrWords);
+    for (size_t i = 0; i < nrImages; ++i)
+    {
+        const BagOfWords& words = m_images.find(imageNumbers[i])->second;
+        unsigned int totalWords = 0;
+        for (BagOfWords::const_iterator word = words.begin(); word != words.end(); ++word)
+        {
+            totalWords += word->second;
+        };
+        double sqLength = 0;
+        for (BagOfWords::const_iterator word = words.begin(); word != words.end(); ++word)
+        {
+            // words which occur in all images don't help
+            const double idf = log(static_cast<double>(nrImages) / documentFrequency[word->first]);
+            if (idf > 0)
+            {
+                const double weight = static_cast<double>(word->second) / totalWords * idf;
+                imageWeights[i].push_back(std::make_pair(word->first, static_cast<float>(weight)));
+                sqLength += weight * weight;
+            };
+        };
+        if (sqLength > 0)
+        {
+            const float factor = static_cast<float>(1.0 / sqrt(sqLength));
+            for (size_t j = 0; j < imageWeights[i].size(); ++j)
+            {
+                imageWeights[i][j].second *= factor;
+                invertedFile[imageWeights[i][j].first].push_back(std::make_pair(static_cast<int>(i), imageWeights[i][j].second));
+            };
+        };
+    };
+    // score all images sharing words with the current image
+    std::vector<std::vector<int> > result(nrImages);
+#pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < static_cast<int>(nrImages); ++i)
+    {
+        std::vector<float> scores(nrImages, 0.0f);
+        for (size_t j = 0; j < imageWeights[i].size(); ++j)
+        {
+            const WeightVector& postings = invertedFile[imageWeights[i][j].first];
+            const float weight = imageWeights[i][j].second;
+            for (size_t p = 0; p < postings.size(); ++p)
+            {
+                scores[postings[p].first] += weight * postings[p].second;
+            };
+        };
+        scores[i] = 0.0f;
+        std::vector<std::pair<float, int> > ranking;
+        for (size_t j = 0; j < nrImages; ++j)
+        {
+            if (scores[j] > 0)
+            {
+                ranking.push_back(std::make_pair(scores[j], static_cast<int>(j)));
+            };
+        };
+        const size_t nrSimilar = std::min(k, ranking.size());
+        std::partial_sort(ranking.begin(), ranking.begin() + nrSimilar, ranking.end(), std::greater<std::pair<float, int> >());
+        for (size_t j = 0; j < nrSimilar; ++j)
+        {
+            result[i].push_back(imageNumbers[ranking[j].second]);
+        };
+    };
+    for (size_t i = 0; i < nrImages; ++i)
+    {
+        similarImages[imageNumbers[i]] = result[i];
+    };
+    return similarImages;
+}
@@ -0,0 +1,77 @@
+// -*- c-basic-offset: 4 ; tab-width: 4 -*-
+/*
+* This file is part of Hugin's cpfind.
+*
+* This program is free software; you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation; either version 2 of the License, or
+* (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with this program; if not, see
+* <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __detectpano_vocabularytree_h
+#define __detectpano_vocabularytree_h
+
+#include <vector>
+#include <map>
+#include <flann/flann.hpp>
+#include "DescriptorDistance.h"
+
+/** image retrieval with a vocabulary of visual words.
+ *
+ *  The visual words are the cluster centers of a hierarchical k-means
+ *  clustering of a sample of the descriptors. Each image is described by
+ *  the histogram of the words of its descriptors, the similarity of two
+ *  images is the scalar product of their tf-idf weighted histograms.
+ */
+class VocabularyTree
+{
+public:
+    /** histogram of visual words: word number and number of occurrences */
+    typedef std::map<int, unsigned int> BagOfWords;
+
+    /** @param vocabularySize maximal number of words
+     *  @param branching branching factor of the k-means tree */
+    VocabularyTree(int vocabularySize, int branching = 10);
+    ~VocabularyTree();
+
+    /** adds up to maxRows of the given descriptors to the training set, the rows are
+     *  selected evenly spaced */
+    void addTrainingDescriptors(const flann::Matrix<float>& descriptors, size_t maxRows);
+    /** clusters the training set and builds the search structure for the words
+     *  @return false, if there were not enough training descriptors */
+    bool build();
+    /** returns the number of words in the vocabulary */
+    size_t getNrOfWords() const { return m_nrWords; };
+
+    /** assigns each descriptor to its nearest word, can be called from several threads */
+    BagOfWords getWords(const flann::Matrix<float>& descriptors, int searchChecks = 32) const;
+    /** adds the histogram of an image to the database */
+    void addImage(int imgNr, const BagOfWords& words);
+    /** returns for each image in the database the numbers of the k most similar other images */
+    std::map<int, std::vector<int> > getSimilarImages(size_t k) const;
+
+private:
+    // prevent copying of class
+    VocabularyTree(const VocabularyTree&);
+    VocabularyTree& operator=(const VocabularyTree&);
+
+    int m_vocabularySize;
+    int m_branching;
+    size_t m_dims;
+    size_t m_nrWords;
+    std::vector<float> m_training;
+    std::vector<float> m_centers;
+    flann::Index<DescriptorDistance::L2<float> >* m_wordIndex;
+    std::map<int, BagOfWords> m_images;
+};
+
+#endif // __detectpano_vocabularytree_h
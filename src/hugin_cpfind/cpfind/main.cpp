@@ -57,19 +57,34 @@ void printUsage()
         << "  --multirow      Enable heuristic multi row matching" << std::endl
         << "  --prealigned    Match only overlapping images," << std::endl
         << "                  requires a rough aligned panorama" << std::endl
+        << "  --globalmatch   Match all images with one common KDTree," << std::endl
+        << "                  faster than all pairs for many images" << std::endl
+        << "                  Can be fine tuned with" << std::endl
+        << "      --globalmatchnn=<int>  Number of nearest neighbours (default: 10)" << std::endl
+        << "  --vocabtree     Match only the most similar images, found with a" << std::endl
+        << "                  vocabulary tree, for large unordered image sets" << std::endl
+        << "                  Can be fine tuned with" << std::endl
+        << "      --vocabtreepairs=<int>  Number of similar images per image (default: 10)" << std::endl
+        << "      --vocabtreesize=<int>   Number of visual words (default: 10000)" << std::endl
         << std::endl << "Feature description options" << std::endl
         << "  --sieve1width=<int>    Sieve 1: Number of buckets on width (default: 10)" << std::endl
         << "  --sieve1height=<int>   Sieve 1: Number of buckets on height (default: 10)" << std::endl
         << "  --sieve1size=<int>     Sieve 1: Max points per bucket (default: 100)" << std::endl
         << "  --kdtreesteps=<int>          KDTree: search steps (default: 200)" << std::endl
         << "  --kdtreeseconddist=<double>  KDTree: distance of 2nd match (default: 0.25)" << std::endl
+        << "  --descriptortype=<string>    KDTree: storage of the descriptors" << std::endl
+        << "                                 Possible values: float, uint8" << std::endl
+        << "                                 uint8 needs a quarter of the memory" << std::endl
+        << "                                 (default: float)" << std::endl
         << std::endl << "Feature matching options" << std::endl
-        << "  --ransaciter=<int>     Ransac: iterations (default: 1000)" << std::endl
+        << "  --ransaciter=<int>     Ransac: maximal iterations (default: 1000)" << std::endl
         << "  --ransacdist=<int>     Ransac: homography estimation distance threshold" << std::endl
         << "                                 (in pixels) (default: 50)" << std::endl
         << "  --ransacmode=<string>  Ransac: Select the mode used in the ransac step." << std::endl
         << "                                 Possible values: auto, hom, rpy, rpyv, rpyb" << std::endl
         << "                                 (default: auto)" << std::endl
+        << "  --ransacsprt           Ransac: reject bad models early with a sequential" << std::endl
+        << "                                 probability ratio test" << std::endl
         << "  --minmatches=<int>     Minimum matches (default: 6)" << std::endl
         << "  --sieve2width=<int>    Sieve 2: Number of buckets on width (default: 5)" << std::endl
         << "  --sieve2height=<int>   Sieve 2: Number of buckets on height (default: 5)" << std::endl
@@ -80,12 +95,20 @@ void printUsage()
         << "  -p|--keypath=<string>    Store keyfiles in given path" << std::endl
         << "  -k|--writekeyfile=<int>  Write a keyfile for this image number" << std::endl
         << "  --kall                   Write keyfiles for all images in the project" << std::endl
+        << "  --keyfileformat=<string> Format of written keyfiles: binary, text" << std::endl
+        << "                           (default: text)" << std::endl
         << std::endl << "Advanced options" << std::endl
         << "  --celeste       Masks area with clouds before running feature descriptor" << std::endl
         << "                  Celeste can be fine tuned with the following parameters" << std::endl
         << "      --celestethreshold=<int>  Threshold for celeste (default 0.5)" << std::endl
         << "      --celesteradius=<int>     Radius for celeste (in pixels, default 20)" << std::endl
-        << "  --ncores=<int>  Number of threads to use (default: autodetect number of cores)" << std::endl;
+        << "  --ncores=<int>  Number of threads to use (default: autodetect number of cores)" << std::endl
+        << "  --max-memory=<int>  Keep only keypoints of images using at most the given" << std::endl
+        << "                  memory in MB, the other images are reloaded from disc" << std::endl
+        << "                  when needed (default: 0, no limit)" << std::endl
+        << "  --profile=<file.json>  Write the run time and memory usage of each" << std::endl
+        << "                  step of each image and image pair to the given file" << std::endl
+        << "                  and print a summary" << std::endl;
 };
 
 bool parseOptions(int argc, char** argv, PanoDetector& ioPanoDetector)
@@ -99,20 +122,30 @@ bool parseOptions(int argc, char** argv, PanoDetector& ioPanoDetector)
         LINEARMATCHLEN,
         MULTIROW,
         PREALIGNED,
+        GLOBALMATCH,
+        GLOBALMATCHNN,
+        VOCABTREE,
+        VOCABTREEPAIRS,
+        VOCABTREESIZE,
         KDTREESTEPS,
         KDTREESECONDDIST,
+        DESCRIPTORTYPE,
         MINMATCHES,
         RANSACMODE,
         RANSACITER,
         RANSACDIST,
+        RANSACSPRT,
         SIEVE2WIDTH,
         SIEVE2HEIGHT,
         SIEVE2SIZE,
         KALL,
+        KEYFILEFORMAT,
         CLEAN,
         CELESTE,
         CELESTETHRESHOLD,
         CELESTERADIUS,
+        MAXMEMORY,
+        PROFILE,
         CPFINDVERSION
     };
     const char* optstring = "qvftn:o:k:cp:h";
@@ -128,20 +161,30 @@ bool parseOptions(int argc, char** argv, PanoDetector& ioPanoDetector)
         {"linearmatchlen", required_argument, NULL, LINEARMATCHLEN},
         {"multirow", no_argument, NULL, MULTIROW},
         {"prealigned", no_argument, NULL, PREALIGNED},
+        {"globalmatch", no_argument, NULL, GLOBALMATCH},
+        {"globalmatchnn", required_argument, NULL, GLOBALMATCHNN},
+        {"vocabtree", no_argument, NULL, VOCABTREE},
+        {"vocabtreepairs", required_argument, NULL, VOCABTREEPAIRS},
+        {"vocabtreesize", required_argument, NULL, VOCABTREESIZE},
         {"kdtreesteps", required_argument, NULL, KDTREESTEPS},
         {"kdtreeseconddist", required_argument, NULL, KDTREESECONDDIST},
+        {"descriptortype", required_argument, NULL, DESCRIPTORTYPE},
         {"minmatches", required_argument, NULL, MINMATCHES},
         {"ransacmode", required_argument, NULL, RANSACMODE},
         {"ransaciter", required_argument, NULL, RANSACITER},
         {"ransacdist", required_argument, NULL, RANSACDIST},
+        {"ransacsprt", no_argument, NULL, RANSACSPRT},
         {"sieve2width", required_argument, NULL, SIEVE2WIDTH},
         {"sieve2height", required_argument, NULL, SIEVE2HEIGHT},
         {"sieve2size", required_argument, NULL, SIEVE2SIZE},
         {"test", no_argument, NULL, 't'},
         {"ncores", required_argument, NULL, 'n'},
+        {"max-memory", required_argument, NULL, MAXMEMORY},
+        {"profile", required_argument, NULL, PROFILE},
         {"output", required_argument, NULL, 'o'},
         {"writekeyfile", required_argument, NULL, 'k'},
         {"kall", no_argument, NULL, KALL},
+        {"keyfileformat", required_argument, NULL, KEYFILEFORMAT},
         {"cache", no_argument, NULL, 'c'},
         {"clean", no_argument, NULL, CLEAN},
         {"keypath", required_argument, NULL, 'p'},
@@ -161,6 +204,8 @@ bool parseOptions(int argc, char** argv, PanoDetector& ioPanoDetector)
     int doLinearMatch=0;
     int doMultirow=0;
     int doPrealign=0;
+    int doGlobalMatch=0;
+    int doVocabTree=0;
     while ((c = getopt_long (argc, argv, optstring, longOptions,nullptr)) != -1)
     {
         switch (c)
@@ -211,6 +256,33 @@ bool parseOptions(int argc, char** argv, PanoDetector& ioPanoDetector)
             case PREALIGNED:
                 doPrealign=1;
                 break;
+            case GLOBALMATCH:
+                doGlobalMatch=1;
+                break;
+            case GLOBALMATCHNN:
+                number=atoi(optarg);
+                if(number>0)
+                {
+                    ioPanoDetector.setGlobalIndexNeighbours(number);
+                };
+                break;
+            case VOCABTREE:
+                doVocabTree=1;
+                break;
+            case VOCABTREEPAIRS:
+                number=atoi(optarg);
+                if(number>0)
+                {
+                    ioPanoDetector.setVocabularyTreePairs(number);
+                };
+                break;
+            case VOCABTREESIZE:
+                number=atoi(optarg);
+                if(number>0)
+                {
+                    ioPanoDetector.setVocabularyTreeSize(number);
+                };
+                break;
             case KDTREESTEPS:
                 number=atoi(optarg);
                 if(number>0)
@@ -225,6 +297,27 @@ bool parseOptions(int argc, char** argv, PanoDetector& ioPanoDetector)
                     ioPanoDetector.setKDTreeSecondDistance(floatNumber);
                 };
                 break;
+            case DESCRIPTORTYPE:
+                {
+                    const std::string descriptorType = hugin_utils::tolower(std::string(optarg));
+                    if (descriptorType == "float")
+                    {
+                        ioPanoDetector.setDescriptorType(PanoDetector::DESCRIPTOR_FLOAT);
+                    }
+                    else
+                    {
+                        if (descriptorType == "uint8")
+                        {
+                            ioPanoDetector.setDescriptorType(PanoDetector::DESCRIPTOR_UINT8);
+                        }
+                        else
+                        {
+                            std::cout << "Warning: " << optarg << " is not a valid descriptor type." << std::endl
+                                      << "Using float descriptors." << std::endl;
+                        };
+                    };
+                };
+                break;
             case MINMATCHES:
                 number=atoi(optarg);
                 if(number>0)
@@ -288,6 +381,9 @@ bool parseOptions(int argc, char** argv, PanoDetector& ioPanoDetector)
                     ioPanoDetector.setRansacDistanceThreshold(number);
                 };
                 break;
+            case RANSACSPRT:
+                ioPanoDetector.setRansacPreVerification(true);
+                break;
             case SIEVE2WIDTH:
                 number=atoi(optarg);
                 if(number>0)
@@ -319,6 +415,16 @@ bool parseOptions(int argc, char** argv, PanoDetector& ioPanoDetector)
                     ioPanoDetector.setCores(number);
                 };
                 break;
+            case MAXMEMORY:
+                number=atoi(optarg);
+                if(number>0)
+                {
+                    ioPanoDetector.setMaxMemory(number);
+                };
+                break;
+            case PROFILE:
+                ioPanoDetector.setProfileFile(optarg);
+                break;
             case 'o':
                 ioPanoDetector.setOutputFile(optarg);
                 break;
@@ -336,6 +442,27 @@ bool parseOptions(int argc, char** argv, PanoDetector& ioPanoDetector)
             case KALL:
                 ioPanoDetector.setWriteAllKeyPoints();
                 break;
+            case KEYFILEFORMAT:
+                {
+                    const std::string keyfileFormat = hugin_utils::tolower(std::string(optarg));
+                    if (keyfileFormat == "binary")
+                    {
+                        ioPanoDetector.setBinaryKeyfiles(true);
+                    }
+                    else
+                    {
+                        if (keyfileFormat == "text")
+                        {
+                            ioPanoDetector.setBinaryKeyfiles(false);
+                        }
+                        else
+                        {
+                            std::cout << "Warning: " << optarg << " is not a valid keyfile format." << std::endl
+                                      << "Writing text keyfiles." << std::endl;
+                        };
+                    };
+                };
+                break;
             case 'c':
                 ioPanoDetector.setCached(true);
                 break;
@@ -394,10 +521,16 @@ bool parseOptions(int argc, char** argv, PanoDetector& ioPanoDetector)
         return false;
     };
     ioPanoDetector.setInputFile(argv[optind]);
-    if(doLinearMatch + doMultirow + doPrealign>1)
+    if(doLinearMatch + doMultirow + doPrealign + doGlobalMatch + doVocabTree>1)
     {
-        std::cerr << hugin_utils::stripPath(argv[0]) << ": The arguments --linearmatch, --multirow and --prealigned are" << std::endl
-             << "  mutually exclusive. Use only one of them." << std::endl;
+        std::cerr << hugin_utils::stripPath(argv[0]) << ": The arguments --linearmatch, --multirow, --prealigned, --globalmatch and" << std::endl
+             << "  --vocabtree are mutually exclusive. Use only one of them." << std::endl;
+        return false;
+    };
+    if(doGlobalMatch && ioPanoDetector.getMaxMemory()>0)
+    {
+        std::cerr << hugin_utils::stripPath(argv[0]) << ": The argument --max-memory can not be used with --globalmatch," << std::endl
+             << "  the global index needs the keypoints of all images at once." << std::endl;
         return false;
     };
     if(doLinearMatch)
@@ -412,6 +545,14 @@ bool parseOptions(int argc, char** argv, PanoDetector& ioPanoDetector)
     {
         ioPanoDetector.setMatchingStrategy(PanoDetector::PREALIGNED);
     };
+    if(doGlobalMatch)
+    {
+        ioPanoDetector.setMatchingStrategy(PanoDetector::GLOBALINDEX);
+    };
+    if(doVocabTree)
+    {
+        ioPanoDetector.setMatchingStrategy(PanoDetector::VOCABULARYTREE);
+    };
     if(!keyfilesIndex.empty())
     {
         ioPanoDetector.setKeyPointsIdx(keyfilesIndex);
@@ -440,6 +581,7 @@ int main(int argc, char** argv)
     }
 
     TIMETRACE("Detection",aPanoDetector.run());
+    aPanoDetector.writeProfile();
 
     return 0;
 
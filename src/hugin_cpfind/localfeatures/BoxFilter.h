@@ -39,6 +39,8 @@ public:
     double getDyyWithX(unsigned int x) const;
     double getDxyWithX(unsigned int x) const;
     double getDetWithX(unsigned int x) const;
+    // calculates getDetWithX for iCount positions starting at iX with a distance of iStep pixels
+    void getDetRow(float* oDet, unsigned int iX, unsigned int iCount, unsigned int iStep) const;
 
     bool checkBounds(int x, int y) const;
 
@@ -138,6 +140,41 @@ inline double BoxFilter::getDetWithX(unsigned int x) const
     return  ((aDxx * aDyy) - (aDxy * aDxy)) * _sqCorrectFactor;
 }
 
+inline void BoxFilter::getDetRow(float* oDet, unsigned int iX, unsigned int iCount, unsigned int iStep) const
+{
+    // same calculation as in getDetWithX, but with all line pointers fetched outside of the loop
+    // and without dependencies between the iterations, so that the compiler can vectorize it
+    const double* aXXTop = _ii[_y_minus_lxx_y_bottom];
+    const double* aXXBottom = _ii[_y_plus_lxx_y_bottom + 1];
+    const double* aYYOuterTop = _ii[_y_minus_lxx_x_right];
+    const double* aYYOuterBottom = _ii[_y_plus_lxx_x_right + 1];
+    const double* aYYInnerTop = _ii[_y_minus_lxx_x_mid];
+    const double* aYYInnerBottom = _ii[_y_plus_lxx_x_mid + 1];
+    const double* aXYTop = _ii[_y_minus_lxy_d2];
+    const double* aXYMidTop = _ii[_y];
+    const double* aXYMidBottom = _ii[_y + 1];
+    const double* aXYBottom = _ii[_y_plus_lxy_d2 + 1];
+    const size_t aXXRight = _lxx_x_right;
+    const size_t aXXMid = _lxx_x_mid;
+    const size_t aYYHalf = _lxx_y_bottom;
+    const size_t aXY = _lxy_d2;
+
+    for (unsigned int i = 0; i < iCount; ++i)
+    {
+        const size_t x = iX + static_cast<size_t>(i) * iStep;
+        const double aDxx = (aXXBottom[x + aXXRight + 1] + aXXTop[x - aXXRight] - aXXBottom[x - aXXRight] - aXXTop[x + aXXRight + 1])
+            - 3.0 * (aXXBottom[x + aXXMid + 1] + aXXTop[x - aXXMid] - aXXBottom[x - aXXMid] - aXXTop[x + aXXMid + 1]);
+        const double aDyy = (aYYOuterBottom[x + aYYHalf + 1] + aYYOuterTop[x - aYYHalf] - aYYOuterBottom[x - aYYHalf] - aYYOuterTop[x + aYYHalf + 1])
+            - 3.0 * (aYYInnerBottom[x + aYYHalf + 1] + aYYInnerTop[x - aYYHalf] - aYYInnerBottom[x - aYYHalf] - aYYInnerTop[x + aYYHalf + 1]);
+        const double aDxyRaw = (aXYBottom[x + aXY + 1] + aXYMidTop[x] - aXYBottom[x] - aXYMidTop[x + aXY + 1])
+            + (aXYMidBottom[x + 1] + aXYTop[x - aXY] - aXYMidBottom[x - aXY] - aXYTop[x + 1])
+            - (aXYMidBottom[x + aXY + 1] + aXYTop[x] - aXYMidBottom[x] - aXYTop[x + aXY + 1])
+            - (aXYBottom[x + 1] + aXYMidTop[x - aXY] - aXYBottom[x - aXY] - aXYMidTop[x + 1]);
+        const double aDxy = aDxyRaw * 0.9 * 2 / 3.0;
+        oDet[i] = static_cast<float>(((aDxx * aDyy) - (aDxy * aDxy)) * _sqCorrectFactor);
+    }
+}
+
 inline void	BoxFilter::setY(unsigned int y)
 {
     _y_minus_lxx_y_bottom = y - _lxx_y_bottom;
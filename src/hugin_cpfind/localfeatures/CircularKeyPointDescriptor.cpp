@@ -127,37 +127,39 @@ CircularKeyPointDescriptor::CircularKeyPointDescriptor(Image& iImage,
     _vecLen = 3;
     _descrLen = _vecLen * _subRegions - 1;
 
-    _ori_hist = new double[_ori_nbins + 2];
-
+    // the sample points of the orientation histogram are weighted with a gaussian
+    // in a circular region, precompute the weights for all squared distances
+    const double coeffadd = 0.5;
+    const double coeffmul = (0.5 + 6) / -(_ori_nbins*_ori_nbins);
+    _ori_weights.resize(_ori_nbins * _ori_nbins + 1);
+    for (size_t i = 0; i < _ori_weights.size(); ++i)
+    {
+        _ori_weights[i] = exp(coeffmul * (i + coeffadd));
+    }
 }
 
 CircularKeyPointDescriptor::~CircularKeyPointDescriptor()
 {
-    delete[] _ori_hist;
     delete[] _samples;
 }
 
-void CircularKeyPointDescriptor::makeDescriptor(lfeat::KeyPoint& ioKeyPoint) const
+void CircularKeyPointDescriptor::makeDescriptor(const lfeat::KeyPoint& iKeyPoint, float* oDescriptor) const
 {
     // create a descriptor context
-    //KeyPointDescriptorContext aCtx(_subRegions, _vecLen, ioKeyPoint._ori);
-
-    // create the storage in the keypoint
-    if (!ioKeyPoint._vec)
-    {
-        ioKeyPoint.allocVector(getDescriptorLength());
-    }
+    //KeyPointDescriptorContext aCtx(_subRegions, _vecLen, iKeyPoint._ori);
 
     // create a vector
-    createDescriptor(ioKeyPoint);
+    createDescriptor(iKeyPoint, oDescriptor);
 
     // normalize
-    Math::Normalize(ioKeyPoint._vec, getDescriptorLength());
+    Math::Normalize(oDescriptor, getDescriptorLength());
 }
 
 int CircularKeyPointDescriptor::assignOrientation(lfeat::KeyPoint& ioKeyPoint, double angles[4]) const
 {
-    double* hist = _ori_hist + 1;
+    // histogram with an additional bin on each side for the wrap around
+    std::vector<double> ori_hist(_ori_nbins + 2, 0.0);
+    double* hist = &ori_hist[1];
     unsigned int aRX = hugin_utils::roundi(ioKeyPoint._x);
     unsigned int aRY = hugin_utils::roundi(ioKeyPoint._y);
     int aStep = (int)(ioKeyPoint._scale + 0.8);
@@ -169,15 +171,6 @@ int CircularKeyPointDescriptor::assignOrientation(lfeat::KeyPoint& ioKeyPoint, d
     std::cerr << "ori= [ ";
 #endif
 
-#ifdef _MSC_VER
-#pragma message("use LUT after parameter tuning")
-#else
-    #warning use LUT after parameter tuning
-#endif
-    double coeffadd = 0.5;
-    double coeffmul = (0.5 + 6) / -(_ori_nbins*_ori_nbins);
-
-    memset(_ori_hist, 0, sizeof(double)*(_ori_nbins + 2));
     // compute haar wavelet responses in a circular neighborhood of _ori_gridsize s
     for (int aYIt = -_ori_gridsize; aYIt <= _ori_gridsize; aYIt++)
     {
@@ -202,7 +195,7 @@ int CircularKeyPointDescriptor::assignOrientation(lfeat::KeyPoint& ioKeyPoint, d
                     // deal with possible rounding problems.
                     bin = (bin + _ori_nbins) % _ori_nbins;
                     // center of bin 0 equals -PI + 16°deg, etc.
-                    double weight = exp(coeffmul * (aSqDist + coeffadd));
+                    double weight = _ori_weights[aSqDist];
                     hist[bin] += aWavResp * weight;
                     //hist[bin] += aWavResp * Exp1_2(aSqDist);
 #ifdef DEBUG_ROT_2
@@ -290,7 +283,7 @@ int CircularKeyPointDescriptor::assignOrientation(lfeat::KeyPoint& ioKeyPoint, d
 }
 
 // gradient and intensity difference
-void CircularKeyPointDescriptor::createDescriptor(KeyPoint& ioKeyPoint) const
+void CircularKeyPointDescriptor::createDescriptor(const KeyPoint& iKeyPoint, float* oDescriptor) const
 {
 #ifdef DEBUG_DESC
     std::ofstream dlog("descriptor_details.txt", std::ios_base::app);
@@ -299,13 +292,13 @@ void CircularKeyPointDescriptor::createDescriptor(KeyPoint& ioKeyPoint) const
     // create the vector of features by analyzing a square patch around the point.
     // for this the current patch (x,y) will be translated in rotated coordinates (u,v)
 
-    double aX = ioKeyPoint._x;
-    double aY = ioKeyPoint._y;
-    int aS = (int)ioKeyPoint._scale;
+    double aX = iKeyPoint._x;
+    double aY = iKeyPoint._y;
+    int aS = (int)iKeyPoint._scale;
 
     // get the sin/cos of the orientation
-    double ori_sin = sin(ioKeyPoint._ori);
-    double ori_cos = cos(ioKeyPoint._ori);
+    double ori_sin = sin(iKeyPoint._ori);
+    double ori_cos = cos(iKeyPoint._ori);
 
     if (aS < 1)
     {
@@ -337,13 +330,13 @@ void CircularKeyPointDescriptor::createDescriptor(KeyPoint& ioKeyPoint) const
 
         if (!aWaveFilter.checkBounds(aIntXSample, aIntYSample, aIntSampleSize))
         {
-            ioKeyPoint._vec[j++] = 0;
-            ioKeyPoint._vec[j++] = 0;
-            //ioKeyPoint._vec[j++] = 0;
-            //ioKeyPoint._vec[j++] = 0;
+            oDescriptor[j++] = 0;
+            oDescriptor[j++] = 0;
+            //oDescriptor[j++] = 0;
+            //oDescriptor[j++] = 0;
             if (i > 0)
             {
-                ioKeyPoint._vec[j++] = 0;
+                oDescriptor[j++] = 0;
             }
 #ifdef DEBUG_DESC
             dlog << xS << " " << yS << " "
@@ -381,27 +374,27 @@ void CircularKeyPointDescriptor::createDescriptor(KeyPoint& ioKeyPoint) const
 #endif
 
         // store descriptor
-        ioKeyPoint._vec[j++] = aWavXR;
-        ioKeyPoint._vec[j++] = aWavYR;
+        oDescriptor[j++] = static_cast<float>(aWavXR);
+        oDescriptor[j++] = static_cast<float>(aWavYR);
         /*
         if (aWavXR > 0) {
-        ioKeyPoint._vec[j++] = aWavXR;
-        ioKeyPoint._vec[j++] = 0;
+        oDescriptor[j++] = aWavXR;
+        oDescriptor[j++] = 0;
         } else {
-        ioKeyPoint._vec[j++] = 0;
-        ioKeyPoint._vec[j++] = -aWavXR;
+        oDescriptor[j++] = 0;
+        oDescriptor[j++] = -aWavXR;
         }
         if (aWavYR > 0) {
-        ioKeyPoint._vec[j++] = aWavYR;
-        ioKeyPoint._vec[j++] = 0;
+        oDescriptor[j++] = aWavYR;
+        oDescriptor[j++] = 0;
         } else {
-        ioKeyPoint._vec[j++] = 0;
-        ioKeyPoint._vec[j++] = -aWavYR;
+        oDescriptor[j++] = 0;
+        oDescriptor[j++] = -aWavYR;
         }
         */
         if (i != 0)
         {
-            ioKeyPoint._vec[j++] = meanGray - middleMean;
+            oDescriptor[j++] = static_cast<float>(meanGray - middleMean);
         }
     }
 #ifdef DEBUG_DESC
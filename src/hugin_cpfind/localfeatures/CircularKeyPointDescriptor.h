@@ -43,15 +43,18 @@ public:
                                int ori_bins=18, double ori_sample_scale=4, int ori_gridsize=11);
     ~CircularKeyPointDescriptor();
 
-    void makeDescriptor(KeyPoint& ioKeyPoint) const;
+    /** computes the descriptor of the keypoint, oDescriptor has to hold getDescriptorLength() values */
+    void makeDescriptor(const KeyPoint& iKeyPoint, float* oDescriptor) const;
     int getDescriptorLength() const
     {
         return _descrLen;
     };
+    /** assigns the dominant orientation to the keypoint and returns the number of further
+     *  orientations in angles. makeDescriptor and assignOrientation can be called from several threads */
     int assignOrientation(KeyPoint& ioKeyPoint, double angles[4]) const;
 
 protected:
-    void createDescriptor(KeyPoint& ioKeyPoint) const;
+    void createDescriptor(const KeyPoint& iKeyPoint, float* oDescriptor) const;
 
 private:
     // orig image info
@@ -63,7 +66,8 @@ private:
     const int _ori_nbins;
     const double _ori_sample_scale;
     const int _ori_gridsize;
-    double* _ori_hist;
+    // weights of the orientation histogram, indexed by the squared distance from the keypoint
+    std::vector<double> _ori_weights;
 };
 
 }
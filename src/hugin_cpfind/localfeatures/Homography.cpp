@@ -111,13 +111,13 @@ void Homography::initMatchesNormalization(PointMatchVector_t& iMatches)
     //estimate the center of gravity
     for (size_t i = 0; i < iMatches.size(); ++i)
     {
-        PointMatchPtr& aMatchIt = iMatches[i];
-        //aMatchIt->print();
+        const PointMatch& aMatchIt = iMatches[i];
+        //aMatchIt.print();
 
-        _v1x += aMatchIt->_img1_x;
-        _v1y += aMatchIt->_img1_y;
-        _v2x += aMatchIt->_img2_x;
-        _v2y += aMatchIt->_img2_y;
+        _v1x += aMatchIt._img1_x;
+        _v1y += aMatchIt._img1_y;
+        _v2x += aMatchIt._img2_x;
+        _v2y += aMatchIt._img2_y;
     }
 
     _v1x /= (double)iMatches.size();
@@ -205,7 +205,7 @@ bool Homography::estimate(PointMatchVector_t& iMatches)
     // fill the matrices and vectors with points
     for (size_t aFillRow = 0; aFillRow < iMatches.size(); ++aFillRow)
     {
-        addMatch(aFillRow, *(iMatches[aFillRow]));
+        addMatch(aFillRow, iMatches[aFillRow]);
     }
 
     // solve the system
@@ -75,40 +75,72 @@ void Image::buildIntegralImage(vigra::DImage &img)
         _ii[i][0] = 0;
     }
 
-    // compute all the others pixels
+    // compute all the others pixels, the running sum of the current line is added
+    // to the line above, so only one dependent addition per pixel remains
     for (unsigned int i = 1; i <= _height; ++i)
+    {
+        const double* aPrevLine = _ii[i - 1];
+        double* aLine = _ii[i];
+        double aLineSum = 0;
         for (unsigned int j = 1; j <= _width; ++j)
         {
-            _ii[i][j] = img[i - 1][j - 1] + _ii[i - 1][j] + _ii[i][j - 1] - _ii[i - 1][j - 1];
+            aLineSum += img[i - 1][j - 1];
+            aLine[j] = aPrevLine[j] + aLineSum;
         }
+    }
 
 }
 
 // allocate and deallocate pixels
-double** Image::AllocateImage(unsigned int iWidth, unsigned int iHeight)
+// the lines holder has one additional entry, which stores the start of the allocated block
+template <class T>
+static T** AllocateAlignedImage(unsigned int iWidth, unsigned int iHeight)
 {
-    // create the lines holder
-    double** aImagePtr = new double*[iHeight];
+    const size_t kAlignment = 64;
+    // pad the lines to a multiple of the alignment
+    const size_t aLineLength = (iWidth * sizeof(T) + kAlignment - 1) / kAlignment * kAlignment / sizeof(T);
+    char* aBlock = new char[aLineLength * iHeight * sizeof(T) + kAlignment] {};
+    T* aFirstLine = reinterpret_cast<T*>(aBlock + kAlignment - reinterpret_cast<size_t>(aBlock) % kAlignment);
 
-    // create the lines
+    // create the lines holder
+    T** aImagePtr = new T*[iHeight + 1];
     for (unsigned int i = 0; i < iHeight; ++i)
     {
-        aImagePtr[i] = new double[iWidth] {};
+        aImagePtr[i] = aFirstLine + i * aLineLength;
     }
+    aImagePtr[iHeight] = reinterpret_cast<T*>(aBlock);
 
     return aImagePtr;
 }
 
-void Image::DeallocateImage(double** iImagePtr, unsigned int iHeight)
+template <class T>
+static void DeallocateAlignedImage(T** iImagePtr, unsigned int iHeight)
 {
     // delete the lines
-    for (unsigned int i = 0; i < iHeight; ++i)
-    {
-        delete[] iImagePtr[i];
-    }
+    delete[] reinterpret_cast<char*>(iImagePtr[iHeight]);
 
     // delete the lines holder
     delete[] iImagePtr;
 }
 
+double** Image::AllocateImage(unsigned int iWidth, unsigned int iHeight)
+{
+    return AllocateAlignedImage<double>(iWidth, iHeight);
+}
+
+void Image::DeallocateImage(double** iImagePtr, unsigned int iHeight)
+{
+    DeallocateAlignedImage(iImagePtr, iHeight);
+}
+
+float** Image::AllocateFloatImage(unsigned int iWidth, unsigned int iHeight)
+{
+    return AllocateAlignedImage<float>(iWidth, iHeight);
+}
+
+void Image::DeallocateImage(float** iImagePtr, unsigned int iHeight)
+{
+    DeallocateAlignedImage(iImagePtr, iHeight);
+}
+
 } // namespace lfeat
\ No newline at end of file
@@ -61,8 +61,13 @@ public:
     }
 
     // allocate and deallocate integral image pixels
+    // the rows are stored in one contiguous block, each row starts at a 64 byte boundary,
+    // so that loops over a row can be vectorized
     static double** AllocateImage(unsigned int iWidth, unsigned int iHeight);
     static void DeallocateImage(double** iImagePtr, unsigned int iHeight);
+    // same for the single precision images of the detector responses
+    static float** AllocateFloatImage(unsigned int iWidth, unsigned int iHeight);
+    static void DeallocateImage(float** iImagePtr, unsigned int iHeight);
 
 private:
 
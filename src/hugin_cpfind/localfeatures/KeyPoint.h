@@ -22,7 +22,7 @@
 #define __lfeat_keypoint_h
 
 #include <hugin_shared.h>
-#include <memory>
+#include <algorithm>
 #include <vector>
 
 namespace lfeat
@@ -33,104 +33,179 @@ class KeyPoint
 {
 public:
     KeyPoint();
-    KeyPoint(const KeyPoint& k);
     KeyPoint(double x, double y, double s, double score, int trace);
-    KeyPoint& operator=(const KeyPoint& k) throw();
-
-    ~KeyPoint();
-
-    void allocVector(int iSize);
 
     double		_x, _y;
     double		_scale;
     double		_score;
     int			_trace;
     double		_ori;
-
-    double*		_vec;
-
 };
 
-inline KeyPoint::KeyPoint() : _x(0), _y(0), _scale(1), _score(0), _trace(0), _ori(0), _vec(0)
+inline KeyPoint::KeyPoint() : _x(0), _y(0), _scale(1), _score(0), _trace(0), _ori(0)
 {
 
 }
 
 inline KeyPoint::KeyPoint(double x, double y, double s, double score, int trace) :
-    _x(x), _y(y), _scale(s), _score(score), _trace(trace), _ori(0), _vec(0)
+    _x(x), _y(y), _scale(s), _score(score), _trace(trace), _ori(0)
 {
 
 }
 
-inline KeyPoint::KeyPoint(const KeyPoint& k) :
-    _x(k._x), _y(k._y), _scale(k._scale), _score(k._score), _trace(k._trace), _ori(0), _vec(0)
-{
 
+inline bool operator < (const KeyPoint& iA, const KeyPoint& iB)
+{
+    return (iA._score < iB._score);
 }
 
 
-inline KeyPoint& KeyPoint::operator=(const KeyPoint& k) throw()
+/** keypoints of one image, stored as structure of arrays.
+ *  The keypoints are referenced by their index, the descriptors of all keypoints
+ *  are stored one after another in a single block. */
+class KeyPointSet
 {
-    if (this == &k)
+public:
+    KeyPointSet() : _descLength(0) {};
+
+    size_t size() const
+    {
+        return _x.size();
+    }
+    bool empty() const
+    {
+        return _x.empty();
+    }
+    void reserve(size_t iSize);
+    /** appends the keypoint, returns its index. If the descriptors are allocated,
+     *  the descriptor of the new keypoint is initialized with 0 */
+    size_t add(const KeyPoint& iKeyPoint);
+    /** returns a copy of the keypoint with the given index */
+    KeyPoint get(size_t i) const;
+    /** keeps only the keypoints with the given indices in the given order */
+    void select(const std::vector<size_t>& iIndices);
+    /** removes all keypoints and releases the memory */
+    void clear();
+    void swap(KeyPointSet& ioOther);
+
+    /** allocates the descriptors of all keypoints */
+    void allocDescriptors(int iDescLength);
+    /** releases the descriptors, the keypoints are kept */
+    void freeDescriptors();
+    bool hasDescriptors() const
+    {
+        return _descLength > 0;
+    }
+    int getDescriptorLength() const
+    {
+        return _descLength;
+    }
+    float* getDescriptor(size_t i)
+    {
+        return _descriptors.data() + i * _descLength;
+    }
+    const float* getDescriptor(size_t i) const
     {
-        return *this;
+        return _descriptors.data() + i * _descLength;
     }
-    _x = k._x;
-    _y = k._y;
-    _scale = k._scale;
-    _score = k._score;
-    _trace = k._trace;
-    _vec = 0;
-    _ori = k._ori;
-    return *this;
+    /** returns the memory used by the keypoints and descriptors in bytes */
+    size_t usedMemory() const;
+
+    std::vector<double>	_x, _y;
+    std::vector<double>	_scale;
+    std::vector<double>	_score;
+    std::vector<int>	_trace;
+    std::vector<double>	_ori;
+
+private:
+    int					_descLength;
+    std::vector<float>	_descriptors;
+};
+
+inline void KeyPointSet::reserve(size_t iSize)
+{
+    _x.reserve(iSize);
+    _y.reserve(iSize);
+    _scale.reserve(iSize);
+    _score.reserve(iSize);
+    _trace.reserve(iSize);
+    _ori.reserve(iSize);
 }
 
-inline KeyPoint::~KeyPoint()
+inline size_t KeyPointSet::add(const KeyPoint& iKeyPoint)
 {
-    if (_vec)
+    _x.push_back(iKeyPoint._x);
+    _y.push_back(iKeyPoint._y);
+    _scale.push_back(iKeyPoint._scale);
+    _score.push_back(iKeyPoint._score);
+    _trace.push_back(iKeyPoint._trace);
+    _ori.push_back(iKeyPoint._ori);
+    if (_descLength > 0)
     {
-        delete[] _vec;
+        _descriptors.resize(_descriptors.size() + _descLength, 0.0f);
     }
+    return _x.size() - 1;
 }
 
-inline void KeyPoint::allocVector(int iSize)
+inline KeyPoint KeyPointSet::get(size_t i) const
 {
-    _vec = new double[iSize];
+    KeyPoint aK(_x[i], _y[i], _scale[i], _score[i], _trace[i]);
+    aK._ori = _ori[i];
+    return aK;
 }
 
-
-inline bool operator < (const KeyPoint& iA, const KeyPoint& iB)
+inline void KeyPointSet::select(const std::vector<size_t>& iIndices)
 {
-    return (iA._score < iB._score);
+    KeyPointSet aSelected;
+    aSelected.reserve(iIndices.size());
+    for (size_t i = 0; i < iIndices.size(); ++i)
+    {
+        aSelected.add(get(iIndices[i]));
+    }
+    if (_descLength > 0)
+    {
+        aSelected.allocDescriptors(_descLength);
+        for (size_t i = 0; i < iIndices.size(); ++i)
+        {
+            std::copy(getDescriptor(iIndices[i]), getDescriptor(iIndices[i]) + _descLength, aSelected.getDescriptor(i));
+        }
+    }
+    swap(aSelected);
 }
 
+inline void KeyPointSet::clear()
+{
+    KeyPointSet().swap(*this);
+}
 
+inline void KeyPointSet::swap(KeyPointSet& ioOther)
+{
+    _x.swap(ioOther._x);
+    _y.swap(ioOther._y);
+    _scale.swap(ioOther._scale);
+    _score.swap(ioOther._score);
+    _trace.swap(ioOther._trace);
+    _ori.swap(ioOther._ori);
+    std::swap(_descLength, ioOther._descLength);
+    _descriptors.swap(ioOther._descriptors);
+}
 
+inline void KeyPointSet::allocDescriptors(int iDescLength)
+{
+    _descLength = iDescLength;
+    _descriptors.assign(size() * iDescLength, 0.0f);
+}
 
-typedef std::shared_ptr<KeyPoint> 		KeyPointPtr;
-typedef std::vector<KeyPointPtr>			KeyPointVect_t;
-typedef std::vector<KeyPointPtr>::iterator	KeyPointVectIt_t;
+inline void KeyPointSet::freeDescriptors()
+{
+    _descLength = 0;
+    std::vector<float>().swap(_descriptors);
+}
 
-class KeyPointPtrSort
+inline size_t KeyPointSet::usedMemory() const
 {
-public:
-    inline bool operator() (const KeyPointPtr& a, const KeyPointPtr& b) const
-    {
-        if (a->_score < b->_score)
-        {
-            return true;
-        }
-        else if (a->_score > b->_score)
-        {
-            return false;
-        }
-        else
-        {
-            // same score, order by scale
-            return (a->_scale < b->_scale);
-        }
-    }
-};
+    return _x.capacity() * (5 * sizeof(double) + sizeof(int)) + _descriptors.capacity() * sizeof(float);
+}
 
 }
 
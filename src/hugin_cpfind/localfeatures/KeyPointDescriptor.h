@@ -31,7 +31,7 @@ namespace lfeat
 class KeyPointDescriptor
 {
 public:
-    virtual void makeDescriptor(KeyPoint& ioKeyPoint) const = 0;
+    virtual void makeDescriptor(const KeyPoint& iKeyPoint, float* oDescriptor) const = 0;
     virtual int getDescriptorLength() const = 0;
     virtual int assignOrientation(KeyPoint& ioKeyPoint, double angles[4]) const = 0;
 
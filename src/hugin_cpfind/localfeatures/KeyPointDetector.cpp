@@ -19,6 +19,8 @@
 */
 
 #include <iostream>
+#include <vector>
+#include <algorithm>
 
 #include "KeyPoint.h"
 #include "KeyPointDetector.h"
@@ -28,6 +30,8 @@
 namespace lfeat
 {
 const double KeyPointDetector::kBaseSigma = 1.2;
+// number of lines of the hessian computed in one task
+const int KeyPointDetector::kStripHeight = 16;
 
 KeyPointDetector::KeyPointDetector()
 {
@@ -44,11 +48,11 @@ KeyPointDetector::KeyPointDetector()
 
 void KeyPointDetector::detectKeypoints(Image& iImage, KeyPointInsertor& iInsertor)
 {
-    // allocate lots of memory for the scales
-    double** * aSH = new double**[_maxScales];
+    // allocate lots of memory for the scales, single precision is sufficient for the responses
+    float** * aSH = new float**[_maxScales];
     for (unsigned int s = 0; s < _maxScales; ++s)
     {
-        aSH[s] = Image::AllocateImage(iImage.getWidth(), iImage.getHeight());
+        aSH[s] = Image::AllocateFloatImage(iImage.getWidth(), iImage.getHeight());
     }
 
     // init the border size
@@ -68,30 +72,37 @@ void KeyPointDetector::detectKeypoints(Image& iImage, KeyPointInsertor& iInserto
         int aOctaveWidth = iImage.getWidth() / aPixelStep;	// integer division
         int aOctaveHeight = iImage.getHeight() / aPixelStep;	// integer division
 
-        // fill each scale matrices
+        // split each scale matrix into strips of lines
+        std::vector<std::pair<unsigned int, int> > aStrips;
         for (unsigned int s = 0; s < _maxScales; ++s)
         {
-            // create a box filter of the correct size.
-            BoxFilter aBoxFilter(getFilterSize(o, s), iImage);
-
             // calculate the border for this scale
             aBorderSize[s] = getBorderSize(o, s);
+            for (int y = aBorderSize[s]; y < aOctaveHeight - (int)aBorderSize[s]; y += kStripHeight)
+            {
+                aStrips.push_back(std::make_pair(s, y));
+            }
+        }
+
+        // fill the hessians, the strips of all scales are independent
+#pragma omp parallel for schedule(dynamic)
+        for (int i = 0; i < (int)aStrips.size(); ++i)
+        {
+            const unsigned int s = aStrips[i].first;
+            // create a box filter of the correct size.
+            BoxFilter aBoxFilter(getFilterSize(o, s), iImage);
 
-            // fill the hessians
-            int aEy = aOctaveHeight - aBorderSize[s];
+            int aEy = std::min(aStrips[i].second + kStripHeight, aOctaveHeight - (int)aBorderSize[s]);
             int aEx = aOctaveWidth - aBorderSize[s];
+            if (aEx <= (int)aBorderSize[s])
+            {
+                continue;
+            }
 
-            int aYPS = aBorderSize[s] * aPixelStep;
-            for (int y = aBorderSize[s]; y < aEy; ++y)
+            for (int y = aStrips[i].second; y < aEy; ++y)
             {
-                aBoxFilter.setY(aYPS);
-                int aXPS = aBorderSize[s] * aPixelStep;
-                for (int x = aBorderSize[s]; x < aEx; ++x)
-                {
-                    aSH[s][y][x] = aBoxFilter.getDetWithX(aXPS);
-                    aXPS += aPixelStep;
-                }
-                aYPS += aPixelStep;
+                aBoxFilter.setY(y * aPixelStep);
+                aBoxFilter.getDetRow(aSH[s][y] + aBorderSize[s], aBorderSize[s] * aPixelStep, aEx - aBorderSize[s], aPixelStep);
             }
         }
 
@@ -104,7 +115,7 @@ void KeyPointDetector::detectKeypoints(Image& iImage, KeyPointInsertor& iInserto
                 for (int aXIt = aBS + 1; aXIt < aOctaveWidth - aBS - 1; aXIt += 2)
                 {
                     // find the maximum in the 2x2x2 cube
-                    double aTab[8];
+                    float aTab[8];
 
                     // get the values in a
                     aTab[0] = aSH[aSIt][aYIt][aXIt];
@@ -246,7 +257,7 @@ void KeyPointDetector::detectKeypoints(Image& iImage, KeyPointInsertor& iInserto
     delete[]aBorderSize;
 }
 
-bool KeyPointDetector::fineTuneExtrema(double** * iSH, unsigned int iX, unsigned int iY, unsigned int iS,
+bool KeyPointDetector::fineTuneExtrema(float** * iSH, unsigned int iX, unsigned int iY, unsigned int iS,
     double& oX, double& oY, double& oS, double& oScore,
     unsigned int iOctaveWidth, unsigned int iOctaveHeight, unsigned int iBorder)
 {
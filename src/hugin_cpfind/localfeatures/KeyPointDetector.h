@@ -78,8 +78,9 @@ private:
 
     // some default values.
     const static double kBaseSigma;
+    const static int kStripHeight;
 
-    bool fineTuneExtrema(double** * iSH, unsigned int iX, unsigned int iY, unsigned int iS,
+    bool fineTuneExtrema(float** * iSH, unsigned int iX, unsigned int iY, unsigned int iS,
                          double& oX, double& oY, double& oS, double& oScore,
                          unsigned int iOctaveWidth, unsigned int iOctaveHeight, unsigned int iBorder);
 
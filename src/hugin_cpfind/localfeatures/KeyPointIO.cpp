@@ -22,11 +22,40 @@
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <cstring>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 #include "KeyPointIO.h"
+#include "MathStuff.h"
 
 namespace lfeat
 {
+// signature and version of the binary keyfile format
+static const char BinaryKeyfileMagic[8] = { 'H', 'K', 'E', 'Y', 'F', 'I', 'L', 'E' };
+static const uint32_t BinaryKeyfileVersion = 1;
+static const uint32_t BinaryKeyfileByteOrder = 0x01020304;
+// alignment of the descriptor block, allows aligned loads of the descriptors
+static const uint64_t BinaryKeyfileAlignment = 64;
+
+static uint64_t alignOffset(uint64_t offset, uint64_t alignment)
+{
+    return (offset + alignment - 1) / alignment * alignment;
+}
+
+static size_t getDescriptorElementSize(uint32_t storage)
+{
+    return storage == DESCRIPTOR_STORAGE_UINT8 ? sizeof(unsigned char) : sizeof(float);
+}
+
 // extremly fagile check...
 static bool identifySIFTKeypoints(const std::string& filename)
 {
@@ -43,7 +72,7 @@ static bool identifySIFTKeypoints(const std::string& filename)
     return (in && nKeypoints > 0 && dims >= 0);
 }
 
-static ImageInfo loadSIFTKeypoints(const std::string& filename, KeyPointVect_t& vec)
+static ImageInfo loadSIFTKeypoints(const std::string& filename, KeyPointSet& vec)
 {
     ImageInfo info;
     std::ifstream in(filename.c_str());
@@ -58,19 +87,25 @@ static ImageInfo loadSIFTKeypoints(const std::string& filename, KeyPointVect_t&
 
     info.dimensions = dims;
 
+    vec.clear();
+    vec.reserve(nKeypoints);
+    if (dims > 0)
+    {
+        vec.allocDescriptors(dims);
+    }
     for (int i = 0; i < nKeypoints; i++)
     {
-        KeyPointPtr k(new lfeat::KeyPoint(0, 0, 0, 0, 0));
-        in >> k->_y >> k->_x >> k->_scale >> k->_ori >> k->_score;
+        lfeat::KeyPoint k(0, 0, 0, 0, 0);
+        in >> k._y >> k._x >> k._scale >> k._ori >> k._score;
+        const size_t index = vec.add(k);
         if (dims > 0)
         {
-            k->allocVector(dims);
+            float* descriptor = vec.getDescriptor(index);
             for (int j = 0; j < dims; j++)
             {
-                in >> k->_vec[j];
+                in >> descriptor[j];
             }
         }
-        vec.push_back(k);
     }
     // finish reading empty line
     std::getline(in, info.filename);
@@ -82,8 +117,43 @@ static ImageInfo loadSIFTKeypoints(const std::string& filename, KeyPointVect_t&
     return info;
 }
 
-ImageInfo loadKeypoints(const std::string& filename, KeyPointVect_t& vec)
+static ImageInfo loadBinaryKeypoints(const std::string& filename, KeyPointSet& vec)
+{
+    MappedKeyfile keyfile;
+    if (!keyfile.open(filename))
+    {
+        return ImageInfo();
+    }
+    keyfile.getKeyPoints(vec);
+    ImageInfo info = keyfile.getImageInfo();
+    // copy the descriptors into the keypoints
+    if (info.dimensions > 0 && !vec.empty())
+    {
+        vec.allocDescriptors(info.dimensions);
+        const size_t nValues = keyfile.getNrOfKeyPoints() * info.dimensions;
+        float* descriptors = vec.getDescriptor(0);
+        if (keyfile.getDescriptorStorage() == DESCRIPTOR_STORAGE_UINT8)
+        {
+            const unsigned char* descriptor = static_cast<const unsigned char*>(keyfile.getDescriptors());
+            for (size_t j = 0; j < nValues; j++)
+            {
+                descriptors[j] = Math::DequantizeDescriptor(descriptor[j]);
+            }
+        }
+        else
+        {
+            memcpy(descriptors, keyfile.getDescriptors(), sizeof(float) * nValues);
+        }
+    }
+    return info;
+}
+
+ImageInfo loadKeypoints(const std::string& filename, KeyPointSet& vec)
 {
+    if (MappedKeyfile::isBinaryKeyfile(filename))
+    {
+        return loadBinaryKeypoints(filename, vec);
+    }
     if (identifySIFTKeypoints(filename))
     {
         return loadSIFTKeypoints(filename, vec);
@@ -95,6 +165,127 @@ ImageInfo loadKeypoints(const std::string& filename, KeyPointVect_t& vec)
     }
 }
 
+MappedKeyfile::MappedKeyfile() : m_data(NULL), m_size(0)
+{
+}
+
+MappedKeyfile::~MappedKeyfile()
+{
+    close();
+}
+
+bool MappedKeyfile::isBinaryKeyfile(const std::string& filename)
+{
+    std::ifstream in(filename.c_str(), std::ios::binary);
+    char magic[sizeof(BinaryKeyfileMagic)];
+    return in.read(magic, sizeof(magic)) && memcmp(magic, BinaryKeyfileMagic, sizeof(magic)) == 0;
+}
+
+bool MappedKeyfile::open(const std::string& filename)
+{
+    close();
+#ifdef _WIN32
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart < static_cast<LONGLONG>(sizeof(BinaryKeyfileHeader)))
+    {
+        CloseHandle(file);
+        return false;
+    }
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if (mapping == NULL)
+    {
+        return false;
+    }
+    // the view keeps the mapping alive, so the handle can be closed directly
+    m_data = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    CloseHandle(mapping);
+    if (m_data == NULL)
+    {
+        return false;
+    }
+    m_size = static_cast<size_t>(fileSize.QuadPart);
+#else
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0 || fileStat.st_size < static_cast<off_t>(sizeof(BinaryKeyfileHeader)))
+    {
+        ::close(fd);
+        return false;
+    }
+    void* data = mmap(NULL, fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // the mapping stays valid after closing the file descriptor
+    ::close(fd);
+    if (data == MAP_FAILED)
+    {
+        return false;
+    }
+    m_data = static_cast<const char*>(data);
+    m_size = static_cast<size_t>(fileStat.st_size);
+#endif
+    // check that the file is complete and was written with the same version and byte order
+    const BinaryKeyfileHeader& header = getHeader();
+    const uint64_t descriptorSize = static_cast<uint64_t>(header.nKeypoints) * header.dims * getDescriptorElementSize(header.descriptorStorage);
+    if (memcmp(header.magic, BinaryKeyfileMagic, sizeof(BinaryKeyfileMagic)) != 0 ||
+        header.version != BinaryKeyfileVersion || header.byteOrder != BinaryKeyfileByteOrder ||
+        header.descriptorStorage > DESCRIPTOR_STORAGE_UINT8 ||
+        sizeof(BinaryKeyfileHeader) + header.filenameLength > header.keypointOffset ||
+        header.keypointOffset % sizeof(double) != 0 ||
+        header.keypointOffset + static_cast<uint64_t>(header.nKeypoints) * sizeof(BinaryKeyPoint) > header.descriptorOffset ||
+        header.descriptorOffset % BinaryKeyfileAlignment != 0 ||
+        header.descriptorOffset + descriptorSize > m_size)
+    {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void MappedKeyfile::close()
+{
+    if (m_data != NULL)
+    {
+#ifdef _WIN32
+        UnmapViewOfFile(m_data);
+#else
+        munmap(const_cast<char*>(m_data), m_size);
+#endif
+        m_data = NULL;
+        m_size = 0;
+    }
+}
+
+ImageInfo MappedKeyfile::getImageInfo() const
+{
+    const BinaryKeyfileHeader& header = getHeader();
+    ImageInfo info(std::string(m_data + sizeof(BinaryKeyfileHeader), header.filenameLength), header.width, header.height);
+    info.dimensions = header.dims;
+    return info;
+}
+
+void MappedKeyfile::getKeyPoints(KeyPointSet& vec) const
+{
+    const BinaryKeyfileHeader& header = getHeader();
+    const BinaryKeyPoint* keypoints = reinterpret_cast<const BinaryKeyPoint*>(m_data + header.keypointOffset);
+    vec.clear();
+    vec.reserve(header.nKeypoints);
+    for (uint32_t i = 0; i < header.nKeypoints; i++)
+    {
+        lfeat::KeyPoint k(keypoints[i].x, keypoints[i].y, keypoints[i].scale, keypoints[i].score, 0);
+        k._ori = keypoints[i].orientation;
+        vec.add(k);
+    }
+}
+
 
 void SIFTFormatWriter::writeHeader(const ImageInfo& imageinfo, int nKeypoints, int dims)
 {
@@ -104,7 +295,7 @@ void SIFTFormatWriter::writeHeader(const ImageInfo& imageinfo, int nKeypoints, i
 }
 
 
-void SIFTFormatWriter::writeKeypoint(double x, double y, double scale, double orientation, double score, int dims, double* vec)
+void SIFTFormatWriter::writeKeypoint(double x, double y, double scale, double orientation, double score, int dims, const float* vec)
 {
     o << y << " " << x << " " << scale << " " << orientation << " " << score;
     for (int i = 0; i < dims; i++)
@@ -121,6 +312,83 @@ void SIFTFormatWriter::writeFooter()
 }
 
 
+void BinaryFormatWriter::writeHeader(const ImageInfo& imageinfo, int nKeypoints, int dims)
+{
+    _image = imageinfo;
+    _dims = dims;
+    _descriptors.clear();
+    _descriptors8.clear();
+    BinaryKeyfileHeader header = BinaryKeyfileHeader();
+    memcpy(header.magic, BinaryKeyfileMagic, sizeof(BinaryKeyfileMagic));
+    header.version = BinaryKeyfileVersion;
+    header.byteOrder = BinaryKeyfileByteOrder;
+    header.width = imageinfo.width;
+    header.height = imageinfo.height;
+    header.nKeypoints = nKeypoints;
+    header.dims = dims;
+    header.descriptorStorage = _storage;
+    header.filenameLength = static_cast<uint32_t>(imageinfo.filename.size());
+    header.parameters = _parameters;
+    header.keypointOffset = alignOffset(sizeof(BinaryKeyfileHeader) + header.filenameLength, sizeof(double));
+    header.descriptorOffset = alignOffset(header.keypointOffset + static_cast<uint64_t>(nKeypoints) * sizeof(BinaryKeyPoint), BinaryKeyfileAlignment);
+    o.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    o.write(imageinfo.filename.c_str(), header.filenameLength);
+    const std::string padding(header.keypointOffset - sizeof(BinaryKeyfileHeader) - header.filenameLength, '\0');
+    o.write(padding.c_str(), padding.size());
+    _descriptorPadding = header.descriptorOffset - header.keypointOffset - static_cast<uint64_t>(nKeypoints) * sizeof(BinaryKeyPoint);
+    // the descriptors are written after all keypoints
+    if (_storage == DESCRIPTOR_STORAGE_UINT8)
+    {
+        _descriptors8.reserve(static_cast<size_t>(nKeypoints) * dims);
+    }
+    else
+    {
+        _descriptors.reserve(static_cast<size_t>(nKeypoints) * dims);
+    }
+}
+
+void BinaryFormatWriter::writeKeypoint(double x, double y, double scale, double orientation, double score, int dims, const float* vec)
+{
+    BinaryKeyPoint keypoint;
+    keypoint.x = x;
+    keypoint.y = y;
+    keypoint.scale = scale;
+    keypoint.orientation = orientation;
+    keypoint.score = score;
+    o.write(reinterpret_cast<const char*>(&keypoint), sizeof(keypoint));
+    for (int i = 0; i < _dims; i++)
+    {
+        // keypoints without descriptors get a zero descriptor
+        const float value = (vec != NULL && i < dims) ? vec[i] : 0.0f;
+        if (_storage == DESCRIPTOR_STORAGE_UINT8)
+        {
+            _descriptors8.push_back(Math::QuantizeDescriptor(value));
+        }
+        else
+        {
+            _descriptors.push_back(value);
+        }
+    }
+}
+
+void BinaryFormatWriter::writeFooter()
+{
+    // pad to the aligned start of the descriptor block
+    const std::string padding(_descriptorPadding, '\0');
+    o.write(padding.c_str(), padding.size());
+    if (_storage == DESCRIPTOR_STORAGE_UINT8)
+    {
+        o.write(reinterpret_cast<const char*>(_descriptors8.data()), _descriptors8.size());
+    }
+    else
+    {
+        o.write(reinterpret_cast<const char*>(_descriptors.data()), _descriptors.size() * sizeof(float));
+    }
+    _descriptors.clear();
+    _descriptors8.clear();
+}
+
+
 void DescPerfFormatWriter::writeHeader(const ImageInfo& imageinfo, int nKeypoints, int dims)
 {
     _image = imageinfo;
@@ -129,7 +397,7 @@ void DescPerfFormatWriter::writeHeader(const ImageInfo& imageinfo, int nKeypoint
 }
 
 
-void DescPerfFormatWriter::writeKeypoint(double x, double y, double scale, double orientation, double score, int dims, double* vec)
+void DescPerfFormatWriter::writeKeypoint(double x, double y, double scale, double orientation, double score, int dims, const float* vec)
 {
     double sc = 2.5 * scale;
     sc *= sc;
@@ -156,7 +424,7 @@ void AutopanoSIFTWriter::writeHeader(const ImageInfo& imageinfo, int nKeypoints,
     o << "  <Arr>" << std::endl;
 }
 
-void AutopanoSIFTWriter::writeKeypoint(double x, double y, double scale, double orientation, double score, int dims, double* vec)
+void AutopanoSIFTWriter::writeKeypoint(double x, double y, double scale, double orientation, double score, int dims, const float* vec)
 {
     o << "    <KeypointN>" << std::endl;
     o << "      <X>" << x << "</X>" << std::endl;
@@ -24,6 +24,8 @@
 
 #include <iostream>
 #include <string>
+#include <vector>
+#include <stdint.h>
 
 #include "KeyPoint.h"
 #include "KeyPointDetector.h"
@@ -48,11 +50,127 @@ struct LFIMPEX ImageInfo
 };
 
 
+/** parameters of the keypoint detection, which are stored in binary keyfiles */
+struct LFIMPEX DetectionParameters
+{
+    DetectionParameters()
+        : sieve1Width(0), sieve1Height(0), sieve1Size(0), sizeMode(0)
+    { }
+
+    bool operator==(const DetectionParameters& other) const
+    {
+        return sieve1Width == other.sieve1Width && sieve1Height == other.sieve1Height &&
+            sieve1Size == other.sieve1Size && sizeMode == other.sizeMode;
+    }
+    bool operator!=(const DetectionParameters& other) const
+    {
+        return !(*this == other);
+    }
+
+    int32_t sieve1Width;
+    int32_t sieve1Height;
+    int32_t sieve1Size;
+    int32_t sizeMode;
+};
+
+/** storage type of the descriptors in binary keyfiles */
+enum DescriptorStorage
+{
+    DESCRIPTOR_STORAGE_FLOAT32 = 0,
+    DESCRIPTOR_STORAGE_UINT8 = 1
+};
+
+/** header of the binary keyfile format. The header is followed by the
+ *  image filename, the array of BinaryKeyPoint and the descriptor block.
+ *  The descriptor block is aligned, so that it can be used directly
+ *  from a memory mapped file. All values are stored in native byte order,
+ *  files with different byte order are rejected. */
+struct BinaryKeyfileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    int32_t width;
+    int32_t height;
+    uint32_t nKeypoints;
+    uint32_t dims;
+    uint32_t descriptorStorage;
+    uint32_t filenameLength;
+    DetectionParameters parameters;
+    uint32_t reserved[2];
+    uint64_t keypointOffset;
+    uint64_t descriptorOffset;
+};
+
+/** keypoint record in the binary keyfile format */
+struct BinaryKeyPoint
+{
+    double x;
+    double y;
+    double scale;
+    double orientation;
+    double score;
+};
+
 // functions to read keypoints
 //bool identifySIFTKeypoints( const std::string & filename);
 //ImageInfo loadSIFTKeypoints( const std::string & filename, KeyPointInsertor & insertor);
 
-ImageInfo LFIMPEX loadKeypoints( const std::string& filename, KeyPointVect_t& insertor);
+/** loads keypoints with descriptors from a text or binary keyfile, replaces the keypoints in vec */
+ImageInfo LFIMPEX loadKeypoints( const std::string& filename, KeyPointSet& vec);
+
+/** read only access to a memory mapped binary keyfile.
+ *  The descriptors can be used directly from the mapped memory. */
+class LFIMPEX MappedKeyfile
+{
+public:
+    MappedKeyfile();
+    ~MappedKeyfile();
+
+    /** maps the given file, returns false if the file is not a valid binary keyfile */
+    bool open(const std::string& filename);
+    /** unmaps the file */
+    void close();
+
+    /** returns the information about the image, the keypoints were detected in */
+    ImageInfo getImageInfo() const;
+    const DetectionParameters& getDetectionParameters() const
+    {
+        return getHeader().parameters;
+    }
+    DescriptorStorage getDescriptorStorage() const
+    {
+        return static_cast<DescriptorStorage>(getHeader().descriptorStorage);
+    }
+    size_t getNrOfKeyPoints() const
+    {
+        return getHeader().nKeypoints;
+    }
+    /** replaces the keypoints in vec by the keypoints of the file, the descriptors are not copied */
+    void getKeyPoints(KeyPointSet& vec) const;
+    /** returns a pointer to the descriptor block, the descriptors of all keypoints are stored
+     *  one after another, the type depends on getDescriptorStorage() */
+    const void* getDescriptors() const
+    {
+        return m_data + getHeader().descriptorOffset;
+    }
+
+    /** returns true, if the given file starts with the binary keyfile signature */
+    static bool isBinaryKeyfile(const std::string& filename);
+
+private:
+    // prevent copying of class
+    MappedKeyfile(const MappedKeyfile&);
+    MappedKeyfile& operator=(const MappedKeyfile&);
+
+    const BinaryKeyfileHeader& getHeader() const
+    {
+        return *reinterpret_cast<const BinaryKeyfileHeader*>(m_data);
+    }
+
+    const char* m_data;
+    size_t m_size;
+};
 
 
 /// Base class for a keypoint writer
@@ -71,7 +189,7 @@ public:
 
     virtual void writeHeader ( const ImageInfo& imageinfo, int nKeypoints, int dims ) = 0;
 
-    virtual void writeKeypoint ( double x, double y, double scale, double orientation, double score, int dims, double* vec ) = 0;
+    virtual void writeKeypoint ( double x, double y, double scale, double orientation, double score, int dims, const float* vec ) = 0;
 
     virtual void writeFooter() = 0;
 };
@@ -89,7 +207,7 @@ public:
 
     void writeHeader (const ImageInfo& imageinfo, int nKeypoints, int dims );
 
-    void writeKeypoint ( double x, double y, double scale, double orientation, double score, int dims, double* vec );
+    void writeKeypoint ( double x, double y, double scale, double orientation, double score, int dims, const float* vec );
 
     void writeFooter();
 };
@@ -107,12 +225,38 @@ public:
 
     void writeHeader (const ImageInfo& imageinfo, int nKeypoints, int dims );
 
-    void writeKeypoint ( double x, double y, double scale, double orientation, double score, int dims, double* vec );
+    void writeKeypoint ( double x, double y, double scale, double orientation, double score, int dims, const float* vec );
 
     void writeFooter();
 };
 
 
+/** writes the binary keyfile format, see BinaryKeyfileHeader.
+ *  The output stream needs to be opened in binary mode. */
+class LFIMPEX BinaryFormatWriter : public KeypointWriter
+{
+
+    ImageInfo _image;
+    DetectionParameters _parameters;
+    DescriptorStorage _storage;
+    int _dims;
+    size_t _descriptorPadding;
+    std::vector<float> _descriptors;
+    std::vector<unsigned char> _descriptors8;
+
+public:
+    BinaryFormatWriter(std::ostream& out, const DetectionParameters& parameters, DescriptorStorage storage)
+        : KeypointWriter(out), _parameters(parameters), _storage(storage), _dims(0), _descriptorPadding(0)
+    {
+    }
+
+    void writeHeader ( const ImageInfo& imageinfo, int nKeypoints, int dims );
+
+    void writeKeypoint ( double x, double y, double scale, double orientation, double score, int dims, const float* vec );
+
+    void writeFooter();
+};
+
 class LFIMPEX AutopanoSIFTWriter : public KeypointWriter
 {
 
@@ -124,7 +268,7 @@ public:
 
     void writeHeader ( const ImageInfo& imageinfo, int nKeypoints, int dims );
 
-    void writeKeypoint ( double x, double y, double scale, double orientation, double score, int dims, double* vec );
+    void writeKeypoint ( double x, double y, double scale, double orientation, double score, int dims, const float* vec );
 
     void writeFooter();
 };
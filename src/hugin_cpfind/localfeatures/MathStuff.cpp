@@ -81,10 +81,11 @@ bool lfeat::Math::SolveLinearSystem33(double* solution, double sq[3][3])
     return true;
 }
 
-bool lfeat::Math::Normalize(double* iVec, int iLen)
+bool lfeat::Math::Normalize(float* iVec, int iLen)
 {
 
     int i;
+    // accumulate in double precision, the vector itself is stored as float
     double fac, sqlen = 0.0;
 
     for (i = 0; i < iLen; i++)
@@ -100,7 +101,7 @@ bool lfeat::Math::Normalize(double* iVec, int iLen)
     fac = 1.0 / sqrt(sqlen);
     for (i = 0; i < iLen; i++)
     {
-        iVec[i] *= fac;
+        iVec[i] = static_cast<float>(iVec[i] * fac);
     }
 
     return true;
@@ -31,8 +31,20 @@ struct Math
 {
 
     static bool				SolveLinearSystem33(double* solution, double sq[3][3]);
-    static bool				Normalize(double* iVec, int iLen);
+    static bool				Normalize(float* iVec, int iLen);
 
+    /** converts an element of a normalized descriptor to 8 bit, the single
+     *  elements are small, so they are scaled and larger values are clipped */
+    static inline unsigned char QuantizeDescriptor(float iValue)
+    {
+        const float scaled = iValue * 256.0f + 128.5f;
+        return static_cast<unsigned char>(scaled < 0.0f ? 0.0f : (scaled > 255.0f ? 255.0f : scaled));
+    }
+    /** inverse of QuantizeDescriptor */
+    static inline float DequantizeDescriptor(unsigned char iValue)
+    {
+        return (static_cast<float>(iValue) - 128.0f) / 256.0f;
+    }
 
 };
 
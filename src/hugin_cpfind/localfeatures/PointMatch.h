@@ -21,7 +21,6 @@
 #ifndef __lfeatPointMatch_h
 #define __lfeatPointMatch_h
 
-#include <memory>
 #include <vector>
 
 #include "KeyPoint.h"
@@ -32,15 +31,22 @@ namespace lfeat
 struct PointMatch
 {
 
-    PointMatch(KeyPointPtr& aPM1, KeyPointPtr& aPM2) :
-        _img1_x(aPM1->_x), _img1_y(aPM1->_y), _img2_x(aPM2->_x),  _img2_y(aPM2->_y),
-        _img1_kp(aPM1), _img2_kp(aPM2) {};
+    PointMatch(const KeyPointSet& iKP1, unsigned int i1, const KeyPointSet& iKP2, unsigned int i2, double aRatio = 1.0) :
+        _img1_x(iKP1._x[i1]), _img1_y(iKP1._y[i1]), _img2_x(iKP2._x[i2]),  _img2_y(iKP2._y[i2]),
+        _ratio(aRatio), _score(iKP1._score[i1]), _img1_kp(i1), _img2_kp(i2) {};
 
     double _img1_x, _img1_y, _img2_x, _img2_y;
 
-    // hold a reference to original keypoint
-    KeyPointPtr		_img1_kp;
-    KeyPointPtr		_img2_kp;
+    // ratio of the distances to the nearest and the second nearest descriptor,
+    // lower values are more distinctive matches
+    double _ratio;
+
+    // score of the keypoint in image 1
+    double _score;
+
+    // index of the original keypoints
+    unsigned int	_img1_kp;
+    unsigned int	_img2_kp;
 
     //void print()
     //{
@@ -49,26 +55,25 @@ struct PointMatch
 
 };
 
-typedef std::shared_ptr<PointMatch> PointMatchPtr;
-typedef std::vector<PointMatchPtr> PointMatchVector_t;
+typedef std::vector<PointMatch> PointMatchVector_t;
 
-class PointMatchPtrSort
+class PointMatchSort
 {
 public:
-    inline bool operator() (const PointMatchPtr& a, const PointMatchPtr& b) const
+    inline bool operator() (const PointMatch& a, const PointMatch& b) const
     {
-        if (a->_img1_kp->_score < b->_img1_kp->_score)
+        if (a._score < b._score)
         {
             return true;
         }
-        else if (a->_img1_kp->_score > b->_img1_kp->_score)
+        else if (a._score > b._score)
         {
             return false;
         }
         else
         {
             // same score, order by _x coordinate (this also removes duplicate matches)
-            return (a->_img1_kp->_y < b->_img1_kp->_y);
+            return (a._img1_y < b._img1_y);
         }
     }
 };
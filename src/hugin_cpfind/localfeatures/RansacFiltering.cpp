@@ -18,13 +18,12 @@
 * <http://www.gnu.org/licenses/>.
 */
 
+#include <algorithm>
+#include <random>
+
 #include "RansacFiltering.h"
 #include "Homography.h"
-
-static int genint(int x)
-{
-    return (int)((double)rand()*x/(double)RAND_MAX);
-}
+#include "vigra_ext/ransac.h"
 
 namespace lfeat
 {
@@ -45,65 +44,96 @@ double Ransac::calcError(Homography* aH, PointMatch& aM)
 
 void Ransac::filter(PointMatchVector_t& ioMatches, PointMatchVector_t& ioRemovedMatches)
 {
-    int aRemainingIterations = _nIter;
+    // number of matches used to fit the model
+    const unsigned int aSampleSize = 5;
+    const unsigned int aNrMatches = (unsigned int)ioMatches.size();
     const double aErrorDistSq = _distanceThres * _distanceThres;
 
-    Homography aCurrentModel;
+    if (aNrMatches <= aSampleSize)
+    {
+        return;
+    }
 
-    unsigned int aMaxInliers = 0;
-    PointMatchVector_t aBestInliers;
-    PointMatchVector_t aBestOutliers;
+    Homography aCurrentModel;
 
     // normalization  !!!!!!
     aCurrentModel.initMatchesNormalization(ioMatches);
 
-
-    //std::cout << "gravity " << _v1x << " " << _v1y << " " << _v2x << " " << _v2y << endl;
-
-    for(; aRemainingIterations > 0; aRemainingIterations--)
+    // the samples are drawn from the most distinctive matches first (PROSAC)
+    std::vector<int> aSortedIndex(aNrMatches);
+    for (unsigned int i = 0; i < aNrMatches; ++i)
     {
-        //cout << "RANSAC -- iter " << aRemainingIterations << endl;
-
-        // random select 4 matches to fit the model
-        // from the input set as maybe_inliers
-        PointMatchVector_t aMatches(ioMatches);
-        PointMatchVector_t aInliers, aOutliers;
+        aSortedIndex[i] = i;
+    }
+    std::stable_sort(aSortedIndex.begin(), aSortedIndex.end(), [&ioMatches](int a, int b)
+        {
+            return ioMatches[a]._ratio < ioMatches[b]._ratio;
+        });
+    // the pre-verification needs the matches in random order
+    std::mt19937 aRng;
+    std::vector<int> aVerifyIndex(aSortedIndex);
+    if (_preVerify)
+    {
+        std::shuffle(aVerifyIndex.begin(), aVerifyIndex.end(), aRng);
+    }
 
-        //std::cout << aMatches.size() << " matches size" << endl;
+    ::Ransac::ProsacSampler aSampler(aNrMatches, aSampleSize, _nIter);
+    ::Ransac::Sprt aSprt(0.5, 50.0);
+    int aNrIterations = _nIter;
+    unsigned int aMaxInliers = 0;
+    std::vector<char> aBestInliers(aNrMatches, 0);
+    std::vector<char> aCurrentInliers(aNrMatches);
+    std::vector<int> aSample;
+    PointMatchVector_t aSampleMatches;
+    aSampleMatches.reserve(aSampleSize);
 
-        for(int i=0; i<5; i++)
+    for (int aIteration = 0; aIteration < aNrIterations; ++aIteration)
+    {
+        // select 5 matches to fit the model, the matches of the sample are always inliers
+        aSampler.sample(aRng, aSample);
+        std::fill(aCurrentInliers.begin(), aCurrentInliers.end(), 0);
+        aSampleMatches.clear();
+        for (unsigned int i = 0; i < aSampleSize; ++i)
         {
-            int n = genint((int)aMatches.size()-1);
-            aInliers.push_back(aMatches.at(n));
-            aMatches.erase(aMatches.begin()+n);
+            const int aIndex = aSortedIndex[aSample[i]];
+            aSampleMatches.push_back(ioMatches[aIndex]);
+            aCurrentInliers[aIndex] = 1;
         }
 
-        //std::cout << aMatches.size() << " estimate" << endl;
-
-        if (!aCurrentModel.estimate(aInliers))
+        if (!aCurrentModel.estimate(aSampleMatches))
         {
-            aMatches.clear();
             continue;
         }
 
-        // for every point remaining in aMatches, add them to aInliers if they fit the model well.
-        for (size_t i = 0; i < aMatches.size(); ++i)
+        // count the remaining matches, which fit the model well
+        unsigned int aNrInliers = aSampleSize;
+        unsigned int aNrTested = 0;
+        bool aRejected = false;
+        aSprt.start();
+        for (unsigned int i = 0; i < aNrMatches; ++i)
         {
-            PointMatchPtr aMatchesIter2 = aMatches[i];
-            if (calcError(&aCurrentModel, *aMatchesIter2) < aErrorDistSq)
+            const int aIndex = aVerifyIndex[i];
+            if (aCurrentInliers[aIndex])
+            {
+                continue;
+            }
+            ++aNrTested;
+            const bool aAgree = calcError(&aCurrentModel, ioMatches[aIndex]) < aErrorDistSq;
+            if (aAgree)
             {
-                aInliers.push_back(aMatchesIter2);
+                aCurrentInliers[aIndex] = 1;
+                ++aNrInliers;
             }
-            else
+            if (_preVerify && !aSprt.update(aAgree))
             {
-                aOutliers.push_back(aMatchesIter2);
+                aSprt.addRejected(aNrInliers - aSampleSize, aNrTested);
+                aRejected = true;
+                break;
             }
         }
 
-        if (aInliers.size() > aMaxInliers)
+        if (!aRejected && aNrInliers > aMaxInliers)
         {
-            //cout << "good found -----------------" << aRemainingIterations << endl;
-            //cout << aCurrentModel << endl;
             for (int i=0; i<3; ++i)
                 for(int j=0; j<3; ++j)
                 {
@@ -115,29 +145,39 @@ void Ransac::filter(PointMatchVector_t& ioMatches, PointMatchVector_t& ioRemoved
             _bestModel._v1y = aCurrentModel._v1y;
             _bestModel._v2y = aCurrentModel._v2y;
 
+            aMaxInliers = aNrInliers;
+            aBestInliers.swap(aCurrentInliers);
 
-            //*ioBestModel = *aCurrentModel;
-            aMaxInliers = (unsigned int)aInliers.size();
-            aBestInliers = aInliers;
-            aBestOutliers = aOutliers;
-            //cout << "Inliers : " << aInliers.size() << " Outliers : " << aOutliers.size() << endl;
-
+            // stop as soon as a sample without outliers was drawn with high probability,
+            // with 0 outliers we are done immediately
+            const double aInlierRatio = (double)aMaxInliers / aNrMatches;
+            if (_preVerify)
+            {
+                aSprt.setInlierRatio(aInlierRatio);
+            }
+            aNrIterations = std::min<int>(aNrIterations, ::Ransac::numberOfTries(0.999, aInlierRatio, aSampleSize, _nIter,
+                _preVerify ? aSprt.getRejectionProbability() : 0.0));
         }
+    }
 
-        // if there are 0 outliers then we are done.
-        if (aOutliers.empty())
+    // keep the original order of the matches
+    PointMatchVector_t aInliers, aOutliers;
+    aInliers.reserve(aMaxInliers);
+    aOutliers.reserve(aNrMatches - aMaxInliers);
+    for (unsigned int i = 0; i < aNrMatches; ++i)
+    {
+        if (aBestInliers[i])
         {
-            break;
+            aInliers.push_back(ioMatches[i]);
+        }
+        else
+        {
+            aOutliers.push_back(ioMatches[i]);
         }
-
-        //cout << "Inliers : " << aInliers.size() << " Outliers : " << aOutliers.size() << endl;
-        //cout << "end iter" << endl;
     }
 
-    ioMatches = aBestInliers;
-    ioRemovedMatches = aBestOutliers;
-
-
+    ioMatches = aInliers;
+    ioRemovedMatches = aOutliers;
 }
 
 void Ransac::transform(double iX, double iY, double& oX, double& oY)
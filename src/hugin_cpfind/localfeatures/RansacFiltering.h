@@ -30,9 +30,9 @@ namespace lfeat
 class LFIMPEX Ransac
 {
 public:
-    Ransac() : _nIter(1000), _distanceThres(25) {};
+    Ransac() : _nIter(1000), _distanceThres(25), _preVerify(false) {};
 
-    void filter(std::vector<PointMatchPtr>& ioMatches, std::vector<PointMatchPtr>& ioRemovedMatches);
+    void filter(PointMatchVector_t& ioMatches, PointMatchVector_t& ioRemovedMatches);
     inline void setIterations(int iIters)
     {
         _nIter = iIters;
@@ -41,6 +41,11 @@ public:
     {
         _distanceThres = iDT;
     }
+    // reject bad models with a sequential probability ratio test before checking all matches
+    inline void setPreVerification(bool iPreVerify)
+    {
+        _preVerify = iPreVerify;
+    }
 
     Homography	_bestModel;
 
@@ -51,8 +56,9 @@ private:
 
     double calcError(Homography* aH, PointMatch& aM);
 
-    int		_nIter;				// number of iterations
+    int		_nIter;				// maximal number of iterations
     int		_distanceThres;	// error distance threshold in pixels
+    bool	_preVerify;			// use sequential probability ratio test
 
 
 };
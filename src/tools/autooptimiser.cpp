@@ -75,6 +75,16 @@ static void usage(const char* name)
          << std::endl
          << "     --only-active-images  take only active images into account when" << std::endl
          << "                optimising (only valid with -n switch)" << std::endl
+         << "     --native  optimise the geometric parameters with the built-in" << std::endl
+         << "                optimizer instead of libpano13, projects with features" << std::endl
+         << "                not supported by it are still optimised by libpano13" << std::endl
+         << "     --changed-images=LIST  optimise only the images near the given images" << std::endl
+         << "                (comma separated image numbers, e.g. images with new" << std::endl
+         << "                control points), all other images are kept fixed." << std::endl
+         << "                Only valid with -n switch, can not be combined with" << std::endl
+         << "                --only-active-images" << std::endl
+         << "     --hops=NUMBER  number of connections in the image graph from the" << std::endl
+         << "                changed images, which are optimised (default: 2)" << std::endl
          << std::endl
          << "   When using -a -l -m and -s options together, a similar operation to the" << std::endl
          << "   \"Align\" button in hugin is performed." << std::endl
@@ -88,13 +98,19 @@ int main(int argc, char* argv[])
     int c;
     enum
     {
-        SWITCH_ONLY_ACTIVE=1000
+        SWITCH_ONLY_ACTIVE=1000,
+        SWITCH_NATIVE,
+        SWITCH_CHANGED_IMAGES,
+        SWITCH_HOPS
     };
     static struct option longOptions[] =
     {
         { "output", required_argument, NULL, 'o'},
         { "help", no_argument, NULL, 'h' },
         { "only-active-images", no_argument, NULL, SWITCH_ONLY_ACTIVE},
+        { "native", no_argument, NULL, SWITCH_NATIVE},
+        { "changed-images", required_argument, NULL, SWITCH_CHANGED_IMAGES},
+        { "hops", required_argument, NULL, SWITCH_HOPS},
         0
     };
     std::string output;
@@ -106,6 +122,9 @@ int main(int argc, char* argv[])
     bool chooseProj = false;
     bool quiet = false;
     bool doPhotometric = false;
+    HuginBase::PTOptimizer::Backend backend = HuginBase::PTOptimizer::PANOTOOLS;
+    std::string changedImagesList;
+    int hops = 2;
     double hfov = 0.0;
     while ((c = getopt_long(argc, argv, optstring, longOptions, nullptr)) != -1)
     {
@@ -144,6 +163,19 @@ int main(int argc, char* argv[])
             case SWITCH_ONLY_ACTIVE:
                 optOnlyActive = true;
                 break;
+            case SWITCH_NATIVE:
+                backend = HuginBase::PTOptimizer::NATIVE;
+                break;
+            case SWITCH_CHANGED_IMAGES:
+                changedImagesList = optarg;
+                break;
+            case SWITCH_HOPS:
+                if (!hugin_utils::stringToInt(optarg, hops) || hops < 0)
+                {
+                    std::cerr << hugin_utils::stripPath(argv[0]) << ": Invalid number of hops: " << optarg << std::endl;
+                    return 1;
+                };
+                break;
             case ':':
             case '?':
                 // missing argument or invalid switch
@@ -155,6 +187,12 @@ int main(int argc, char* argv[])
         }
     }
 
+    if (optOnlyActive && !changedImagesList.empty())
+    {
+        std::cerr << hugin_utils::stripPath(argv[0]) << ": The switches --only-active-images and --changed-images can not be combined." << std::endl;
+        return 1;
+    };
+
     if (argc - optind != 1)
     {
         if (argc - optind < 1)
@@ -242,14 +280,14 @@ int main(int argc, char* argv[])
     if (doPairwise && ! doAutoOpt)
     {
         // do pairwise optimisation
-        HuginBase::AutoOptimise::autoOptimise(pano);
+        HuginBase::AutoOptimise::autoOptimise(pano, true, backend);
 
         // do global optimisation
         if (!quiet)
         {
             std::cerr << "*** Pairwise position optimisation" << std::endl;
         }
-        HuginBase::PTools::optimize(pano);
+        HuginBase::PTOptimizer::optimize(pano, backend);
     }
     else if (doAutoOpt)
     {
@@ -257,11 +295,33 @@ int main(int argc, char* argv[])
         {
             std::cerr << "*** Adaptive geometric optimisation" << std::endl;
         }
-        HuginBase::SmartOptimise::smartOptimize(pano);
+        HuginBase::SmartOptimise::smartOptimize(pano, backend);
     }
     else if (doNormalOpt)
     {
-        if (optOnlyActive)
+        if (!changedImagesList.empty())
+        {
+            HuginBase::UIntSet changedImages;
+            std::vector<std::string> imagesString = hugin_utils::SplitString(changedImagesList, ",");
+            for (auto& img : imagesString)
+            {
+                unsigned int imgNr;
+                if (hugin_utils::stringToUInt(img, imgNr) && imgNr < pano.getNrOfImages())
+                {
+                    changedImages.insert(imgNr);
+                }
+                else
+                {
+                    std::cerr << "Ignoring invalid image number " << img << " in list of changed images." << std::endl;
+                };
+            };
+            if (!quiet)
+            {
+                std::cerr << "*** Optimising parameters specified in PTO file (near changed images)" << std::endl;
+            }
+            HuginBase::PTOptimizer::optimizeIncremental(pano, changedImages, backend, hops);
+        }
+        else if (optOnlyActive)
         {
             if (!quiet)
             {
@@ -276,7 +336,7 @@ int main(int argc, char* argv[])
             else
             {
                 HuginBase::Panorama optPano = pano.getSubset(activeImages);
-                HuginBase::PTools::optimize(optPano);
+                HuginBase::PTOptimizer::optimize(optPano, backend);
                 // write result back into initial pano
                 pano.updateVariables(activeImages, optPano.getVariables());
             };
@@ -288,7 +348,7 @@ int main(int argc, char* argv[])
             {
                 std::cerr << "*** Optimising parameters specified in PTO file" << std::endl;
             }
-            HuginBase::PTools::optimize(pano);
+            HuginBase::PTOptimizer::optimize(pano, backend);
         };
     }
     else
@@ -38,6 +38,7 @@
 #include <hugin_basic.h>
 #include "hugin_base/algorithms/basic/LayerStacks.h"
 #include <hugin_utils/platform.h>
+#include <hugin_utils/filesystem.h>
 #include <algorithms/nona/NonaFileStitcher.h>
 #include <vigra_ext/ImageTransformsGPU.h>
 #include "hugin_utils/stl_utils.h"
@@ -108,6 +109,43 @@ static void usage(const char* name)
          << "                   lower and upper cutoff (specify in range 0...1," << std::endl
          << "                   relative the full range)" << std::endl
          << "      --seam=hard|blend   select the blend mode for the seam" << std::endl
+         << "      --sparse-grid[=tolerance]  calculate the exact coordinate" << std::endl
+         << "                   transform only on a sparse grid and interpolate" << std::endl
+         << "                   in between, the grid is refined where the" << std::endl
+         << "                   interpolation error is higher than tolerance" << std::endl
+         << "                   (in pixel, default: 0.1)" << std::endl
+         << "      --tabulated-interpolation  use precalculated tables for the" << std::endl
+         << "                   interpolation weights (faster, especially for" << std::endl
+         << "                   spline and sinc interpolators)" << std::endl
+         << "      --pyramid-sampling  sample from a reduced version of the" << std::endl
+         << "                   source images where they are scaled down" << std::endl
+         << "                   (faster and less aliasing for small output sizes)" << std::endl
+         << "      --max-memory=MB  limit the memory used for stitching a TIFF" << std::endl
+         << "                   panorama with hard seams, if the canvas does not" << std::endl
+         << "                   fit and --tiled-stitching is given the panorama" << std::endl
+         << "                   is stitched region by region into a tiled TIFF" << std::endl
+         << "                   file" << std::endl
+         << "                   for multiple image output: limit the memory" << std::endl
+         << "                   of the images remapped in parallel and write" << std::endl
+         << "                   uncropped TIFF layers, whose canvas does not fit," << std::endl
+         << "                   as tiled TIFF files" << std::endl
+         << "                   for HDR merging: stitch in horizontal bands, only" << std::endl
+         << "                   the images of the current band are kept in memory," << std::endl
+         << "                   TIFF and EXR output are written band by band" << std::endl
+         << "      --tiled-stitching  allow stitching region by region with" << std::endl
+         << "                   --max-memory. The seams are calculated for each" << std::endl
+         << "                   region separately, so the output differs from" << std::endl
+         << "                   stitching the full canvas and the seams can jump" << std::endl
+         << "                   at the region borders" << std::endl
+         << "      --parallel-remap[=N]  remap several images in parallel with" << std::endl
+         << "                   N workers (default: half the number of cores)," << std::endl
+         << "                   only for multiple image output" << std::endl
+         << "      --prefetch[=MB]  load the next images in the background while" << std::endl
+         << "                   the current image is remapped, use at most MB" << std::endl
+         << "                   for the images loaded in advance (default: 1024)" << std::endl
+         << "      --coordinate-cache=DIR  store the coordinate maps of the" << std::endl
+         << "                   remapping in DIR and reuse them, when the" << std::endl
+         << "                   geometry of an image has not changed" << std::endl
          << std::endl;
 }
 
@@ -143,7 +181,15 @@ int main(int argc, char* argv[])
         MASKCLIPEXPOSURE,
         SEAMMODE,
         USE_BIGTIFF,
-        RANGECOMPRESSION
+        RANGECOMPRESSION,
+        SPARSEGRID,
+        TABULATEDINTERPOLATION,
+        PYRAMIDSAMPLING,
+        MAXMEMORY,
+        TILEDSTITCHING,
+        PARALLELREMAP,
+        COORDINATECACHE,
+        PREFETCH
     };
     static struct option longOptions[] =
     {
@@ -157,6 +203,14 @@ int main(int argc, char* argv[])
         { "gpu", no_argument, NULL, 'g'},
         { "bigtiff", no_argument, NULL, USE_BIGTIFF },
         { "output-range-compression", required_argument, NULL, RANGECOMPRESSION },
+        { "sparse-grid", optional_argument, NULL, SPARSEGRID },
+        { "tabulated-interpolation", no_argument, NULL, TABULATEDINTERPOLATION },
+        { "pyramid-sampling", no_argument, NULL, PYRAMIDSAMPLING },
+        { "max-memory", required_argument, NULL, MAXMEMORY },
+        { "tiled-stitching", no_argument, NULL, TILEDSTITCHING },
+        { "parallel-remap", optional_argument, NULL, PARALLELREMAP },
+        { "coordinate-cache", required_argument, NULL, COORDINATECACHE },
+        { "prefetch", optional_argument, NULL, PREFETCH },
         { "help", no_argument, NULL, 'h'},
         { "debug", no_argument, NULL, 'd'},
         { "output", required_argument, NULL, 'o'},
@@ -318,6 +372,77 @@ int main(int argc, char* argv[])
                     return 1;
                 };
                 break;
+            case SPARSEGRID:
+                HuginBase::Nona::SetAdvancedOption(advOptions, "sparseGridTransform", true);
+                if (optarg != NULL && *optarg != 0)
+                {
+                    double tolerance;
+                    if (!hugin_utils::stringToDouble(std::string(optarg), tolerance) || tolerance <= 0.0)
+                    {
+                        std::cerr << hugin_utils::stripPath(argv[0]) << ": Argument \"" << optarg << "\" is not a valid tolerance for --sparse-grid." << std::endl
+                            << "      The tolerance should be a positive number (in pixel)." << std::endl;
+                        return 1;
+                    };
+                    HuginBase::Nona::SetAdvancedOption(advOptions, "sparseGridTolerance", static_cast<float>(tolerance));
+                };
+                break;
+            case TABULATEDINTERPOLATION:
+                HuginBase::Nona::SetAdvancedOption(advOptions, "tabulatedInterpolation", true);
+                break;
+            case PYRAMIDSAMPLING:
+                HuginBase::Nona::SetAdvancedOption(advOptions, "pyramidSampling", true);
+                break;
+            case MAXMEMORY:
+                {
+                    double maxMemory;
+                    if (!hugin_utils::stringToDouble(std::string(optarg), maxMemory) || maxMemory <= 0.0)
+                    {
+                        std::cerr << hugin_utils::stripPath(argv[0]) << ": Argument \"" << optarg << "\" is not a valid memory size for --max-memory." << std::endl
+                            << "      The size should be a positive number (in MB)." << std::endl;
+                        return 1;
+                    };
+                    HuginBase::Nona::SetAdvancedOption(advOptions, "maxMemory", static_cast<float>(maxMemory));
+                };
+                break;
+            case TILEDSTITCHING:
+                HuginBase::Nona::SetAdvancedOption(advOptions, "tiledStitching", true);
+                break;
+            case PARALLELREMAP:
+                HuginBase::Nona::SetAdvancedOption(advOptions, "parallelRemapping", true);
+                if (optarg != NULL && *optarg != 0)
+                {
+                    int workers;
+                    if (!hugin_utils::stringToInt(std::string(optarg), workers) || workers < 1)
+                    {
+                        std::cerr << hugin_utils::stripPath(argv[0]) << ": Argument \"" << optarg << "\" is not a valid number of workers for --parallel-remap." << std::endl
+                            << "      The number of workers should be a positive integer." << std::endl;
+                        return 1;
+                    };
+                    HuginBase::Nona::SetAdvancedOption(advOptions, "remapWorkers", static_cast<float>(workers));
+                };
+                break;
+            case COORDINATECACHE:
+                if (!fs::is_directory(fs::path(optarg)))
+                {
+                    std::cerr << hugin_utils::stripPath(argv[0]) << ": Directory \"" << optarg << "\" for --coordinate-cache does not exist." << std::endl;
+                    return 1;
+                };
+                HuginBase::Nona::SetAdvancedOption(advOptions, "coordinateCache", std::string(optarg));
+                break;
+            case PREFETCH:
+                HuginBase::Nona::SetAdvancedOption(advOptions, "prefetchImages", true);
+                if (optarg != NULL && *optarg != 0)
+                {
+                    double prefetchMemory;
+                    if (!hugin_utils::stringToDouble(std::string(optarg), prefetchMemory) || prefetchMemory <= 0.0)
+                    {
+                        std::cerr << hugin_utils::stripPath(argv[0]) << ": Argument \"" << optarg << "\" is not a valid memory size for --prefetch." << std::endl
+                            << "      The size should be a positive number (in MB)." << std::endl;
+                        return 1;
+                    };
+                    HuginBase::Nona::SetAdvancedOption(advOptions, "prefetchMemory", static_cast<float>(prefetchMemory));
+                };
+                break;
             case ':':
             case '?':
                 // missing argument or invalid switch